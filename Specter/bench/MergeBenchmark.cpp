@@ -0,0 +1,215 @@
+/*
+	MergeBenchmark.cpp
+	Benchmark of the file source merge (see TimeOrderedMerger). Reads a CoMPASS run end to end (reading, merge and event building) twice: once
+	through CompassRun, and once through the linear scan CompassRun used before the loser tree, which is kept here as the reference. Both
+	must produce the same hits in the same order; the checksums are compared, and the time per hit is printed for each. Opening the files is
+	not timed.
+
+	Usage: MergeBenchmark [run directory]
+	Without a directory, runs of 8, 32 and 128 files (2M hits without waveforms, and 1M hits with 32 sample waveforms) are generated in
+	the temp directory, benchmarked and removed again. With a directory, the .BIN files in it are benchmarked as they are.
+*/
+#include <iostream>
+#include <fstream>
+#include <memory>
+#include <utility>
+#include <algorithm>
+#include <functional>
+#include <string>
+#include <vector>
+#include <filesystem>
+#include <chrono>
+#include <random>
+#include <cstdint>
+
+#include "Specter/Core/Logger.h"
+#include "Specter/Utils/Functions.h"
+#include "Specter/Physics/Caen/CompassRun.h"
+
+namespace Specter {
+
+	static constexpr uint64_t s_coincidenceWindow = 500;
+
+	struct MergeResult
+	{
+		uint64_t hits = 0;
+		uint64_t checksum = 0;
+		uint64_t outOfOrder = 0;
+		double nsPerHit = 0.0;
+	};
+
+	static void ConsumeEvents(const EventArena::Ref& arena, MergeResult& result, uint64_t& lastTime)
+	{
+		for (std::size_t i = 0; i < arena->GetNumberOfEvents(); i++)
+		{
+			for (auto& hit : arena->GetEvent(i))
+			{
+				result.hits++;
+				result.checksum = result.checksum * 31 + hit.timestamp + hit.id;
+				if (hit.timestamp < lastTime)
+					result.outOfOrder++;
+				lastTime = hit.timestamp;
+			}
+		}
+	}
+
+	//CompassRun as it was before the loser tree: every file is scanned for the earliest hit, which is copied out for each comparison
+	static MergeResult RunLinearScan(const std::filesystem::path& directory)
+	{
+		MergeResult result;
+		uint64_t lastTime = 0;
+		std::vector<std::string> names;
+		for (auto& item : std::filesystem::directory_iterator(directory))
+		{
+			if (item.path().extension() == ".BIN")
+				names.push_back(item.path().string());
+		}
+		std::vector<CompassFile> files;
+		files.reserve(names.size()); //A CompassFile closes its stream when destroyed, so the vector must never reallocate
+		for (auto& name : names)
+			files.emplace_back(name);
+
+		auto start = std::chrono::steady_clock::now();
+		PhysicsEventBuilder builder(s_coincidenceWindow);
+		SpecData datum;
+		std::size_t startIndex = 0;
+		while (true)
+		{
+			std::pair<CompassHit, bool*> earliestHit = std::make_pair(CompassHit(), nullptr);
+			for (std::size_t i = startIndex; i < files.size(); i++)
+			{
+				if (files[i].CheckHitHasBeenUsed())
+					files[i].GetNextHit();
+
+				if (files[i].IsEOF())
+				{
+					if (i == startIndex)
+						startIndex++;
+					continue;
+				}
+				else if (i == startIndex)
+					earliestHit = std::make_pair(files[i].GetCurrentHit(), files[i].GetUsedFlagPtr());
+				else if (files[i].GetCurrentHit().timestamp < earliestHit.first.timestamp)
+					earliestHit = std::make_pair(files[i].GetCurrentHit(), files[i].GetUsedFlagPtr());
+			}
+			if (earliestHit.second == nullptr)
+				break;
+			*earliestHit.second = true;
+
+			datum.longEnergy = earliestHit.first.energy;
+			datum.shortEnergy = earliestHit.first.energyShort;
+			datum.calEnergy = earliestHit.first.energyCalibrated;
+			datum.timestamp = earliestHit.first.timestamp;
+			datum.id = Utilities::GetBoardChannelUUID(earliestHit.first.board, earliestHit.first.channel);
+			builder.AddDatum(datum);
+			if (builder.IsEventReady())
+				ConsumeEvents(builder.GetReadyEvents(), result, lastTime);
+		}
+		builder.Flush();
+		if (builder.IsEventReady())
+			ConsumeEvents(builder.GetReadyEvents(), result, lastTime);
+
+		result.nsPerHit = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count() / std::max(result.hits, uint64_t(1));
+		return result;
+	}
+
+	static MergeResult RunCompassRun(const std::filesystem::path& directory)
+	{
+		MergeResult result;
+		uint64_t lastTime = 0;
+		CompassRun run(directory.string(), s_coincidenceWindow);
+
+		auto start = std::chrono::steady_clock::now();
+		while (run.IsValid())
+		{
+			run.ProcessData();
+			if (run.IsEventReady())
+				ConsumeEvents(run.GetEvents(), result, lastTime);
+		}
+
+		result.nsPerHit = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count() / std::max(result.hits, uint64_t(1));
+		return result;
+	}
+
+	template<typename T>
+	static void WriteValue(std::vector<char>& buffer, T value)
+	{
+		const char* bytes = reinterpret_cast<const char*>(&value); //CoMPASS files are little endian, as is every platform Specter builds on
+		buffer.insert(buffer.end(), bytes, bytes + sizeof(T));
+	}
+
+	//One file per channel, with the hits of the files interleaved in time like a real run. waveSamples = 0 for no waveforms
+	static void GenerateRun(const std::filesystem::path& directory, int nFiles, int nHits, int waveSamples)
+	{
+		std::filesystem::remove_all(directory);
+		std::filesystem::create_directories(directory);
+		std::mt19937_64 rng(nFiles);
+		std::uniform_int_distribution<uint64_t> start(1, 1000);
+		std::uniform_int_distribution<uint64_t> step(1, 2000);
+		uint16_t header = CompassHeaders::Energy | CompassHeaders::EnergyShort;
+		if (waveSamples != 0)
+			header |= CompassHeaders::EnergyCalibrated | CompassHeaders::Waves;
+
+		std::vector<char> buffer;
+		for (int file = 0; file < nFiles; file++)
+		{
+			buffer.clear();
+			WriteValue<uint16_t>(buffer, header);
+			uint64_t timestamp = start(rng);
+			for (int i = 0; i < nHits / nFiles; i++)
+			{
+				timestamp += step(rng) * nFiles;
+				WriteValue<uint16_t>(buffer, file / 16); //board
+				WriteValue<uint16_t>(buffer, file % 16); //channel
+				WriteValue<uint64_t>(buffer, timestamp);
+				WriteValue<uint16_t>(buffer, 100 + i % 50); //energy
+				if (waveSamples != 0)
+					WriteValue<uint64_t>(buffer, 0); //calibrated energy
+				WriteValue<uint16_t>(buffer, 50); //short energy
+				WriteValue<uint32_t>(buffer, 0); //flags
+				if (waveSamples != 0)
+				{
+					WriteValue<uint8_t>(buffer, 1); //wave code
+					WriteValue<uint32_t>(buffer, waveSamples);
+					for (int sample = 0; sample < waveSamples; sample++)
+						WriteValue<uint16_t>(buffer, 7);
+				}
+			}
+			char name[16];
+			std::snprintf(name, sizeof(name), "f%03d.BIN", file);
+			std::ofstream output(directory / name, std::ios::binary);
+			output.write(buffer.data(), buffer.size());
+		}
+	}
+
+	static bool Compare(const std::string& label, const std::filesystem::path& directory)
+	{
+		MergeResult scan = RunLinearScan(directory);
+		MergeResult merged = RunCompassRun(directory);
+		bool isSame = scan.hits == merged.hits && scan.checksum == merged.checksum && merged.outOfOrder == 0;
+		std::printf("%-28s %10llu hits   linear scan %8.1f ns/hit   loser tree %8.1f ns/hit   %s\n", label.c_str(), (unsigned long long)merged.hits,
+					scan.nsPerHit, merged.nsPerHit, isSame ? "same output" : "OUTPUT DIFFERS");
+		return isSame;
+	}
+}
+
+int main(int argc, char** argv)
+{
+	Specter::Logger::Init();
+	if (argc > 1)
+		return Specter::Compare(argv[1], argv[1]) ? 0 : 1;
+
+	struct Config { int nFiles; int nHits; int waveSamples; };
+	const Config configs[] = { {8, 2000000, 0}, {32, 2000000, 0}, {128, 2000000, 0}, {8, 1000000, 32}, {32, 1000000, 32}, {128, 1000000, 32} };
+	std::error_code error;
+	std::filesystem::path directory = std::filesystem::temp_directory_path(error) / "SpecterMergeBenchmark";
+	bool isSame = true;
+	for (auto& config : configs)
+	{
+		Specter::GenerateRun(directory, config.nFiles, config.nHits, config.waveSamples);
+		std::string label = std::to_string(config.nFiles) + " files, " + (config.waveSamples == 0 ? "no waves" : std::to_string(config.waveSamples) + " samples");
+		isSame &= Specter::Compare(label, directory);
+	}
+	std::filesystem::remove_all(directory, error);
+	return isSame ? 0 : 1;
+}
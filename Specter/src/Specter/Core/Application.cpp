@@ -39,6 +39,7 @@ namespace Specter {
 
 		//Create the manager
 		m_manager = std::make_shared<SpectrumManager>();
+		m_manager->SetShardedStorage(m_args.shardedHistogramStorage);
 
 		m_physicsLayer = new PhysicsLayer(m_manager);
 		PushLayer(m_physicsLayer);
@@ -29,6 +29,7 @@ namespace Specter {
 	{
 		std::string name = "";
 		std::filesystem::path runtimePath = "";
+		bool shardedHistogramStorage = false; //Give each filling thread private histogram bins, merged when read. See BinStorage
 	};
 
 	class Application
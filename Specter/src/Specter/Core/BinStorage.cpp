@@ -0,0 +1,630 @@
+/*
+	BinStorage.cpp
+	Storage for the bin counts of a histogram. By default this is just a flat array of doubles, exactly as the histograms have always used.
+
+	Optionally the storage can be sharded. In sharded mode every thread which fills the histogram gets a private array of bins (a shard), so fills from
+	different threads never write to the same memory and need no lock. Readers (drawing, analysis, exporting) go through GetBins(), which returns a merged
+	view of all the shards. See BinStorage.h for the rules of sharded mode.
+
+	The counts can be stored as uint32, uint64, float or double (BinCountType), see BinBuffer.
+
+	Large 2D storage is tiled, allocating a tile only on the first fill of one of its bins. See BinStorage.h.
+*/
+#include "BinStorage.h"
+
+#include <type_traits>
+
+namespace Specter {
+
+	namespace {
+
+		//Global pool of shard slots. The last slot is the overflow slot, shared by any threads beyond the pool size.
+		class ShardSlotPool
+		{
+		public:
+			static constexpr size_t s_overflowSlot = BinStorage::s_maxShards - 1;
+
+			size_t Acquire()
+			{
+				std::scoped_lock<std::mutex> guard(m_poolMutex);
+				for (size_t i = 0; i < s_overflowSlot; i++)
+				{
+					if (!m_isUsed[i])
+					{
+						m_isUsed[i] = true;
+						return i;
+					}
+				}
+				SPEC_WARN("More than {0} threads are filling sharded histograms, extra threads will share a locked shard.", s_overflowSlot);
+				return s_overflowSlot;
+			}
+
+			void Release(size_t slot)
+			{
+				std::scoped_lock<std::mutex> guard(m_poolMutex);
+				if (slot != s_overflowSlot)
+					m_isUsed[slot] = false;
+			}
+
+		private:
+			std::mutex m_poolMutex;
+			bool m_isUsed[BinStorage::s_maxShards] = { false };
+		};
+
+		ShardSlotPool& GetShardSlotPool()
+		{
+			static ShardSlotPool s_pool;
+			return s_pool;
+		}
+
+		//Acquires a slot on the first sharded fill from a thread, returns it when the thread exits
+		struct ThreadShardSlot
+		{
+			ThreadShardSlot() : index(GetShardSlotPool().Acquire()) {}
+			~ThreadShardSlot() { GetShardSlotPool().Release(index); }
+
+			size_t index;
+		};
+
+		size_t GetThreadShardSlot()
+		{
+			thread_local ThreadShardSlot s_slot;
+			return s_slot.index;
+		}
+	}
+
+	std::string ConvertBinCountTypeToString(BinCountType type)
+	{
+		switch (type)
+		{
+			case BinCountType::UInt32: return "UInt32";
+			case BinCountType::UInt64: return "UInt64";
+			case BinCountType::Float: return "Float";
+			case BinCountType::Double: return "Double";
+		}
+		return "Double";
+	}
+
+	BinCountType ConvertStringToBinCountType(const std::string& keyword)
+	{
+		if (keyword == "UInt32")
+			return BinCountType::UInt32;
+		else if (keyword == "UInt64")
+			return BinCountType::UInt64;
+		else if (keyword == "Float")
+			return BinCountType::Float;
+		else
+			return BinCountType::Double;
+	}
+
+	size_t GetBinCountSize(BinCountType type)
+	{
+		switch (type)
+		{
+			case BinCountType::UInt32: return sizeof(uint32_t);
+			case BinCountType::UInt64: return sizeof(uint64_t);
+			case BinCountType::Float: return sizeof(float);
+			case BinCountType::Double: return sizeof(double);
+		}
+		return sizeof(double);
+	}
+
+	void BinBuffer::Assign(BinCountType type, size_t nBins)
+	{
+		m_type = type;
+		m_size = nBins;
+		m_data.assign((nBins * GetBinCountSize(type) + sizeof(uint64_t) - 1) / sizeof(uint64_t), 0);
+	}
+
+	//Resize, keeping the existing counts. New bins are zero.
+	void BinBuffer::Grow(size_t nBins)
+	{
+		m_size = nBins;
+		m_data.resize((nBins * GetBinCountSize(m_type) + sizeof(uint64_t) - 1) / sizeof(uint64_t), 0);
+	}
+
+	void BinBuffer::Zero()
+	{
+		std::fill(m_data.begin(), m_data.end(), 0);
+	}
+
+	void BinBuffer::ConvertToDoubles(std::vector<double>& result) const
+	{
+		result.resize(m_size);
+		Visit([this, &result](const auto* bins)
+		{
+			for (size_t i = 0; i < m_size; i++)
+				result[i] = double(bins[i]);
+		});
+	}
+
+	std::vector<double> BinBuffer::ToDoubles() const
+	{
+		std::vector<double> result;
+		ConvertToDoubles(result);
+		return result;
+	}
+
+	BinStorage::BinStorage() :
+		m_isSharded(false), m_needsMerge(false), m_modified(s_allModified), m_nCols(0), m_nRows(0), m_isTiled(false), m_tilesX(0),
+		m_maxTiles(0), m_droppedCounts(0), m_isAllDirty(true), m_snapshotVersion(0)
+	{
+		for (auto& shard : m_shards)
+			shard.store(nullptr);
+	}
+
+	BinStorage::~BinStorage()
+	{
+		ReleaseShards();
+	}
+
+	void BinStorage::Resize(size_t nBins, BinCountType type)
+	{
+		ReleaseShards();
+		m_isTiled = false;
+		m_tileSlots.clear();
+		m_tileList.clear();
+		m_dirtyTileFlags.clear();
+		m_dirtyTiles.clear();
+		m_tilesX = 0;
+		m_maxTiles = 0;
+		m_droppedCounts = 0;
+		m_nCols = nBins;
+		m_nRows = 1;
+		m_bins.Assign(type, nBins);
+		m_modified = s_allModified;
+		m_isAllDirty = true;
+		if (m_isSharded)
+		{
+			m_merged.Assign(type, nBins);
+			m_baseline.Assign(type, nBins);
+		}
+	}
+
+	//Bins are laid out row by row (bin = row * nCols + col). Storage with more than s_tiledBinThreshold bins, or with a tile limit, is tiled, and is not sharded.
+	void BinStorage::Resize2D(size_t nCols, size_t nRows, BinCountType type, size_t maxTiles)
+	{
+		if (maxTiles == 0 && nCols * nRows <= s_tiledBinThreshold)
+		{
+			Resize(nCols * nRows, type);
+			m_nCols = nCols;
+			m_nRows = nRows;
+			m_tilesX = (nCols + s_tileMask) >> s_tileShift;
+			m_dirtyTileFlags.assign(m_tilesX * ((nRows + s_tileMask) >> s_tileShift), 0);
+			return;
+		}
+
+		ReleaseShards();
+		m_nCols = nCols;
+		m_nRows = nRows;
+		m_modified = s_allModified;
+		m_isSharded = false;
+		m_merged = BinBuffer();
+		m_baseline = BinBuffer();
+		m_isTiled = true;
+		m_tilesX = (nCols + s_tileMask) >> s_tileShift;
+		m_tileSlots.assign(m_tilesX * ((nRows + s_tileMask) >> s_tileShift), s_noTile);
+		m_tileList.clear();
+		m_maxTiles = maxTiles == 0 ? m_tileSlots.size() : maxTiles;
+		m_droppedCounts = 0;
+		m_bins = BinBuffer();
+		m_bins.Assign(type, 0);
+		m_dirtyTileFlags.assign(m_tileSlots.size(), 0);
+		m_dirtyTiles.clear();
+		m_isAllDirty = true;
+	}
+
+	void BinStorage::SetSharded(bool sharded)
+	{
+		if (sharded == m_isSharded || m_isTiled)
+			return;
+
+		m_isAllDirty = true;
+		if (sharded)
+		{
+			m_merged = m_bins;
+			m_baseline.Assign(m_bins.GetType(), m_bins.GetSize());
+			m_needsMerge = false;
+			m_isSharded = true;
+		}
+		else
+		{
+			m_bins = GetBins(); //fold everything back into the flat array
+			ReleaseShards();
+			m_merged = BinBuffer();
+			m_baseline = BinBuffer();
+			m_isSharded = false;
+		}
+	}
+
+	void BinStorage::Clear()
+	{
+		if (m_isTiled)
+		{
+			std::fill(m_tileSlots.begin(), m_tileSlots.end(), s_noTile);
+			m_tileList.clear();
+			BinCountType type = m_bins.GetType();
+			m_bins = BinBuffer(); //Assign would keep the memory of the tiles
+			m_bins.Assign(type, 0);
+			m_droppedCounts = 0;
+			m_merged = BinBuffer();
+			m_modified = s_allModified;
+			m_isAllDirty = true;
+			return;
+		}
+
+		m_bins.Zero();
+		m_modified = s_allModified;
+		m_isAllDirty = true;
+		if (m_isSharded)
+		{
+			SumShards(m_baseline);
+			m_merged.Zero();
+			m_needsMerge = true;
+		}
+	}
+
+	const BinBuffer& BinStorage::GetBins()
+	{
+		if (m_isTiled)
+		{
+			//Expensive: expands the tiles into a dense copy
+			m_merged.Assign(m_bins.GetType(), m_nCols * m_nRows);
+			m_merged.Visit([this](auto* dense)
+			{
+				VisitRegion(0, m_nCols, 0, m_nRows, [this, dense](size_t x, size_t y, double count)
+				{
+					using CountType = std::remove_pointer_t<decltype(dense)>;
+					dense[y * m_nCols + x] = CountType(count);
+				});
+			});
+			return m_merged;
+		}
+
+		if (!m_isSharded)
+			return m_bins;
+
+		PollShards();
+		if (m_needsMerge)
+			Merge();
+		return m_merged;
+	}
+
+	//Add counts to a bin outside of a fill. In sharded mode the counts go into the pre-sharding counts, which are part of every merge
+	void BinStorage::Add(size_t bin, double count)
+	{
+		if (m_isTiled)
+			return;
+		m_bins.Visit([bin, count](auto* bins)
+		{
+			using CountType = std::remove_pointer_t<decltype(bins)>;
+			bins[bin] += CountType(count);
+		});
+		m_modified = s_allModified;
+		m_isAllDirty = true;
+		if (m_isSharded)
+			m_needsMerge = true;
+	}
+
+	//In sharded mode the counts come out of the pre-sharding counts, like Add. Integer counts may wrap there, the merged sum is still right
+	void BinStorage::Subtract(const BinBuffer& counts)
+	{
+		if (m_isTiled || counts.GetType() != m_bins.GetType() || counts.GetSize() != m_bins.GetSize())
+			return;
+		m_bins.Visit([&counts](auto* bins)
+		{
+			using CountType = std::remove_pointer_t<decltype(bins)>;
+			const CountType* subtracted = counts.GetData<CountType>();
+			for (size_t i = 0; i < counts.GetSize(); i++)
+				bins[i] -= subtracted[i];
+		});
+		m_modified = s_allModified;
+		m_isAllDirty = true;
+		if (m_isSharded)
+			m_needsMerge = true;
+	}
+
+	//In sharded mode the shards keep counting, so the current shard sums become the new baseline and the scaled total is folded into the pre-sharding counts
+	void BinStorage::Scale(double factor)
+	{
+		if (m_isSharded)
+		{
+			BinBuffer shardSum;
+			SumShards(shardSum);
+			m_bins.Visit([this, &shardSum, factor](auto* bins)
+			{
+				using CountType = std::remove_pointer_t<decltype(bins)>;
+				const CountType* sum = shardSum.GetData<CountType>();
+				CountType* baseline = m_baseline.GetData<CountType>();
+				for (size_t i = 0; i < m_bins.GetSize(); i++)
+				{
+					bins[i] = CountType(factor * double(CountType(sum[i] + bins[i] - baseline[i])));
+					baseline[i] = sum[i];
+				}
+			});
+			m_needsMerge = true;
+		}
+		else
+		{
+			//Tiled storage holds only the allocated tiles in m_bins, so this covers it as well
+			m_bins.Visit([this, factor](auto* bins)
+			{
+				using CountType = std::remove_pointer_t<decltype(bins)>;
+				for (size_t i = 0; i < m_bins.GetSize(); i++)
+					bins[i] = CountType(factor * double(bins[i]));
+			});
+		}
+		m_modified = s_allModified;
+		m_isAllDirty = true;
+	}
+
+	//In sharded mode the current shard sums become the baseline, as in Clear. Tiled storage only allocates the tiles with counts
+	bool BinStorage::Load(BinBuffer&& bins)
+	{
+		if (bins.GetType() != m_bins.GetType() || bins.GetSize() != m_nCols * m_nRows)
+			return false;
+
+		m_modified = s_allModified;
+		m_isAllDirty = true;
+		if (!m_isTiled)
+		{
+			if (m_isSharded)
+			{
+				SumShards(m_baseline);
+				m_merged.Zero();
+				m_needsMerge = true;
+			}
+			m_bins = std::move(bins);
+			return true;
+		}
+
+		Clear();
+		size_t tilesY = m_tileSlots.size() / m_tilesX;
+		bins.Visit([this, tilesY](const auto* dense)
+		{
+			using CountType = std::remove_const_t<std::remove_pointer_t<decltype(dense)>>;
+			for (size_t tile = 0; tile < m_tilesX * tilesY; tile++)
+			{
+				size_t x0 = (tile % m_tilesX) << s_tileShift;
+				size_t y0 = (tile / m_tilesX) << s_tileShift;
+				size_t xEnd = std::min(x0 + s_tileSize, m_nCols);
+				size_t yEnd = std::min(y0 + s_tileSize, m_nRows);
+				bool isEmpty = true;
+				for (size_t y = y0; y < yEnd && isEmpty; y++)
+					for (size_t x = x0; x < xEnd && isEmpty; x++)
+						isEmpty = dense[y * m_nCols + x] == CountType(0);
+				if (isEmpty)
+					continue;
+
+				uint32_t slot = AllocateTile(tile); //Grows m_bins, so before taking the pointer
+				if (slot == s_noTile)
+				{
+					for (size_t y = y0; y < yEnd; y++)
+						for (size_t x = x0; x < xEnd; x++)
+							m_droppedCounts += uint64_t(dense[y * m_nCols + x]);
+					continue;
+				}
+				CountType* counts = m_bins.GetData<CountType>() + slot * s_tileBins;
+				for (size_t y = y0; y < yEnd; y++)
+					for (size_t x = x0; x < xEnd; x++)
+						counts[((y - y0) << s_tileShift) + (x - x0)] = dense[y * m_nCols + x];
+			}
+		});
+		return true;
+	}
+
+	//Batch fill of dense storage. Negative entries are out of range values and are skipped. The accumulation is a plain loop: repeated bins
+	//within a batch are common (peaks), and each increment has to see the previous one
+	void BinStorage::IncrementBatch(const int32_t* bins, size_t count)
+	{
+		if (m_isSharded)
+		{
+			IncrementShardBatch(bins, count);
+			return;
+		}
+
+		m_bins.Visit([bins, count](auto* data)
+		{
+			using CountType = std::remove_pointer_t<decltype(data)>;
+			for (size_t i = 0; i < count; i++)
+			{
+				if (bins[i] >= 0)
+					data[bins[i]] += CountType(1);
+			}
+		});
+		m_modified = s_allModified;
+	}
+
+	//Dense copy of the bins as double, for exporting
+	std::vector<double> BinStorage::ToDoubles()
+	{
+		if (!m_isTiled)
+			return GetBins().ToDoubles();
+
+		std::vector<double> result(m_nCols * m_nRows, 0.0);
+		VisitRegion(0, m_nCols, 0, m_nRows, [this, &result](size_t x, size_t y, double count)
+		{
+			result[y * m_nCols + x] = count;
+		});
+		return result;
+	}
+
+	//Copy the bins for drawing. For tiled storage only the allocated tiles are copied.
+	void BinStorage::CopySnapshot(BinSnapshot& snapshot)
+	{
+		snapshot.nCols = m_nCols;
+		snapshot.nRows = m_nRows;
+		snapshot.isTiled = m_isTiled;
+		snapshot.version = ++m_snapshotVersion;
+		snapshot.isAllDirty = m_isAllDirty || m_isSharded; //Sharded fills don't track tiles
+		snapshot.dirtyTiles.clear();
+		if (!snapshot.isAllDirty)
+			snapshot.dirtyTiles = m_dirtyTiles;
+		for (uint32_t tile : m_dirtyTiles)
+			m_dirtyTileFlags[tile] = 0;
+		m_dirtyTiles.clear();
+		m_isAllDirty = false;
+
+		if (!m_isTiled)
+		{
+			snapshot.bins = GetBins();
+			snapshot.tiles.clear();
+			snapshot.maxCount = 0.0;
+			return;
+		}
+
+		snapshot.bins = m_bins;
+		snapshot.tiles = m_tileList;
+		snapshot.maxCount = m_bins.Visit([this](const auto* bins)
+		{
+			double maxCount = 0.0;
+			for (size_t i = 0; i < m_bins.GetSize(); i++)
+				maxCount = std::max(maxCount, double(bins[i]));
+			return maxCount;
+		});
+	}
+
+	//Returns true if the bins have changed since the consumer last called. Used to avoid redoing work on unchanged data (see Histogram snapshots, RegionTable)
+	bool BinStorage::ConsumeModified(Consumer consumer)
+	{
+		if (m_isSharded)
+			PollShards();
+		uint8_t bit = uint8_t(1) << int(consumer);
+		bool modified = (m_modified & bit) != 0;
+		m_modified &= uint8_t(~bit);
+		return modified;
+	}
+
+	//Bytes currently held, for memory accounting. Shards are created by their filling threads, so they are read through the atomic pointers
+	size_t BinStorage::GetMemorySize() const
+	{
+		size_t size = m_bins.GetMemorySize() + m_merged.GetMemorySize() + m_baseline.GetMemorySize();
+		for (const auto& shardPtr : m_shards)
+		{
+			const Shard* shard = shardPtr.load(std::memory_order_acquire);
+			if (shard != nullptr)
+				size += sizeof(Shard) + shard->bins.GetMemorySize();
+		}
+		size += (m_tileSlots.capacity() + m_tileList.capacity() + m_dirtyTiles.capacity()) * sizeof(uint32_t) + m_dirtyTileFlags.capacity();
+		return size;
+	}
+
+	//Shard of the calling thread, created on first use. If the thread has to use the shared overflow slot, overflowGuard is locked
+	BinStorage::Shard* BinStorage::GetThreadShard(std::unique_lock<std::mutex>& overflowGuard)
+	{
+		size_t slot = GetThreadShardSlot();
+		if (slot == ShardSlotPool::s_overflowSlot)
+			overflowGuard = std::unique_lock<std::mutex>(m_overflowMutex);
+
+		Shard* shard = m_shards[slot].load(std::memory_order_acquire);
+		if (shard == nullptr)
+		{
+			shard = new Shard(m_bins.GetType(), m_bins.GetSize());
+			m_shards[slot].store(shard, std::memory_order_release);
+		}
+		return shard;
+	}
+
+	void BinStorage::IncrementShard(size_t bin)
+	{
+		std::unique_lock<std::mutex> overflowGuard;
+		Shard* shard = GetThreadShard(overflowGuard);
+		shard->bins.Visit([bin](auto* bins)
+		{
+			using CountType = std::remove_pointer_t<decltype(bins)>;
+			std::atomic_ref<CountType> count(bins[bin]);
+			count.store(count.load(std::memory_order_relaxed) + CountType(1), std::memory_order_relaxed);
+		});
+		shard->isDirty.store(true, std::memory_order_release);
+	}
+
+	//Same as IncrementShard, but the shard lookup is done once for the whole batch
+	void BinStorage::IncrementShardBatch(const int32_t* bins, size_t count)
+	{
+		std::unique_lock<std::mutex> overflowGuard;
+		Shard* shard = GetThreadShard(overflowGuard);
+		shard->bins.Visit([bins, count](auto* data)
+		{
+			using CountType = std::remove_pointer_t<decltype(data)>;
+			for (size_t i = 0; i < count; i++)
+			{
+				if (bins[i] < 0)
+					continue;
+				std::atomic_ref<CountType> binCount(data[bins[i]]);
+				binCount.store(binCount.load(std::memory_order_relaxed) + CountType(1), std::memory_order_relaxed);
+			}
+		});
+		shard->isDirty.store(true, std::memory_order_release);
+	}
+
+	//Collect the dirty flags of the shards into m_needsMerge
+	void BinStorage::PollShards()
+	{
+		for (auto& shardPtr : m_shards)
+		{
+			Shard* shard = shardPtr.load(std::memory_order_acquire);
+			//Always exchange (no short circuit), so that every flag is reset for this merge
+			if (shard != nullptr && shard->isDirty.exchange(false, std::memory_order_acq_rel))
+			{
+				m_needsMerge = true;
+				m_modified = s_allModified;
+			}
+		}
+	}
+
+	//merged = pre-shard counts + sum of shards - sum of shards at last clear
+	void BinStorage::Merge()
+	{
+		SPEC_PROFILE_FUNCTION();
+		SumShards(m_merged);
+		m_merged.Visit([this](auto* merged)
+		{
+			using CountType = std::remove_pointer_t<decltype(merged)>;
+			const CountType* bins = m_bins.GetData<CountType>();
+			const CountType* baseline = m_baseline.GetData<CountType>();
+			for (size_t i = 0; i < m_merged.GetSize(); i++)
+				merged[i] += bins[i] - baseline[i];
+		});
+		m_needsMerge = false;
+		m_modified = s_allModified;
+	}
+
+	void BinStorage::SumShards(BinBuffer& sum)
+	{
+		sum.Assign(m_bins.GetType(), m_bins.GetSize());
+		sum.Visit([this](auto* total)
+		{
+			using CountType = std::remove_pointer_t<decltype(total)>;
+			for (auto& shardPtr : m_shards)
+			{
+				Shard* shard = shardPtr.load(std::memory_order_acquire);
+				if (shard == nullptr)
+					continue;
+				CountType* bins = shard->bins.GetData<CountType>();
+				for (size_t i = 0; i < m_bins.GetSize(); i++)
+					total[i] += std::atomic_ref<CountType>(bins[i]).load(std::memory_order_relaxed);
+			}
+		});
+	}
+
+	//Returns s_noTile if the tile limit is reached
+	uint32_t BinStorage::AllocateTile(size_t tile)
+	{
+		if (m_tileList.size() >= m_maxTiles)
+			return s_noTile;
+		uint32_t slot = uint32_t(m_tileList.size());
+		m_tileList.push_back(uint32_t(tile));
+		m_tileSlots[tile] = slot;
+		m_bins.Grow(m_tileList.size() * s_tileBins);
+		return slot;
+	}
+
+	void BinStorage::ReleaseShards()
+	{
+		for (auto& shardPtr : m_shards)
+		{
+			Shard* shard = shardPtr.exchange(nullptr);
+			delete shard;
+		}
+	}
+}
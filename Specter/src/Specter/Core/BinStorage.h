@@ -0,0 +1,318 @@
+/*
+	BinStorage.h
+	Storage for the bin counts of a histogram. By default this is just a flat array of doubles, exactly as the histograms have always used.
+
+	Optionally the storage can be sharded. In sharded mode every thread which fills the histogram gets a private array of bins (a shard), so fills from
+	different threads never write to the same memory and need no lock. Readers (drawing, analysis, exporting) go through GetBins(), which returns a merged
+	view of all the shards. The merge is lazy: it is only done when someone actually asks for the bins, and only if something was filled since the last merge.
+
+	Some rules for sharded mode:
+	- A shard is only ever written by the thread that owns it. Bins are read/written through std::atomic_ref with relaxed ordering, so a reader merging while a
+	  fill is in progress sees either the old or the new count of a bin, never garbage. Each shard has its own dirty flag, so fills never share a cache line.
+	- Threads are assigned a shard slot from a global pool the first time they fill any sharded histogram. The slot is returned to the pool when the thread exits.
+	  If more than s_maxShards - 1 threads fill at once, the extra threads share the last (overflow) slot, which is guarded by a mutex.
+	- GetBins, ConsumeModified, Clear, Resize and SetSharded are NOT safe to call from multiple threads at once; these are expected to be called with the SpectrumManager lock held.
+	  Resize and SetSharded(false) free the shards, so there must also be no fills in flight. Clear does not touch the shards (their owners may be filling),
+	  it instead records a baseline which is subtracted in the merge.
+
+	The type of the counts is selected per histogram (BinCountType). Integer counts use half (uint32) or the same (uint64) memory as doubles, and are exact, but uint32
+	wraps after ~4e9 counts in a bin. Float counts stop increasing once a bin reaches 2^24 (~1.7e7) counts. The counts are only converted to double when exported;
+	drawing and analysis work on the native type through BinBuffer::Visit.
+
+	Large 2D storage (more than s_tiledBinThreshold bins, see Resize2D) is tiled. The bins are split into s_tileSize x s_tileSize tiles, and a tile is only allocated
+	the first time one of its bins is filled, so memory scales with the occupied part of the histogram rather than its declared range. Clear frees the tiles.
+	Tiled storage is never sharded (it is filled under the SpectrumManager fill lock like flat storage). Readers should use VisitRegion or CopySnapshot, which only walk
+	the allocated tiles; GetBins still works but has to expand the tiles into a dense copy.
+
+	2D storage (tiled or not) also keeps track of which s_tileSize x s_tileSize tiles were filled since the last snapshot. Each snapshot carries a version and the
+	list of changed tiles, so that the UI can update data derived from the bins (see HeatmapPyramid) without rescanning the whole histogram. Sharded storage,
+	and anything that changes bins outside of Increment2D (Clear, Add, Resize), flags every tile as changed.
+
+	Subtract and Scale take counts out again (time windowed histograms). They flag every tile as changed, as data derived from the bins may assume that counts
+	only grow between full updates.
+
+	Whether anything changed at all is tracked once per Consumer (snapshots, region tables, the linked summary a Histogram1D is a row of), so each can update lazily without hiding changes from the others.
+
+	2D storage can be given a tile limit (Resize2D), for histograms which would not fit the memory budget of the SpectrumManager when fully occupied. Such
+	storage is always tiled, and once the limit is reached, counts falling into tiles which are not yet allocated are dropped (GetDroppedCounts). GetMemorySize
+	is what the storage currently holds, including shards and tile bookkeeping.
+*/
+#ifndef BIN_STORAGE_H
+#define BIN_STORAGE_H
+
+#include "SpecCore.h"
+
+#include <atomic>
+#include <mutex>
+
+namespace Specter {
+
+	enum class BinCountType
+	{
+		UInt32,
+		UInt64,
+		Float,
+		Double
+	};
+
+	std::string ConvertBinCountTypeToString(BinCountType type);
+	BinCountType ConvertStringToBinCountType(const std::string& keyword);
+	size_t GetBinCountSize(BinCountType type);
+
+	//Flat array of bin counts of a runtime selected type. Visit() hands the typed data to a (generic) function, so that loops over
+	//the bins are compiled once per count type rather than switching on the type for every bin.
+	class BinBuffer
+	{
+	public:
+		BinBuffer() :
+			m_type(BinCountType::Double), m_size(0)
+		{
+		}
+
+		void Assign(BinCountType type, size_t nBins);
+		void Grow(size_t nBins);
+		void Zero();
+		void ConvertToDoubles(std::vector<double>& result) const;
+		std::vector<double> ToDoubles() const;
+
+		BinCountType GetType() const { return m_type; }
+		size_t GetSize() const { return m_size; }
+		size_t GetMemorySize() const { return m_data.capacity() * sizeof(uint64_t); } //Allocated bytes, may be more than the counts need after Grow
+
+		template<typename T>
+		T* GetData() { return reinterpret_cast<T*>(m_data.data()); }
+		template<typename T>
+		const T* GetData() const { return reinterpret_cast<const T*>(m_data.data()); }
+
+		template<typename Func>
+		decltype(auto) Visit(Func&& func) const
+		{
+			switch (m_type)
+			{
+				case BinCountType::UInt32: return func(GetData<uint32_t>());
+				case BinCountType::UInt64: return func(GetData<uint64_t>());
+				case BinCountType::Float: return func(GetData<float>());
+				case BinCountType::Double: break;
+			}
+			return func(GetData<double>());
+		}
+
+		template<typename Func>
+		decltype(auto) Visit(Func&& func)
+		{
+			switch (m_type)
+			{
+				case BinCountType::UInt32: return func(GetData<uint32_t>());
+				case BinCountType::UInt64: return func(GetData<uint64_t>());
+				case BinCountType::Float: return func(GetData<float>());
+				case BinCountType::Double: break;
+			}
+			return func(GetData<double>());
+		}
+
+	private:
+		std::vector<uint64_t> m_data; //8 byte words, so that every count type is aligned
+		BinCountType m_type;
+		size_t m_size;
+	};
+
+	//Copy of a BinStorage handed to the UI for drawing. For tiled storage, bins holds only the allocated tiles (tile i of tiles is at bins[i * s_tileBins])
+	struct BinSnapshot
+	{
+		BinBuffer bins;
+		bool isTiled = false;
+		std::vector<uint32_t> tiles; //Tiled only: index (tileY * tilesX + tileX) of each copied tile
+		size_t nCols = 0;
+		size_t nRows = 0;
+		double maxCount = 0.0; //Tiled only: largest bin count, for the color scale
+		uint64_t version = 0; //Incremented by every CopySnapshot of the storage
+		bool isAllDirty = true; //2D only: any bin may have changed since the previous version
+		std::vector<uint32_t> dirtyTiles; //2D only, if !isAllDirty: tiles (tileY * tilesX + tileX) changed since the previous version
+	};
+
+	class BinStorage
+	{
+	public:
+		BinStorage();
+		~BinStorage();
+
+		BinStorage(const BinStorage&) = delete;
+		BinStorage& operator=(const BinStorage&) = delete;
+
+		void Resize(size_t nBins, BinCountType type = BinCountType::Double);
+		void Resize2D(size_t nCols, size_t nRows, BinCountType type = BinCountType::Double, size_t maxTiles = 0); //maxTiles > 0: tiled, with at most this many tiles
+		size_t GetSize() const { return m_nCols * m_nRows; }
+		size_t GetNumberOfColumns() const { return m_nCols; }
+		size_t GetNumberOfRows() const { return m_nRows; }
+		BinCountType GetCountType() const { return m_bins.GetType(); }
+		bool IsTiled() const { return m_isTiled; }
+		size_t GetMemorySize() const;
+		uint64_t GetDroppedCounts() const { return m_droppedCounts; }
+
+		void SetSharded(bool sharded);
+		bool IsSharded() const { return m_isSharded; }
+
+		void Clear();
+		const BinBuffer& GetBins();
+		std::vector<double> ToDoubles();
+		void CopySnapshot(BinSnapshot& snapshot);
+		//Everything which keeps data derived from the bins, and has to know when to update it
+		enum class Consumer
+		{
+			Snapshot,
+			RegionTable,
+			Summary
+		};
+
+		bool ConsumeModified(Consumer consumer);
+		void Add(size_t bin, double count); //For seeding derived histograms, dense storage only
+		void Subtract(const BinBuffer& counts); //Dense storage only, counts must have the same type and size. For expiring counts, see TimeWindow
+		void Scale(double factor); //For decaying counts, see TimeWindow. Integer counts are truncated
+		bool Load(BinBuffer&& bins); //Replace all counts with a dense buffer of the same type and size, e.g. from a saved file. Returns false on a mismatch
+
+		//Calls func(xbin, ybin, count) for the bins in [xBegin, xEnd) x [yBegin, yEnd) (rows counted from the first row). Tiled storage skips unallocated tiles.
+		template<typename Func>
+		void VisitRegion(size_t xBegin, size_t xEnd, size_t yBegin, size_t yEnd, Func&& func)
+		{
+			xEnd = std::min(xEnd, m_nCols);
+			yEnd = std::min(yEnd, m_nRows);
+			if (!m_isTiled)
+			{
+				GetBins().Visit([&](const auto* bins)
+				{
+					for (size_t y = yBegin; y < yEnd; y++)
+						for (size_t x = xBegin; x < xEnd; x++)
+							func(x, y, double(bins[y * m_nCols + x]));
+				});
+				return;
+			}
+
+			m_bins.Visit([&](const auto* bins)
+			{
+				for (size_t slot = 0; slot < m_tileList.size(); slot++)
+				{
+					size_t x0 = (m_tileList[slot] % m_tilesX) << s_tileShift;
+					size_t y0 = (m_tileList[slot] / m_tilesX) << s_tileShift;
+					const auto* tile = bins + slot * s_tileBins;
+					for (size_t y = std::max(y0, yBegin); y < std::min(y0 + s_tileSize, yEnd); y++)
+						for (size_t x = std::max(x0, xBegin); x < std::min(x0 + s_tileSize, xEnd); x++)
+							func(x, y, double(tile[((y - y0) << s_tileShift) + (x - x0)]));
+				}
+			});
+		}
+
+		inline void Increment(size_t bin)
+		{
+			if (!m_isSharded)
+			{
+				switch (m_bins.GetType())
+				{
+					case BinCountType::UInt32: m_bins.GetData<uint32_t>()[bin] += 1; break;
+					case BinCountType::UInt64: m_bins.GetData<uint64_t>()[bin] += 1; break;
+					case BinCountType::Float: m_bins.GetData<float>()[bin] += 1.0f; break;
+					case BinCountType::Double: m_bins.GetData<double>()[bin] += 1.0; break;
+				}
+				m_modified = s_allModified;
+				return;
+			}
+			IncrementShard(bin);
+		}
+
+		void IncrementBatch(const int32_t* bins, size_t count); //Dense storage only, negative bins are skipped
+
+		//Increment by column and row, required for tiled storage
+		inline void Increment2D(size_t xbin, size_t ybin)
+		{
+			size_t tile = (ybin >> s_tileShift) * m_tilesX + (xbin >> s_tileShift);
+			if (!m_isTiled)
+			{
+				if (!m_isSharded)
+					MarkTileDirty(tile);
+				Increment(ybin * m_nCols + xbin);
+				return;
+			}
+
+			uint32_t slot = m_tileSlots[tile];
+			if (slot == s_noTile)
+			{
+				slot = AllocateTile(tile);
+				if (slot == s_noTile) //Over the tile limit
+				{
+					m_droppedCounts++;
+					return;
+				}
+			}
+			MarkTileDirty(tile);
+			size_t bin = slot * s_tileBins + ((ybin & s_tileMask) << s_tileShift) + (xbin & s_tileMask);
+			switch (m_bins.GetType())
+			{
+				case BinCountType::UInt32: m_bins.GetData<uint32_t>()[bin] += 1; break;
+				case BinCountType::UInt64: m_bins.GetData<uint64_t>()[bin] += 1; break;
+				case BinCountType::Float: m_bins.GetData<float>()[bin] += 1.0f; break;
+				case BinCountType::Double: m_bins.GetData<double>()[bin] += 1.0; break;
+			}
+			m_modified = s_allModified;
+		}
+
+		static constexpr size_t s_maxShards = 64;
+		static constexpr size_t s_tileShift = 6;
+		static constexpr size_t s_tileSize = size_t(1) << s_tileShift; //bins per tile side
+		static constexpr size_t s_tileMask = s_tileSize - 1;
+		static constexpr size_t s_tileBins = s_tileSize * s_tileSize;
+		static constexpr size_t s_tiledBinThreshold = size_t(1) << 22; //2D storage larger than this is tiled
+
+	private:
+		struct Shard
+		{
+			Shard(BinCountType type, size_t nBins) : isDirty(false) { bins.Assign(type, nBins); }
+
+			std::atomic<bool> isDirty;
+			BinBuffer bins;
+		};
+
+		Shard* GetThreadShard(std::unique_lock<std::mutex>& overflowGuard);
+		void IncrementShard(size_t bin);
+		void IncrementShardBatch(const int32_t* bins, size_t count);
+		void PollShards();
+		void Merge();
+		void SumShards(BinBuffer& sum);
+		void ReleaseShards();
+		uint32_t AllocateTile(size_t tile);
+
+		inline void MarkTileDirty(size_t tile)
+		{
+			if (!m_dirtyTileFlags[tile])
+			{
+				m_dirtyTileFlags[tile] = 1;
+				m_dirtyTiles.push_back(uint32_t(tile));
+			}
+		}
+
+		static constexpr uint32_t s_noTile = ~uint32_t(0);
+		static constexpr uint8_t s_allModified = 0xff;
+
+		BinBuffer m_bins; //Unsharded: the bins. Sharded: counts accumulated before sharding was enabled. Tiled: the allocated tiles, in allocation order
+		BinBuffer m_merged; //Sharded only: merged view handed out by GetBins
+		BinBuffer m_baseline; //Sharded only: sum of the shards at the last Clear
+		std::atomic<Shard*> m_shards[s_maxShards];
+		bool m_isSharded;
+		bool m_needsMerge;
+		uint8_t m_modified; //One bit per Consumer: set on any change, reset by ConsumeModified
+		size_t m_nCols;
+		size_t m_nRows;
+		bool m_isTiled;
+		size_t m_tilesX;
+		size_t m_maxTiles; //Tiled only
+		uint64_t m_droppedCounts; //Tiled only: counts not stored because of the tile limit
+		std::vector<uint32_t> m_tileSlots; //Tiled only: slot of each tile in m_bins, or s_noTile
+		std::vector<uint32_t> m_tileList; //Tiled only: tile index of each slot
+		std::vector<uint8_t> m_dirtyTileFlags; //2D only: tiles filled since the last snapshot, listed in m_dirtyTiles
+		std::vector<uint32_t> m_dirtyTiles;
+		bool m_isAllDirty; //Every tile changed since the last snapshot
+		uint64_t m_snapshotVersion;
+		std::mutex m_overflowMutex;
+	};
+
+}
+
+#endif
@@ -0,0 +1,126 @@
+/*
+	Binning.cpp
+	Bin edges of a histogram axis, and the lookup from a value to its bin. See Binning.h for the binning types and how the lookup works.
+*/
+#include "Binning.h"
+
+namespace Specter {
+
+	std::string ConvertBinningTypeToString(BinningType type)
+	{
+		switch (type)
+		{
+			case BinningType::Uniform: return "Uniform";
+			case BinningType::Log: return "Log";
+			case BinningType::Piecewise: return "Piecewise";
+			case BinningType::Edges: return "Edges";
+		}
+		return "Uniform";
+	}
+
+	BinningType ConvertStringToBinningType(const std::string& keyword)
+	{
+		if (keyword == "Log")
+			return BinningType::Log;
+		else if (keyword == "Piecewise")
+			return BinningType::Piecewise;
+		else if (keyword == "Edges")
+			return BinningType::Edges;
+		else
+			return BinningType::Uniform;
+	}
+
+	Binning::Binning() :
+		m_type(BinningType::Uniform), m_nBins(0), m_min(0.0), m_max(0.0), m_binWidth(0.0), m_invBinWidth(0.0), m_logMin(0.0), m_invLogWidth(0.0), m_invCellWidth(0.0)
+	{
+	}
+
+	bool Binning::Init(BinningType type, int nbins, double min, double max, const std::vector<double>& edges, const std::vector<int>& segmentBins)
+	{
+		m_type = type;
+		m_edges.clear();
+		m_cellFirstBin.clear();
+		m_cellLastBin.clear();
+
+		switch (type)
+		{
+			case BinningType::Uniform:
+			{
+				if (nbins <= 0 || min >= max)
+					return false;
+				m_binWidth = (max - min) / nbins;
+				m_invBinWidth = 1.0 / m_binWidth;
+				for (int i = 0; i < nbins; i++)
+					m_edges.push_back(min + i * m_binWidth);
+				break;
+			}
+			case BinningType::Log:
+			{
+				if (nbins <= 0 || min <= 0.0 || min >= max)
+					return false;
+				m_logMin = std::log(min);
+				m_invLogWidth = nbins / (std::log(max) - m_logMin);
+				for (int i = 0; i < nbins; i++)
+					m_edges.push_back(std::exp(m_logMin + i / m_invLogWidth));
+				m_edges[0] = min;
+				break;
+			}
+			case BinningType::Piecewise:
+			{
+				if (edges.size() < 2 || segmentBins.size() != edges.size() - 1)
+					return false;
+				for (size_t seg = 0; seg < segmentBins.size(); seg++)
+				{
+					if (segmentBins[seg] <= 0 || edges[seg] >= edges[seg + 1])
+						return false;
+					double width = (edges[seg + 1] - edges[seg]) / segmentBins[seg];
+					for (int i = 0; i < segmentBins[seg]; i++)
+						m_edges.push_back(edges[seg] + i * width);
+				}
+				break;
+			}
+			case BinningType::Edges:
+			{
+				if (edges.size() < 2)
+					return false;
+				for (size_t i = 0; i < edges.size() - 1; i++)
+				{
+					if (edges[i] >= edges[i + 1])
+						return false;
+					m_edges.push_back(edges[i]);
+				}
+				break;
+			}
+		}
+
+		m_nBins = int(m_edges.size());
+		m_min = m_edges.front();
+		m_max = (type == BinningType::Uniform || type == BinningType::Log) ? max : edges.back();
+		m_edges.push_back(m_max);
+
+		if (type == BinningType::Piecewise || type == BinningType::Edges)
+		{
+			//Bins overlapping each lookup cell. Cell c covers [min + c * width, min + (c+1) * width)
+			size_t nCells = size_t(m_nBins) * s_cellsPerBin;
+			double cellWidth = (m_max - m_min) / nCells;
+			m_invCellWidth = 1.0 / cellWidth;
+			m_cellFirstBin.resize(nCells);
+			m_cellLastBin.resize(nCells);
+			size_t bin = 0;
+			for (size_t cell = 0; cell < nCells; cell++)
+			{
+				double cellLow = m_min + cell * cellWidth;
+				double cellHigh = cell == nCells - 1 ? m_max : m_min + (cell + 1) * cellWidth;
+				while (bin < size_t(m_nBins) - 1 && m_edges[bin + 1] <= cellLow)
+					bin++;
+				m_cellFirstBin[cell] = uint32_t(bin);
+				size_t last = bin;
+				while (last < size_t(m_nBins) - 1 && m_edges[last + 1] < cellHigh)
+					last++;
+				m_cellLastBin[cell] = uint32_t(last);
+			}
+		}
+
+		return true;
+	}
+}
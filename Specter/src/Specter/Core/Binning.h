@@ -0,0 +1,129 @@
+/*
+	Binning.h
+	Bin edges of a histogram axis, and the lookup from a value to its bin. Binning comes in four flavors (BinningType):
+	- Uniform: nbins equal bins over [min, max). This is what histograms have always used.
+	- Log: nbins bins over [min, max) which are equal in log(x). Requires min > 0.
+	- Piecewise: a set of segments, each with its own number of uniform bins. The segments are given by their boundaries (edges) and the bins per segment.
+	- Edges: an arbitrary, strictly increasing list of bin edges.
+
+	Like everywhere else in Specter, bins are [low, high). FindBin returns -1 for values outside of [min, max).
+
+	Lookup has to stay close to the cost of the uniform case, as it is done for every fill. Uniform is a multiply by the inverse width and a correction of at most
+	one bin for rounding (the same arithmetic as the batch kernels in FillKernels.h, so single and batch fills agree exactly). Log is a log, a multiply and a correction
+	of at most one bin for rounding. For Piecewise and Edges, the range is split into a table of equal cells (s_cellsPerBin times as many cells as bins). Each cell
+	records the first and last bin it overlaps, so a lookup is one multiply to find the cell followed by a branchless binary search over the (usually one or two)
+	candidate bins.
+*/
+#ifndef BINNING_H
+#define BINNING_H
+
+#include "FillKernels.h"
+
+#include <cmath>
+
+namespace Specter {
+
+	enum class BinningType
+	{
+		Uniform,
+		Log,
+		Piecewise,
+		Edges
+	};
+
+	std::string ConvertBinningTypeToString(BinningType type);
+	BinningType ConvertStringToBinningType(const std::string& keyword);
+
+	class Binning
+	{
+	public:
+		Binning();
+
+		//Returns false if the definition is illegal. For Piecewise, edges are the segment boundaries; for Edges, all of the bin edges.
+		bool Init(BinningType type, int nbins, double min, double max, const std::vector<double>& edges = {}, const std::vector<int>& segmentBins = {});
+
+		BinningType GetType() const { return m_type; }
+		bool IsUniform() const { return m_type == BinningType::Uniform; }
+		int GetNBins() const { return m_nBins; }
+		double GetMin() const { return m_min; }
+		double GetMax() const { return m_max; }
+		const std::vector<double>& GetEdges() const { return m_edges; }
+		double GetBinLowEdge(int bin) const { return m_edges[bin]; }
+		double GetBinCenter(int bin) const { return 0.5 * (m_edges[bin] + m_edges[bin + 1]); }
+		double GetBinWidth(int bin) const { return m_edges[bin + 1] - m_edges[bin]; }
+		//Uniform only: the axis as seen by the batch kernels
+		UniformAxis GetUniformAxis() const { return UniformAxis{ m_min, m_max, m_invBinWidth, m_edges.data(), m_nBins }; }
+
+		//Same definition, so FindBin gives the same bin for every value (the lookup tables are derived from the edges)
+		bool operator==(const Binning& other) const
+		{
+			return m_type == other.m_type && m_nBins == other.m_nBins && m_min == other.m_min && m_max == other.m_max && m_edges == other.m_edges;
+		}
+
+		inline int FindBin(double x) const
+		{
+			if (!(x >= m_min && x < m_max)) //also rejects NaN
+				return -1;
+
+			switch (m_type)
+			{
+				case BinningType::Uniform:
+				{
+					int bin = std::min(int((x - m_min) * m_invBinWidth), m_nBins - 1);
+					return CorrectBin(x, bin);
+				}
+				case BinningType::Log:
+				{
+					int bin = std::min(int((std::log(x) - m_logMin) * m_invLogWidth), m_nBins - 1);
+					return CorrectBin(x, std::max(bin, 0));
+				}
+				case BinningType::Piecewise: break;
+				case BinningType::Edges: break;
+			}
+			return FindBinInTable(x);
+		}
+
+		static constexpr int s_cellsPerBin = 4;
+
+	private:
+		//Rounding can leave the estimated bin one off at a bin edge
+		inline int CorrectBin(double x, int bin) const
+		{
+			if (x < m_edges[bin])
+				return bin - 1;
+			else if (x >= m_edges[bin + 1])
+				return bin + 1;
+			return bin;
+		}
+
+		inline int FindBinInTable(double x) const
+		{
+			size_t cell = std::min(size_t((x - m_min) * m_invCellWidth), m_cellFirstBin.size() - 1);
+			//Largest edge index in [first, last] with edge <= x
+			const double* base = m_edges.data() + m_cellFirstBin[cell];
+			size_t count = m_cellLastBin[cell] - m_cellFirstBin[cell] + 1;
+			while (count > 1)
+			{
+				size_t half = count / 2;
+				base = (base[half] <= x) ? base + half : base;
+				count -= half;
+			}
+			return CorrectBin(x, int(base - m_edges.data()));
+		}
+
+		BinningType m_type;
+		int m_nBins;
+		double m_min;
+		double m_max;
+		double m_binWidth; //Uniform only
+		double m_invBinWidth; //Uniform only
+		double m_logMin; //Log only
+		double m_invLogWidth; //Log only
+		double m_invCellWidth; //Piecewise and Edges only
+		std::vector<double> m_edges; //nbins + 1 edges
+		std::vector<uint32_t> m_cellFirstBin; //Piecewise and Edges only: first bin overlapping each lookup cell
+		std::vector<uint32_t> m_cellLastBin; //Piecewise and Edges only: last bin overlapping each lookup cell
+	};
+}
+
+#endif
@@ -17,6 +17,8 @@
 #include "Cut.h"
 #include "implot.h"
 
+#include <cmath>
+
 namespace Specter {
 
 	std::string ConvertCutTypeToString(CutType type)
@@ -74,13 +76,96 @@ namespace Specter {
 
 	/*2D Cuts -- Can only be made on 2D histogram, but applied to either 1D or 2D histograms*/
     Cut2D::Cut2D(const CutArgs& params, const std::vector<double>& xpoints, const std::vector<double>& ypoints) :
-        Cut(params), m_xpoints(xpoints), m_ypoints(ypoints)
+        Cut(params), m_xpoints(xpoints), m_ypoints(ypoints), m_isAccelerated(false), m_isClosed(false), m_xMin(0.0), m_xMax(0.0), m_minEdgeHeight(0.0)
 	{
 		m_params.type = CutType::Cut2D;
+		BuildAcceleration();
 	}
 
 	Cut2D::~Cut2D() {}
 
+	void Cut2D::IsInside(double x, double y)
+	{
+		SPEC_PROFILE_FUNCTION();
+		if (m_isAccelerated)
+			m_isValid = IsInsideSlab(x, y);
+		else
+			m_isValid = IsInsideFullWalk(x, y);
+	}
+
+	/*
+		Build the bounding box and y-slabs. The vertex y values, sorted and made unique, split the plane into slabs. An edge (i, i+1) takes part in the
+		even-odd walk only when y is in [min(y_i, y_i+1), max(y_i, y_i+1)), which is always a whole number of slabs, so every slab can list exactly the edges
+		that the full walk would act upon for any y inside it. Vertex matches can only happen at one of the vertex y values, so those are listed per y value.
+		If the points are not usable (non-finite, mismatched sizes) the cut falls back to the full walk.
+	*/
+	void Cut2D::BuildAcceleration()
+	{
+		SPEC_PROFILE_FUNCTION();
+		m_isAccelerated = false;
+		size_t nPoints = m_xpoints.size();
+		if (nPoints < 2 || m_ypoints.size() != nPoints)
+			return;
+		for (size_t i = 0; i < nPoints; i++)
+		{
+			if (!std::isfinite(m_xpoints[i]) || !std::isfinite(m_ypoints[i]))
+				return;
+		}
+
+		m_isClosed = m_xpoints.front() == m_xpoints.back() && m_ypoints.front() == m_ypoints.back();
+		auto xRange = std::minmax_element(m_xpoints.begin(), m_xpoints.end());
+		m_xMin = *xRange.first;
+		m_xMax = *xRange.second;
+
+		m_minEdgeHeight = 0.0;
+		for (size_t i = 0; i < nPoints - 1; i++)
+		{
+			double height = std::abs(m_ypoints[i + 1] - m_ypoints[i]);
+			if (height > 0.0 && (m_minEdgeHeight == 0.0 || height < m_minEdgeHeight))
+				m_minEdgeHeight = height;
+		}
+
+		m_slabY = m_ypoints;
+		std::sort(m_slabY.begin(), m_slabY.end());
+		m_slabY.erase(std::unique(m_slabY.begin(), m_slabY.end()), m_slabY.end());
+		auto findLevel = [this](double y) { return uint32_t(std::lower_bound(m_slabY.begin(), m_slabY.end(), y) - m_slabY.begin()); };
+
+		//Vertices which the walk checks for an exact match (the first vertex is never checked)
+		m_levelOffsets.assign(m_slabY.size() + 1, 0);
+		for (size_t i = 1; i < nPoints; i++)
+			m_levelOffsets[findLevel(m_ypoints[i]) + 1]++;
+		for (size_t i = 1; i < m_levelOffsets.size(); i++)
+			m_levelOffsets[i] += m_levelOffsets[i - 1];
+		m_levelVertices.resize(m_levelOffsets.back());
+		std::vector<uint32_t> fill(m_levelOffsets.begin(), m_levelOffsets.end() - 1);
+		for (size_t i = 1; i < nPoints; i++)
+			m_levelVertices[fill[findLevel(m_ypoints[i])]++] = uint32_t(i);
+
+		//Edges crossing each slab
+		size_t nSlabs = m_slabY.size() - 1;
+		m_slabOffsets.assign(nSlabs + 1, 0);
+		for (size_t i = 0; i < nPoints - 1; i++)
+		{
+			uint32_t low = findLevel(std::min(m_ypoints[i], m_ypoints[i + 1]));
+			uint32_t high = findLevel(std::max(m_ypoints[i], m_ypoints[i + 1]));
+			for (uint32_t slab = low; slab < high; slab++)
+				m_slabOffsets[slab + 1]++;
+		}
+		for (size_t i = 1; i < m_slabOffsets.size(); i++)
+			m_slabOffsets[i] += m_slabOffsets[i - 1];
+		m_slabEdges.resize(m_slabOffsets.back());
+		fill.assign(m_slabOffsets.begin(), m_slabOffsets.end() - 1);
+		for (size_t i = 0; i < nPoints - 1; i++)
+		{
+			uint32_t low = findLevel(std::min(m_ypoints[i], m_ypoints[i + 1]));
+			uint32_t high = findLevel(std::max(m_ypoints[i], m_ypoints[i + 1]));
+			for (uint32_t slab = low; slab < high; slab++)
+				m_slabEdges[fill[slab]++] = uint32_t(i);
+		}
+
+		m_isAccelerated = true;
+	}
+
 	/*
         Even-odd point in polygon algorithm (see Wikipedia)
         Walk around the sides of the polygon and check intersection with each of  the sides.
@@ -88,32 +173,100 @@ namespace Specter {
         If odd number of intersections, point is inside. Even, point is outside.
         Edge cases of point is a vertex or on a side considered.
 	*/
-	void Cut2D::IsInside(double x, double y)
+	bool Cut2D::IsInsideFullWalk(double x, double y) const
 	{
-		SPEC_PROFILE_FUNCTION();
-		m_isValid = false;
+		if (m_xpoints.size() < 2)
+			return false;
+
+		bool isInside = false;
         double slope;
         for(size_t i=0; i<(m_xpoints.size()-1); i++)
         {
 			if (x == m_xpoints[i + 1] && y == m_ypoints[i + 1])
 			{
-				m_isValid = true;
-				return;
+				return true;
 			}
             else if((m_ypoints[i+1] > y) !=  (m_ypoints[i] > y))
             {
                 slope = (x - m_xpoints[i+1])*(m_ypoints[i] - m_ypoints[i+1]) - (m_xpoints[i] - m_xpoints[i+1])*(y - m_ypoints[i+1]);
 				if (slope == 0.0)
 				{
-					m_isValid = true;
-					return;
+					return true;
 				}
 				else if ((slope < 0.0) != (m_ypoints[i] < m_ypoints[i + 1]))
 				{
-					m_isValid = !m_isValid;
+					isInside = !isInside;
 				}
             }
         }
+		return isInside;
+	}
+
+	/*
+		Same walk as IsInsideFullWalk, restricted to the vertices and edges the full walk could act upon for this y. Every early exit of the
+		walk returns true and the toggles commute, so visiting the edges in slab order gives exactly the same result.
+	*/
+	bool Cut2D::IsInsideSlab(double x, double y) const
+	{
+		//Also rejects NaN
+		if (!(y >= m_slabY.front() && y <= m_slabY.back()))
+			return false;
+		if (IsOutsideXRange(x))
+			return false;
+
+		size_t level = std::upper_bound(m_slabY.begin(), m_slabY.end(), y) - m_slabY.begin() - 1;
+		if (m_slabY[level] == y)
+		{
+			for (uint32_t i = m_levelOffsets[level]; i < m_levelOffsets[level + 1]; i++)
+			{
+				if (x == m_xpoints[m_levelVertices[i]])
+					return true;
+			}
+		}
+
+		bool isInside = false;
+		if (level + 1 == m_slabY.size()) //top of the polygon, no edge can cross
+			return isInside;
+
+		double slope;
+		for (uint32_t j = m_slabOffsets[level]; j < m_slabOffsets[level + 1]; j++)
+		{
+			uint32_t i = m_slabEdges[j];
+			slope = (x - m_xpoints[i + 1]) * (m_ypoints[i] - m_ypoints[i + 1]) - (m_xpoints[i] - m_xpoints[i + 1]) * (y - m_ypoints[i + 1]);
+			if (slope == 0.0)
+				return true;
+			else if ((slope < 0.0) != (m_ypoints[i] < m_ypoints[i + 1]))
+				isInside = !isInside;
+		}
+		return isInside;
+	}
+
+	/*
+		Bounding box rejection in x. Unlike y (which only involves comparisons), the walk's answer for a point outside the box in x depends on the sign of the
+		slope calculation, which is subject to rounding. So we only reject points which are far enough outside the box that the rounding error can not change
+		the sign of any slope (relative error ~1e-15, we demand 1e-12), and where the products can neither underflow nor overflow. The walk counts edges to the
+		right of the point, so rejecting on the left additionally requires a closed polygon (an even number of crossings).
+	*/
+	bool Cut2D::IsOutsideXRange(double x) const
+	{
+		static constexpr double s_relativeMargin = 1.0e-12;
+		static constexpr double s_minProduct = 1.0e-250;
+		static constexpr double s_maxProduct = 1.0e250;
+
+		double yRange = m_slabY.back() - m_slabY.front();
+		if (x > m_xMax)
+		{
+			double distance = x - m_xMax;
+			double extent = x - m_xMin;
+			return distance > s_relativeMargin * extent && distance * m_minEdgeHeight > s_minProduct && extent * yRange < s_maxProduct;
+		}
+		else if (x < m_xMin && m_isClosed)
+		{
+			double distance = m_xMin - x;
+			double extent = m_xMax - x;
+			return distance > s_relativeMargin * extent && distance * m_minEdgeHeight > s_minProduct && extent * yRange < s_maxProduct;
+		}
+		return false;
 	}
 
     //Only in ImPlot/ImGui context!!!!
@@ -13,6 +13,12 @@
 	to flood-fill algorithms.
 
 	GWM -- Feb 2022
+
+	Cuts are now evaluated lazily by the SpectrumManager, only when a histogram actually needs them for an event. Each cut keeps counters of how many
+	events it was evaluated for and how many evaluations were skipped; these are updated by the physics thread and can be read from anywhere.
+
+	Cut2D precomputes a bounding box and a set of y-slabs (the bands between consecutive vertex y values, each listing the edges which cross it) when it is created,
+	so that a containment check only walks the two or so edges in the point's slab instead of the whole polygon. The result is identical to the full edge walk.
 */
 #ifndef CUT_H
 #define CUT_H
@@ -20,6 +26,8 @@
 #include "SpecCore.h"
 #include "imgui.h"
 
+#include <atomic>
+
 namespace Specter {
 
 	enum class CutType
@@ -31,6 +39,12 @@ namespace Specter {
 		None
 	};
 
+	struct CutEvaluationStats
+	{
+		uint64_t evaluated = 0;
+		uint64_t skipped = 0;
+	};
+
 	std::string ConvertCutTypeToString(CutType type);
 	CutType ConvertStringToCutType(const std::string& keyword);
 
@@ -53,7 +67,7 @@ namespace Specter {
 	public:
         
 		Cut(const CutArgs& params) :
-			m_params(params), m_isValid(false)
+			m_params(params), m_isValid(false), m_evaluatedCount(0), m_skippedCount(0)
 		{
 		}
 
@@ -71,9 +85,22 @@ namespace Specter {
 		const std::string& GetXParameter() const { return m_params.x_par; }
 		const std::string& GetYParameter() const { return m_params.y_par;  }
         const CutArgs& GetCutArgs() const { return m_params; }
+
+		void AddEvaluationStats(uint64_t evaluated, uint64_t skipped)
+		{
+			m_evaluatedCount.fetch_add(evaluated, std::memory_order_relaxed);
+			m_skippedCount.fetch_add(skipped, std::memory_order_relaxed);
+		}
+		CutEvaluationStats GetEvaluationStats() const
+		{
+			return { m_evaluatedCount.load(std::memory_order_relaxed), m_skippedCount.load(std::memory_order_relaxed) };
+		}
+
 	protected:
 		CutArgs m_params;
 		bool m_isValid;
+		std::atomic<uint64_t> m_evaluatedCount;
+		std::atomic<uint64_t> m_skippedCount;
 	};
 
 	class Cut1D : public Cut
@@ -101,8 +128,25 @@ namespace Specter {
 		virtual std::vector<double> GetYValues() const override { return m_ypoints; }
 
 	private:
+		void BuildAcceleration();
+		bool IsInsideFullWalk(double x, double y) const;
+		bool IsInsideSlab(double x, double y) const;
+		bool IsOutsideXRange(double x) const;
+
 		std::vector<double> m_xpoints;
 		std::vector<double> m_ypoints;
+
+		//Acceleration structure, built once in the constructor (see Cut.cpp)
+		bool m_isAccelerated;
+		bool m_isClosed;
+		double m_xMin;
+		double m_xMax;
+		double m_minEdgeHeight; //smallest non-zero |dy| of any edge
+		std::vector<double> m_slabY; //sorted distinct y values of the vertices; slab j is [m_slabY[j], m_slabY[j+1])
+		std::vector<uint32_t> m_slabOffsets; //range of each slab in m_slabEdges
+		std::vector<uint32_t> m_slabEdges; //index of the first vertex of each edge crossing the slab
+		std::vector<uint32_t> m_levelOffsets; //range of each y value in m_levelVertices
+		std::vector<uint32_t> m_levelVertices; //vertices (excluding the first) at each y value
 	};
 
 	class CutSummary : public Cut
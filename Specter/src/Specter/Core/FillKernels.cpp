@@ -0,0 +1,164 @@
+/*
+	FillKernels.cpp
+	See FillKernels.h. The AVX2 version is compiled with a function level target attribute (GCC/Clang), so the rest of Specter does not need to be built with AVX2
+	enabled and still runs on older CPUs. MSVC allows the intrinsics without any flags.
+*/
+#include "FillKernels.h"
+
+#if defined(__x86_64__) || defined(_M_X64) //SSE2 is part of x86-64, AVX2 is checked at runtime
+#define SPEC_FILL_X86
+#include <immintrin.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+#define SPEC_TARGET_AVX2
+#else
+#define SPEC_TARGET_AVX2 __attribute__((target("avx2")))
+#endif
+#endif
+
+namespace Specter {
+
+	using ComputeBinsFunc = void(*)(const UniformAxis&, const double*, size_t, int32_t*, bool);
+
+	static void ComputeBinsScalar(const UniformAxis& axis, const double* values, size_t count, int32_t* bins, bool negate)
+	{
+		for (size_t i = 0; i < count; i++)
+			bins[i] = FindUniformBin(axis, negate ? -values[i] : values[i]);
+	}
+
+#ifdef SPEC_FILL_X86
+
+	static void ComputeBinsSSE2(const UniformAxis& axis, const double* values, size_t count, int32_t* bins, bool negate)
+	{
+		const __m128d sign = _mm_set1_pd(negate ? -0.0 : 0.0);
+		const __m128d vmin = _mm_set1_pd(axis.min);
+		const __m128d vmax = _mm_set1_pd(axis.max);
+		const __m128d vinv = _mm_set1_pd(axis.invWidth);
+		const __m128d vlast = _mm_set1_pd(double(axis.nbins - 1));
+		const __m128d vzero = _mm_setzero_pd();
+
+		size_t i = 0;
+		for (; i + 2 <= count; i += 2)
+		{
+			__m128d x = _mm_xor_pd(_mm_loadu_pd(values + i), sign);
+			int inRange = _mm_movemask_pd(_mm_and_pd(_mm_cmpge_pd(x, vmin), _mm_cmplt_pd(x, vmax)));
+			//Clamp before truncating, so out of range lanes also give a valid (ignored) index. min_pd returns vlast for NaN
+			__m128d t = _mm_max_pd(_mm_min_pd(_mm_mul_pd(_mm_sub_pd(x, vmin), vinv), vlast), vzero);
+			int32_t estimate[4];
+			_mm_storeu_si128((__m128i*)estimate, _mm_cvttpd_epi32(t));
+
+			double lanes[2];
+			_mm_storeu_pd(lanes, x);
+			for (int lane = 0; lane < 2; lane++)
+			{
+				int32_t bin = estimate[lane];
+				if (!(inRange & (1 << lane)))
+					bin = -1;
+				else if (lanes[lane] < axis.edges[bin])
+					bin -= 1;
+				else if (lanes[lane] >= axis.edges[bin + 1])
+					bin += 1;
+				bins[i + lane] = bin;
+			}
+		}
+		ComputeBinsScalar(axis, values + i, count - i, bins + i, negate);
+	}
+
+	//Packs the four 64-bit lane masks of a compare into four 32-bit lane masks
+	SPEC_TARGET_AVX2 static inline __m128i PackMask(__m256d mask)
+	{
+		const __m256i order = _mm256_setr_epi32(0, 2, 4, 6, 0, 0, 0, 0);
+		return _mm256_castsi256_si128(_mm256_permutevar8x32_epi32(_mm256_castpd_si256(mask), order));
+	}
+
+	SPEC_TARGET_AVX2 static void ComputeBinsAVX2(const UniformAxis& axis, const double* values, size_t count, int32_t* bins, bool negate)
+	{
+		const __m256d sign = _mm256_set1_pd(negate ? -0.0 : 0.0);
+		const __m256d vmin = _mm256_set1_pd(axis.min);
+		const __m256d vmax = _mm256_set1_pd(axis.max);
+		const __m256d vinv = _mm256_set1_pd(axis.invWidth);
+		const __m256d vlast = _mm256_set1_pd(double(axis.nbins - 1));
+		const __m256d vzero = _mm256_setzero_pd();
+		const __m128i outside = _mm_set1_epi32(-1);
+
+		size_t i = 0;
+		for (; i + 4 <= count; i += 4)
+		{
+			__m256d x = _mm256_xor_pd(_mm256_loadu_pd(values + i), sign);
+			__m256d inRange = _mm256_and_pd(_mm256_cmp_pd(x, vmin, _CMP_GE_OQ), _mm256_cmp_pd(x, vmax, _CMP_LT_OQ));
+			//Clamp before truncating, so out of range lanes also give a valid index for the gathers. min_pd returns vlast for NaN
+			__m256d t = _mm256_max_pd(_mm256_min_pd(_mm256_mul_pd(_mm256_sub_pd(x, vmin), vinv), vlast), vzero);
+			__m128i bin = _mm256_cvttpd_epi32(t);
+
+			__m256d low = _mm256_i32gather_pd(axis.edges, bin, 8);
+			__m256d high = _mm256_i32gather_pd(axis.edges + 1, bin, 8);
+			//Masks are -1 where true: adding the below mask steps down a bin, subtracting the above mask steps up
+			bin = _mm_add_epi32(bin, PackMask(_mm256_cmp_pd(x, low, _CMP_LT_OQ)));
+			bin = _mm_sub_epi32(bin, PackMask(_mm256_cmp_pd(x, high, _CMP_GE_OQ)));
+			bin = _mm_blendv_epi8(outside, bin, PackMask(inRange));
+			_mm_storeu_si128((__m128i*)(bins + i), bin);
+		}
+		ComputeBinsScalar(axis, values + i, count - i, bins + i, negate);
+	}
+
+	static bool IsAVX2Supported()
+	{
+#ifdef _MSC_VER
+		int info[4];
+		__cpuid(info, 0);
+		if (info[0] < 7)
+			return false;
+		__cpuid(info, 1);
+		bool osSavesAVX = (info[2] & (1 << 27)) && (info[2] & (1 << 28)); //OSXSAVE and AVX
+		if (!osSavesAVX || (_xgetbv(0) & 0x6) != 0x6) //XMM and YMM state enabled by the OS
+			return false;
+		__cpuidex(info, 7, 0);
+		return (info[1] & (1 << 5)) != 0;
+#else
+		__builtin_cpu_init();
+		return __builtin_cpu_supports("avx2");
+#endif
+	}
+
+#endif
+
+	static ComputeBinsFunc SelectKernel(const char*& name)
+	{
+#ifdef SPEC_FILL_X86
+		if (IsAVX2Supported())
+		{
+			name = "AVX2";
+			return ComputeBinsAVX2;
+		}
+		name = "SSE2";
+		return ComputeBinsSSE2;
+#else
+		name = "Scalar";
+		return ComputeBinsScalar;
+#endif
+	}
+
+	struct FillKernel
+	{
+		FillKernel() { func = SelectKernel(name); }
+
+		ComputeBinsFunc func;
+		const char* name;
+	};
+
+	static const FillKernel& GetFillKernel()
+	{
+		static const FillKernel s_kernel;
+		return s_kernel;
+	}
+
+	void ComputeUniformBins(const UniformAxis& axis, const double* values, size_t count, int32_t* bins, bool negate)
+	{
+		GetFillKernel().func(axis, values, count, bins, negate);
+	}
+
+	const char* GetFillKernelName()
+	{
+		return GetFillKernel().name;
+	}
+}
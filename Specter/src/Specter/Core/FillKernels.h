@@ -0,0 +1,54 @@
+/*
+	FillKernels.h
+	Batch bin lookup for the FillBatch functions of the histograms. Given a block of values on a uniform axis, ComputeUniformBins writes the bin of each value
+	(or -1 if the value is outside of [min, max)), which the histogram then accumulates one bin at a time. Accumulation is kept scalar on purpose: a batch of a
+	peaked spectrum puts many values in the same bin, which vectorized scatters would get wrong (or have to detect and resolve at a cost).
+
+	The bin is estimated with a multiply by the inverse bin width and then checked against the two neighbouring bin edges, so the result is exactly the bin
+	whose edges enclose the value (the same answer as a search over the edges), regardless of rounding in the estimate. Binning::FindBin uses the same
+	arithmetic for uniform axes, so single fills and batch fills always agree.
+
+	There are three versions of the lookup: AVX2 (4 values at once, edges fetched with gathers), SSE2 (2 values at once, edge check per value) and plain scalar.
+	The best version supported by the CPU is selected the first time a batch is binned. Non-x86 builds only have the scalar version.
+*/
+#ifndef FILL_KERNELS_H
+#define FILL_KERNELS_H
+
+#include <cstddef>
+#include <cstdint>
+
+namespace Specter {
+
+	//Uniform axis of nbins bins over [min, max). edges has nbins + 1 entries, edges[i] = min + i * width
+	struct UniformAxis
+	{
+		double min = 0.0;
+		double max = 0.0;
+		double invWidth = 0.0;
+		const double* edges = nullptr;
+		int nbins = 0;
+	};
+
+	inline int FindUniformBin(const UniformAxis& axis, double x)
+	{
+		if (!(x >= axis.min && x < axis.max)) //also rejects NaN
+			return -1;
+		int bin = int((x - axis.min) * axis.invWidth);
+		bin = bin < axis.nbins - 1 ? bin : axis.nbins - 1;
+		if (x < axis.edges[bin])
+			return bin - 1;
+		else if (x >= axis.edges[bin + 1])
+			return bin + 1;
+		return bin;
+	}
+
+	//Bins of count values. With negate, the bins of -values[i] are computed instead (used for the rows of a Histogram2D, which count down from max_y)
+	void ComputeUniformBins(const UniformAxis& axis, const double* values, size_t count, int32_t* bins, bool negate = false);
+
+	//Name of the version of the lookup in use, for logging
+	const char* GetFillKernelName();
+
+	static constexpr size_t s_fillBatchSize = 256; //Values binned per call of ComputeUniformBins by the FillBatch functions
+}
+
+#endif
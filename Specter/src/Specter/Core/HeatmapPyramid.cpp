@@ -0,0 +1,296 @@
+/*
+	HeatmapPyramid.cpp
+	See HeatmapPyramid.h. Tiles here are the BinStorage tiles (s_tileSize bins on a side, aligned to the first row/column), whether or not the storage is tiled.
+*/
+#include "HeatmapPyramid.h"
+#include "implot.h"
+
+namespace Specter {
+
+	HeatmapPyramid::HeatmapPyramid() :
+		m_nCols(0), m_nRows(0), m_tilesX(0), m_maxCount(0.0), m_version(0)
+	{
+	}
+
+	void HeatmapPyramid::Update(const BinSnapshot& snapshot)
+	{
+		bool isSameShape = snapshot.nCols == m_nCols && snapshot.nRows == m_nRows;
+		if (snapshot.version == m_version && isSameShape)
+			return;
+
+		SPEC_PROFILE_FUNCTION();
+		bool isConsecutive = snapshot.version == m_version + 1 && isSameShape;
+		m_version = snapshot.version;
+		if (snapshot.isTiled)
+		{
+			size_t tilesY = (snapshot.nRows + BinStorage::s_tileMask) >> BinStorage::s_tileShift;
+			m_tileSlots.assign(((snapshot.nCols + BinStorage::s_tileMask) >> BinStorage::s_tileShift) * tilesY, -1);
+			for (size_t slot = 0; slot < snapshot.tiles.size(); slot++)
+				m_tileSlots[snapshot.tiles[slot]] = int32_t(slot);
+		}
+
+		if (!isConsecutive || snapshot.isAllDirty)
+		{
+			Rebuild(snapshot);
+			return;
+		}
+
+		for (uint32_t tile : snapshot.dirtyTiles)
+		{
+			SumTile(snapshot, tile);
+			size_t x0 = (tile % m_tilesX) << BinStorage::s_tileShift;
+			size_t y0 = (tile / m_tilesX) << BinStorage::s_tileShift;
+			size_t x1 = std::min(x0 + BinStorage::s_tileSize, m_nCols);
+			size_t y1 = std::min(y0 + BinStorage::s_tileSize, m_nRows);
+			for (size_t level = 2; level <= m_levels.size(); level++)
+			{
+				size_t round = (size_t(1) << level) - 1;
+				SumRegion(level, x0 >> level, (x1 + round) >> level, y0 >> level, (y1 + round) >> level);
+			}
+		}
+	}
+
+	size_t HeatmapPyramid::GetMemorySize() const
+	{
+		size_t size = m_tileSlots.capacity() * sizeof(int32_t) + m_window.capacity() * sizeof(float);
+		for (auto& level : m_levels)
+			size += level.counts.capacity() * sizeof(float);
+		return size;
+	}
+
+	//Size of the levels of an nCols x nRows histogram, about a third of its bin count in floats. The drawn window is not included, it depends on the plot
+	size_t HeatmapPyramid::EstimateMemorySize(size_t nCols, size_t nRows)
+	{
+		size_t size = 0;
+		while (nCols > s_minLevelSize || nRows > s_minLevelSize)
+		{
+			nCols = (nCols + 1) / 2;
+			nRows = (nRows + 1) / 2;
+			size += nCols * nRows * sizeof(float);
+		}
+		return size;
+	}
+
+	void HeatmapPyramid::Rebuild(const BinSnapshot& snapshot)
+	{
+		SPEC_PROFILE_FUNCTION();
+		m_nCols = snapshot.nCols;
+		m_nRows = snapshot.nRows;
+		m_tilesX = (m_nCols + BinStorage::s_tileMask) >> BinStorage::s_tileShift;
+		m_maxCount = 0.0;
+
+		size_t nLevels = 0;
+		size_t nCols = m_nCols;
+		size_t nRows = m_nRows;
+		while (nCols > s_minLevelSize || nRows > s_minLevelSize)
+		{
+			nCols = (nCols + 1) / 2;
+			nRows = (nRows + 1) / 2;
+			nLevels++;
+		}
+		m_levels.resize(nLevels);
+		nCols = m_nCols;
+		nRows = m_nRows;
+		for (auto& level : m_levels)
+		{
+			nCols = (nCols + 1) / 2;
+			nRows = (nRows + 1) / 2;
+			level.nCols = nCols;
+			level.nRows = nRows;
+			level.counts.assign(nCols * nRows, 0.0f); //reuses the allocation
+			level.maxCount = 0.0;
+		}
+
+		//Tiled snapshots: unallocated tiles are empty, and the levels start zeroed
+		if (snapshot.isTiled)
+		{
+			for (uint32_t tile : snapshot.tiles)
+				SumTile(snapshot, tile);
+		}
+		else
+		{
+			size_t nTiles = m_tilesX * ((m_nRows + BinStorage::s_tileMask) >> BinStorage::s_tileShift);
+			for (size_t tile = 0; tile < nTiles; tile++)
+				SumTile(snapshot, tile);
+		}
+
+		for (size_t level = 2; level <= m_levels.size(); level++)
+			SumRegion(level, 0, m_levels[level - 1].nCols, 0, m_levels[level - 1].nRows);
+	}
+
+	//Re-sum the level 1 cells of one tile from the snapshot, and fold the tile into the level 0 maximum
+	void HeatmapPyramid::SumTile(const BinSnapshot& snapshot, size_t tile)
+	{
+		size_t x0 = (tile % m_tilesX) << BinStorage::s_tileShift;
+		size_t y0 = (tile / m_tilesX) << BinStorage::s_tileShift;
+		size_t x1 = std::min(x0 + BinStorage::s_tileSize, m_nCols);
+		size_t y1 = std::min(y0 + BinStorage::s_tileSize, m_nRows);
+
+		snapshot.bins.Visit([&](const auto* bins)
+		{
+			//Bin (x, y) of the tile is origin[(y - y0) * stride + (x - x0)]
+			const auto* origin = bins + y0 * m_nCols + x0;
+			size_t stride = m_nCols;
+			if (snapshot.isTiled)
+			{
+				int32_t slot = m_tileSlots[tile];
+				if (slot < 0)
+					return; //Nothing filled; a tile is never freed without a full update
+				origin = bins + size_t(slot) * BinStorage::s_tileBins;
+				stride = BinStorage::s_tileSize;
+			}
+
+			for (size_t y = y0; y < y1; y++)
+			{
+				const auto* row = origin + (y - y0) * stride;
+				for (size_t x = x0; x < x1; x++)
+					m_maxCount = std::max(m_maxCount, double(row[x - x0]));
+			}
+
+			if (m_levels.empty())
+				return;
+			Level& level = m_levels[0];
+			for (size_t y = y0; y < y1; y += 2)
+			{
+				const auto* row = origin + (y - y0) * stride;
+				const auto* nextRow = y + 1 < y1 ? row + stride : nullptr;
+				for (size_t x = x0; x < x1; x += 2)
+				{
+					double sum = double(row[x - x0]);
+					if (x + 1 < x1)
+						sum += double(row[x + 1 - x0]);
+					if (nextRow)
+					{
+						sum += double(nextRow[x - x0]);
+						if (x + 1 < x1)
+							sum += double(nextRow[x + 1 - x0]);
+					}
+					level.counts[(y / 2) * level.nCols + x / 2] = float(sum);
+					level.maxCount = std::max(level.maxCount, sum);
+				}
+			}
+		});
+	}
+
+	//Re-sum the cells [xBegin, xEnd) x [yBegin, yEnd) of a level (>= 2) from the level below it
+	void HeatmapPyramid::SumRegion(size_t level, size_t xBegin, size_t xEnd, size_t yBegin, size_t yEnd)
+	{
+		const Level& below = m_levels[level - 2];
+		Level& current = m_levels[level - 1];
+		xEnd = std::min(xEnd, current.nCols);
+		yEnd = std::min(yEnd, current.nRows);
+		for (size_t y = yBegin; y < yEnd; y++)
+		{
+			for (size_t x = xBegin; x < xEnd; x++)
+			{
+				size_t bx = 2 * x;
+				size_t by = 2 * y;
+				double sum = below.counts[by * below.nCols + bx];
+				if (bx + 1 < below.nCols)
+					sum += below.counts[by * below.nCols + bx + 1];
+				if (by + 1 < below.nRows)
+				{
+					sum += below.counts[(by + 1) * below.nCols + bx];
+					if (bx + 1 < below.nCols)
+						sum += below.counts[(by + 1) * below.nCols + bx + 1];
+				}
+				current.counts[y * current.nCols + x] = float(sum);
+				current.maxCount = std::max(current.maxCount, sum);
+			}
+		}
+	}
+
+	//Copy the cells [xBegin, xEnd) x [yBegin, yEnd) of a level into m_window, row by row
+	void HeatmapPyramid::CopyWindow(const BinSnapshot& snapshot, size_t level, size_t xBegin, size_t xEnd, size_t yBegin, size_t yEnd)
+	{
+		size_t nCols = xEnd - xBegin;
+		m_window.resize(nCols * (yEnd - yBegin));
+		float* out = m_window.data();
+		if (level > 0)
+		{
+			const Level& source = m_levels[level - 1];
+			for (size_t y = yBegin; y < yEnd; y++, out += nCols)
+				std::copy_n(source.counts.data() + y * source.nCols + xBegin, nCols, out);
+			return;
+		}
+
+		snapshot.bins.Visit([&](const auto* bins)
+		{
+			for (size_t y = yBegin; y < yEnd; y++, out += nCols)
+			{
+				if (!snapshot.isTiled)
+				{
+					const auto* row = bins + y * m_nCols;
+					for (size_t x = xBegin; x < xEnd; x++)
+						out[x - xBegin] = float(row[x]);
+					continue;
+				}
+
+				size_t tileRow = (y >> BinStorage::s_tileShift) * m_tilesX;
+				size_t binRow = (y & BinStorage::s_tileMask) << BinStorage::s_tileShift;
+				for (size_t x = xBegin; x < xEnd; x++)
+				{
+					int32_t slot = m_tileSlots[tileRow + (x >> BinStorage::s_tileShift)];
+					out[x - xBegin] = slot < 0 ? 0.0f : float(bins[size_t(slot) * BinStorage::s_tileBins + binRow + (x & BinStorage::s_tileMask)]);
+				}
+			}
+		});
+	}
+
+	void HeatmapPyramid::Draw(const std::string& name, const BinSnapshot& snapshot, double minX, double maxX, double minY, double maxY, float scaleMin, float scaleMax)
+	{
+		SPEC_PROFILE_FUNCTION();
+		Update(snapshot);
+		if (m_nCols == 0 || m_nRows == 0)
+			return;
+
+		double binWidthX = (maxX - minX) / m_nCols;
+		double binWidthY = (maxY - minY) / m_nRows;
+		ImPlotRect limits = ImPlot::GetPlotLimits();
+		ImVec2 plotSize = ImPlot::GetPlotSize();
+
+		//Visible bins, rows counted from the top
+		auto clampBin = [](double bin, size_t nBins) { return size_t(std::clamp(bin, 0.0, double(nBins))); };
+		size_t xBegin = clampBin(std::floor((limits.X.Min - minX) / binWidthX), m_nCols);
+		size_t xEnd = clampBin(std::ceil((limits.X.Max - minX) / binWidthX), m_nCols);
+		size_t yBegin = clampBin(std::floor((maxY - limits.Y.Max) / binWidthY), m_nRows);
+		size_t yEnd = clampBin(std::ceil((maxY - limits.Y.Min) / binWidthY), m_nRows);
+
+		//Coarsest level which keeps at least one cell per pixel along both axes
+		double binsPerPixel = std::min(double(xEnd - xBegin) / std::max(plotSize.x, 1.0f), double(yEnd - yBegin) / std::max(plotSize.y, 1.0f));
+		size_t level = 0;
+		while (level < m_levels.size() && binsPerPixel >= 2.0)
+		{
+			binsPerPixel *= 0.5;
+			level++;
+		}
+
+		double levelMax = level == 0 ? m_maxCount : m_levels[level - 1].maxCount;
+		double binsPerCell = double(size_t(1) << (2 * level));
+		double colorMin = scaleMin * binsPerCell;
+		double colorMax = scaleMax * binsPerCell;
+		if (scaleMin == 0.0f && scaleMax == 0.0f)
+			colorMax = levelMax > 0.0 ? levelMax : 1.0;
+
+		//Empty background over the full range: gives the plot its extent (for fitting) and the color of unfilled bins
+		static const float s_emptyCell = 0.0f;
+		ImPlot::PlotHeatmap(name.c_str(), &s_emptyCell, 1, 1, colorMin, colorMax, NULL, ImPlotPoint(minX, minY), ImPlotPoint(maxX, maxY));
+		if (xBegin >= xEnd || yBegin >= yEnd)
+			return;
+
+		size_t round = (size_t(1) << level) - 1;
+		size_t levelCols = level == 0 ? m_nCols : m_levels[level - 1].nCols;
+		size_t levelRows = level == 0 ? m_nRows : m_levels[level - 1].nRows;
+		size_t cellXBegin = xBegin >> level;
+		size_t cellXEnd = std::min((xEnd + round) >> level, levelCols);
+		size_t cellYBegin = yBegin >> level;
+		size_t cellYEnd = std::min((yEnd + round) >> level, levelRows);
+		CopyWindow(snapshot, level, cellXBegin, cellXEnd, cellYBegin, cellYEnd);
+
+		//Cells keep their full size, so a partial cell at the upper edge of a level overhangs the histogram range by less than a cell
+		double cellWidthX = binWidthX * double(size_t(1) << level);
+		double cellWidthY = binWidthY * double(size_t(1) << level);
+		ImPlot::PlotHeatmap(name.c_str(), m_window.data(), int(cellYEnd - cellYBegin), int(cellXEnd - cellXBegin), colorMin, colorMax, NULL,
+							ImPlotPoint(minX + cellWidthX * cellXBegin, maxY - cellWidthY * cellYEnd), ImPlotPoint(minX + cellWidthX * cellXEnd, maxY - cellWidthY * cellYBegin));
+	}
+}
@@ -0,0 +1,67 @@
+/*
+	HeatmapPyramid.h
+	Multi-resolution view of a 2D histogram for drawing. A 4096x4096 histogram has 16M bins, but a plot is only ever a few hundred to a couple of thousand pixels
+	wide, so handing every bin to ImPlot each frame is mostly wasted work. The pyramid keeps downsampled copies of the bins (levels): level k sums 2^k x 2^k
+	bins into one cell, down to s_minLevelSize cells on a side. Level 0 is the snapshot itself and is not copied.
+
+	Draw picks the coarsest level which still has at least one cell per pixel over the visible range of the axes, and hands ImPlot only the visible window of
+	that level. Zoomed in views thus use the full resolution bins, but only the ones on screen.
+
+	The levels are updated from the dirty tiles of each new snapshot (see BinStorage), so a frame in which a few tiles were filled only re-sums those tiles.
+	If a snapshot was missed (versions not consecutive) or the snapshot says every bin changed, the levels are rebuilt. This relies on counts only changing
+	through Increment2D between such full updates.
+
+	Summed levels have larger counts than the bins. A user color scale is given per bin, so it is multiplied by the bins per cell of the level drawn.
+	The default scale is (0, largest cell of the level drawn).
+
+	UI thread only.
+*/
+#ifndef HEATMAP_PYRAMID_H
+#define HEATMAP_PYRAMID_H
+
+#include "BinStorage.h"
+
+namespace Specter {
+
+	class HeatmapPyramid
+	{
+	public:
+		HeatmapPyramid();
+
+		void Update(const BinSnapshot& snapshot);
+		//Must be called within an ImPlot plot, after the axes are setup. Range is the range of the histogram axes, rows count down from maxY
+		void Draw(const std::string& name, const BinSnapshot& snapshot, double minX, double maxX, double minY, double maxY, float scaleMin, float scaleMax);
+
+		size_t GetNumberOfLevels() const { return m_levels.size() + 1; }
+		size_t GetMemorySize() const;
+
+		static size_t EstimateMemorySize(size_t nCols, size_t nRows);
+
+		static constexpr size_t s_minLevelSize = 64; //No level is built below this many cells on a side
+
+	private:
+		struct Level
+		{
+			size_t nCols = 0;
+			size_t nRows = 0;
+			std::vector<float> counts;
+			double maxCount = 0.0;
+		};
+
+		void Rebuild(const BinSnapshot& snapshot);
+		void SumTile(const BinSnapshot& snapshot, size_t tile);
+		void SumRegion(size_t level, size_t xBegin, size_t xEnd, size_t yBegin, size_t yEnd);
+		void CopyWindow(const BinSnapshot& snapshot, size_t level, size_t xBegin, size_t xEnd, size_t yBegin, size_t yEnd);
+
+		std::vector<Level> m_levels; //m_levels[k - 1] is level k
+		size_t m_nCols;
+		size_t m_nRows;
+		size_t m_tilesX;
+		double m_maxCount; //Largest bin of level 0
+		uint64_t m_version; //Version of the last snapshot used
+		std::vector<int32_t> m_tileSlots; //Tiled snapshots only: slot of each tile in the snapshot, or -1
+		std::vector<float> m_window; //Visible cells of the level being drawn
+	};
+}
+
+#endif
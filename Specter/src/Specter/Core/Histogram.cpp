@@ -17,8 +17,13 @@
 
 	StatResults is a struct containing statistical information about a region of a histogram.
 
+	A Histogram2D with a very large number of bins uses tiled (sparse) storage, see BinStorage. This is transparent to the rest of the application: Draw only
+	renders the allocated tiles, and AnalyzeRegion only walks them.
+
 	A HistogramSummary is a 2D display of many 1D histograms. That is, a summary back-links to other Histogram1D's already created. It is important to note that the linked sub-histograms should all have the same binning.
 
+	A HistogramND is an N parameter histogram in sparse, blocked storage, drawn as a (gated) 1D or 2D projection. See Histogram.h.
+
 	GWM -- Feb 2022
 */
 #include "Histogram.h"
@@ -31,6 +36,16 @@
 
 namespace Specter {
 
+	//Mean and sigma along one axis from the region sums of n, n*v and n*v^2. Sigma uses n - 1, as the bin by bin sums do
+	static void GetAxisStats(double n, double sum, double sumSquares, double& mean, double& sigma)
+	{
+		mean = sum / n;
+		double deviations = sumSquares - sum * mean; //sum of n * (v - mean)^2
+		if (deviations < 1.0e-12 * sumSquares) //cancellation noise, i.e. all counts in one bin
+			deviations = 0.0;
+		sigma = std::sqrt(deviations / (n - 1));
+	}
+
 	std::string ConvertSpectrumTypeToString(SpectrumType type)
 	{
 		SPEC_PROFILE_FUNCTION();
@@ -39,6 +54,7 @@ namespace Specter {
 		case SpectrumType::Histo1D: return "Histogram1D";
 		case SpectrumType::Histo2D: return "Histogram2D";
 		case SpectrumType::Summary: return "Summary";
+		case SpectrumType::HistoND: return "HistogramND";
 		case SpectrumType::None: return "None";
 		}
 		return "None";
@@ -52,10 +68,184 @@ namespace Specter {
 			return SpectrumType::Histo2D;
 		else if (keyword == "Summary")
 			return SpectrumType::Summary;
+		else if (keyword == "HistogramND")
+			return SpectrumType::HistoND;
 		else
 			return SpectrumType::None;
 	}
 
+	//Tiles of a sparse Histogram2D (HistogramArgs::maxBinMemory), at least one. 0 if not sparse
+	static size_t GetTileLimit(const HistogramArgs& params, BinCountType countType)
+	{
+		if (params.maxBinMemory == 0)
+			return 0;
+		return std::max(size_t(1), size_t(params.maxBinMemory / (BinStorage::s_tileBins * GetBinCountSize(countType))));
+	}
+
+	//Memory a histogram with these args can grow to: the counts, the two snapshot buffers and everything derived from the counts (rolling window slices,
+	//region table, heatmap levels, draw buffers). Sharded storage adds a copy of the counts per filling thread, which is not included. HistogramND only
+	//allocates what is filled and is not estimated. params.type must be set, and for a summary nbins_y must be the number of sub-histograms.
+	size_t EstimateHistogramMemorySize(const HistogramArgs& params)
+	{
+		BinCountType countType = params.countType;
+		if (params.windowMode == TimeWindowMode::Decaying && (countType == BinCountType::UInt32 || countType == BinCountType::UInt64))
+			countType = BinCountType::Double; //See Histogram::ValidateTimeWindowCountType
+		size_t countSize = GetBinCountSize(countType);
+		size_t nSlices = params.windowMode == TimeWindowMode::Rolling ? size_t(std::max(params.windowSlices, 0)) : 0;
+		switch (params.type)
+		{
+			case SpectrumType::Histo1D:
+			{
+				Binning binning;
+				if (!binning.Init(params.binning_x, params.nbins_x, params.min_x, params.max_x, params.edges_x, params.segmentBins_x))
+					return 0;
+				size_t nBins = binning.GetNBins();
+				return nBins * countSize * (3 + nSlices) + nBins * 2 * sizeof(double) + RegionTable::EstimateMemorySize(nBins, 1);
+			}
+			case SpectrumType::Histo2D:
+			case SpectrumType::Summary:
+			{
+				if (params.nbins_x <= 0 || params.nbins_y <= 0)
+					return 0;
+				size_t nCols = params.nbins_x;
+				size_t nRows = params.nbins_y;
+				size_t size = HeatmapPyramid::EstimateMemorySize(nCols, nRows);
+				size_t maxTiles = params.type == SpectrumType::Histo2D ? GetTileLimit(params, countType) : 0;
+				if (maxTiles == 0 && nCols * nRows <= BinStorage::s_tiledBinThreshold)
+				{
+					if (params.type == SpectrumType::Histo2D)
+						size += RegionTable::EstimateMemorySize(nCols, nRows);
+					return size + nCols * nRows * countSize * (3 + nSlices);
+				}
+
+				//Tiled: bookkeeping per tile, a region table of at most one corner per tile, and the tiles themselves. No rolling window
+				size_t nTiles = ((nCols + BinStorage::s_tileMask) >> BinStorage::s_tileShift) * ((nRows + BinStorage::s_tileMask) >> BinStorage::s_tileShift);
+				size += nTiles * (3 * sizeof(uint32_t) + 1);
+				if (params.type == SpectrumType::Histo2D)
+					size += RegionTable::EstimateMemorySize(nCols, nRows, true);
+				if (maxTiles != 0)
+					nTiles = std::min(nTiles, maxTiles);
+				return size + nTiles * BinStorage::s_tileBins * countSize * 3;
+			}
+			case SpectrumType::HistoND: return 0;
+			case SpectrumType::None: return 0;
+		}
+		return 0;
+	}
+
+	/*
+		Histogram base class
+	*/
+
+	//Publish a snapshot of the bins for drawing. Only done if the UI asked for one (or ignoreRequest) and the bins changed since the last snapshot.
+	//Called by the SpectrumManager with the manager lock held
+	void Histogram::UpdateSnapshot(bool ignoreRequest)
+	{
+		if (!ignoreRequest && !m_isSnapshotRequested.load(std::memory_order_relaxed))
+			return;
+		m_isSnapshotRequested.store(false, std::memory_order_relaxed);
+		if (!ConsumeSnapshotChanges())
+			return;
+
+		SPEC_PROFILE_FUNCTION();
+		std::shared_ptr<BinSnapshot> buffer;
+		{
+			std::scoped_lock<std::mutex> guard(m_snapshotMutex);
+			buffer = std::move(m_snapshotBackBuffer);
+		}
+		//If a reader is still drawing from the old buffer we can't reuse it
+		if (buffer == nullptr || buffer.use_count() != 1)
+			buffer = std::make_shared<BinSnapshot>();
+		std::atomic_thread_fence(std::memory_order_acquire);
+
+		CopySnapshot(*buffer);
+
+		std::scoped_lock<std::mutex> guard(m_snapshotMutex);
+		m_snapshotBackBuffer = std::move(m_snapshot);
+		m_snapshot = std::move(buffer);
+	}
+
+	//Returns true if the snapshot is out of date. Histograms with a BinStorage don't need to override this or CopySnapshot
+	bool Histogram::ConsumeSnapshotChanges()
+	{
+		BinStorage* storage = GetBinStorage();
+		return storage != nullptr && storage->ConsumeModified(BinStorage::Consumer::Snapshot);
+	}
+
+	void Histogram::CopySnapshot(BinSnapshot& snapshot)
+	{
+		GetBinStorage()->CopySnapshot(snapshot);
+	}
+
+	std::shared_ptr<const BinSnapshot> Histogram::GetSnapshot()
+	{
+		std::scoped_lock<std::mutex> guard(m_snapshotMutex);
+		return m_snapshot;
+	}
+
+	//Dense copy of the counts, for saving. Must be called with the fill lock held. Returns false if the histogram has no BinStorage (HistogramND)
+	bool Histogram::CopyBins(BinBuffer& bins)
+	{
+		BinStorage* storage = GetBinStorage();
+		if (storage == nullptr)
+			return false;
+		bins = storage->GetBins();
+		return true;
+	}
+
+	//Replace the counts, for loading a saved file. Must be called with the fill lock held. Returns false if the type or size don't match
+	bool Histogram::RestoreBins(BinBuffer&& bins)
+	{
+		BinStorage* storage = GetBinStorage();
+		return storage != nullptr && storage->Load(std::move(bins));
+	}
+
+	//Bytes held by the counts and the snapshots. Must be called with the fill lock held. Histograms add whatever else they keep
+	size_t Histogram::GetMemorySize()
+	{
+		BinStorage* storage = GetBinStorage();
+		size_t size = storage == nullptr ? 0 : storage->GetMemorySize();
+		std::scoped_lock<std::mutex> guard(m_snapshotMutex);
+		for (const auto* snapshot : { m_snapshot.get(), m_snapshotBackBuffer.get() })
+		{
+			if (snapshot != nullptr)
+				size += snapshot->bins.GetMemorySize() + (snapshot->tiles.capacity() + snapshot->dirtyTiles.capacity()) * sizeof(uint32_t);
+		}
+		return size;
+	}
+
+	//Counts not stored because a sparse histogram reached its memory limit. Must be called with the fill lock held
+	uint64_t Histogram::GetDroppedCounts()
+	{
+		BinStorage* storage = GetBinStorage();
+		return storage == nullptr ? 0 : storage->GetDroppedCounts();
+	}
+
+	//Decaying counts are not integers, so decaying histograms always count in double. Call before the storage is sized
+	void Histogram::ValidateTimeWindowCountType()
+	{
+		if (m_params.windowMode == TimeWindowMode::Decaying && (m_params.countType == BinCountType::UInt32 || m_params.countType == BinCountType::UInt64))
+		{
+			SPEC_WARN("Histogram {0} has a decaying time window, which needs non-integer counts. Using Double counts instead of {1}.", m_params.name, ConvertBinCountTypeToString(m_params.countType));
+			m_params.countType = BinCountType::Double;
+		}
+	}
+
+	//Call once the storage is sized. If the window can't be made, the histogram accumulates as usual
+	void Histogram::InitTimeWindow(TimeWindow& window, const BinStorage& storage)
+	{
+		if (m_params.windowMode == TimeWindowMode::Rolling && storage.IsTiled())
+		{
+			SPEC_WARN("Histogram {0} is too large for a rolling time window ({1} bins). It will accumulate as usual.", m_params.name, storage.GetSize());
+			m_params.windowMode = TimeWindowMode::None;
+		}
+		if (!window.Init(m_params.windowMode, m_params.windowSeconds, m_params.windowSlices, storage.GetCountType(), storage.GetSize()))
+		{
+			SPEC_WARN("Histogram {0} has an illegal time window of {1} s with {2} slices. It will accumulate as usual.", m_params.name, m_params.windowSeconds, m_params.windowSlices);
+			m_params.windowMode = TimeWindowMode::None;
+		}
+	}
+
 	/*
 		1D Histogram class
 	*/
@@ -71,23 +261,23 @@ namespace Specter {
 	{
 		SPEC_PROFILE_FUNCTION();
 		m_params.type = SpectrumType::Histo1D;
-		if(m_params.nbins_x == 0 || (m_params.min_x >= m_params.max_x))
+		m_params.maxBinMemory = 0; //Only Histogram2D can be sparse
+		if(!m_binning.Init(m_params.binning_x, m_params.nbins_x, m_params.min_x, m_params.max_x, m_params.edges_x, m_params.segmentBins_x))
 		{
-			SPEC_WARN("Attempting to create an illegal Histogram1D {0} with {1} bins and a range from {2} to {3}. Historgram not initialized.", m_params.name, m_params.nbins_x, m_params.min_x, m_params.max_x);
+			SPEC_WARN("Attempting to create an illegal Histogram1D {0} with {1} binning, {2} bins and a range from {3} to {4}. Historgram not initialized.", m_params.name, ConvertBinningTypeToString(m_params.binning_x),
+					  m_params.nbins_x, m_params.min_x, m_params.max_x);
 			m_initFlag = false;
 			return;
 		}
 
-		m_binWidth = (m_params.max_x - m_params.min_x)/m_params.nbins_x;
+		//Edge based binnings define their own range
+		m_params.nbins_x = m_binning.GetNBins();
+		m_params.min_x = m_binning.GetMin();
+		m_params.max_x = m_binning.GetMax();
 
-		m_binCenters.resize(m_params.nbins_x);
-		m_binCounts.resize(m_params.nbins_x);
-
-		for(int i=0; i<m_params.nbins_x; i++)
-		{
-			m_binCenters[i] = m_params.min_x + i*m_binWidth + m_binWidth*0.5;
-			m_binCounts[i] = 0;
-		}
+		ValidateTimeWindowCountType();
+		m_binCounts.Resize(m_params.nbins_x, m_params.countType);
+		InitTimeWindow(m_window, m_binCounts);
 
 		m_initFlag = true;
 	}
@@ -96,24 +286,89 @@ namespace Specter {
 	void Histogram1D::FillData(double x, double y)
 	{
 		SPEC_PROFILE_FUNCTION();
-		if (x < m_params.min_x || x >= m_params.max_x)
+		Fill(x);
+	}
+
+	void Histogram1D::FillBatch(std::span<const double> values)
+	{
+		SPEC_PROFILE_FUNCTION();
+		if (!m_initFlag)
 			return;
-		int bin = int((x - m_params.min_x)/(m_binWidth));
-		m_binCounts[bin] += 1.0;
+
+		if (!m_binning.IsUniform())
+		{
+			for (double x : values)
+				Fill(x);
+			return;
+		}
+
+		UniformAxis axis = m_binning.GetUniformAxis();
+		int32_t bins[s_fillBatchSize];
+		for (size_t offset = 0; offset < values.size(); offset += s_fillBatchSize)
+		{
+			size_t count = std::min(s_fillBatchSize, values.size() - offset);
+			ComputeUniformBins(axis, values.data() + offset, count, bins);
+			m_binCounts.IncrementBatch(bins, count);
+			if (m_window.IsRolling())
+				m_window.IncrementBatch(bins, count);
+		}
 	}
 
 	//Can only be used within an ImGui / ImPlot context!!
 	void Histogram1D::Draw()
 	{
 		SPEC_PROFILE_FUNCTION();
+		RequestSnapshot();
+		std::shared_ptr<const BinSnapshot> snapshot = GetSnapshot();
+		if (snapshot == nullptr || !m_initFlag)
+			return;
 		ImPlot::SetupAxes(m_params.x_par.c_str(), "Counts",0, ImPlotAxisFlags_LockMin | ImPlotAxisFlags_AutoFit);
-		ImPlot::PlotBars(m_params.name.c_str(), &m_binCenters.data()[0], &m_binCounts.data()[0], m_params.nbins_x, m_binWidth);
+		if (!m_binning.IsUniform())
+		{
+			//Bars have a single width, so non-uniform bins are drawn as stairs over the edges. Stairs need one more point than there are bins.
+			snapshot->bins.ConvertToDoubles(m_drawCounts);
+			m_drawCounts.push_back(m_drawCounts.back());
+			ImPlot::PlotStairs(m_params.name.c_str(), m_binning.GetEdges().data(), m_drawCounts.data(), int(m_drawCounts.size()));
+			return;
+		}
+
+		//Made on first draw, as the rows of a linked HistogramSummary are never drawn
+		if (m_binCenters.empty())
+		{
+			m_binCenters.resize(m_params.nbins_x);
+			for (int i = 0; i < m_params.nbins_x; i++)
+				m_binCenters[i] = m_binning.GetBinCenter(i);
+		}
+
+		const double* counts = snapshot->bins.GetData<double>();
+		if (snapshot->bins.GetType() != BinCountType::Double)
+		{
+			snapshot->bins.ConvertToDoubles(m_drawCounts);
+			counts = m_drawCounts.data();
+		}
+		ImPlot::PlotBars(m_params.name.c_str(), &m_binCenters.data()[0], counts, m_params.nbins_x, m_binning.GetBinWidth(0));
+	}
+
+	//Restored counts go into the current slice of a rolling window, so that they expire like new data
+	bool Histogram1D::RestoreBins(BinBuffer&& bins)
+	{
+		if (!m_binCounts.Load(std::move(bins)))
+			return false;
+		if (m_window.IsRolling())
+			m_window.Restore(m_binCounts.GetBins());
+		return true;
+	}
+
+	//Also reads the draw buffers, so the UI thread must call this
+	size_t Histogram1D::GetMemorySize()
+	{
+		return Histogram::GetMemorySize() + m_regionTable.GetMemorySize() + m_window.GetMemorySize() + (m_binCenters.capacity() + m_drawCounts.capacity()) * sizeof(double);
 	}
 
 	void Histogram1D::ClearData()
 	{
-		for(int i=0; i<m_params.nbins_x; i++)
-			m_binCounts[i] = 0;
+		m_binCounts.Clear();
+		m_window.Clear();
 	}
 
 	//Again here yvalues can be ignored, only for compliance
@@ -127,25 +382,28 @@ namespace Specter {
 		if (x_min <= m_params.min_x)
 			bin_min = 0;
 		else
-			bin_min = int((x_min - m_params.min_x) / (m_binWidth));
+			bin_min = m_binning.FindBin(x_min);
 
 		if (x_max >= m_params.max_x)
 			bin_max = m_params.nbins_x - 1;
 		else
-			bin_max = int((x_max - m_params.min_x) / (m_binWidth));
+			bin_max = m_binning.FindBin(x_max);
 
-		for (int i = bin_min; i <= bin_max; i++)
-		{
-			results.integral += m_binCounts[i];
-			results.cent_x += m_binCounts[i] * (m_params.min_x + m_binWidth * i);
-		}
-		if (results.integral == 0)
+		if (bin_min < 0 || bin_min > bin_max) //region starts past the end of the histogram
 			return results;
 
-		results.cent_x /= results.integral;
-		for (int i = bin_min; i <= bin_max; i++)
-			results.sigma_x += m_binCounts[i] * ((m_params.min_x + m_binWidth * i) - results.cent_x) * ((m_params.min_x + m_binWidth * i) - results.cent_x);
-		results.sigma_x = std::sqrt(results.sigma_x / (results.integral - 1));
+		//Uniform binning: the table holds bin indices, low edge = min + width * index. Otherwise it holds the low edges themselves
+		m_regionTable.Update(m_binCounts, m_binning.IsUniform() ? std::vector<double>() : m_binning.GetEdges());
+		RegionSums sums = m_regionTable.Sum(m_binCounts, bin_min, bin_max + 1, 0, 1);
+		results.integral = sums.n;
+		if (results.integral == 0)
+			return results;
+		GetAxisStats(sums.n, sums.x, sums.xx, results.cent_x, results.sigma_x);
+		if (m_binning.IsUniform())
+		{
+			results.cent_x = m_params.min_x + m_binning.GetBinWidth(0) * results.cent_x;
+			results.sigma_x *= m_binning.GetBinWidth(0);
+		}
 		return results;
 	}
 
@@ -167,6 +425,7 @@ namespace Specter {
 	{
 		SPEC_PROFILE_FUNCTION();
 		m_params.type = SpectrumType::Histo2D;
+		m_params.binning_x = BinningType::Uniform; //Only Histogram1D supports non-uniform binning
 		if(m_params.nbins_x <= 0 || m_params.nbins_y <= 0 || m_params.min_x >= m_params.max_x || m_params.min_y >= m_params.max_y)
 		{
 			SPEC_WARN("Attempting to create illegal Histogram2D {0} with {1} x bins, {2} y bins, an x range of {3} to {4}, and a y range of {5} to {6}. Not initialized.", m_params.name, m_params.nbins_x, m_params.nbins_y,
@@ -180,10 +439,12 @@ namespace Specter {
 
 		m_nBinsTotal = m_params.nbins_x*m_params.nbins_y;
 
-		m_binCounts.resize(m_nBinsTotal);
-		for(int i=0; i<m_nBinsTotal; i++)
-			m_binCounts[i] = 0;
-		m_maxBinContent = 0;
+		m_binningX.Init(BinningType::Uniform, m_params.nbins_x, m_params.min_x, m_params.max_x);
+		m_binningY.Init(BinningType::Uniform, m_params.nbins_y, -m_params.max_y, -m_params.min_y);
+
+		ValidateTimeWindowCountType();
+		m_binCounts.Resize2D(m_params.nbins_x, m_params.nbins_y, m_params.countType, GetTileLimit(m_params, m_params.countType));
+		InitTimeWindow(m_window, m_binCounts);
 
 		m_initFlag = true;
 	}
@@ -191,15 +452,31 @@ namespace Specter {
 	void Histogram2D::FillData(double x, double y)
 	{
 		SPEC_PROFILE_FUNCTION();
-		if (x < m_params.min_x || x >= m_params.max_x || y <= m_params.min_y || y > m_params.max_y)
-			return;
-		int bin_x = int((x - m_params.min_x)/m_binWidthX);
-		int bin_y = int((m_params.max_y - y)/m_binWidthY);
-		int bin = bin_y*m_params.nbins_x + bin_x;
+		Fill(x, y);
+	}
 
-		m_binCounts[bin] += 1.0;
+	void Histogram2D::FillBatch(std::span<const double> xValues, std::span<const double> yValues)
+	{
+		SPEC_PROFILE_FUNCTION();
+		if (!m_initFlag)
+			return;
 
-		m_maxBinContent = m_binCounts[bin] > m_maxBinContent ? (m_binCounts[bin]) : m_maxBinContent;
+		UniformAxis xAxis = m_binningX.GetUniformAxis();
+		UniformAxis yAxis = m_binningY.GetUniformAxis();
+		int32_t xBins[s_fillBatchSize];
+		int32_t yBins[s_fillBatchSize];
+		size_t size = std::min(xValues.size(), yValues.size());
+		for (size_t offset = 0; offset < size; offset += s_fillBatchSize)
+		{
+			size_t count = std::min(s_fillBatchSize, size - offset);
+			ComputeUniformBins(xAxis, xValues.data() + offset, count, xBins);
+			ComputeUniformBins(yAxis, yValues.data() + offset, count, yBins, true);
+			for (size_t i = 0; i < count; i++)
+			{
+				if (xBins[i] >= 0 && yBins[i] >= 0)
+					FillBins(xBins[i], yBins[i]);
+			}
+		}
 	}
 
 	//Can only be used within an ImGui / ImPlot context!!
@@ -212,25 +489,147 @@ namespace Specter {
 	void Histogram2D::Draw()
 	{
 		SPEC_PROFILE_FUNCTION();
+		RequestSnapshot();
+		std::shared_ptr<const BinSnapshot> snapshot = GetSnapshot();
+		if (snapshot == nullptr)
+			return;
 		ImPlot::SetupAxes(m_params.x_par.c_str(), m_params.y_par.c_str());
 		ImPlot::PushColormap(ImPlotColormap_Viridis);
-		ImPlot::PlotHeatmap(m_params.name.c_str(), &m_binCounts.data()[0], m_params.nbins_y, m_params.nbins_x, m_colorScaleRange[0], m_colorScaleRange[1], NULL,
-							ImPlotPoint(m_params.min_x, m_params.min_y), ImPlotPoint(m_params.max_x, m_params.max_y));
+		m_pyramid.Draw(m_params.name, *snapshot, m_params.min_x, m_params.max_x, m_params.min_y, m_params.max_y, m_colorScaleRange[0], m_colorScaleRange[1]);
 		ImPlot::PopColormap();
 	}
 
+	bool Histogram2D::RestoreBins(BinBuffer&& bins)
+	{
+		if (!m_binCounts.Load(std::move(bins)))
+			return false;
+		if (m_window.IsRolling())
+			m_window.Restore(m_binCounts.GetBins());
+		return true;
+	}
+
+	//Also reads the heatmap pyramid, so the UI thread must call this
+	size_t Histogram2D::GetMemorySize()
+	{
+		return Histogram::GetMemorySize() + m_pyramid.GetMemorySize() + m_regionTable.GetMemorySize() + m_window.GetMemorySize();
+	}
+
 	void Histogram2D::ClearData()
 	{
-		for(int i=0; i<m_nBinsTotal; i++)
-			m_binCounts[i] = 0;
-		m_maxBinContent = 0;
+		m_binCounts.Clear();
+		m_window.Clear();
+		for (auto& projection : m_projections)
+			projection.histogram->ClearData();
+	}
+
+	//The args of a projection of this histogram, see CreateProjection. The binning always follows the parent's axis, whatever params asks for
+	HistogramArgs Histogram2D::GetProjectionArgs(const HistogramArgs& params) const
+	{
+		HistogramArgs args;
+		args.type = SpectrumType::Histo1D;
+		args.name = params.name;
+		args.parent = m_params.name;
+		args.isYProjection = params.isYProjection;
+		args.bandMin = params.bandMin;
+		args.bandMax = params.bandMax;
+		args.countType = m_params.countType;
+		args.windowMode = m_params.windowMode;
+		args.windowSeconds = m_params.windowSeconds;
+		args.windowSlices = m_params.windowSlices;
+		args.cutsDrawnUpon = params.cutsDrawnUpon;
+		args.x_par = params.isYProjection ? m_params.y_par : m_params.x_par;
+		args.nbins_x = params.isYProjection ? m_params.nbins_y : m_params.nbins_x;
+		args.min_x = params.isYProjection ? m_params.min_y : m_params.min_x;
+		args.max_x = params.isYProjection ? m_params.max_y : m_params.max_x;
+		return args;
+	}
+
+	//Make a projection of this histogram, seeded with the current counts. From then on it is filled along with this histogram.
+	//Must be called with the fill lock held. Returns nullptr if the projection is illegal.
+	std::shared_ptr<Histogram1D> Histogram2D::CreateProjection(const HistogramArgs& params)
+	{
+		SPEC_PROFILE_FUNCTION();
+		if (!m_initFlag)
+			return nullptr;
+
+		HistogramArgs args = GetProjectionArgs(params);
+
+		//Bands are clamped to the parent axis; a band entirely outside of it would never fill
+		double axisMin = params.isYProjection ? m_params.min_x : m_params.min_y;
+		double axisMax = params.isYProjection ? m_params.max_x : m_params.max_y;
+		if (params.bandMin < params.bandMax && (params.bandMax <= axisMin || params.bandMin >= axisMax))
+		{
+			SPEC_WARN("Cannot make projection {0} of {1}, band {2} to {3} is outside of the range {4} to {5}", params.name, m_params.name, params.bandMin, params.bandMax, axisMin, axisMax);
+			return nullptr;
+		}
+
+		ProjectionEntry entry;
+		entry.histogram = std::make_shared<Histogram1D>(args);
+		entry.isY = params.isYProjection;
+		if (entry.isY)
+		{
+			//Band in columns
+			entry.bandBegin = 0;
+			entry.bandEnd = m_params.nbins_x - 1;
+			if (params.bandMin < params.bandMax)
+			{
+				entry.bandBegin = std::clamp(int(std::floor((params.bandMin - m_params.min_x) / m_binWidthX)), 0, m_params.nbins_x - 1);
+				entry.bandEnd = std::clamp(int(std::floor((params.bandMax - m_params.min_x) / m_binWidthX)), 0, m_params.nbins_x - 1);
+			}
+		}
+		else
+		{
+			//Band in rows, counted from the top
+			entry.bandBegin = 0;
+			entry.bandEnd = m_params.nbins_y - 1;
+			if (params.bandMin < params.bandMax)
+			{
+				entry.bandBegin = std::clamp(int(std::floor((m_params.max_y - params.bandMax) / m_binWidthY)), 0, m_params.nbins_y - 1);
+				entry.bandEnd = std::clamp(int(std::floor((m_params.max_y - params.bandMin) / m_binWidthY)), 0, m_params.nbins_y - 1);
+			}
+		}
+
+		if (entry.isY)
+		{
+			m_binCounts.VisitRegion(entry.bandBegin, entry.bandEnd + 1, 0, m_params.nbins_y, [&](size_t x, size_t y, double count)
+			{
+				if (count != 0.0)
+					entry.histogram->AddToBin(m_params.nbins_y - 1 - int(y), count);
+			});
+		}
+		else
+		{
+			m_binCounts.VisitRegion(0, m_params.nbins_x, entry.bandBegin, entry.bandEnd + 1, [&](size_t x, size_t y, double count)
+			{
+				if (count != 0.0)
+					entry.histogram->AddToBin(int(x), count);
+			});
+		}
+
+		m_projections.push_back(entry);
+		return entry.histogram;
+	}
+
+	//Must be called with the fill lock held
+	void Histogram2D::RemoveProjection(const std::string& name)
+	{
+		auto iter = std::find_if(m_projections.begin(), m_projections.end(), [&name](const ProjectionEntry& entry) { return entry.histogram->GetName() == name; });
+		if (iter != m_projections.end())
+			m_projections.erase(iter);
+	}
+
+	std::vector<std::string> Histogram2D::GetProjections() const
+	{
+		std::vector<std::string> names;
+		for (auto& projection : m_projections)
+			names.push_back(projection.histogram->GetName());
+		return names;
 	}
 
 	StatResults Histogram2D::AnalyzeRegion(double x_min, double x_max, double y_min, double y_max)
 	{
 		SPEC_PROFILE_FUNCTION();
 		int xbin_min, xbin_max, ybin_min, ybin_max;
-		int curbin;
 
 		StatResults results;
 
@@ -255,35 +654,21 @@ namespace Specter {
 		else
 			ybin_min = int((m_params.max_y - y_max) / m_binWidthY);
 
-		for (int y = ybin_min; y <= ybin_max; y++)
-		{
-			for (int x = xbin_min; x <= xbin_max; x++)
-			{
-				curbin = y * m_params.nbins_x + x;
-				results.integral += m_binCounts[curbin];
-				results.cent_x += m_binCounts[curbin] * (m_params.min_x + m_binWidthX * x);
-				results.cent_y += m_binCounts[curbin] * (m_params.max_y - m_binWidthY * y);
-			}
-		}
+		if (xbin_min > xbin_max || ybin_min > ybin_max)
+			return results;
 
+		//The table holds bin indices, rows counted from the top
+		m_regionTable.Update(m_binCounts);
+		RegionSums sums = m_regionTable.Sum(m_binCounts, xbin_min, xbin_max + 1, ybin_min, ybin_max + 1);
+		results.integral = sums.n;
 		if (results.integral == 0)
 			return results;
-
-		results.cent_x /= results.integral;
-		results.cent_y /= results.integral;
-		for (int y = ybin_min; y <= ybin_max; y++)
-		{
-			for (int x = xbin_min; x <= xbin_max; x++)
-			{
-				curbin = y * m_params.nbins_x + x;
-				results.sigma_x += m_binCounts[curbin] * ((m_params.min_x + m_binWidthX * x) - results.cent_x) * ((m_params.min_x + m_binWidthX * x) - results.cent_x);
-				results.sigma_y += m_binCounts[curbin] * ((m_params.max_y - m_binWidthY * y) - results.cent_y) * ((m_params.max_y - m_binWidthY * y) - results.cent_y);
-			}
-		}
-
-		results.sigma_x = std::sqrt(results.sigma_x / (results.integral - 1));
-		results.sigma_y = std::sqrt(results.sigma_y / (results.integral - 1));
-		
+		GetAxisStats(sums.n, sums.x, sums.xx, results.cent_x, results.sigma_x);
+		GetAxisStats(sums.n, sums.y, sums.yy, results.cent_y, results.sigma_y);
+		results.cent_x = m_params.min_x + m_binWidthX * results.cent_x;
+		results.sigma_x *= m_binWidthX;
+		results.cent_y = m_params.max_y - m_binWidthY * results.cent_y;
+		results.sigma_y *= m_binWidthY;
 		return results;
 	}
 
@@ -299,12 +684,12 @@ namespace Specter {
 		-- Literally everything hahaha
 	*/
 
-	HistogramSummary::HistogramSummary(const HistogramArgs& params, const std::vector<std::string>& subhistos) :
-		Histogram(params), m_subhistos(subhistos), m_labels(nullptr)
+	HistogramSummary::HistogramSummary(const HistogramArgs& params, const std::vector<std::string>& subhistos, const std::vector<std::shared_ptr<Histogram1D>>& sharedRows) :
+		Histogram(params), m_subhistos(subhistos), m_labels(nullptr), m_snapshotVersion(0), m_isAllModified(true)
 	{
 		m_colorScaleRange[0] = 0.0f;
 		m_colorScaleRange[1] = 0.0f;
-		InitBins();
+		InitBins(sharedRows);
 	}
 
 	HistogramSummary::~HistogramSummary()
@@ -313,10 +698,13 @@ namespace Specter {
 			delete[] m_labels;
 	}
 
-	void HistogramSummary::InitBins()
+	void HistogramSummary::InitBins(const std::vector<std::shared_ptr<Histogram1D>>& sharedRows)
 	{
 		SPEC_PROFILE_FUNCTION();
 		m_params.type = SpectrumType::Summary;
+		m_params.binning_x = BinningType::Uniform; //Only Histogram1D supports non-uniform binning
+		m_params.windowMode = TimeWindowMode::None; //Only Histogram1D/2D have time windows
+		m_params.maxBinMemory = 0; //Only Histogram2D can be sparse
 		if (m_params.nbins_x <= 0 || m_params.min_x >= m_params.max_x)
 		{
 			SPEC_WARN("Attempting to create illegal HistogramSummary {0} with {1} x bins and an x range of {2} to {3}. Not initialized.", m_params.name, m_params.nbins_x, m_params.min_x, m_params.max_x);
@@ -335,81 +723,629 @@ namespace Specter {
 
 		m_nBinsTotal = m_params.nbins_x * m_params.nbins_y;
 
-		m_binCounts.resize(m_nBinsTotal);
-		for (int i = 0; i < m_nBinsTotal; i++)
-			m_binCounts[i] = 0;
+		if (!m_params.isLinkedSummary)
+		{
+			m_binCounts.Resize2D(m_params.nbins_x, m_params.nbins_y, m_params.countType);
+			m_initFlag = true;
+			return;
+		}
+
+		m_rows.resize(m_subhistos.size());
+		m_isRowModified.assign(m_subhistos.size(), false);
+		for (size_t i = 0; i < m_subhistos.size(); i++)
+		{
+			if (i < sharedRows.size() && sharedRows[i] != nullptr && CanShareRow(m_params, m_subhistos[i], sharedRows[i]->GetParameters()))
+			{
+				m_rows[i].histogram = sharedRows[i];
+				m_rows[i].isShared = true;
+				continue;
+			}
+			HistogramArgs rowArgs(m_params.name + ":" + m_subhistos[i], m_subhistos[i], m_params.nbins_x, m_params.min_x, m_params.max_x);
+			rowArgs.countType = m_params.countType;
+			m_rows[i].histogram = std::make_shared<Histogram1D>(rowArgs);
+		}
 
 		m_initFlag = true;
 	}
 
+	//A row can be shared if the histogram bins the sub-histogram's parameter exactly like the summary, and counts exactly what the summary would (same cuts)
+	bool HistogramSummary::CanShareRow(const HistogramArgs& params, const std::string& subhisto, const HistogramArgs& row)
+	{
+		return row.type == SpectrumType::Histo1D && row.parent == "None" && row.x_par == subhisto && row.binning_x == BinningType::Uniform &&
+			row.nbins_x == params.nbins_x && row.min_x == params.min_x && row.max_x == params.max_x && row.countType == params.countType &&
+			row.windowMode == TimeWindowMode::None && row.cutsAppliedTo == params.cutsAppliedTo;
+	}
+
+	bool HistogramSummary::IsRowShared(const Histogram* histogram) const
+	{
+		return std::any_of(m_rows.begin(), m_rows.end(), [histogram](const Row& row) { return row.isShared && row.histogram.get() == histogram; });
+	}
+
+	//The histogram is no longer filled by the SpectrumManager. Its counts stay in the row, which is filled by the summary from now on
+	void HistogramSummary::DetachRow(const Histogram* histogram)
+	{
+		for (auto& row : m_rows)
+		{
+			if (row.histogram.get() == histogram)
+				row.isShared = false;
+		}
+	}
+
+	//After the cuts of the summary or of a shared histogram changed: a shared row which no longer counts what the summary would (see CanShareRow) is
+	//replaced by a private copy of its counts, which the summary fills from now on. The histogram keeps its own counts. Must be called with the fill lock held
+	void HistogramSummary::UnshareRows()
+	{
+		for (size_t i = 0; i < m_rows.size(); i++)
+		{
+			if (!m_rows[i].isShared || CanShareRow(m_params, m_subhistos[i], m_rows[i].histogram->GetParameters()))
+				continue;
+			HistogramArgs rowArgs(m_params.name + ":" + m_subhistos[i], m_subhistos[i], m_params.nbins_x, m_params.min_x, m_params.max_x);
+			rowArgs.countType = m_params.countType;
+			auto row = std::make_shared<Histogram1D>(rowArgs);
+			BinBuffer bins;
+			if (m_rows[i].histogram->CopyBins(bins))
+				row->RestoreBins(std::move(bins));
+			row->SetShardedStorage(m_binCounts.IsSharded());
+			m_rows[i].histogram = row;
+			m_rows[i].isShared = false;
+		}
+	}
+
 	void HistogramSummary::FillData(double x, double y)
 	{
 		SPEC_PROFILE_FUNCTION();
-		if (x < m_params.min_x || x >= m_params.max_x || y <= m_params.min_y || y > m_params.max_y)
+		if (!m_params.isLinkedSummary)
+		{
+			Fill(x, y);
 			return;
-		int bin_x = int((x - m_params.min_x) / m_binWidthX);
-		int bin_y = int((m_params.max_y - y) / m_binWidthY);
-		int bin = bin_y * m_params.nbins_x + bin_x;
-
-		m_binCounts[bin] += 1.0;
+		}
+		if (y >= m_params.min_y && y < m_params.max_y)
+			m_rows[size_t(y - m_params.min_y)].histogram->Fill(x);
 	}
 
 	void HistogramSummary::Draw()
 	{
 		SPEC_PROFILE_FUNCTION();
+		RequestSnapshot();
+		std::shared_ptr<const BinSnapshot> snapshot = GetSnapshot();
+		if (snapshot == nullptr)
+			return;
 		ImPlot::SetupAxisTicks(ImAxis_Y1, m_params.min_y, m_params.max_y, m_params.nbins_y, m_labels, false);
 		ImPlot::PushColormap(ImPlotColormap_Viridis);
-		ImPlot::PlotHeatmap(m_params.name.c_str(), &m_binCounts.data()[0], m_params.nbins_y, m_params.nbins_x, m_colorScaleRange[0], m_colorScaleRange[1], NULL,
-			ImPlotPoint(m_params.min_x, m_params.min_y), ImPlotPoint(m_params.max_x, m_params.max_y));
+		m_pyramid.Draw(m_params.name, *snapshot, m_params.min_x, m_params.max_x, m_params.min_y, m_params.max_y, m_colorScaleRange[0], m_colorScaleRange[1]);
 		ImPlot::PopColormap();
 	}
 
+	//Shared rows belong to their histogram, and are only cleared with it
 	void HistogramSummary::ClearData()
 	{
-		for (int i = 0; i < m_nBinsTotal; i++)
-			m_binCounts[i] = 0;
+		m_binCounts.Clear();
+		for (auto& row : m_rows)
+		{
+			if (!row.isShared)
+				row.histogram->ClearData();
+		}
+	}
+
+	void HistogramSummary::SetShardedStorage(bool sharded)
+	{
+		m_binCounts.SetSharded(sharded);
+		for (auto& row : m_rows)
+		{
+			if (!row.isShared)
+				row.histogram->SetShardedStorage(sharded);
+		}
+	}
+
+	bool HistogramSummary::CopyBins(BinBuffer& bins)
+	{
+		bins = GetSummaryBins();
+		return true;
+	}
+
+	//A linked summary restores every row, shared or not, so that it matches the file even if the shared histogram was not saved with it
+	bool HistogramSummary::RestoreBins(BinBuffer&& bins)
+	{
+		if (!m_params.isLinkedSummary)
+			return Histogram::RestoreBins(std::move(bins));
+		if (bins.GetType() != m_params.countType || bins.GetSize() != size_t(m_nBinsTotal))
+			return false;
+
+		size_t nCols = m_params.nbins_x;
+		bool isRestored = true;
+		for (size_t i = 0; i < m_rows.size(); i++)
+		{
+			BinBuffer rowBins;
+			rowBins.Assign(bins.GetType(), nCols);
+			bins.Visit([&](const auto* counts)
+			{
+				using CountType = std::remove_const_t<std::remove_pointer_t<decltype(counts)>>;
+				const CountType* row = counts + (m_rows.size() - 1 - i) * nCols;
+				std::copy(row, row + nCols, rowBins.GetData<CountType>());
+			});
+			isRestored &= m_rows[i].histogram->RestoreBins(std::move(rowBins));
+		}
+		return isRestored;
+	}
+
+	//Also reads the heatmap pyramid, so the UI thread must call this. Shared rows are counted by their histogram
+	size_t HistogramSummary::GetMemorySize()
+	{
+		size_t size = Histogram::GetMemorySize() + m_pyramid.GetMemorySize() + m_rowBins.GetMemorySize();
+		for (auto& row : m_rows)
+		{
+			if (!row.isShared)
+				size += row.histogram->GetMemorySize();
+		}
+		return size;
+	}
+
+	//Consumes the changes of every row, so that the snapshot knows which rows to mark dirty
+	bool HistogramSummary::ConsumeSnapshotChanges()
+	{
+		if (!m_params.isLinkedSummary)
+			return Histogram::ConsumeSnapshotChanges();
+
+		bool isModified = m_isAllModified;
+		for (size_t i = 0; i < m_rows.size(); i++)
+		{
+			m_isRowModified[i] = m_rows[i].histogram->m_binCounts.ConsumeModified(BinStorage::Consumer::Summary);
+			isModified |= m_isRowModified[i];
+		}
+		return isModified;
+	}
+
+	//The whole summary is copied, as the snapshot buffer is recycled from two versions back, but only the tiles of modified rows are marked dirty
+	void HistogramSummary::CopySnapshot(BinSnapshot& snapshot)
+	{
+		if (!m_params.isLinkedSummary)
+		{
+			Histogram::CopySnapshot(snapshot);
+			return;
+		}
+
+		CopyRows(snapshot.bins);
+		snapshot.isTiled = false;
+		snapshot.tiles.clear();
+		snapshot.nCols = m_params.nbins_x;
+		snapshot.nRows = m_params.nbins_y;
+		snapshot.maxCount = 0.0;
+		snapshot.version = ++m_snapshotVersion;
+		snapshot.isAllDirty = m_isAllModified;
+		snapshot.dirtyTiles.clear();
+		m_isAllModified = false;
+		if (snapshot.isAllDirty)
+			return;
+
+		size_t tilesX = (snapshot.nCols + BinStorage::s_tileMask) >> BinStorage::s_tileShift;
+		size_t lastTileY = ~size_t(0);
+		for (size_t i = m_rows.size(); i-- > 0;) //Rows of the snapshot count down from the last sub-histogram, so tile rows come in order
+		{
+			size_t tileY = (m_rows.size() - 1 - i) >> BinStorage::s_tileShift;
+			if (!m_isRowModified[i] || tileY == lastTileY)
+				continue;
+			lastTileY = tileY;
+			for (size_t tileX = 0; tileX < tilesX; tileX++)
+				snapshot.dirtyTiles.push_back(uint32_t(tileY * tilesX + tileX));
+		}
+	}
+
+	//The counts as a nbins_x x nbins_y matrix, first row at max_y. Fill lock
+	const BinBuffer& HistogramSummary::GetSummaryBins()
+	{
+		if (!m_params.isLinkedSummary)
+			return m_binCounts.GetBins();
+		CopyRows(m_rowBins);
+		return m_rowBins;
+	}
+
+	//Rows always have the count type of the summary (see CanShareRow)
+	void HistogramSummary::CopyRows(BinBuffer& bins)
+	{
+		size_t nCols = m_params.nbins_x;
+		bins.Assign(m_params.countType, nCols * m_rows.size());
+		bins.Visit([&](auto* counts)
+		{
+			using CountType = std::remove_pointer_t<decltype(counts)>;
+			for (size_t i = 0; i < m_rows.size(); i++)
+			{
+				const CountType* row = m_rows[i].histogram->m_binCounts.GetBins().template GetData<CountType>();
+				std::copy(row, row + nCols, counts + (m_rows.size() - 1 - i) * nCols);
+			}
+		});
 	}
 
 	StatResults HistogramSummary::AnalyzeRegion(double x_min, double x_max, double y_min, double y_max)
 	{
 		SPEC_PROFILE_FUNCTION();
-		int xbin_min, xbin_max, ybin_min, ybin_max;
-		int curbin;
+		return GetSummaryBins().Visit([&](const auto* binCounts)
+		{
+			int xbin_min, xbin_max, ybin_min, ybin_max;
+			int curbin;
 
-		StatResults results;
+			StatResults results;
 
-		//We clamp to the boundaries of the histogram
-		if (x_min <= m_params.min_x)
-			xbin_min = 0;
-		else
-			xbin_min = int((x_min - m_params.min_x) / (m_binWidthX));
+			//We clamp to the boundaries of the histogram
+			if (x_min <= m_params.min_x)
+				xbin_min = 0;
+			else
+				xbin_min = int((x_min - m_params.min_x) / (m_binWidthX));
 
-		if (x_max >= m_params.max_x)
-			xbin_max = m_params.nbins_x - 1;
-		else
-			xbin_max = int((x_max - m_params.min_x) / (m_binWidthX));
+			if (x_max >= m_params.max_x)
+				xbin_max = m_params.nbins_x - 1;
+			else
+				xbin_max = int((x_max - m_params.min_x) / (m_binWidthX));
 
-		if (y_min <= m_params.min_y)
-			ybin_max = m_params.nbins_y - 1;
-		else
-			ybin_max = int((m_params.max_y - y_min) / m_binWidthY);
+			if (y_min <= m_params.min_y)
+				ybin_max = m_params.nbins_y - 1;
+			else
+				ybin_max = int((m_params.max_y - y_min) / m_binWidthY);
 
-		if (y_max >= m_params.max_y)
-			ybin_min = 0;
-		else
-			ybin_min = int((m_params.max_y - y_max) / m_binWidthY);
+			if (y_max >= m_params.max_y)
+				ybin_min = 0;
+			else
+				ybin_min = int((m_params.max_y - y_max) / m_binWidthY);
+
+			for (int y = ybin_min; y <= ybin_max; y++)
+			{
+				for (int x = xbin_min; x <= xbin_max; x++)
+				{
+					curbin = y * m_params.nbins_x + x;
+					results.integral += binCounts[curbin];
+					results.cent_x += binCounts[curbin] * (m_params.min_x + m_binWidthX * x);
+					results.cent_y += binCounts[curbin] * (m_params.max_y - m_binWidthY * y);
+				}
+			}
+
+			if (results.integral == 0)
+				return results;
+
+			results.cent_x /= results.integral;
+			results.cent_y /= results.integral;
+			for (int y = ybin_min; y <= ybin_max; y++)
+			{
+				for (int x = xbin_min; x <= xbin_max; x++)
+				{
+					curbin = y * m_params.nbins_x + x;
+					results.sigma_x += binCounts[curbin] * ((m_params.min_x + m_binWidthX * x) - results.cent_x) * ((m_params.min_x + m_binWidthX * x) - results.cent_x);
+					results.sigma_y += binCounts[curbin] * ((m_params.max_y - m_binWidthY * y) - results.cent_y) * ((m_params.max_y - m_binWidthY * y) - results.cent_y);
+				}
+			}
+
+			results.sigma_x = std::sqrt(results.sigma_x / (results.integral - 1));
+			results.sigma_y = std::sqrt(results.sigma_y / (results.integral - 1));
+
+			return results;
+		});
+	}
+
+	/*
+		N-dimensional Histogram class
+		Bins are grouped in blocks of 2^blockShift bins per axis side. Within a block, axis i takes bits [i * blockShift, (i+1) * blockShift) of the offset.
+		Projections follow the Histogram1D/2D layouts, so for 2D the first row is the largest y bin.
+	*/
+	HistogramND::HistogramND(const HistogramArgs& params) :
+		Histogram(params), m_blockShift(0), m_blockMask(0), m_blockBins(0), m_generation(0), m_snapshotGeneration(0), m_isProjectionChanged(true)
+	{
+		m_colorScaleRange[0] = 0.0f;
+		m_colorScaleRange[1] = 0.0f;
+		InitBins();
+	}
+
+	HistogramND::~HistogramND() {}
+
+	void HistogramND::InitBins()
+	{
+		SPEC_PROFILE_FUNCTION();
+		m_params.type = SpectrumType::HistoND;
+		m_params.binning_x = BinningType::Uniform;
+		m_params.windowMode = TimeWindowMode::None;
+		m_params.maxBinMemory = 0;
+		m_params.axes.resize(std::min(m_params.axes.size(), s_maxAxes + 1)); //Still illegal if too many, but no need to keep them all
+		bool isLegal = m_params.axes.size() >= 2 && m_params.axes.size() <= s_maxAxes;
+		for (auto& axis : m_params.axes)
+			isLegal &= axis.nbins > 0 && axis.min < axis.max;
+		if (!isLegal)
+		{
+			SPEC_WARN("Attempting to create illegal HistogramND {0} with {1} axes. Requires 2 to {2} axes, each with bins > 0 and min < max. Not initialized.", m_params.name, m_params.axes.size(), s_maxAxes);
+			m_params.axes.clear();
+			m_initFlag = false;
+			return;
+		}
+
+		//Keep blocks at (at most) 4096 bins
+		size_t nAxes = m_params.axes.size();
+		m_blockShift = std::min(uint64_t(3), uint64_t(12 / nAxes));
+		m_blockMask = (uint64_t(1) << m_blockShift) - 1;
+		m_blockBins = uint64_t(1) << (m_blockShift * nAxes);
+
+		uint64_t stride = 1;
+		m_binWidths.clear();
+		m_blockStrides.clear();
+		m_blocksPerAxis.clear();
+		for (auto& axis : m_params.axes)
+		{
+			uint64_t nBlocks = (uint64_t(axis.nbins) + m_blockMask) >> m_blockShift;
+			m_binWidths.push_back((axis.max - axis.min) / axis.nbins);
+			m_blockStrides.push_back(stride);
+			m_blocksPerAxis.push_back(nBlocks);
+			if (stride > (uint64_t(1) << 62) / nBlocks)
+			{
+				SPEC_WARN("Attempting to create illegal HistogramND {0}, too many bins in total. Not initialized.", m_params.name);
+				m_params.axes.clear();
+				m_initFlag = false;
+				return;
+			}
+			stride *= nBlocks;
+		}
+
+		m_blocks.Assign(m_params.countType, 0);
+		m_blockSlots.clear();
+		m_blockList.clear();
+
+		if (!IsValidProjection(m_params.projection))
+			m_params.projection = ProjectionArgs();
+		SyncProjectionParams();
+
+		m_initFlag = true;
+	}
+
+	bool HistogramND::IsValidProjection(const ProjectionArgs& projection) const
+	{
+		int nAxes = int(m_params.axes.size());
+		return projection.x_axis >= 0 && projection.x_axis < nAxes && projection.y_axis >= -1 && projection.y_axis < nAxes && projection.y_axis != projection.x_axis
+			&& (projection.gates.empty() || projection.gates.size() == m_params.axes.size());
+	}
+
+	//The x/y parameters and binning of the args describe the projection, so that everything outside treats it as a 1D/2D histogram
+	void HistogramND::SyncProjectionParams()
+	{
+		const AxisArgs& xAxis = m_params.axes[m_params.projection.x_axis];
+		m_params.x_par = xAxis.par;
+		m_params.nbins_x = xAxis.nbins;
+		m_params.min_x = xAxis.min;
+		m_params.max_x = xAxis.max;
+		if (m_params.projection.y_axis < 0)
+		{
+			m_params.y_par = "None";
+			m_params.nbins_y = 0;
+			m_params.min_y = 0.0;
+			m_params.max_y = 0.0;
+			return;
+		}
+		const AxisArgs& yAxis = m_params.axes[m_params.projection.y_axis];
+		m_params.y_par = yAxis.par;
+		m_params.nbins_y = yAxis.nbins;
+		m_params.min_y = yAxis.min;
+		m_params.max_y = yAxis.max;
+	}
+
+	void HistogramND::SetProjection(const ProjectionArgs& projection)
+	{
+		if (!m_initFlag || !IsValidProjection(projection))
+		{
+			SPEC_WARN("Invalid projection for HistogramND {0}", m_params.name);
+			return;
+		}
+		m_params.projection = projection;
+		SyncProjectionParams();
+		m_isProjectionChanged = true;
+	}
+
+	uint32_t HistogramND::AllocateBlock(uint64_t block)
+	{
+		uint32_t slot = uint32_t(m_blockList.size());
+		m_blockList.push_back(block);
+		m_blockSlots[block] = slot;
+		m_blocks.Grow(m_blockList.size() * m_blockBins);
+		return slot;
+	}
+
+	//Cached projections are only valid for the generation (i.e. the data) they were computed from
+	const std::vector<double>& HistogramND::GetProjection(const ProjectionArgs& projection)
+	{
+		SPEC_PROFILE_FUNCTION();
+		auto iter = std::find_if(m_projectionCache.begin(), m_projectionCache.end(), [&projection](const ProjectionCache& cache) { return cache.projection == projection; });
+		if (iter == m_projectionCache.end())
+		{
+			if (m_projectionCache.size() < s_maxCachedProjections)
+				m_projectionCache.emplace_back();
+			iter = m_projectionCache.end() - 1; //Replace the least recently used
+			iter->projection = projection;
+			iter->generation = m_generation + 1;
+		}
+		if (iter->generation != m_generation)
+		{
+			ComputeProjection(projection, iter->counts);
+			iter->generation = m_generation;
+		}
+		std::rotate(m_projectionCache.begin(), iter, iter + 1);
+		return m_projectionCache.front().counts;
+	}
+
+	void HistogramND::ComputeProjection(const ProjectionArgs& projection, std::vector<double>& result)
+	{
+		SPEC_PROFILE_FUNCTION();
+		size_t nAxes = m_params.axes.size();
+		int xAxis = projection.x_axis;
+		int yAxis = projection.y_axis;
+		size_t nCols = m_params.axes[xAxis].nbins;
+		size_t nRows = yAxis < 0 ? 1 : m_params.axes[yAxis].nbins;
+		result.assign(nCols * nRows, 0.0);
+		if (!IsValidProjection(projection))
+			return;
+
+		//Gates in (inclusive) bins
+		std::vector<uint64_t> gateMin(nAxes, 0);
+		std::vector<uint64_t> gateMax(nAxes);
+		for (size_t i = 0; i < nAxes; i++)
+		{
+			const AxisArgs& axis = m_params.axes[i];
+			gateMax[i] = axis.nbins - 1;
+			if (projection.gates.empty() || int(i) == xAxis || int(i) == yAxis)
+				continue;
+			const auto& gate = projection.gates[i];
+			if (gate.first > axis.min)
+				gateMin[i] = gate.first >= axis.max ? axis.nbins : uint64_t((gate.first - axis.min) / m_binWidths[i]);
+			if (gate.second < axis.max)
+			{
+				if (gate.second < axis.min)
+					gateMin[i] = axis.nbins; //Empty
+				else
+					gateMax[i] = uint64_t((gate.second - axis.min) / m_binWidths[i]);
+			}
+		}
+
+		uint64_t blockSide = m_blockMask + 1;
+		std::vector<uint64_t> blockLow(nAxes);
+		std::vector<uint64_t> bins(nAxes);
+		m_blocks.Visit([&](const auto* blocks)
+		{
+			for (size_t slot = 0; slot < m_blockList.size(); slot++)
+			{
+				//Skip blocks entirely outside the gates
+				bool isGated = false;
+				for (size_t i = 0; i < nAxes; i++)
+				{
+					blockLow[i] = ((m_blockList[slot] / m_blockStrides[i]) % m_blocksPerAxis[i]) << m_blockShift;
+					isGated |= blockLow[i] > gateMax[i] || blockLow[i] + blockSide <= gateMin[i];
+				}
+				if (isGated)
+					continue;
+
+				const auto* block = blocks + slot * m_blockBins;
+				for (uint64_t offset = 0; offset < m_blockBins; offset++)
+				{
+					if (block[offset] == 0)
+						continue;
+					bool isInside = true;
+					for (size_t i = 0; i < nAxes; i++)
+					{
+						bins[i] = blockLow[i] + ((offset >> (m_blockShift * i)) & m_blockMask);
+						isInside &= bins[i] >= gateMin[i] && bins[i] <= gateMax[i];
+					}
+					if (!isInside)
+						continue;
+					size_t row = yAxis < 0 ? 0 : nRows - 1 - bins[yAxis];
+					result[row * nCols + bins[xAxis]] += double(block[offset]);
+				}
+			}
+		});
+	}
+
+	bool HistogramND::ConsumeSnapshotChanges()
+	{
+		bool isChanged = m_isProjectionChanged || m_generation != m_snapshotGeneration;
+		m_isProjectionChanged = false;
+		m_snapshotGeneration = m_generation;
+		return isChanged && m_initFlag;
+	}
+
+	void HistogramND::CopySnapshot(BinSnapshot& snapshot)
+	{
+		const std::vector<double>& counts = GetProjection(m_params.projection);
+		snapshot.bins.Assign(BinCountType::Double, counts.size());
+		std::copy(counts.begin(), counts.end(), snapshot.bins.GetData<double>());
+		snapshot.isTiled = false;
+		snapshot.tiles.clear();
+		snapshot.nCols = m_params.nbins_x;
+		snapshot.nRows = m_params.projection.y_axis < 0 ? 1 : m_params.nbins_y;
+		snapshot.maxCount = 0.0;
+	}
+
+	//Can only be used within an ImGui / ImPlot context!!
+	void HistogramND::Draw()
+	{
+		SPEC_PROFILE_FUNCTION();
+		RequestSnapshot();
+		std::shared_ptr<const BinSnapshot> snapshot = GetSnapshot();
+		if (snapshot == nullptr || !m_initFlag)
+			return;
+
+		const double* counts = snapshot->bins.GetData<double>();
+		if (m_params.projection.y_axis < 0)
+		{
+			//The snapshot may still be of the previous projection
+			if (snapshot->nRows != 1 || snapshot->nCols != size_t(m_params.nbins_x))
+				return;
+			double binWidth = (m_params.max_x - m_params.min_x) / m_params.nbins_x;
+			m_drawCenters.resize(m_params.nbins_x);
+			for (int i = 0; i < m_params.nbins_x; i++)
+				m_drawCenters[i] = m_params.min_x + i * binWidth + binWidth * 0.5;
+			ImPlot::SetupAxes(m_params.x_par.c_str(), "Counts", 0, ImPlotAxisFlags_LockMin | ImPlotAxisFlags_AutoFit);
+			ImPlot::PlotBars(m_params.name.c_str(), m_drawCenters.data(), counts, m_params.nbins_x, binWidth);
+			return;
+		}
+
+		if (snapshot->nRows != size_t(m_params.nbins_y) || snapshot->nCols != size_t(m_params.nbins_x))
+			return;
+		ImPlot::SetupAxes(m_params.x_par.c_str(), m_params.y_par.c_str());
+		ImPlot::PushColormap(ImPlotColormap_Viridis);
+		ImPlot::PlotHeatmap(m_params.name.c_str(), counts, m_params.nbins_y, m_params.nbins_x, m_colorScaleRange[0], m_colorScaleRange[1], NULL,
+							ImPlotPoint(m_params.min_x, m_params.min_y), ImPlotPoint(m_params.max_x, m_params.max_y));
+		ImPlot::PopColormap();
+	}
+
+	void HistogramND::ClearData()
+	{
+		BinCountType type = m_blocks.GetType();
+		m_blocks = BinBuffer(); //Assign would keep the memory of the blocks
+		m_blocks.Assign(type, 0);
+		m_blockSlots.clear();
+		m_blockList.clear();
+		++m_generation;
+	}
+
+	//The block map is counted as a node per block plus the bucket array. UI thread, see Histogram2D::GetMemorySize
+	size_t HistogramND::GetMemorySize()
+	{
+		size_t size = Histogram::GetMemorySize() + m_blocks.GetMemorySize() + m_blockList.capacity() * sizeof(uint64_t) + m_drawCenters.capacity() * sizeof(double);
+		size += m_blockSlots.size() * (sizeof(std::pair<const uint64_t, uint32_t>) + 2 * sizeof(void*)) + m_blockSlots.bucket_count() * sizeof(void*);
+		for (auto& cache : m_projectionCache)
+			size += cache.counts.capacity() * sizeof(double);
+		return size;
+	}
+
+	std::vector<double> HistogramND::GetBinData()
+	{
+		if (!m_initFlag)
+			return std::vector<double>();
+		return GetProjection(m_params.projection);
+	}
+
+	//Statistics of the current projection, same as Histogram1D/Histogram2D
+	StatResults HistogramND::AnalyzeRegion(double x_min, double x_max, double y_min, double y_max)
+	{
+		SPEC_PROFILE_FUNCTION();
+		StatResults results;
+		if (!m_initFlag)
+			return results;
+
+		const std::vector<double>& counts = GetProjection(m_params.projection);
+		double binWidthX = (m_params.max_x - m_params.min_x) / m_params.nbins_x;
+		int xbin_min = x_min <= m_params.min_x ? 0 : int((x_min - m_params.min_x) / binWidthX);
+		int xbin_max = x_max >= m_params.max_x ? m_params.nbins_x - 1 : int((x_max - m_params.min_x) / binWidthX);
+		int ybin_min = 0;
+		int ybin_max = 0;
+		double binWidthY = 0.0;
+		bool is2D = m_params.projection.y_axis >= 0;
+		if (is2D)
+		{
+			binWidthY = (m_params.max_y - m_params.min_y) / m_params.nbins_y;
+			ybin_max = y_min <= m_params.min_y ? m_params.nbins_y - 1 : int((m_params.max_y - y_min) / binWidthY);
+			ybin_min = y_max >= m_params.max_y ? 0 : int((m_params.max_y - y_max) / binWidthY);
+		}
 
 		for (int y = ybin_min; y <= ybin_max; y++)
 		{
 			for (int x = xbin_min; x <= xbin_max; x++)
 			{
-				curbin = y * m_params.nbins_x + x;
-				results.integral += m_binCounts[curbin];
-				results.cent_x += m_binCounts[curbin] * (m_params.min_x + m_binWidthX * x);
-				results.cent_y += m_binCounts[curbin] * (m_params.max_y - m_binWidthY * y);
+				double count = counts[y * m_params.nbins_x + x];
+				results.integral += count;
+				results.cent_x += count * (m_params.min_x + binWidthX * x);
+				results.cent_y += count * (m_params.max_y - binWidthY * y);
 			}
 		}
-
 		if (results.integral == 0)
 			return results;
 
@@ -419,15 +1355,16 @@ namespace Specter {
 		{
 			for (int x = xbin_min; x <= xbin_max; x++)
 			{
-				curbin = y * m_params.nbins_x + x;
-				results.sigma_x += m_binCounts[curbin] * ((m_params.min_x + m_binWidthX * x) - results.cent_x) * ((m_params.min_x + m_binWidthX * x) - results.cent_x);
-				results.sigma_y += m_binCounts[curbin] * ((m_params.max_y - m_binWidthY * y) - results.cent_y) * ((m_params.max_y - m_binWidthY * y) - results.cent_y);
+				double count = counts[y * m_params.nbins_x + x];
+				results.sigma_x += count * ((m_params.min_x + binWidthX * x) - results.cent_x) * ((m_params.min_x + binWidthX * x) - results.cent_x);
+				results.sigma_y += count * ((m_params.max_y - binWidthY * y) - results.cent_y) * ((m_params.max_y - binWidthY * y) - results.cent_y);
 			}
 		}
-
 		results.sigma_x = std::sqrt(results.sigma_x / (results.integral - 1));
-		results.sigma_y = std::sqrt(results.sigma_y / (results.integral - 1));
-
+		if (is2D)
+			results.sigma_y = std::sqrt(results.sigma_y / (results.integral - 1));
+		else
+			results.cent_y = 0.0;
 		return results;
 	}
 }
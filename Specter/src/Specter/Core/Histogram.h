@@ -20,11 +20,62 @@
 	A HistogramSummary is a 2D display of many 1D histograms. That is, a summary back-links to other Histogram1D's already created. It is important to note that the linked sub-histograms should all have the same binning.
 
 	GWM -- Feb 2022
+
+	Bin counts are now held in a BinStorage, which can optionally be sharded per filling thread (see BinStorage.h). Anything reading the bins must go through GetBins().
+
+	Histograms are drawn from a snapshot of the bins rather than the live data, so that rendering never has to hold the SpectrumManager lock (and thus never stalls the physics thread).
+	Draw() flags that a new snapshot is wanted; the physics thread publishes a new snapshot (if the bins changed) the next time the manager updates the histograms. Snapshots are double buffered:
+	the previously published buffer is reused for the next snapshot as long as no reader still holds it.
+
+	The bin count type (uint32, uint64, float, double) is selected per histogram with HistogramArgs::countType. Snapshots keep the native type; counts are only
+	converted to double for export (GetBinData) and for drawing a Histogram1D (ImPlot bars need the same type for x and y).
+
+	A Histogram1D can have non-uniform binning (log, piecewise uniform, or a list of edges), selected with HistogramArgs::binning_x, see Binning.h. For these nbins_x,
+	min_x and max_x are filled in from the edges when the histogram is created. Histogram2D and HistogramSummary are always uniform.
+
+	HistogramND fills several parameters (HistogramArgs::axes) at once into sparse, blocked storage: the bins are grouped in blocks (e.g. 8x8x8 for 3 axes), and a
+	block is only allocated once one of its bins is filled. It is drawn as a 1D or 2D projection (HistogramArgs::projection), optionally gated on the remaining axes.
+	Projections are computed on demand and cached until new data arrives. x_par/y_par and the x/y binning of the args always describe the current projection, so
+	that regions, cuts and the editor treat it like a Histogram1D/2D.
+
+	A projection is a Histogram1D derived from a Histogram2D (HistogramArgs::parent): the parent's counts projected onto its x or y axis, optionally only within a band
+	of the other axis. Projections are not filled by the SpectrumManager; the parent fills them as part of its own fill (so they also see the parent's cuts), after
+	seeding them with the parent's counts when they are created. This keeps them live without reducing the whole parent every frame.
+
+	Histogram2D and HistogramSummary draw through a HeatmapPyramid: summed, downsampled levels of the snapshot which are kept up to date from the tiles filled
+	since the previous snapshot. Only the visible part of the level matching the plot resolution is handed to ImPlot.
+
+	Histogram1D and Histogram2D answer AnalyzeRegion from a RegionTable (summed-area table of the counts and their moments), rebuilt only when the bins changed,
+	so every open region costs four lookups per frame instead of a pass over its bins. Large and tiled 2D storage get a table over blocks of bins, and only sum
+	the bins along the border of a region one by one.
+
+	Histogram1D and Histogram2D also have FillBatch, which fills a block of values at once. The SpectrumManager uses it when replaying a ParameterBatch, so that the
+	bins of uncut histograms are computed with the vectorized kernels of FillKernels.h rather than one event at a time. Single and batch fills bin identically.
+
+	Histogram1D and Histogram2D can show only recent data (HistogramArgs::windowMode): a rolling window of the last windowSeconds, or counts decaying with time
+	constant windowSeconds. See TimeWindow.h. Projections of a windowed Histogram2D get the same window.
+
+	Every histogram reports the memory it holds (GetMemorySize): the counts, snapshots and everything derived from them. EstimateHistogramMemorySize gives what
+	a histogram can grow to before it is made, which the SpectrumManager checks against its memory budget. A Histogram2D over budget can be made sparse with a
+	limit on the memory of its counts (HistogramArgs::maxBinMemory); counts which would need more are dropped and reported by GetDroppedCounts.
+
+	A HistogramSummary can be linked (HistogramArgs::isLinkedSummary): each row is then a Histogram1D rather than a row of a 2D matrix. When the summary is made,
+	a row is shared with the Histogram1D of its parameter if there is one with the same binning, count type and cuts (and no time window); the hit is then binned
+	once, for that histogram, and the summary draws it as is (its clears, and cuts applied to it later, show in the summary too). Other rows are private
+	Histogram1D's which the SpectrumManager fills like any 1D spectrum, with the cuts of the summary. A linked summary holds no counts of its own; its snapshot
+	is put together from the rows.
 */
 #ifndef HISTOGRAM_H
 #define HISTOGRAM_H
 
 #include "SpecCore.h"
+#include "BinStorage.h"
+#include "Binning.h"
+#include "HeatmapPyramid.h"
+#include "RegionTable.h"
+#include "TimeWindow.h"
+
+#include <span>
 
 namespace Specter {
 
@@ -33,6 +84,7 @@ namespace Specter {
 		Histo1D,
 		Histo2D,
 		Summary,
+		HistoND,
 		None
 	};
 
@@ -48,6 +100,26 @@ namespace Specter {
 		double sigma_y = 0.0;
 	};
 
+	//One axis of a HistogramND
+	struct AxisArgs
+	{
+		std::string par = "None";
+		int nbins = 0;
+		double min = 0.0;
+		double max = 0.0;
+	};
+
+	//Which axes of a HistogramND are drawn, and the (min, max) gate on each axis. Gates are only applied to the axes which are not drawn;
+	//an empty list of gates means no gates.
+	struct ProjectionArgs
+	{
+		int x_axis = 0;
+		int y_axis = 1; //-1 for a 1D projection
+		std::vector<std::pair<double, double>> gates;
+
+		bool operator==(const ProjectionArgs& other) const = default;
+	};
+
 	struct HistogramArgs
 	{
 		HistogramArgs() {}
@@ -74,17 +146,34 @@ namespace Specter {
 		int nbins_y = 0;
 		double min_y = 0;
 		double max_y = 0;
+		BinCountType countType = BinCountType::Double;
+		BinningType binning_x = BinningType::Uniform; //Histogram1D only
+		std::vector<double> edges_x; //Piecewise: segment boundaries. Edges: all bin edges
+		std::vector<int> segmentBins_x; //Piecewise only: number of bins in each segment
+		std::vector<AxisArgs> axes; //HistogramND only
+		ProjectionArgs projection; //HistogramND only
+		std::string parent = "None"; //Projections only: the Histogram2D this is a projection of
+		bool isYProjection = false; //Projections only: projected onto the y axis of the parent (otherwise x)
+		double bandMin = 0.0; //Projections only: band of the other axis of the parent. No band if bandMin >= bandMax
+		double bandMax = 0.0;
+		TimeWindowMode windowMode = TimeWindowMode::None; //Histogram1D/2D only
+		double windowSeconds = 30.0; //Rolling: length of the window. Decaying: time constant (counts fall by 1/e)
+		int windowSlices = 10; //Rolling: slices in the window. Decaying: steps per time constant
+		uint64_t maxBinMemory = 0; //Histogram2D only: if not 0, the counts are sparse (tiled) and limited to about this many bytes
+		bool isLinkedSummary = false; //Summary only: rows are Histogram1D's, shared with the histograms of the parameters where possible
 	};
 
+	size_t EstimateHistogramMemorySize(const HistogramArgs& params);
+
 	class Histogram
 	{
 	public:
 		Histogram() :
-			m_initFlag(false)
+			m_initFlag(false), m_isSnapshotRequested(false)
 		{
 		}
 		Histogram(const HistogramArgs& params) :
-			m_params(params), m_initFlag(false)
+			m_params(params), m_initFlag(false), m_isSnapshotRequested(false)
 		{
 		}
 
@@ -95,18 +184,41 @@ namespace Specter {
 		virtual StatResults AnalyzeRegion(double x_min, double x_max, double y_min = 0.0, double y_max = 0.0) { return StatResults();  }
 		virtual float* GetColorScaleRange() { return nullptr; }
         virtual std::vector<double> GetBinData() { return std::vector<double>(); }
+		virtual void SetShardedStorage(bool sharded) {}
+		virtual void AdvanceTimeWindow(TimeWindow::Clock::time_point now) {}
+		virtual bool CopyBins(BinBuffer& bins);
+		virtual bool RestoreBins(BinBuffer&& bins);
+		virtual size_t GetMemorySize();
+		virtual uint64_t GetDroppedCounts();
 
 		HistogramArgs& GetParameters() { return m_params; }
 		SpectrumType GetType() { return m_params.type; }
 		const std::string& GetXParam() const { return m_params.x_par; };
 		const std::string& GetYParam() const { return m_params.y_par; };
 		const std::string& GetName() const { return m_params.name; }
+		bool IsInitialized() const { return m_initFlag; }
         void AddCutToBeDrawn(const std::string& name) { m_params.cutsDrawnUpon.push_back(name); }
         void AddCutToBeApplied(const std::string& name) { m_params.cutsAppliedTo.push_back(name); }
 
+		void UpdateSnapshot(bool ignoreRequest = false);
+
 	protected:
+		virtual BinStorage* GetBinStorage() { return nullptr; }
+		virtual bool ConsumeSnapshotChanges();
+		virtual void CopySnapshot(BinSnapshot& snapshot);
+		std::shared_ptr<const BinSnapshot> GetSnapshot();
+		void RequestSnapshot() { m_isSnapshotRequested.store(true, std::memory_order_relaxed); }
+		void ValidateTimeWindowCountType();
+		void InitTimeWindow(TimeWindow& window, const BinStorage& storage);
+
 		HistogramArgs m_params;
 		bool m_initFlag;
+
+	private:
+		std::shared_ptr<BinSnapshot> m_snapshot; //Published snapshot, read by Draw
+		std::shared_ptr<BinSnapshot> m_snapshotBackBuffer; //Previously published snapshot, recycled when no longer in use
+		std::mutex m_snapshotMutex;
+		std::atomic<bool> m_isSnapshotRequested;
 	};
 
 	class Histogram1D : public Histogram
@@ -118,14 +230,56 @@ namespace Specter {
 		virtual void Draw() override;
 		virtual void ClearData() override;
 		virtual StatResults AnalyzeRegion(double x_min, double x_max, double y_min = 0.0, double y_max = 0.0) override;
-        virtual std::vector<double> GetBinData() override { return m_binCounts; }
+        virtual std::vector<double> GetBinData() override { return m_binCounts.GetBins().ToDoubles(); }
+		virtual void SetShardedStorage(bool sharded) override { m_binCounts.SetSharded(sharded); }
+		virtual void AdvanceTimeWindow(TimeWindow::Clock::time_point now) override { m_window.Advance(m_binCounts, now); }
+		virtual bool RestoreBins(BinBuffer&& bins) override;
+		virtual size_t GetMemorySize() override;
+
+		//Non-virtual fill kernel, used directly by the SpectrumManager fill plan
+		inline void Fill(double x)
+		{
+			int bin = FindBin(x);
+			if (bin < 0)
+				return;
+			FillBin(bin);
+		}
+
+		//-1 if outside. The SpectrumManager finds the bin once for all histograms of a parameter with the same binning, and fills each with FillBin
+		inline int FindBin(double x) const { return m_binning.FindBin(x); }
+		bool HasSameBinning(const Histogram1D& other) const { return m_binning == other.m_binning; }
+
+		//Fills a block of values at once. For uniform binning the bins are computed several values at a time, see FillKernels.h
+		void FillBatch(std::span<const double> values);
+
+		//Used by a parent Histogram2D to fill a projection (see Histogram2D::Fill), and by the SpectrumManager with FindBin
+		inline void FillBin(int bin)
+		{
+			m_binCounts.Increment(bin);
+			if (m_window.IsRolling())
+				m_window.Increment(bin);
+		}
+
+		void AddToBin(int bin, double count)
+		{
+			m_binCounts.Add(bin, count);
+			m_window.Add(bin, count);
+		}
+
+	protected:
+		virtual BinStorage* GetBinStorage() override { return &m_binCounts; }
 
 	private:
+		friend class HistogramSummary; //Linked summaries read the counts of their rows
+
 		void InitBins();
 
-		std::vector<double> m_binCenters;
-		std::vector<double> m_binCounts;
-		double m_binWidth;
+		std::vector<double> m_binCenters; //UI thread only
+		std::vector<double> m_drawCounts; //Snapshot converted to double for drawing. UI thread only
+		BinStorage m_binCounts;
+		RegionTable m_regionTable; //Fill lock
+		TimeWindow m_window; //Fill lock
+		Binning m_binning;
 		
 	};
 
@@ -138,25 +292,88 @@ namespace Specter {
 		virtual void Draw() override;
 		virtual void ClearData() override;
 		virtual StatResults AnalyzeRegion(double x_min, double x_max, double y_min = 0.0, double y_max = 0.0) override;
-        virtual std::vector<double> GetBinData() override { return m_binCounts; }
+        virtual std::vector<double> GetBinData() override { return m_binCounts.ToDoubles(); }
+		virtual void SetShardedStorage(bool sharded) override { m_binCounts.SetSharded(sharded); }
+		virtual void AdvanceTimeWindow(TimeWindow::Clock::time_point now) override { m_window.Advance(m_binCounts, now); }
+		virtual bool RestoreBins(BinBuffer&& bins) override;
+		virtual size_t GetMemorySize() override;
 
 		virtual float* GetColorScaleRange() override { return m_colorScaleRange; }
 
+		//Non-virtual fill kernel, used directly by the SpectrumManager fill plan
+		inline void Fill(double x, double y)
+		{
+			int bin_x, bin_y;
+			FindBins(x, y, bin_x, bin_y);
+			if (bin_x < 0 || bin_y < 0)
+				return;
+			FillBins(bin_x, bin_y);
+		}
+
+		//Bins of (x, y), -1 if outside. Like Histogram1D::FindBin, shared by the histograms with the same binning; fill each with FillBins
+		inline void FindBins(double x, double y, int& bin_x, int& bin_y) const
+		{
+			bin_x = m_binningX.FindBin(x);
+			bin_y = m_binningY.FindBin(-y);
+		}
+		bool HasSameBinning(const Histogram2D& other) const { return m_binningX == other.m_binningX && m_binningY == other.m_binningY; }
+
+		inline void FillBins(int bin_x, int bin_y)
+		{
+			m_binCounts.Increment2D(bin_x, bin_y);
+			if (m_window.IsRolling())
+				m_window.Increment(size_t(bin_y) * m_params.nbins_x + bin_x);
+			for (auto& projection : m_projections)
+			{
+				if (projection.isY && bin_x >= projection.bandBegin && bin_x <= projection.bandEnd)
+					projection.histogram->FillBin(m_params.nbins_y - 1 - bin_y);
+				else if (!projection.isY && bin_y >= projection.bandBegin && bin_y <= projection.bandEnd)
+					projection.histogram->FillBin(bin_x);
+			}
+		}
+
+		//Fills pairs (xValues[i], yValues[i]) at once, see Histogram1D::FillBatch
+		void FillBatch(std::span<const double> xValues, std::span<const double> yValues);
+
+		HistogramArgs GetProjectionArgs(const HistogramArgs& params) const;
+		std::shared_ptr<Histogram1D> CreateProjection(const HistogramArgs& params);
+		void RemoveProjection(const std::string& name);
+		std::vector<std::string> GetProjections() const;
+
+	protected:
+		virtual BinStorage* GetBinStorage() override { return &m_binCounts; }
+
 	private:
+		//A projection onto x is banded in rows (bin_y, counted from the top), a projection onto y in columns. Bands are inclusive
+		struct ProjectionEntry
+		{
+			std::shared_ptr<Histogram1D> histogram;
+			bool isY = false;
+			int bandBegin = 0;
+			int bandEnd = 0;
+		};
+
 		void InitBins();
 
-		std::vector<double> m_binCounts;
+		std::vector<ProjectionEntry> m_projections;
+
+		BinStorage m_binCounts;
+		HeatmapPyramid m_pyramid; //UI thread only
+		RegionTable m_regionTable; //Fill lock
+		TimeWindow m_window; //Fill lock
 		int m_nBinsTotal;
 		double m_binWidthY;
 		double m_binWidthX;
-		double m_maxBinContent;
+		Binning m_binningX;
+		Binning m_binningY; //Binning of -y: rows count down from max_y, and y in (min_y, max_y] is -y in [-max_y, -min_y)
 		float m_colorScaleRange[2];
 	};
 
 	class HistogramSummary : public Histogram
 	{
 	public:
-		HistogramSummary(const HistogramArgs& params, const std::vector<std::string>& subhistos);
+		//sharedRows is only used by a linked summary: per sub-histogram, the Histogram1D the row is shared with, or nullptr for a private row
+		HistogramSummary(const HistogramArgs& params, const std::vector<std::string>& subhistos, const std::vector<std::shared_ptr<Histogram1D>>& sharedRows = {});
 		~HistogramSummary();
 
 		const std::vector<std::string>& GetSubHistograms() const { return m_subhistos;  }
@@ -166,20 +383,145 @@ namespace Specter {
 		virtual void Draw() override;
 		virtual float* GetColorScaleRange() override { return m_colorScaleRange; }
 		virtual StatResults AnalyzeRegion(double x_min, double x_max, double y_min = 0.0, double y_max = 0.0) override;
-		virtual std::vector<double> GetBinData() override { return m_binCounts; }
+		virtual std::vector<double> GetBinData() override { return GetSummaryBins().ToDoubles(); }
+		virtual void SetShardedStorage(bool sharded) override;
+		virtual bool CopyBins(BinBuffer& bins) override;
+		virtual bool RestoreBins(BinBuffer&& bins) override;
+		virtual size_t GetMemorySize() override;
+
+		//Linked summaries only. Rows are fixed when the summary is made; a shared row is detached (becomes private) when its histogram is removed from the manager,
+		//and replaced by a private copy (UnshareRows) when a cut applied to either side means the two no longer count the same events
+		bool IsLinked() const { return m_params.isLinkedSummary; }
+		static bool CanShareRow(const HistogramArgs& params, const std::string& subhisto, const HistogramArgs& row);
+		Histogram1D* GetRow(size_t index) const { return m_rows[index].histogram.get(); }
+		bool IsRowShared(size_t index) const { return m_rows[index].isShared; }
+		bool IsRowShared(const Histogram* histogram) const;
+		void DetachRow(const Histogram* histogram);
+		void UnshareRows();
+
+		//Non-virtual fill kernel, used directly by the SpectrumManager fill plan
+		inline void Fill(double x, double y)
+		{
+			if (x < m_params.min_x || x >= m_params.max_x || y <= m_params.min_y || y > m_params.max_y)
+				return;
+			int bin_x = int((x - m_params.min_x) / m_binWidthX);
+			int bin_y = int((m_params.max_y - y) / m_binWidthY);
+			m_binCounts.Increment2D(bin_x, bin_y);
+		}
+
+	protected:
+		virtual BinStorage* GetBinStorage() override { return &m_binCounts; }
+		virtual bool ConsumeSnapshotChanges() override;
+		virtual void CopySnapshot(BinSnapshot& snapshot) override;
 
 	private:
-		void InitBins();
+		struct Row
+		{
+			std::shared_ptr<Histogram1D> histogram;
+			bool isShared = false; //Filled as a histogram of the SpectrumManager, rather than by the summary. Manager lock
+		};
+
+		void InitBins(const std::vector<std::shared_ptr<Histogram1D>>& sharedRows);
+		const BinBuffer& GetSummaryBins();
+		void CopyRows(BinBuffer& bins);
 
 		std::vector<std::string> m_subhistos;
 		const char** m_labels;
-		std::vector<double> m_binCounts;
+		BinStorage m_binCounts; //Not linked only
+		std::vector<Row> m_rows; //Linked only, one per sub-histogram (row i of the summary is drawn at y = i + 0.5)
+		std::vector<bool> m_isRowModified; //Linked only, rows changed since the last snapshot
+		BinBuffer m_rowBins; //Linked only, the rows copied together for analysis and export. Fill lock
+		uint64_t m_snapshotVersion; //Linked only
+		bool m_isAllModified; //Linked only: next snapshot can't be built from the modified rows (first snapshot)
+		HeatmapPyramid m_pyramid; //UI thread only
 		int m_nBinsTotal;
 		double m_binWidthX;
 		const double m_binWidthY = 1.0;
 		float m_colorScaleRange[2];
 	};
 
+	class HistogramND : public Histogram
+	{
+	public:
+		HistogramND(const HistogramArgs& params);
+		virtual ~HistogramND();
+
+		virtual void Draw() override;
+		virtual void ClearData() override;
+		virtual StatResults AnalyzeRegion(double x_min, double x_max, double y_min = 0.0, double y_max = 0.0) override;
+		virtual std::vector<double> GetBinData() override; //Current projection
+		virtual float* GetColorScaleRange() override { return m_colorScaleRange; }
+		virtual size_t GetMemorySize() override;
+
+		void SetProjection(const ProjectionArgs& projection);
+		const std::vector<double>& GetProjection(const ProjectionArgs& projection);
+		size_t GetNumberOfAxes() const { return m_params.axes.size(); }
+
+		//Non-virtual fill kernel, used directly by the SpectrumManager fill plan. values holds one value per axis
+		inline void Fill(const double* values)
+		{
+			uint64_t block = 0;
+			uint64_t offset = 0;
+			for (size_t i = 0; i < m_params.axes.size(); i++)
+			{
+				const AxisArgs& axis = m_params.axes[i];
+				if (!(values[i] >= axis.min && values[i] < axis.max)) //also rejects NaN
+					return;
+				uint64_t bin = std::min(uint64_t((values[i] - axis.min) / m_binWidths[i]), uint64_t(axis.nbins - 1));
+				block += (bin >> m_blockShift) * m_blockStrides[i];
+				offset += (bin & m_blockMask) << (m_blockShift * i);
+			}
+
+			auto iter = m_blockSlots.find(block);
+			uint64_t bin = (iter == m_blockSlots.end() ? AllocateBlock(block) : iter->second) * m_blockBins + offset;
+			switch (m_blocks.GetType())
+			{
+				case BinCountType::UInt32: m_blocks.GetData<uint32_t>()[bin] += 1; break;
+				case BinCountType::UInt64: m_blocks.GetData<uint64_t>()[bin] += 1; break;
+				case BinCountType::Float: m_blocks.GetData<float>()[bin] += 1.0f; break;
+				case BinCountType::Double: m_blocks.GetData<double>()[bin] += 1.0; break;
+			}
+			++m_generation;
+		}
+
+		static constexpr size_t s_maxAxes = 8;
+		static constexpr size_t s_maxCachedProjections = 4;
+
+	protected:
+		virtual bool ConsumeSnapshotChanges() override;
+		virtual void CopySnapshot(BinSnapshot& snapshot) override;
+
+	private:
+		struct ProjectionCache
+		{
+			ProjectionArgs projection;
+			uint64_t generation = 0;
+			std::vector<double> counts;
+		};
+
+		void InitBins();
+		bool IsValidProjection(const ProjectionArgs& projection) const;
+		void SyncProjectionParams();
+		void ComputeProjection(const ProjectionArgs& projection, std::vector<double>& result);
+		uint32_t AllocateBlock(uint64_t block);
+
+		BinBuffer m_blocks; //Allocated blocks, in allocation order
+		std::unordered_map<uint64_t, uint32_t> m_blockSlots; //block index -> slot in m_blocks
+		std::vector<uint64_t> m_blockList; //block index of each slot
+		std::vector<double> m_binWidths;
+		std::vector<uint64_t> m_blockStrides; //Block index = sum over axes of block coordinate * stride
+		std::vector<uint64_t> m_blocksPerAxis;
+		uint64_t m_blockShift; //log2 of the block side
+		uint64_t m_blockMask;
+		uint64_t m_blockBins; //bins per block
+		uint64_t m_generation; //Incremented on every change to the bins
+		uint64_t m_snapshotGeneration; //m_generation of the last snapshot
+		bool m_isProjectionChanged;
+		std::vector<ProjectionCache> m_projectionCache; //Most recently used first
+		std::vector<double> m_drawCenters; //UI thread only
+		float m_colorScaleRange[2];
+	};
+
 }
 
 #endif
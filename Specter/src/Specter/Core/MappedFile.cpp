@@ -0,0 +1,115 @@
+/*
+	MappedFile.cpp
+	See MappedFile.h.
+*/
+#include "MappedFile.h"
+
+#ifdef SPEC_WINDOWS
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+namespace Specter {
+
+#ifdef SPEC_WINDOWS
+
+	MappedFile::MappedFile() :
+		m_data(nullptr), m_size(0), m_fileHandle(INVALID_HANDLE_VALUE), m_mappingHandle(nullptr)
+	{
+	}
+
+	bool MappedFile::Open(const std::string& filename)
+	{
+		Close();
+		m_fileHandle = CreateFileA(filename.c_str(), GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_WRITE, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+		if (m_fileHandle == INVALID_HANDLE_VALUE)
+			return false;
+
+		LARGE_INTEGER size;
+		if (!GetFileSizeEx(m_fileHandle, &size) || size.QuadPart == 0)
+		{
+			Close();
+			return false;
+		}
+		m_mappingHandle = CreateFileMappingA(m_fileHandle, nullptr, PAGE_READONLY, 0, 0, nullptr);
+		if (m_mappingHandle == nullptr)
+		{
+			Close();
+			return false;
+		}
+		m_data = static_cast<const uint8_t*>(MapViewOfFile(m_mappingHandle, FILE_MAP_READ, 0, 0, 0));
+		if (m_data == nullptr)
+		{
+			Close();
+			return false;
+		}
+		m_size = size_t(size.QuadPart);
+		return true;
+	}
+
+	void MappedFile::Close()
+	{
+		if (m_data != nullptr)
+			UnmapViewOfFile(m_data);
+		if (m_mappingHandle != nullptr)
+			CloseHandle(m_mappingHandle);
+		if (m_fileHandle != INVALID_HANDLE_VALUE)
+			CloseHandle(m_fileHandle);
+		m_data = nullptr;
+		m_size = 0;
+		m_mappingHandle = nullptr;
+		m_fileHandle = INVALID_HANDLE_VALUE;
+	}
+
+#else
+
+	MappedFile::MappedFile() :
+		m_data(nullptr), m_size(0)
+	{
+	}
+
+	bool MappedFile::Open(const std::string& filename)
+	{
+		Close();
+		int file = open(filename.c_str(), O_RDONLY);
+		if (file < 0)
+			return false;
+
+		struct stat info;
+		if (fstat(file, &info) != 0 || info.st_size == 0)
+		{
+			close(file);
+			return false;
+		}
+		void* data = mmap(nullptr, size_t(info.st_size), PROT_READ, MAP_PRIVATE, file, 0);
+		close(file); //The mapping keeps the file open
+		if (data == MAP_FAILED)
+			return false;
+
+		//The file is read front to back
+		madvise(data, size_t(info.st_size), MADV_SEQUENTIAL);
+		m_data = static_cast<const uint8_t*>(data);
+		m_size = size_t(info.st_size);
+		return true;
+	}
+
+	void MappedFile::Close()
+	{
+		if (m_data != nullptr)
+			munmap(const_cast<uint8_t*>(m_data), m_size);
+		m_data = nullptr;
+		m_size = 0;
+	}
+
+#endif
+
+	MappedFile::~MappedFile()
+	{
+		Close();
+	}
+}
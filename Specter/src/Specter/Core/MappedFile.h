@@ -0,0 +1,43 @@
+/*
+	MappedFile.h
+	Read-only memory mapping of a whole file. The file's pages are only read from disk as they are touched, so opening a large file is nearly free and reading it
+	costs no more than copying the parts actually used. Used for loading saved histogram counts, see SpectrumSerializer, and for replaying the spill file of
+	the ParameterCache.
+
+	mmap on Linux/MacOS, file mappings on Windows. The file may still be appended to while mapped (the ParameterCache spills while a backfill reads);
+	only the size at Open is mapped.
+*/
+#ifndef MAPPED_FILE_H
+#define MAPPED_FILE_H
+
+#include "SpecCore.h"
+
+namespace Specter {
+
+	class MappedFile
+	{
+	public:
+		MappedFile();
+		~MappedFile();
+
+		MappedFile(const MappedFile&) = delete;
+		MappedFile& operator=(const MappedFile&) = delete;
+
+		bool Open(const std::string& filename);
+		void Close();
+
+		bool IsOpen() const { return m_data != nullptr; }
+		const uint8_t* GetData() const { return m_data; }
+		size_t GetSize() const { return m_size; }
+
+	private:
+		const uint8_t* m_data;
+		size_t m_size;
+#ifdef SPEC_WINDOWS
+		void* m_fileHandle;
+		void* m_mappingHandle;
+#endif
+	};
+}
+
+#endif
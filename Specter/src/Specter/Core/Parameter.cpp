@@ -25,6 +25,14 @@
 	Variables added; similar to Parameters, but intend to be an interface with UI feedback. See SpecProject for examples. -- GWM April 2023
 
 	Scalers added. In nuclear phyiscs, scalers refer to time counters of data, to track the rate of different detector components. -- GWM April 2023
+
+	ParameterBatch added. Stages the parameter values of many events so that the SpectrumManager can fill histograms for the whole block under a single lock.
+
+	Parameter validity is now tracked with an event generation counter (ParameterState, owned by the SpectrumManager) rather than a flag. A parameter is valid
+	only if its stamp matches the current generation, so invalidating every parameter at the end of an event is a single increment instead of a sweep over
+	all bound parameters. The parameters set during an event are also listed in the ParameterState, so the ParameterBatch only visits those.
+	From the AnalysisStage side nothing changes: SetValue makes a parameter valid, and once an event is done its parameters read as 0 until set
+	again (as the old InvalidateParameters reset did). Invalidate() within an event only clears validity; the value stays readable until the event ends.
 */
 #include "Parameter.h"
 
@@ -54,6 +62,39 @@ namespace Specter {
 		m_name = name;
 	}
 
+	ParameterBatch::ParameterBatch(size_t maxEvents) :
+		m_state(nullptr), m_maxEvents(maxEvents == 0 ? 1 : maxEvents)
+	{
+		m_eventOffsets.push_back(0);
+	}
+
+	ParameterBatch::~ParameterBatch() {}
+
+	//Copy the valid parameters of the current event into the batch, and then invalidate them in preparation for the next event.
+	//Only the parameters set during the event are visited. Parameters bound since the batch was last synced are dropped, as before.
+	void ParameterBatch::RecordEvent()
+	{
+		if (m_state != nullptr)
+		{
+			for (ParameterData* data : m_state->touched)
+			{
+				if (data->IsValid() && data->index < m_params.size())
+					m_entries.push_back({ data->index, data->value });
+				data->stamp = 0; //Skips duplicates (parameter invalidated and set again within the event)
+			}
+			m_state->touched.clear();
+			m_state->generation++;
+		}
+		m_eventOffsets.push_back(m_entries.size());
+	}
+
+	void ParameterBatch::Clear()
+	{
+		m_entries.clear();
+		m_eventOffsets.clear();
+		m_eventOffsets.push_back(0);
+	}
+
 	Variable::Variable() :
 		m_name(""), m_pdata(nullptr)
 	{
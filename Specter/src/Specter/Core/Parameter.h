@@ -25,6 +25,14 @@
 	Variables added; similar to Parameters, but intend to be an interface with UI feedback. See SpecProject for examples. -- GWM April 2023
 
 	Scalers added. In nuclear phyiscs, scalers refer to time counters of data, to track the rate of different detector components. -- GWM April 2023
+
+	ParameterBatch added. Stages the parameter values of many events so that the SpectrumManager can fill histograms for the whole block under a single lock.
+
+	Parameter validity is now tracked with an event generation counter (ParameterState, owned by the SpectrumManager) rather than a flag. A parameter is valid
+	only if its stamp matches the current generation, so invalidating every parameter at the end of an event is a single increment instead of a sweep over
+	all bound parameters. The parameters set during an event are also listed in the ParameterState, so the ParameterBatch only visits those.
+	From the AnalysisStage side nothing changes: SetValue makes a parameter valid, and once an event is done its parameters read as 0 until set
+	again (as the old InvalidateParameters reset did). Invalidate() within an event only clears validity; the value stays readable until the event ends.
 */
 #ifndef PARAMETER_H
 #define PARAMETER_H
@@ -33,11 +41,34 @@
 
 namespace Specter {
 
+	struct ParameterData;
+
+	//Event generation shared by all parameters of a SpectrumManager. Incrementing the generation invalidates every parameter.
+	struct ParameterState
+	{
+		uint64_t generation = 1;
+		std::vector<ParameterData*> touched; //Parameters set in the current generation (may contain duplicates)
+	};
+
 	//Underlying data
 	struct ParameterData
 	{
 		double value=0.0;
-		bool validFlag=false;
+		uint64_t stamp=0; //generation in which value was set
+		uint64_t invalidated=0; //generation in which Invalidate() was called; value stays readable for the rest of it
+		uint32_t index=0; //bind order, index into the manager's parameter list
+		ParameterState* state=nullptr;
+
+		bool IsValid() const { return stamp == state->generation; }
+		void Set(double val)
+		{
+			if (stamp != state->generation)
+			{
+				stamp = state->generation;
+				state->touched.push_back(this);
+			}
+			value = val;
+		}
 	};
 
 	//Interface to parameter data
@@ -49,10 +80,15 @@ namespace Specter {
 		Parameter(const std::string& name);
 		~Parameter();
         
-        bool IsValid() const { return m_pdata->validFlag; }
-        void Invalidate() { m_pdata->validFlag = false; }
-        void SetValue(double value) { m_pdata->validFlag = true; m_pdata->value = value; }
-        double GetValue() const { return m_pdata->value; }
+        bool IsValid() const { return m_pdata->IsValid(); }
+        void Invalidate()
+        {
+            if (m_pdata->IsValid())
+                m_pdata->invalidated = m_pdata->state->generation;
+            m_pdata->stamp = 0;
+        }
+        void SetValue(double value) { m_pdata->Set(value); }
+        double GetValue() const { return m_pdata->IsValid() || m_pdata->invalidated == m_pdata->state->generation ? m_pdata->value : 0.0; }
         const std::string& GetName() const { return m_name; }
 		void SetName(const std::string& name);
 
@@ -63,6 +99,40 @@ namespace Specter {
 
 	};
 
+	//Staging buffer for the parameter values of a block of events. The PhysicsLayer records each event into the batch after the
+	//AnalysisStack has run, and then hands the whole batch to SpectrumManager::UpdateHistograms, so that the manager lock is taken once
+	//per batch rather than twice per event. Recording an event also invalidates its parameters, replacing SpectrumManager::InvalidateParameters.
+	//Like Parameter, this is NOT thread safe and should only ever be used from the physics thread.
+	class ParameterBatch
+	{
+	public:
+		ParameterBatch(size_t maxEvents = 1);
+		~ParameterBatch();
+
+		void RecordEvent();
+		void Clear();
+		void SetMaxEvents(size_t maxEvents) { m_maxEvents = maxEvents == 0 ? 1 : maxEvents; }
+		size_t GetMaxEvents() const { return m_maxEvents; }
+		size_t GetNumberOfEvents() const { return m_eventOffsets.size() - 1; }
+		bool IsFull() const { return GetNumberOfEvents() >= m_maxEvents; }
+		bool IsEmpty() const { return GetNumberOfEvents() == 0; }
+
+		friend class SpectrumManager;
+		friend class ParameterCache;
+	private:
+		struct Entry
+		{
+			uint32_t index; //index into m_params
+			double value;
+		};
+
+		std::vector<std::shared_ptr<ParameterData>> m_params; //Copy of the manager's parameter list, kept in sync by the manager
+		ParameterState* m_state; //The manager's parameter generation
+		std::vector<Entry> m_entries; //Valid parameter values of all recorded events
+		std::vector<size_t> m_eventOffsets; //Start of each event in m_entries, plus one past the end of the last event
+		size_t m_maxEvents;
+	};
+
 	//Similar to  parameters, sometimes you want to have a numeric input (in calculation terms, a constant)
 	//which you can use with your analysis. To be able to expose these numeric values to the UI, we need to implement them
 	//in the manager. To help with this, Variables are atomics. So unlike Parameters they are implicity thread safe on read and write.
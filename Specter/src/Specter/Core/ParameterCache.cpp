@@ -0,0 +1,387 @@
+/*
+	ParameterCache.cpp
+	See ParameterCache.h.
+
+	Spill file layout, one record per chunk, all fields 8 bytes so that a mapped chunk can be used in place:
+	nEvents, nColumns, then (offset, nValues) for each column (offset from the start of the chunk, 0 if the column is empty), then for each non-empty
+	column its validity words followed by its values. Written in native byte order; the file is removed with the cache and never read by anything else.
+
+	The file offset of a chunk is fixed when it is queued (SealChunk), and the spill thread writes the queue in order, so the offsets hold as long as the
+	stream is only restarted along with the chunk list (ClearData).
+*/
+#include "ParameterCache.h"
+#include "MappedFile.h"
+
+#include <chrono>
+
+namespace Specter {
+
+	static size_t GetValidWords(size_t nEvents)
+	{
+		return (nEvents + 63) / 64;
+	}
+
+	ParameterCache::ParameterCache() :
+		m_isSpillWriting(false), m_isStopping(false), m_isEnabled(false), m_memorySize(0), m_queuedMemory(0), m_diskSize(0), m_queuedDiskSize(0),
+		m_nSpilled(0), m_nQueued(0), m_events(0), m_isFull(false)
+	{
+		//Unique per cache, so that two instances of the application don't share a spill file
+		std::string name = "SpecterParameterCache_" + std::to_string(std::chrono::system_clock::now().time_since_epoch().count()) + ".bin";
+		std::error_code error;
+		m_defaultSpillPath = (std::filesystem::temp_directory_path(error) / name).string();
+		m_spillThread = std::thread(&ParameterCache::RunSpillThread, this);
+	}
+
+	//Chunks still queued are dropped with the file
+	ParameterCache::~ParameterCache()
+	{
+		{
+			std::scoped_lock<std::mutex> guard(m_cacheMutex);
+			m_isStopping = true;
+		}
+		m_spillCondition.notify_all();
+		m_spillThread.join();
+		m_spillStream.close();
+		RemoveSpillFile();
+	}
+
+	//Changing the spill path or disabling the cache drops everything recorded. The limits can be changed at any time, and apply from the next chunk
+	void ParameterCache::SetArgs(const ParameterCacheArgs& args)
+	{
+		SPEC_PROFILE_FUNCTION();
+		std::unique_lock<std::mutex> guard(m_cacheMutex);
+		std::string spillPath = args.spillPath.empty() ? m_defaultSpillPath : args.spillPath;
+		if (!args.isEnabled || spillPath != m_spillPath)
+			ClearData(guard);
+		m_args = args;
+		m_spillPath = spillPath;
+		m_isEnabled.store(args.isEnabled, std::memory_order_relaxed);
+	}
+
+	ParameterCacheArgs ParameterCache::GetArgs()
+	{
+		std::scoped_lock<std::mutex> guard(m_cacheMutex);
+		return m_args;
+	}
+
+	void ParameterCache::Clear()
+	{
+		SPEC_PROFILE_FUNCTION();
+		std::unique_lock<std::mutex> guard(m_cacheMutex);
+		ClearData(guard);
+	}
+
+	ParameterCacheStats ParameterCache::GetStats()
+	{
+		std::scoped_lock<std::mutex> guard(m_cacheMutex);
+		ParameterCacheStats stats;
+		stats.events = m_events;
+		stats.memorySize = m_memorySize + GetChunkMemorySize(m_openChunk);
+		stats.diskSize = m_diskSize;
+		stats.isFull = m_isFull;
+		return stats;
+	}
+
+	void ParameterCache::Record(const ParameterBatch& batch)
+	{
+		if (!IsEnabled())
+			return;
+
+		std::scoped_lock<std::mutex> guard(m_cacheMutex);
+		for (size_t event = 0; event < batch.GetNumberOfEvents() && !m_isFull; event++)
+		{
+			for (size_t i = batch.m_eventOffsets[event]; i < batch.m_eventOffsets[event + 1]; i++)
+				AddValue(batch.m_entries[i].index, batch.m_entries[i].value);
+			EndEvent();
+		}
+	}
+
+	//For events filled one at a time (SpectrumManager::UpdateHistograms()). touched is the ParameterState list, so may hold invalidated parameters and duplicates
+	void ParameterCache::RecordEvent(const std::vector<ParameterData*>& touched)
+	{
+		if (!IsEnabled())
+			return;
+
+		std::scoped_lock<std::mutex> guard(m_cacheMutex);
+		if (m_isFull)
+			return;
+		for (ParameterData* data : touched)
+		{
+			if (data->IsValid())
+				AddValue(data->index, data->value);
+		}
+		EndEvent();
+	}
+
+	ParameterCache::Contents ParameterCache::GetContents()
+	{
+		SPEC_PROFILE_FUNCTION();
+		std::scoped_lock<std::mutex> guard(m_cacheMutex);
+		Contents contents;
+		contents.chunks = m_chunks;
+		if (m_openChunk.nEvents != 0)
+			contents.openChunk = std::make_shared<Chunk>(m_openChunk);
+		contents.spillPath = m_spillPath;
+		contents.events = m_events;
+		return contents;
+	}
+
+	bool ParameterCache::ForEachChunk(const Contents& contents, const std::function<void(const ChunkView&)>& func)
+	{
+		SPEC_PROFILE_FUNCTION();
+		MappedFile spillFile;
+		bool isSpilled = std::any_of(contents.chunks.begin(), contents.chunks.end(), [](const ChunkRecord& record) { return record.chunk == nullptr; });
+		if (isSpilled && !spillFile.Open(contents.spillPath))
+		{
+			SPEC_ERROR("Could not open the parameter cache spill file {0}", contents.spillPath);
+			return false;
+		}
+
+		for (auto& record : contents.chunks)
+		{
+			if (record.chunk != nullptr)
+			{
+				func(MakeView(*record.chunk));
+				continue;
+			}
+
+			ChunkView view;
+			if (record.fileOffset + record.fileSize > spillFile.GetSize() || !MakeView(spillFile.GetData() + record.fileOffset, record.fileSize, view))
+			{
+				SPEC_ERROR("Parameter cache spill file {0} is damaged at offset {1}", contents.spillPath, record.fileOffset);
+				return false;
+			}
+			func(view);
+		}
+
+		if (contents.openChunk != nullptr)
+			func(MakeView(*contents.openChunk));
+		return true;
+	}
+
+	void ParameterCache::AddValue(uint32_t index, double value)
+	{
+		if (index >= m_openChunk.columns.size())
+			m_openChunk.columns.resize(size_t(index) + 1);
+		Column& column = m_openChunk.columns[index];
+		if (column.valid.empty())
+			column.valid.assign(s_validWords, 0);
+
+		uint64_t& word = column.valid[m_openChunk.nEvents >> 6];
+		uint64_t bit = uint64_t(1) << (m_openChunk.nEvents & 63);
+		if (word & bit) //Set again within the event, the last value wins
+		{
+			column.values.back() = value;
+			return;
+		}
+		word |= bit;
+		column.values.push_back(value);
+	}
+
+	void ParameterCache::EndEvent()
+	{
+		m_openChunk.nEvents++;
+		m_events++;
+		if (m_openChunk.nEvents == s_chunkEvents)
+			SealChunk();
+	}
+
+	//Move the open chunk to the chunk list, then queue the oldest chunks still in memory for the spill thread until back under the memory limit.
+	//Spilled and queued chunks are always the front of the list (m_nSpilled and m_nQueued of them).
+	void ParameterCache::SealChunk()
+	{
+		std::shared_ptr<Chunk> chunk = std::make_shared<Chunk>(std::move(m_openChunk));
+		m_openChunk = Chunk();
+		for (auto& column : chunk->columns)
+			column.values.shrink_to_fit();
+		chunk->memorySize = GetChunkMemorySize(*chunk);
+		m_memorySize += chunk->memorySize;
+		m_chunks.push_back({ chunk, 0, 0 });
+
+		while (m_memorySize - m_queuedMemory > m_args.maxMemory && m_nQueued < m_chunks.size())
+		{
+			ChunkRecord& record = m_chunks[m_nQueued];
+			uint64_t size = 0;
+			MakeSpillHeader(*record.chunk, size);
+			if (m_queuedDiskSize + size > m_args.maxDisk)
+			{
+				m_isFull = true;
+				SPEC_WARN("Parameter cache is full after {0} events ({1} bytes in memory, {2} bytes on disk). Recording stopped.", m_events, m_memorySize, m_queuedDiskSize);
+				break;
+			}
+			record.fileOffset = m_queuedDiskSize;
+			record.fileSize = size;
+			m_queuedDiskSize += size;
+			m_queuedMemory += record.chunk->memorySize;
+			m_nQueued++;
+		}
+		if (m_nQueued > m_nSpilled)
+			m_spillCondition.notify_all();
+	}
+
+	//Writes the queued chunks, one at a time, without holding the lock during the write. A chunk is only marked spilled (and dropped from memory)
+	//once it is in the file, so a replay never maps a chunk that isn't there yet.
+	void ParameterCache::RunSpillThread()
+	{
+		std::unique_lock<std::mutex> guard(m_cacheMutex);
+		while (true)
+		{
+			m_spillCondition.wait(guard, [this]() { return m_isStopping || m_nSpilled < m_nQueued; });
+			if (m_isStopping)
+				return;
+
+			std::shared_ptr<const Chunk> chunk = m_chunks[m_nSpilled].chunk;
+			std::string path = m_spillPath;
+			m_isSpillWriting = true;
+			guard.unlock();
+			bool isWritten = WriteChunk(*chunk, path);
+			guard.lock();
+			m_isSpillWriting = false;
+
+			if (isWritten)
+			{
+				ChunkRecord& record = m_chunks[m_nSpilled]; //The list may have grown meanwhile
+				m_diskSize += record.fileSize;
+				m_memorySize -= chunk->memorySize;
+				m_queuedMemory -= chunk->memorySize;
+				record.chunk.reset(); //Still alive for any Contents holding it
+				m_nSpilled++;
+			}
+			else
+			{
+				//The rest of the queue stays in memory, and nothing more is recorded
+				SPEC_ERROR("Could not write the parameter cache spill file {0}. Recording stopped.", path);
+				m_isFull = true;
+				m_nQueued = m_nSpilled;
+				m_queuedMemory = 0;
+				m_queuedDiskSize = m_diskSize;
+			}
+			m_spillCondition.notify_all();
+		}
+	}
+
+	//Spill thread only
+	bool ParameterCache::WriteChunk(const Chunk& chunk, const std::string& path)
+	{
+		SPEC_PROFILE_FUNCTION();
+		//The stream is closed whenever the cache is cleared, so opening it always starts the file over. This keeps offsets right even if the file
+		//of a previous recording could not be removed
+		if (!m_spillStream.is_open())
+			m_spillStream.open(path, std::ios::binary | std::ios::trunc);
+
+		uint64_t size = 0;
+		std::vector<uint64_t> header = MakeSpillHeader(chunk, size);
+		size_t nValid = GetValidWords(chunk.nEvents);
+		m_spillStream.write(reinterpret_cast<const char*>(header.data()), header.size() * sizeof(uint64_t));
+		for (auto& column : chunk.columns)
+		{
+			if (column.valid.empty())
+				continue;
+			m_spillStream.write(reinterpret_cast<const char*>(column.valid.data()), nValid * sizeof(uint64_t));
+			m_spillStream.write(reinterpret_cast<const char*>(column.values.data()), column.values.size() * sizeof(double));
+		}
+		m_spillStream.flush(); //Replays map the file, the chunk must be in it before it is marked spilled
+		return m_spillStream.good();
+	}
+
+	//Record header of a chunk in the spill file; size is set to the bytes of the whole record
+	std::vector<uint64_t> ParameterCache::MakeSpillHeader(const Chunk& chunk, uint64_t& size)
+	{
+		size_t nValid = GetValidWords(chunk.nEvents);
+		std::vector<uint64_t> header(2 + 2 * chunk.columns.size(), 0);
+		header[0] = chunk.nEvents;
+		header[1] = chunk.columns.size();
+		size = header.size() * sizeof(uint64_t);
+		for (size_t i = 0; i < chunk.columns.size(); i++)
+		{
+			const Column& column = chunk.columns[i];
+			if (column.valid.empty())
+				continue;
+			header[2 + 2 * i] = size;
+			header[3 + 2 * i] = column.values.size();
+			size += (nValid + column.values.size()) * sizeof(uint64_t);
+		}
+		return header;
+	}
+
+	//A write in progress is let finish first, as the spill thread holds on to the stream and the chunk list. Cache lock must be held by lock
+	void ParameterCache::ClearData(std::unique_lock<std::mutex>& lock)
+	{
+		m_spillCondition.wait(lock, [this]() { return !m_isSpillWriting; });
+		m_spillStream.close();
+		m_spillStream.clear();
+		m_chunks.clear();
+		m_openChunk = Chunk();
+		m_memorySize = 0;
+		m_queuedMemory = 0;
+		m_diskSize = 0;
+		m_queuedDiskSize = 0;
+		m_nSpilled = 0;
+		m_nQueued = 0;
+		m_events = 0;
+		m_isFull = false;
+		RemoveSpillFile();
+	}
+
+	void ParameterCache::RemoveSpillFile()
+	{
+		if (m_spillPath.empty())
+			return;
+		std::error_code error;
+		if (!std::filesystem::remove(m_spillPath, error) && error)
+			SPEC_WARN("Could not remove the parameter cache spill file {0}: {1}", m_spillPath, error.message());
+	}
+
+	size_t ParameterCache::GetChunkMemorySize(const Chunk& chunk)
+	{
+		size_t size = chunk.columns.capacity() * sizeof(Column);
+		for (auto& column : chunk.columns)
+			size += column.valid.capacity() * sizeof(uint64_t) + column.values.capacity() * sizeof(double);
+		return size;
+	}
+
+	ParameterCache::ChunkView ParameterCache::MakeView(const Chunk& chunk)
+	{
+		ChunkView view;
+		view.nEvents = chunk.nEvents;
+		view.columns.resize(chunk.columns.size());
+		size_t nValid = GetValidWords(chunk.nEvents);
+		for (size_t i = 0; i < chunk.columns.size(); i++)
+		{
+			if (chunk.columns[i].valid.empty())
+				continue;
+			view.columns[i].valid = std::span<const uint64_t>(chunk.columns[i].valid.data(), nValid);
+			view.columns[i].values = chunk.columns[i].values;
+		}
+		return view;
+	}
+
+	//View of a spilled chunk, in place. Returns false if the record doesn't fit in size
+	bool ParameterCache::MakeView(const uint8_t* data, size_t size, ChunkView& view)
+	{
+		if (size < 2 * sizeof(uint64_t))
+			return false;
+		const uint64_t* words = reinterpret_cast<const uint64_t*>(data);
+		uint64_t nEvents = words[0];
+		uint64_t nColumns = words[1];
+		if (nEvents > s_chunkEvents || nColumns > size / (2 * sizeof(uint64_t)) - 1)
+			return false;
+
+		size_t nValid = GetValidWords(nEvents);
+		view.nEvents = uint32_t(nEvents);
+		view.columns.assign(nColumns, ColumnView());
+		for (size_t i = 0; i < nColumns; i++)
+		{
+			uint64_t offset = words[2 + 2 * i];
+			uint64_t nValues = words[3 + 2 * i];
+			if (offset == 0)
+				continue;
+			if (offset % sizeof(uint64_t) != 0 || nValues > nEvents || offset > size || (nValid + nValues) * sizeof(uint64_t) > size - offset)
+				return false;
+			const uint64_t* valid = reinterpret_cast<const uint64_t*>(data + offset);
+			view.columns[i].valid = std::span<const uint64_t>(valid, nValid);
+			view.columns[i].values = std::span<const double>(reinterpret_cast<const double*>(valid + nValid), nValues);
+		}
+		return true;
+	}
+}
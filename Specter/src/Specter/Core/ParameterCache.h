@@ -0,0 +1,152 @@
+/*
+	ParameterCache.h
+	Columnar record of the bound parameter values of every event, so that a histogram (or cut) added in the middle of a run can be filled with the events
+	it missed, without going back to the data source (see SpectrumManager::BackfillHistograms).
+
+	Events are recorded after the AnalysisStack has run, by the SpectrumManager, in chunks of s_chunkEvents events. Within a chunk each parameter is a column:
+	a validity bitmap with one bit per event, and the values of the valid events packed in event order. Parameters which are never valid in a chunk take no space.
+	Packed values mean a column can be handed straight to Histogram1D::FillBatch, and sparse parameters (most detector channels) cost little more than their bitmap.
+
+	Memory is bounded: once the chunks held in memory go over maxMemory, the oldest are queued to be written to a spill file, and read back through a MappedFile
+	when replayed. The writing is done by the cache's own spill thread, through a stream kept open for the whole recording, so the physics thread never waits on
+	the disk; a queued chunk stays in memory (and is replayed from there) until it is written. Once the spill file would go over maxDisk, recording stops (the cache
+	is full) until it is cleared; the cache then only covers the start of the run.
+
+	Recording happens on the physics thread, with the SpectrumManager fill lock held. GetContents takes a consistent copy of the chunk list (and of the chunk
+	being filled), which can then be replayed by ForEachChunk without holding anything, while recording carries on.
+*/
+#ifndef PARAMETER_CACHE_H
+#define PARAMETER_CACHE_H
+
+#include "Parameter.h"
+
+#include <span>
+#include <mutex>
+#include <atomic>
+#include <thread>
+#include <condition_variable>
+
+namespace Specter {
+
+	struct ParameterCacheArgs
+	{
+		bool isEnabled = false;
+		size_t maxMemory = size_t(256) << 20; //Bytes of chunks kept in memory, older chunks spill to disk
+		size_t maxDisk = size_t(16) << 30; //Bytes of the spill file, 0 to never spill. Recording stops once full
+		std::string spillPath = ""; //Empty for a file in the temp directory
+	};
+
+	struct ParameterCacheStats
+	{
+		uint64_t events = 0;
+		size_t memorySize = 0;
+		size_t diskSize = 0;
+		bool isFull = false;
+	};
+
+	class ParameterCache
+	{
+	public:
+		//A parameter over the events of one chunk. Empty if the parameter was never valid in the chunk
+		struct ColumnView
+		{
+			std::span<const uint64_t> valid; //bit i of word i/64: event i of the chunk
+			std::span<const double> values; //one per set bit, in event order
+		};
+
+		//A chunk as handed to ForEachChunk. columns is indexed by parameter bind order, and may be shorter than the parameter list
+		struct ChunkView
+		{
+			uint32_t nEvents = 0;
+			std::vector<ColumnView> columns;
+		};
+
+	private:
+		struct Column
+		{
+			std::vector<uint64_t> valid;
+			std::vector<double> values;
+		};
+
+		struct Chunk
+		{
+			uint32_t nEvents = 0;
+			std::vector<Column> columns;
+			size_t memorySize = 0; //sealed chunks only
+		};
+
+		struct ChunkRecord
+		{
+			std::shared_ptr<const Chunk> chunk; //nullptr once spilled
+			uint64_t fileOffset = 0;
+			uint64_t fileSize = 0;
+		};
+
+	public:
+		//A copy of the cache at one point in time, see GetContents
+		struct Contents
+		{
+			std::vector<ChunkRecord> chunks;
+			std::shared_ptr<const Chunk> openChunk;
+			std::string spillPath;
+			uint64_t events = 0;
+		};
+
+		ParameterCache();
+		~ParameterCache();
+
+		void SetArgs(const ParameterCacheArgs& args);
+		ParameterCacheArgs GetArgs();
+		bool IsEnabled() const { return m_isEnabled.load(std::memory_order_relaxed); }
+		void Clear();
+		ParameterCacheStats GetStats();
+
+		//Physics thread only
+		void Record(const ParameterBatch& batch);
+		void RecordEvent(const std::vector<ParameterData*>& touched);
+
+		Contents GetContents();
+		//Calls func for every chunk of contents, in recording order. Returns false if a spilled chunk could not be read back
+		static bool ForEachChunk(const Contents& contents, const std::function<void(const ChunkView&)>& func);
+
+		static constexpr uint32_t s_chunkEvents = 16384;
+
+	private:
+		void AddValue(uint32_t index, double value);
+		void EndEvent();
+		void SealChunk();
+		void RunSpillThread();
+		bool WriteChunk(const Chunk& chunk, const std::string& path);
+		void ClearData(std::unique_lock<std::mutex>& lock);
+		void RemoveSpillFile();
+		static size_t GetChunkMemorySize(const Chunk& chunk);
+		static std::vector<uint64_t> MakeSpillHeader(const Chunk& chunk, uint64_t& size);
+		static ChunkView MakeView(const Chunk& chunk);
+		static bool MakeView(const uint8_t* data, size_t size, ChunkView& view);
+
+		std::mutex m_cacheMutex;
+		std::condition_variable m_spillCondition; //Chunks queued, a write done, or stopping
+		std::thread m_spillThread;
+		std::ofstream m_spillStream; //Spill thread only, except while no write is in progress (ClearData)
+		bool m_isSpillWriting; //The spill thread is writing without the lock; the chunk list can grow but not be cleared
+		bool m_isStopping;
+		std::atomic<bool> m_isEnabled;
+		ParameterCacheArgs m_args;
+		std::string m_spillPath;
+		std::string m_defaultSpillPath;
+		std::vector<ChunkRecord> m_chunks;
+		Chunk m_openChunk;
+		size_t m_memorySize; //sealed chunks in memory
+		size_t m_queuedMemory; //of the chunks queued but not yet written
+		size_t m_diskSize; //written
+		size_t m_queuedDiskSize; //written and queued, the offset of the next chunk queued
+		size_t m_nSpilled; //Spilled chunks, always the front of m_chunks
+		size_t m_nQueued; //Spilled or queued to be, the front of m_chunks
+		uint64_t m_events;
+		bool m_isFull;
+
+		static constexpr size_t s_validWords = s_chunkEvents / 64;
+	};
+}
+
+#endif
@@ -0,0 +1,190 @@
+/*
+	RegionTable.cpp
+	See RegionTable.h.
+*/
+#include "RegionTable.h"
+
+#include <algorithm>
+
+namespace Specter {
+
+	RegionTable::RegionTable() :
+		m_isExact(false), m_isValid(false), m_nCols(0), m_nRows(0), m_shiftX(0), m_shiftY(0), m_nBlocksX(0), m_nBlocksY(0)
+	{
+	}
+
+	void RegionTable::Update(BinStorage& storage, const std::vector<double>& xCoordinates)
+	{
+		//Always consume, so that a stale flag is never left behind for the next Update
+		bool isModified = storage.ConsumeModified(BinStorage::Consumer::RegionTable);
+		if (m_isValid && !isModified && storage.GetNumberOfColumns() == m_nCols && storage.GetNumberOfRows() == m_nRows)
+			return;
+
+		SPEC_PROFILE_FUNCTION();
+		m_nCols = storage.GetNumberOfColumns();
+		m_nRows = storage.GetNumberOfRows();
+		GetBlockShifts(m_nCols, m_nRows, storage.IsTiled(), m_shiftX, m_shiftY);
+		m_nBlocksX = (m_nCols + (size_t(1) << m_shiftX) - 1) >> m_shiftX;
+		m_nBlocksY = (m_nRows + (size_t(1) << m_shiftY) - 1) >> m_shiftY;
+		m_xCoordinates = m_shiftX == 0 ? std::vector<double>() : xCoordinates;
+
+		BinCountType type = storage.GetCountType();
+		m_isExact = xCoordinates.empty() && (type == BinCountType::UInt32 || type == BinCountType::UInt64);
+		if (m_isExact)
+		{
+			m_table = std::vector<double>();
+			Build(storage, xCoordinates, m_exactTable);
+		}
+		else
+		{
+			m_exactTable = std::vector<uint64_t>();
+			Build(storage, xCoordinates, m_table);
+		}
+		m_isValid = true;
+	}
+
+	//Smallest blocks (starting from the tiles of tiled storage) for which the table has at most s_maxTableBins corners. The axis with more blocks is halved first
+	void RegionTable::GetBlockShifts(size_t nCols, size_t nRows, bool isTiled, size_t& shiftX, size_t& shiftY)
+	{
+		shiftX = isTiled ? BinStorage::s_tileShift : 0;
+		shiftY = isTiled ? BinStorage::s_tileShift : 0;
+		while (true)
+		{
+			size_t nBlocksX = (nCols + (size_t(1) << shiftX) - 1) >> shiftX;
+			size_t nBlocksY = (nRows + (size_t(1) << shiftY) - 1) >> shiftY;
+			if ((nBlocksX + 1) * (nBlocksY + 1) <= s_maxTableBins)
+				return;
+			if (nBlocksX >= nBlocksY)
+				shiftX++;
+			else
+				shiftY++;
+		}
+	}
+
+	//The sums of each block go into its far corner, which then becomes corner(x + 1, y + 1) = block + corner(x, y + 1) + corner(x + 1, y) - corner(x, y).
+	//Tiled storage only visits its allocated tiles; its counts pass through double, which is exact for integers up to 2^53
+	template<typename T>
+	void RegionTable::Build(BinStorage& storage, const std::vector<double>& xCoordinates, std::vector<T>& table)
+	{
+		size_t rowStride = (m_nBlocksX + 1) * s_nSums;
+		table.assign((m_nBlocksY + 1) * rowStride, T(0));
+		auto addBin = [&](size_t x, size_t y, T count)
+		{
+			T coordX = xCoordinates.empty() ? T(x) : T(xCoordinates[x]);
+			T coordY = T(y);
+			T* block = table.data() + ((y >> m_shiftY) + 1) * rowStride + ((x >> m_shiftX) + 1) * s_nSums;
+			block[0] += count;
+			block[1] += count * coordX;
+			block[2] += count * coordY;
+			block[3] += count * coordX * coordX;
+			block[4] += count * coordY * coordY;
+		};
+
+		if (storage.IsTiled())
+			storage.VisitRegion(0, m_nCols, 0, m_nRows, [&](size_t x, size_t y, double count) { addBin(x, y, T(count)); });
+		else
+		{
+			storage.GetBins().Visit([&](const auto* counts)
+			{
+				for (size_t y = 0; y < m_nRows; y++)
+					for (size_t x = 0; x < m_nCols; x++)
+						addBin(x, y, T(counts[y * m_nCols + x]));
+			});
+		}
+
+		for (size_t y = 1; y <= m_nBlocksY; y++)
+		{
+			T* above = table.data() + (y - 1) * rowStride;
+			T* corner = table.data() + y * rowStride;
+			for (size_t x = 1; x <= m_nBlocksX; x++)
+			{
+				for (size_t i = 0; i < s_nSums; i++)
+					corner[x * s_nSums + i] += corner[(x - 1) * s_nSums + i] + above[x * s_nSums + i] - above[(x - 1) * s_nSums + i];
+			}
+		}
+	}
+
+	//Sums over the blocks [xBegin, xEnd) x [yBegin, yEnd)
+	template<typename T>
+	RegionSums RegionTable::SumCorners(const std::vector<T>& table, size_t xBegin, size_t xEnd, size_t yBegin, size_t yEnd) const
+	{
+		size_t rowStride = (m_nBlocksX + 1) * s_nSums;
+		const T* topLeft = table.data() + yBegin * rowStride + xBegin * s_nSums;
+		const T* topRight = table.data() + yBegin * rowStride + xEnd * s_nSums;
+		const T* bottomLeft = table.data() + yEnd * rowStride + xBegin * s_nSums;
+		const T* bottomRight = table.data() + yEnd * rowStride + xEnd * s_nSums;
+		T sums[s_nSums];
+		for (size_t i = 0; i < s_nSums; i++)
+			sums[i] = bottomRight[i] - topRight[i] - bottomLeft[i] + topLeft[i];
+
+		RegionSums result;
+		result.n = double(sums[0]);
+		result.x = double(sums[1]);
+		result.y = double(sums[2]);
+		result.xx = double(sums[3]);
+		result.yy = double(sums[4]);
+		return result;
+	}
+
+	//Bin by bin, for the border of a region which doesn't cover whole blocks
+	RegionSums RegionTable::SumBins(BinStorage& storage, size_t xBegin, size_t xEnd, size_t yBegin, size_t yEnd) const
+	{
+		RegionSums result;
+		if (xBegin >= xEnd || yBegin >= yEnd)
+			return result;
+		storage.VisitRegion(xBegin, xEnd, yBegin, yEnd, [&](size_t x, size_t y, double count)
+		{
+			double coordX = m_xCoordinates.empty() ? double(x) : m_xCoordinates[x];
+			result.n += count;
+			result.x += count * coordX;
+			result.y += count * y;
+			result.xx += count * coordX * coordX;
+			result.yy += count * y * y;
+		});
+		return result;
+	}
+
+	//Size of the table of a storage with nCols x nRows bins
+	size_t RegionTable::EstimateMemorySize(size_t nCols, size_t nRows, bool isTiled)
+	{
+		size_t shiftX = 0;
+		size_t shiftY = 0;
+		GetBlockShifts(nCols, nRows, isTiled, shiftX, shiftY);
+		size_t nBlocksX = (nCols + (size_t(1) << shiftX) - 1) >> shiftX;
+		size_t nBlocksY = (nRows + (size_t(1) << shiftY) - 1) >> shiftY;
+		return (nBlocksX + 1) * (nBlocksY + 1) * s_nSums * sizeof(uint64_t);
+	}
+
+	//Whole blocks from the table, then the four strips of partial blocks around them
+	RegionSums RegionTable::Sum(BinStorage& storage, size_t xBegin, size_t xEnd, size_t yBegin, size_t yEnd) const
+	{
+		xEnd = std::min(xEnd, m_nCols);
+		yEnd = std::min(yEnd, m_nRows);
+		if (!m_isValid || xBegin >= xEnd || yBegin >= yEnd)
+			return RegionSums();
+
+		//The last block may be short, so the end of the storage also ends a block
+		size_t blockXBegin = (xBegin + (size_t(1) << m_shiftX) - 1) >> m_shiftX;
+		size_t blockXEnd = xEnd == m_nCols ? m_nBlocksX : xEnd >> m_shiftX;
+		size_t blockYBegin = (yBegin + (size_t(1) << m_shiftY) - 1) >> m_shiftY;
+		size_t blockYEnd = yEnd == m_nRows ? m_nBlocksY : yEnd >> m_shiftY;
+		if (blockXBegin >= blockXEnd || blockYBegin >= blockYEnd)
+			return SumBins(storage, xBegin, xEnd, yBegin, yEnd);
+
+		RegionSums result = m_isExact ? SumCorners(m_exactTable, blockXBegin, blockXEnd, blockYBegin, blockYEnd) : SumCorners(m_table, blockXBegin, blockXEnd, blockYBegin, blockYEnd);
+		size_t innerXBegin = blockXBegin << m_shiftX;
+		size_t innerXEnd = std::min(blockXEnd << m_shiftX, m_nCols);
+		size_t innerYBegin = blockYBegin << m_shiftY;
+		size_t innerYEnd = std::min(blockYEnd << m_shiftY, m_nRows);
+		for (const RegionSums& border : { SumBins(storage, xBegin, xEnd, yBegin, innerYBegin), SumBins(storage, xBegin, xEnd, innerYEnd, yEnd),
+										  SumBins(storage, xBegin, innerXBegin, innerYBegin, innerYEnd), SumBins(storage, innerXEnd, xEnd, innerYBegin, innerYEnd) })
+		{
+			result.n += border.n;
+			result.x += border.x;
+			result.y += border.y;
+			result.xx += border.xx;
+			result.yy += border.yy;
+		}
+		return result;
+	}
+}
@@ -0,0 +1,75 @@
+/*
+	RegionTable.h
+	Summed-area table of a histogram's counts, used by AnalyzeRegion. Each corner (x, y) of the table holds the sums over all bins below and left of it of
+	the counts n, n*x, n*y, n*x^2 and n*y^2, so the same sums over any rectangle of bins are four lookups. Integral, centroid and sigma of a region are thus
+	constant time, no matter how large the region or how many regions are open.
+
+	x and y are bin indices (the caller maps them to axis values), unless Update is given the x coordinate of each column. With integer counts and index
+	coordinates the table is kept in uint64: the sums of a rectangle are then exact (differences are taken modulo 2^64, so even wrapped corner sums give the
+	right answer as long as the rectangle's own sum fits). Otherwise the table is double.
+
+	A table costs 40 bytes per corner, so large storage is summed in blocks: a corner per block of bins rather than per bin, with the blocks made as small as
+	s_maxTableBins corners allow. Tiled storage (see BinStorage) uses at least its tiles as blocks, and is built from the allocated tiles only, so the table
+	stays small for a large, mostly empty histogram. The whole blocks inside a region are then four lookups as before, and the bins of the partial blocks along
+	its border are summed one by one, so a query costs in proportion to the region's perimeter rather than its area.
+
+	The table is rebuilt lazily: Update only rebuilds it if the bins changed since the last Update (see BinStorage::ConsumeModified).
+
+	Must be called with the SpectrumManager fill lock held, like anything else reading live bins.
+*/
+#ifndef REGION_TABLE_H
+#define REGION_TABLE_H
+
+#include "BinStorage.h"
+
+namespace Specter {
+
+	//Sums over a rectangle of bins
+	struct RegionSums
+	{
+		double n = 0.0;
+		double x = 0.0;
+		double y = 0.0;
+		double xx = 0.0;
+		double yy = 0.0;
+	};
+
+	class RegionTable
+	{
+	public:
+		RegionTable();
+
+		void Update(BinStorage& storage, const std::vector<double>& xCoordinates = {});
+		//Sums over the bins [xBegin, xEnd) x [yBegin, yEnd). storage must be the one last given to Update
+		RegionSums Sum(BinStorage& storage, size_t xBegin, size_t xEnd, size_t yBegin, size_t yEnd) const;
+		size_t GetMemorySize() const { return m_exactTable.capacity() * sizeof(uint64_t) + (m_table.capacity() + m_xCoordinates.capacity()) * sizeof(double); }
+
+		static size_t EstimateMemorySize(size_t nCols, size_t nRows, bool isTiled = false);
+
+		static constexpr size_t s_maxTableBins = size_t(1) << 20; //Corners
+
+	private:
+		static constexpr size_t s_nSums = 5; //n, x, y, xx, yy
+
+		static void GetBlockShifts(size_t nCols, size_t nRows, bool isTiled, size_t& shiftX, size_t& shiftY);
+		template<typename T>
+		void Build(BinStorage& storage, const std::vector<double>& xCoordinates, std::vector<T>& table);
+		template<typename T>
+		RegionSums SumCorners(const std::vector<T>& table, size_t xBegin, size_t xEnd, size_t yBegin, size_t yEnd) const;
+		RegionSums SumBins(BinStorage& storage, size_t xBegin, size_t xEnd, size_t yBegin, size_t yEnd) const;
+
+		std::vector<uint64_t> m_exactTable; //(nBlocksX + 1) x (nBlocksY + 1) corners of s_nSums sums, if m_isExact
+		std::vector<double> m_table; //Same, otherwise
+		std::vector<double> m_xCoordinates; //Only kept when summing the border bins of blocks needs them
+		bool m_isExact;
+		bool m_isValid;
+		size_t m_nCols;
+		size_t m_nRows;
+		size_t m_shiftX; //Bins per block along x, as a power of two
+		size_t m_shiftY;
+		size_t m_nBlocksX;
+		size_t m_nBlocksY;
+	};
+}
+
+#endif
@@ -7,45 +7,135 @@
 	Note that SpectrumManager is a singleton. There should only ever be one SpectrumManager with a given application.
 
 	GWM -- Feb 2022
+
+	The physics thread no longer takes the manager lock. Configuration edits publish an immutable FillPlan (RCU-style), and bin data has its own fill lock.
+	See SpectrumManager.h for details.
 */
 #include "SpectrumManager.h"
 
 #include "implot.h"
 
+#include <bit>
+
 namespace Specter {
 
-	SpectrumManager::SpectrumManager()
+	static constexpr double s_megabyte = 1024.0 * 1024.0;
+
+	SpectrumManager::SpectrumManager() :
+		m_planVersion(0), m_isShardedStorage(false), m_memoryBudget(s_defaultMemoryBudget), m_memoryBudgetPolicy(MemoryBudgetPolicy::Downgrade), m_isMemoryWarned(false),
+		m_nFilledEvents(0), m_cacheFirstEvent(0), m_isBackfillRunning(false)
 	{
+		PublishFillPlan(); //Start with a valid (empty) plan
+		SPEC_INFO("Histogram batch fills use the {0} bin kernel", GetFillKernelName());
 	}
 
 	SpectrumManager::~SpectrumManager()
 	{
+		if (m_backfillThread.joinable())
+			m_backfillThread.join();
 	}
 
 	/*************Histogram Functions Begin*************/
 
-	void SpectrumManager::AddHistogram(const HistogramArgs& params)
+	//Returns false if the histogram was not made, as it doesn't fit in the memory budget. It may also be made smaller than asked for, see FitMemoryBudget
+	//The histogram is allocated and the plan compiled under the manager lock alone; the fill lock is only taken to unlink a replaced histogram (EraseHistogram)
+	//and to note the event it starts from, so the physics thread never waits on the allocation.
+	bool SpectrumManager::AddHistogram(const HistogramArgs& params)
 	{
 		SPEC_PROFILE_FUNCTION();
 		std::scoped_lock<std::mutex> guard(m_managerMutex);
-		if (params.y_par == "None") //Check dimensionality
-			m_histoMap[params.name].reset(new Histogram1D(params));
+		HistogramArgs args = params;
+		if (args.type != SpectrumType::HistoND)
+			args.type = args.y_par == "None" ? SpectrumType::Histo1D : SpectrumType::Histo2D; //Check dimensionality
+		if (!FitMemoryBudget(args))
+			return false;
+
+		std::shared_ptr<Histogram> histogram;
+		if (args.type == SpectrumType::HistoND)
+			histogram = std::make_shared<HistogramND>(args);
+		else if (args.type == SpectrumType::Histo1D)
+			histogram = std::make_shared<Histogram1D>(args);
 		else
-			m_histoMap[params.name].reset(new Histogram2D(params));
+			histogram = std::make_shared<Histogram2D>(args);
+		histogram->SetShardedStorage(m_isShardedStorage);
+		histogram->UpdateSnapshot(true);
+
+		EraseHistogram(args.name); //A replaced projection or parent must be unlinked, as in RemoveHistogram
+		m_histoMap[args.name] = histogram;
+		{
+			std::scoped_lock<std::mutex> fillGuard(m_fillMutex);
+			m_histoFirstEvent[args.name] = m_nFilledEvents;
+		}
+		PublishFillPlan();
+		return true;
 	}
 
-	void SpectrumManager::AddHistogramSummary(const HistogramArgs& params, const std::vector<std::string>& subhistos)
+	//As AddHistogram. The snapshot of a linked summary reads its shared rows, which the physics thread fills, so it is taken under the fill lock
+	bool SpectrumManager::AddHistogramSummary(const HistogramArgs& params, const std::vector<std::string>& subhistos)
 	{
 		SPEC_PROFILE_FUNCTION();
 		std::scoped_lock<std::mutex> guard(m_managerMutex);
-		m_histoMap[params.name].reset(new HistogramSummary(params, subhistos));
+		HistogramArgs args = params;
+		args.type = SpectrumType::Summary;
+		args.nbins_y = int(subhistos.size());
+		if (!FitMemoryBudget(args))
+			return false;
+
+		std::vector<std::shared_ptr<Histogram1D>> sharedRows;
+		if (args.isLinkedSummary)
+			sharedRows = FindSharedRows(args, subhistos);
+		auto histogram = std::make_shared<HistogramSummary>(args, subhistos, sharedRows);
+		histogram->SetShardedStorage(m_isShardedStorage);
+
+		EraseHistogram(args.name);
+		m_histoMap[args.name] = histogram;
+		{
+			std::scoped_lock<std::mutex> fillGuard(m_fillMutex);
+			histogram->UpdateSnapshot(true);
+			m_histoFirstEvent[args.name] = m_nFilledEvents;
+		}
+		PublishFillPlan();
+		return true;
+	}
+
+	//Add a projection of a Histogram2D (params.parent) onto one of its axes, see Histogram.h. The projection is seeded with the parent's
+	//current counts and from then on filled by the parent.
+	void SpectrumManager::AddHistogramProjection(const HistogramArgs& params)
+	{
+		SPEC_PROFILE_FUNCTION();
+		std::scoped_lock<std::mutex> guard(m_managerMutex);
+		auto iter = m_histoMap.find(params.parent);
+		if (iter == m_histoMap.end() || iter->second->GetType() != SpectrumType::Histo2D || params.name == params.parent)
+		{
+			SPEC_WARN("Cannot make projection {0}, {1} is not a Histogram2D", params.name, params.parent);
+			return;
+		}
+		auto parent = std::static_pointer_cast<Histogram2D>(iter->second);
+		HistogramArgs args = parent->GetProjectionArgs(params);
+		if (!FitMemoryBudget(args, false))
+			return;
+
+		EraseHistogram(params.name);
+		{
+			//Seeding reads the parent's counts, and the parent fills its projections
+			std::scoped_lock<std::mutex> fillGuard(m_fillMutex);
+			std::shared_ptr<Histogram1D> projection = parent->CreateProjection(params);
+			if (projection == nullptr)
+				return;
+			projection->SetShardedStorage(m_isShardedStorage);
+			projection->UpdateSnapshot(true);
+			m_histoMap[params.name] = projection;
+			m_histoFirstEvent[params.name] = m_nFilledEvents;
+		}
+		PublishFillPlan();
 	}
 
 	void SpectrumManager::RemoveHistogram(const std::string& name)
 	{
 		SPEC_PROFILE_FUNCTION();
 		std::scoped_lock<std::mutex> guard(m_managerMutex);
-		m_histoMap.erase(name);
+		EraseHistogram(name);
+		PublishFillPlan();
 	}
 
 	void SpectrumManager::AddCutToHistogramDraw(const std::string& cutname, const std::string& histoname)
@@ -57,107 +147,199 @@ namespace Specter {
 			iter->second->AddCutToBeDrawn(cutname);
 	}
 
+	//A linked summary and the histograms sharing its rows must count the same events, so rows shared across the change get their own copy (fill lock)
 	void SpectrumManager::AddCutToHistogramApplied(const std::string& cutname, const std::string& histoname)
 	{
 		SPEC_PROFILE_FUNCTION();
-		std::scoped_lock<std::mutex> guard(m_managerMutex);
+		std::scoped_lock<std::mutex, std::mutex> guard(m_managerMutex, m_fillMutex);
 		auto iter = m_histoMap.find(histoname);
 		if (iter != m_histoMap.end())
+		{
 			iter->second->AddCutToBeApplied(cutname);
+			for (auto& pair : m_histoMap)
+			{
+				if (pair.second->GetType() == SpectrumType::Summary)
+					std::static_pointer_cast<HistogramSummary>(pair.second)->UnshareRows();
+			}
+			PublishFillPlan();
+		}
 	}
 
 	//Use this to fill histograms. Currently can only be filled in bulk; maybe a use case for individual fills?
+	//All lookups are done ahead of time by CompileFillPlan, so here we only walk the flattened plan. Physics thread only.
 	void SpectrumManager::UpdateHistograms()
 	{
 		SPEC_PROFILE_FUNCTION();
-		std::scoped_lock<std::mutex> guard(m_managerMutex);
+		AcquireFillPlan();
+		std::scoped_lock<std::mutex> guard(m_fillMutex);
+
+		AdvanceTimeWindows(*m_activePlan);
+		m_nFilledEvents++;
+		m_parameterCache.RecordEvent(m_paramState.touched);
+		FillEvent(*m_activePlan, m_fillState);
+		if (m_fillState.eventsSinceFlush >= s_cutStatsFlushEvents)
+			FlushCutStats(*m_activePlan);
+		UpdateSnapshots(*m_activePlan, false);
+	}
 
-		//Set state of all cuts for the event
-		CheckCuts();
+	//Fill histograms for every event staged in the batch under a single lock. Each replayed event gets its own parameter generation, and
+	//the event's values are written back into the ParameterData stamped with it. Moving to the next generation invalidates them again.
+	//The batch is cleared once done. Must be called between events (i.e. not while the AnalysisStack is setting parameters).
+	void SpectrumManager::UpdateHistograms(ParameterBatch& batch)
+	{
+		SPEC_PROFILE_FUNCTION();
+		AcquireFillPlan();
+		std::scoped_lock<std::mutex> guard(m_fillMutex);
+
+		const FillPlan& plan = *m_activePlan;
+		AdvanceTimeWindows(plan);
+		m_nFilledEvents += batch.GetNumberOfEvents();
+		m_parameterCache.Record(batch);
+
+		//Histograms without cuts are filled in bulk: 1D from per-parameter columns of the batch, 2D from the pairs collected while replaying (see FillEvent)
+		m_batchColumns.resize(plan.params.size());
+		for (auto& column : m_batchColumns)
+			column.clear();
+		for (auto& entry : batch.m_entries)
+		{
+			if (entry.index < plan.isBatchColumn.size() && plan.isBatchColumn[entry.index])
+				m_batchColumns[entry.index].push_back(entry.value);
+		}
+		for (auto& entry : plan.fill1D)
+		{
+			if (entry.isBatched)
+				entry.histogram->FillBatch(m_batchColumns[entry.xParam->index]);
+		}
 
-		bool cutFlag;
-		for (auto& pair : m_histoMap)
+		m_fillState.batchPairs.resize(plan.fill2D.size());
+		for (auto& pair : m_fillState.batchPairs)
 		{
-			cutFlag = true;
-			for (auto& cutname : pair.second->GetParameters().cutsAppliedTo) //check the associated cuts
-			{
-				if (!IsCutValid(cutname))
-				{
-					cutFlag = false;
-					break;
-				}
-			}
-			if (!cutFlag)
-				continue;
+			pair.first.clear();
+			pair.second.clear();
+		}
 
-			switch (pair.second->GetType())
+		for (size_t event = 0; event < batch.GetNumberOfEvents(); event++)
+		{
+			size_t entryBegin = batch.m_eventOffsets[event];
+			size_t entryEnd = batch.m_eventOffsets[event + 1];
+			uint64_t generation = ++m_paramState.generation;
+			for (size_t i = entryBegin; i < entryEnd; i++)
 			{
-				case SpectrumType::Histo1D:
-				{
-					auto iterX = m_paramMap.find(pair.second->GetXParam());
-					if (iterX != m_paramMap.end() && iterX->second->validFlag)
-						pair.second->FillData(iterX->second->value);
-					break;
-				}
-				case SpectrumType::Histo2D:
-				{
-					auto iterX = m_paramMap.find(pair.second->GetXParam());
-					auto iterY = m_paramMap.find(pair.second->GetYParam());
-					if (iterX != m_paramMap.end() && iterY != m_paramMap.end() && iterX->second->validFlag && iterY->second->validFlag)
-						pair.second->FillData(iterX->second->value, iterY->second->value);
-					break;
-				}
-				case SpectrumType::Summary:
-				{
-					const std::vector<std::string>& subhistos = std::static_pointer_cast<HistogramSummary>(pair.second)->GetSubHistograms();
-					for (size_t i = 0; i < subhistos.size(); i++)
-					{
-						auto iterX = m_paramMap.find(subhistos[i]);
-						if (iterX != m_paramMap.end() && iterX->second->validFlag)
-							pair.second->FillData(iterX->second->value, i + 0.5); //avoid floating point conversion issues
-					}
-					break;
-				}
-				case SpectrumType::None:
-				{
-					SPEC_WARN("Found a spectrum with None type!");
-					break;
-				}
+				ParameterData& data = *(batch.m_params[batch.m_entries[i].index]);
+				data.value = batch.m_entries[i].value;
+				data.stamp = generation;
 			}
+
+			FillEvent(plan, m_fillState, true);
 		}
 
-		//Reset the state of all cuts in preparation for next event
-		ResetCutValidities();
+		for (size_t i = 0; i < plan.fill2D.size(); i++)
+		{
+			if (plan.fill2D[i].isBatched)
+				plan.fill2D[i].histogram->FillBatch(m_fillState.batchPairs[i].first, m_fillState.batchPairs[i].second);
+		}
+
+		InvalidateParameters();
+		batch.Clear();
+		FlushCutStats(plan);
+		UpdateSnapshots(plan, false);
+
+		//Parameters bound since the last sync were not recorded by the batch; pick them up for the next batch
+		if (batch.m_params.size() != plan.params.size())
+			batch.m_params = plan.params;
 	}
 
-	void SpectrumManager::ClearHistograms()
+	//Switch all histograms (current and future) between flat and per-thread sharded bin storage. See BinStorage for details.
+	//Existing counts are preserved.
+	void SpectrumManager::SetShardedStorage(bool sharded)
 	{
 		SPEC_PROFILE_FUNCTION();
+		std::scoped_lock<std::mutex, std::mutex> guard(m_managerMutex, m_fillMutex);
+		m_isShardedStorage = sharded;
+		for (auto& pair : m_histoMap)
+			pair.second->SetShardedStorage(sharded);
+	}
+
+	//Publish new draw snapshots for any histograms the UI has asked for. Should be called periodically by the physics thread
+	//even when there is no data to fill. If ignoreRequests is true, every histogram with new data is published (i.e. the physics
+	//thread is about to stop and nobody will publish after this).
+	void SpectrumManager::PublishSnapshots(bool ignoreRequests)
+	{
+		SPEC_PROFILE_FUNCTION();
+		AcquireFillPlan();
+		std::scoped_lock<std::mutex> guard(m_fillMutex);
+		AdvanceTimeWindows(*m_activePlan);
+		FlushCutStats(*m_activePlan);
+		UpdateSnapshots(*m_activePlan, ignoreRequests);
+	}
+
+	bool SpectrumManager::IsShardedStorage()
+	{
 		std::scoped_lock<std::mutex> guard(m_managerMutex);
+		return m_isShardedStorage;
+	}
+
+	void SpectrumManager::ClearHistograms()
+	{
+		SPEC_PROFILE_FUNCTION();
+		std::scoped_lock<std::mutex, std::mutex> guard(m_managerMutex, m_fillMutex);
 		for (auto& pair : m_histoMap)
+		{
 			pair.second->ClearData();
+			pair.second->UpdateSnapshot(true);
+			m_histoFirstEvent[pair.first] = m_nFilledEvents;
+		}
 	}
 
 	void SpectrumManager::ClearHistogram(const std::string& name)
 	{
 		SPEC_PROFILE_FUNCTION();
-		std::scoped_lock<std::mutex> guard(m_managerMutex);
+		std::scoped_lock<std::mutex, std::mutex> guard(m_managerMutex, m_fillMutex);
 		auto iter = m_histoMap.find(name);
 		if (iter != m_histoMap.end())
+		{
 			iter->second->ClearData();
+			iter->second->UpdateSnapshot(true);
+			m_histoFirstEvent[name] = m_nFilledEvents;
+		}
 	}
 
-	void  SpectrumManager::DrawHistogram(const std::string& name)
+	//Select the projection (and gates) a HistogramND is drawn and analyzed with. The fill lock is taken as the projection is read when publishing snapshots
+	void SpectrumManager::SetHistogramProjection(const std::string& name, const ProjectionArgs& projection)
 	{
 		SPEC_PROFILE_FUNCTION();
-		std::scoped_lock<std::mutex> guard(m_managerMutex);
+		std::scoped_lock<std::mutex, std::mutex> guard(m_managerMutex, m_fillMutex);
 		auto iter = m_histoMap.find(name);
-		if (iter != m_histoMap.end())
+		if (iter != m_histoMap.end() && iter->second->GetType() == SpectrumType::HistoND)
+			std::static_pointer_cast<HistogramND>(iter->second)->SetProjection(projection);
+	}
+
+	//The manager lock is only held to find the histogram and its cuts. The actual drawing is done from the histogram's
+	//published snapshot, so that rendering never blocks the physics thread. Histograms and cuts are only ever modified
+	//from the UI thread (the same thread which draws), so it is safe to draw them outside of the lock.
+	void  SpectrumManager::DrawHistogram(const std::string& name)
+	{
+		SPEC_PROFILE_FUNCTION();
+		std::shared_ptr<Histogram> histo;
+		std::vector<std::shared_ptr<Cut>> cuts;
 		{
-			iter->second->Draw();
-			for (auto& cutname : iter->second->GetParameters().cutsDrawnUpon) //Draw all cuts made upon the histogram
-				DrawCut(cutname);
+			SPEC_PROFILE_SCOPE("DrawHistogram Lookup");
+			std::scoped_lock<std::mutex> guard(m_managerMutex);
+			auto iter = m_histoMap.find(name);
+			if (iter == m_histoMap.end())
+				return;
+			histo = iter->second;
+			for (auto& cutname : histo->GetParameters().cutsDrawnUpon) //Draw all cuts made upon the histogram
+			{
+				auto cutIter = m_cutMap.find(cutname);
+				if (cutIter != m_cutMap.end())
+					cuts.push_back(cutIter->second);
+			}
 		}
+
+		histo->Draw();
+		for (auto& cut : cuts)
+			cut->Draw();
 	}
 
 	const HistogramArgs& SpectrumManager::GetHistogramParams(const std::string& name)
@@ -187,7 +369,7 @@ namespace Specter {
 
     std::vector<double> SpectrumManager::GetBinData(const std::string& name)
     {
-        std::scoped_lock<std::mutex> guard(m_managerMutex);
+        std::scoped_lock<std::mutex, std::mutex> guard(m_managerMutex, m_fillMutex);
         auto iter = m_histoMap.find(name);
         if (iter != m_histoMap.end())
         {
@@ -197,6 +379,45 @@ namespace Specter {
         return std::vector<double>();
     }
 
+	//Copies of the counts of every histogram (except HistogramND), for saving. All are taken under one fill lock, so they are consistent with each other.
+	//The physics thread waits for the copy (a memcpy per histogram), but not for the caller writing them out.
+	std::vector<std::pair<std::string, BinBuffer>> SpectrumManager::CopyAllBins()
+	{
+		SPEC_PROFILE_FUNCTION();
+		std::scoped_lock<std::mutex, std::mutex> guard(m_managerMutex, m_fillMutex);
+		std::vector<std::pair<std::string, BinBuffer>> result;
+		result.reserve(m_histoMap.size());
+		for (auto& pair : m_histoMap)
+		{
+			BinBuffer bins;
+			if (pair.second->CopyBins(bins))
+				result.emplace_back(pair.first, std::move(bins));
+		}
+		return result;
+	}
+
+	//Number of counts CopyBins gives for the histogram, 0 if there is no such histogram or it has no dense counts (HistogramND)
+	size_t SpectrumManager::GetNumberOfBins(const std::string& name)
+	{
+		std::scoped_lock<std::mutex> guard(m_managerMutex);
+		auto iter = m_histoMap.find(name);
+		if (iter == m_histoMap.end() || iter->second->GetType() == SpectrumType::HistoND)
+			return 0;
+		const HistogramArgs& params = iter->second->GetParameters();
+		return params.type == SpectrumType::Histo1D ? size_t(params.nbins_x) : size_t(params.nbins_x) * size_t(params.nbins_y);
+	}
+
+	//Replace the counts of a histogram, for loading saved counts. Returns false if there is no such histogram or the counts don't fit it
+	bool SpectrumManager::RestoreBins(const std::string& name, BinBuffer&& bins)
+	{
+		std::scoped_lock<std::mutex, std::mutex> guard(m_managerMutex, m_fillMutex);
+		auto iter = m_histoMap.find(name);
+		if (iter == m_histoMap.end() || !iter->second->RestoreBins(std::move(bins)))
+			return false;
+		m_histoFirstEvent.erase(name); //The restored counts were never cached
+		return true;
+	}
+
 	std::vector<std::string> SpectrumManager::GetSubHistograms(const std::string& name)
 	{
 		SPEC_PROFILE_FUNCTION();
@@ -213,7 +434,7 @@ namespace Specter {
 	//Pass through for stats
 	StatResults SpectrumManager::AnalyzeHistogramRegion(const std::string& name, const ImPlotRect& region)
 	{
-		std::scoped_lock<std::mutex> guard(m_managerMutex);
+		std::scoped_lock<std::mutex, std::mutex> guard(m_managerMutex, m_fillMutex);
 		auto iter = m_histoMap.find(name);
 		if (iter != m_histoMap.end())
 			return iter->second->AnalyzeRegion(region.X.Min, region.X.Max, region.Y.Min, region.Y.Max);
@@ -237,6 +458,438 @@ namespace Specter {
 
 	/*************Histogram Functions End*************/
 
+	/*************Memory Functions Begin*************/
+
+	//budget in bytes, 0 for no budget. Only applies to histograms made from now on
+	void SpectrumManager::SetMemoryBudget(size_t budget, MemoryBudgetPolicy policy)
+	{
+		std::scoped_lock<std::mutex> guard(m_managerMutex);
+		m_memoryBudget = budget;
+		m_memoryBudgetPolicy = policy;
+	}
+
+	size_t SpectrumManager::GetMemoryBudget()
+	{
+		std::scoped_lock<std::mutex> guard(m_managerMutex);
+		return m_memoryBudget;
+	}
+
+	MemoryBudgetPolicy SpectrumManager::GetMemoryBudgetPolicy()
+	{
+		std::scoped_lock<std::mutex> guard(m_managerMutex);
+		return m_memoryBudgetPolicy;
+	}
+
+	//Budget left for a new histogram called name (replacing any histogram of that name). Only meaningful if there is a budget
+	size_t SpectrumManager::GetAvailableMemory(const std::string& name)
+	{
+		std::scoped_lock<std::mutex> guard(m_managerMutex);
+		size_t reserved = GetReservedMemory(name);
+		return reserved < m_memoryBudget ? m_memoryBudget - reserved : 0;
+	}
+
+	//What every histogram holds, and can grow to. Takes the fill lock, and reads data only used by the UI thread (draw buffers, heatmap levels),
+	//so must be called from the UI thread. Meant to be polled now and then, not every frame.
+	MemoryReport SpectrumManager::GetMemoryReport()
+	{
+		SPEC_PROFILE_FUNCTION();
+		std::scoped_lock<std::mutex, std::mutex> guard(m_managerMutex, m_fillMutex);
+		MemoryReport report;
+		report.budget = m_memoryBudget;
+		report.histograms.reserve(m_histoMap.size());
+		for (auto& gram : m_histoMap)
+		{
+			HistogramMemory memory;
+			memory.name = gram.first;
+			memory.used = gram.second->GetMemorySize();
+			memory.reserved = EstimateHistogramMemorySize(gram.second->GetParameters());
+			memory.droppedCounts = gram.second->GetDroppedCounts();
+			report.used += memory.used;
+			report.reserved += memory.reserved;
+			report.histograms.push_back(std::move(memory));
+		}
+		std::sort(report.histograms.begin(), report.histograms.end(), [](const HistogramMemory& a, const HistogramMemory& b) { return a.used > b.used; });
+
+		report.isNearBudget = m_memoryBudget != 0 && double(std::max(report.used, report.reserved)) >= s_memoryWarningFraction * m_memoryBudget;
+		if (report.isNearBudget && !m_isMemoryWarned)
+			SPEC_WARN("Histograms hold {0:.1f} MB and can grow to {1:.1f} MB, close to the memory budget of {2:.1f} MB.", report.used / s_megabyte, report.reserved / s_megabyte, m_memoryBudget / s_megabyte);
+		m_isMemoryWarned = report.isNearBudget;
+		return report;
+	}
+
+	//Sum of what the histograms can grow to, except for the histogram called excluded. Called with the manager lock held
+	size_t SpectrumManager::GetReservedMemory(const std::string& excluded)
+	{
+		size_t reserved = 0;
+		for (auto& gram : m_histoMap)
+		{
+			if (gram.first != excluded)
+				reserved += EstimateHistogramMemorySize(gram.second->GetParameters());
+		}
+		return reserved;
+	}
+
+	//Checks a new histogram against the memory budget. With MemoryBudgetPolicy::Downgrade the args are made smaller, a step at a time and losing the least first,
+	//until the histogram fits: 4 byte counts, then (Histogram2D) sparse storage for at least a quarter of the bins, then half the bins on each axis.
+	//Projections are not resizable (their binning follows the parent), so they either fit or are rejected.
+	//params.type must be resolved. Returns false if the histogram should not be made. Called with the manager lock held
+	bool SpectrumManager::FitMemoryBudget(HistogramArgs& params, bool isResizable)
+	{
+		if (m_memoryBudget == 0)
+			return true;
+
+		size_t reserved = GetReservedMemory(params.name);
+		size_t available = reserved < m_memoryBudget ? m_memoryBudget - reserved : 0;
+		size_t size = EstimateHistogramMemorySize(params);
+		if (size <= available)
+			return true;
+
+		size_t requested = size;
+		bool isCoarsenable = params.type != SpectrumType::Histo1D || params.binning_x == BinningType::Uniform || params.binning_x == BinningType::Log; //Edges can't be halved
+		while (isResizable && m_memoryBudgetPolicy == MemoryBudgetPolicy::Downgrade && size > available)
+		{
+			size_t denseBinMemory = size_t(params.nbins_x) * size_t(params.nbins_y) * GetBinCountSize(params.countType);
+			if (GetBinCountSize(params.countType) > sizeof(uint32_t))
+				params.countType = params.windowMode == TimeWindowMode::Decaying ? BinCountType::Float : BinCountType::UInt32;
+			else if (params.type == SpectrumType::Histo2D && params.windowMode != TimeWindowMode::Rolling && (params.maxBinMemory == 0 || params.maxBinMemory / 2 >= denseBinMemory / 4))
+				params.maxBinMemory = (params.maxBinMemory == 0 ? denseBinMemory : params.maxBinMemory) / 2;
+			else if (isCoarsenable && (params.nbins_x > 1 || (params.type == SpectrumType::Histo2D && params.nbins_y > 1)))
+			{
+				params.maxBinMemory = 0;
+				params.nbins_x = std::max(params.nbins_x / 2, 1);
+				if (params.type == SpectrumType::Histo2D)
+					params.nbins_y = std::max(params.nbins_y / 2, 1);
+			}
+			else
+				break;
+			size = EstimateHistogramMemorySize(params);
+		}
+
+		if (size > available)
+		{
+			SPEC_ERROR("Histogram {0} needs up to {1:.1f} MB, but only {2:.1f} MB of the memory budget are left. Histogram not created.", params.name, requested / s_megabyte, available / s_megabyte);
+			return false;
+		}
+		SPEC_WARN("Histogram {0} needs up to {1:.1f} MB, but only {2:.1f} MB of the memory budget are left. Made with {3} counts, {4} x {5} bins and {6} storage instead, up to {7:.1f} MB.",
+				  params.name, requested / s_megabyte, available / s_megabyte, ConvertBinCountTypeToString(params.countType), params.nbins_x, std::max(params.nbins_y, 1),
+				  params.maxBinMemory == 0 ? "dense" : "sparse", size / s_megabyte);
+		return true;
+	}
+
+	/*************Memory Functions End*************/
+
+	/*************Parameter Cache Functions Begin*************/
+
+	//Fill lock, so that no event is filled between (re)starting the recording and noting where it starts
+	void SpectrumManager::SetParameterCache(const ParameterCacheArgs& args)
+	{
+		std::scoped_lock<std::mutex> guard(m_fillMutex);
+		m_parameterCache.SetArgs(args);
+		if (m_parameterCache.GetStats().events == 0)
+			m_cacheFirstEvent = m_nFilledEvents;
+	}
+
+	ParameterCacheArgs SpectrumManager::GetParameterCacheArgs()
+	{
+		return m_parameterCache.GetArgs();
+	}
+
+	ParameterCacheStats SpectrumManager::GetParameterCacheStats()
+	{
+		return m_parameterCache.GetStats();
+	}
+
+	void SpectrumManager::ClearParameterCache()
+	{
+		std::scoped_lock<std::mutex> guard(m_fillMutex);
+		m_parameterCache.Clear();
+		m_cacheFirstEvent = m_nFilledEvents;
+	}
+
+	//Run BackfillHistograms on a worker thread, so that the UI keeps drawing while the cache is replayed. One backfill at a time. UI thread only
+	void SpectrumManager::StartBackfill(const std::vector<std::string>& names)
+	{
+		if (m_isBackfillRunning.exchange(true))
+		{
+			SPEC_WARN("A backfill is already running, try again once it is done");
+			return;
+		}
+		if (m_backfillThread.joinable())
+			m_backfillThread.join();
+		m_backfillThread = std::thread([this, names]()
+		{
+			BackfillHistograms(names);
+			m_isBackfillRunning.store(false);
+		});
+	}
+
+	bool SpectrumManager::IsBackfillRunning() const
+	{
+		return m_isBackfillRunning.load();
+	}
+
+	//Clear the named histograms and fill them again from every event in the parameter cache, with their current cuts. Returns the number of events replayed.
+	//Projections are filled by their parent (and cleared with it), and time windowed histograms are skipped, as the cache doesn't know when an event happened.
+	//A histogram is only backfilled if the cache holds every event it was filled with (see m_histoFirstEvent), and nothing is backfilled from a full cache,
+	//as the events since it filled up would be lost. The physics thread may keep running: checking, taking the cache contents and clearing happen under one
+	//fill lock, and every event after that is filled live. The replay itself holds neither the manager lock nor, between chunks, the fill lock; the plan keeps
+	//everything it fills alive should the histograms be removed meanwhile.
+	uint64_t SpectrumManager::BackfillHistograms(const std::vector<std::string>& names)
+	{
+		SPEC_PROFILE_FUNCTION();
+		std::scoped_lock<std::mutex> backfillGuard(m_backfillMutex); //Backfills would clear each other's histograms
+		if (!m_parameterCache.IsEnabled())
+		{
+			SPEC_WARN("Cannot backfill histograms, the parameter cache is off");
+			return 0;
+		}
+
+		std::unique_lock<std::mutex> managerGuard(m_managerMutex);
+		std::unique_lock<std::mutex> binGuard(m_fillMutex);
+		if (m_parameterCache.GetStats().isFull)
+		{
+			SPEC_WARN("Cannot backfill histograms, the parameter cache is full and is missing every event since. Clear the cache to record again");
+			return 0;
+		}
+
+		std::unordered_set<Histogram*> targets;
+		std::vector<Histogram*> cleared;
+		std::vector<std::string> backfilled;
+		for (auto& name : names)
+		{
+			auto iter = m_histoMap.find(name);
+			if (iter == m_histoMap.end())
+				continue;
+			const HistogramArgs& params = iter->second->GetParameters();
+			if (params.parent != "None")
+				SPEC_WARN("Histogram {0} is a projection, backfill its parent {1} instead", name, params.parent);
+			else if (params.windowMode != TimeWindowMode::None)
+				SPEC_WARN("Histogram {0} has a time window, it cannot be backfilled", name);
+			else if (!m_histoFirstEvent.contains(name) || m_histoFirstEvent[name] < m_cacheFirstEvent)
+				SPEC_WARN("Histogram {0} holds events the parameter cache does not have, backfilling it would lose them", name);
+			else if (targets.insert(iter->second.get()).second)
+			{
+				backfilled.push_back(name);
+				cleared.push_back(iter->second.get());
+				if (params.type == SpectrumType::Summary && params.isLinkedSummary)
+				{
+					//The summary's own rows are filled as 1D entries. Shared rows belong to their histogram, and are backfilled with it
+					auto summary = static_cast<HistogramSummary*>(iter->second.get());
+					for (size_t i = 0; i < summary->GetSubHistograms().size(); i++)
+					{
+						if (!summary->IsRowShared(i))
+							targets.insert(summary->GetRow(i));
+					}
+				}
+				else if (params.type == SpectrumType::Histo2D)
+				{
+					for (auto& projection : static_cast<Histogram2D*>(iter->second.get())->GetProjections())
+					{
+						auto projectionIter = m_histoMap.find(projection);
+						if (projectionIter != m_histoMap.end())
+							cleared.push_back(projectionIter->second.get());
+					}
+				}
+			}
+		}
+		if (targets.empty())
+			return 0;
+
+		//Plan for the targets alone, pointing at private copies of the parameters, so that the replay never touches what the physics thread is using
+		ParameterState replayState;
+		std::vector<ParameterData> replayParams(m_paramList.size());
+		for (size_t i = 0; i < replayParams.size(); i++)
+		{
+			replayParams[i].index = uint32_t(i);
+			replayParams[i].state = &replayState;
+		}
+		auto retarget = [&replayParams](ParameterData*& data)
+		{
+			if (data != nullptr)
+				data = &replayParams[data->index];
+		};
+
+		FillPlan plan;
+		CompileFillPlan(plan);
+		std::erase_if(plan.fill1D, [&targets](const Fill1DEntry& entry) { return !targets.contains(entry.histogram); });
+		std::erase_if(plan.fill2D, [&targets](const Fill2DEntry& entry) { return !targets.contains(entry.histogram); });
+		std::erase_if(plan.fillSummary, [&targets](const FillSummaryEntry& entry) { return !targets.contains(entry.histogram); });
+		std::erase_if(plan.fillND, [&targets](const FillNDEntry& entry) { return !targets.contains(entry.histogram); });
+
+		//Parameters which the event by event replay has to set; batched 1D entries are filled straight from the cached columns
+		std::vector<uint32_t> eventParams;
+		auto addEventParam = [&eventParams](ParameterData* data)
+		{
+			if (data != nullptr && std::find(eventParams.begin(), eventParams.end(), data->index) == eventParams.end())
+				eventParams.push_back(data->index);
+		};
+		bool isEventByEvent = !plan.fillSummary.empty() || !plan.fillND.empty() ||
+			std::any_of(plan.fill1D.begin(), plan.fill1D.end(), [](const Fill1DEntry& entry) { return !entry.isBatched; }) ||
+			std::any_of(plan.fill2D.begin(), plan.fill2D.end(), [](const Fill2DEntry& entry) { return !entry.isBatched; });
+		if (isEventByEvent)
+		{
+			for (auto& entry : plan.cuts)
+			{
+				addEventParam(entry.xParam);
+				addEventParam(entry.yParam);
+				for (auto* param : entry.subParams)
+					addEventParam(param);
+			}
+			for (auto& entry : plan.fill1D)
+			{
+				if (!entry.isBatched)
+					addEventParam(entry.xParam);
+			}
+			for (auto& entry : plan.fill2D)
+			{
+				addEventParam(entry.xParam);
+				addEventParam(entry.yParam);
+			}
+			for (auto& entry : plan.fillSummary)
+			{
+				for (auto& subParam : entry.subParams)
+					addEventParam(subParam.first);
+			}
+			for (auto& entry : plan.fillND)
+			{
+				for (auto* param : entry.params)
+					addEventParam(param);
+			}
+		}
+
+		for (auto& entry : plan.cuts)
+		{
+			retarget(entry.xParam);
+			retarget(entry.yParam);
+			for (auto& param : entry.subParams)
+				retarget(param);
+		}
+		for (auto& entry : plan.fill1D)
+			retarget(entry.xParam);
+		for (auto& entry : plan.fill2D)
+		{
+			retarget(entry.xParam);
+			retarget(entry.yParam);
+		}
+		for (auto& entry : plan.fillSummary)
+		{
+			for (auto& subParam : entry.subParams)
+				retarget(subParam.first);
+		}
+		for (auto& entry : plan.fillND)
+		{
+			for (auto& param : entry.params)
+				retarget(param);
+		}
+		GroupFillEntries(plan);
+
+		ParameterCache::Contents contents = m_parameterCache.GetContents();
+		for (auto* histogram : cleared)
+			histogram->ClearData();
+		for (auto& name : backfilled)
+			m_histoFirstEvent[name] = m_cacheFirstEvent;
+		binGuard.unlock();
+		managerGuard.unlock();
+
+		FillState state;
+		state.cutMemo.assign(plan.cuts.size(), CutMemo());
+		state.batchPairs.resize(plan.fill2D.size());
+		bool isComplete = ParameterCache::ForEachChunk(contents, [&](const ParameterCache::ChunkView& chunk)
+		{
+			std::scoped_lock<std::mutex> fillGuard(m_fillMutex);
+			ReplayCachedChunk(plan, state, chunk, replayParams, eventParams);
+		});
+
+		{
+			std::scoped_lock<std::mutex> fillGuard(m_fillMutex);
+			for (auto* histogram : cleared)
+				histogram->UpdateSnapshot(true);
+		}
+		if (!isComplete)
+			SPEC_ERROR("Backfill stopped early, the histograms are missing part of the cached events");
+		SPEC_INFO("Backfilled {0} histogram(s) from {1} cached events", targets.size(), contents.events);
+		return contents.events;
+	}
+
+	//Values of the events of a chunk where both columns are valid. The values of a column are packed, so an event's value is at the number of valid events before it
+	static void GatherCachedPairs(const ParameterCache::ColumnView& x, const ParameterCache::ColumnView& y, std::vector<double>& xValues, std::vector<double>& yValues)
+	{
+		if (x.valid.empty() || y.valid.empty())
+			return;
+		size_t xOffset = 0;
+		size_t yOffset = 0;
+		for (size_t word = 0; word < x.valid.size(); word++)
+		{
+			uint64_t both = x.valid[word] & y.valid[word];
+			while (both != 0)
+			{
+				uint64_t below = (both & (~both + 1)) - 1; //bits under the lowest set bit
+				xValues.push_back(x.values[xOffset + std::popcount(x.valid[word] & below)]);
+				yValues.push_back(y.values[yOffset + std::popcount(y.valid[word] & below)]);
+				both &= both - 1;
+			}
+			xOffset += std::popcount(x.valid[word]);
+			yOffset += std::popcount(y.valid[word]);
+		}
+	}
+
+	//Fill the histograms of a backfill plan with one chunk of the parameter cache. Fill lock must be held.
+	//Batched 1D entries take the packed column as is. Everything else is replayed event by event through FillEvent, with the chunk's values written into params
+	//(the plan's private parameters) for the parameters in eventParams; if nothing needs that, batched 2D entries gather their pairs from the columns instead.
+	void SpectrumManager::ReplayCachedChunk(const FillPlan& plan, FillState& state, const ParameterCache::ChunkView& chunk, std::vector<ParameterData>& params, const std::vector<uint32_t>& eventParams)
+	{
+		static const ParameterCache::ColumnView s_emptyColumn;
+		auto getColumn = [&chunk](uint32_t index) -> const ParameterCache::ColumnView&
+		{
+			return index < chunk.columns.size() ? chunk.columns[index] : s_emptyColumn;
+		};
+
+		for (auto& entry : plan.fill1D)
+		{
+			if (entry.isBatched)
+				entry.histogram->FillBatch(getColumn(entry.xParam->index).values);
+		}
+
+		for (auto& pair : state.batchPairs)
+		{
+			pair.first.clear();
+			pair.second.clear();
+		}
+
+		if (eventParams.empty())
+		{
+			for (size_t i = 0; i < plan.fill2D.size(); i++)
+				GatherCachedPairs(getColumn(plan.fill2D[i].xParam->index), getColumn(plan.fill2D[i].yParam->index), state.batchPairs[i].first, state.batchPairs[i].second);
+		}
+		else
+		{
+			ParameterState& replayState = *params.front().state;
+			std::vector<size_t> offsets(eventParams.size(), 0);
+			for (uint32_t event = 0; event < chunk.nEvents; event++)
+			{
+				uint64_t generation = ++replayState.generation;
+				for (size_t i = 0; i < eventParams.size(); i++)
+				{
+					const ParameterCache::ColumnView& column = getColumn(eventParams[i]);
+					if (column.valid.empty() || ((column.valid[event >> 6] >> (event & 63)) & 1) == 0)
+						continue;
+					ParameterData& data = params[eventParams[i]];
+					data.value = column.values[offsets[i]++];
+					data.stamp = generation;
+				}
+				FillEvent(plan, state, true);
+			}
+		}
+
+		for (size_t i = 0; i < plan.fill2D.size(); i++)
+		{
+			if (plan.fill2D[i].isBatched)
+				plan.fill2D[i].histogram->FillBatch(state.batchPairs[i].first, state.batchPairs[i].second);
+		}
+	}
+
+	/*************Parameter Cache Functions End*************/
+
 	/*************Graph Functions Begin*************/
 
 	void SpectrumManager::AddGraph(const GraphArgs& args)
@@ -328,14 +981,19 @@ namespace Specter {
 		auto iter = m_paramMap.find(param.GetName());
 		if (iter == m_paramMap.end())
 		{
-			m_paramMap[param.GetName()].reset(new ParameterData());
+			std::shared_ptr<ParameterData> data = std::make_shared<ParameterData>();
+			data->index = uint32_t(m_paramList.size());
+			data->state = &m_paramState;
+			m_paramMap[param.GetName()] = data;
+			m_paramList.push_back(data);
 		}
 
 		param.m_pdata = m_paramMap[param.GetName()];
+		PublishFillPlan();
 	}
 
 	//Bind a Parameter instance to the manager. If the Parameter doesn't exist, make a new one, otherwise attach to extant memory
-	//Additionally, make a default 1D histogram for the parameter (histogram has same name as parameter)
+	//Additionally, make a default 1D histogram for the parameter (histogram has same name as parameter), against the memory budget as in AddHistogram
 	void SpectrumManager::BindParameter(Parameter& param, int nbins, double minVal, double maxVal)
 	{
 		SPEC_PROFILE_FUNCTION();
@@ -343,7 +1001,11 @@ namespace Specter {
 		auto iter = m_paramMap.find(param.GetName());
 		if (iter == m_paramMap.end())
 		{
-			m_paramMap[param.GetName()].reset(new ParameterData());
+			std::shared_ptr<ParameterData> data = std::make_shared<ParameterData>();
+			data->index = uint32_t(m_paramList.size());
+			data->state = &m_paramState;
+			m_paramMap[param.GetName()] = data;
+			m_paramList.push_back(data);
 		}
 
 		param.m_pdata = m_paramMap[param.GetName()];
@@ -352,20 +1014,35 @@ namespace Specter {
 		if (histoIter == m_histoMap.end())
 		{
 			HistogramArgs histo(param.GetName(), param.GetName(), nbins, minVal, maxVal);
-			m_histoMap[param.GetName()].reset(new Histogram1D(histo));
+			histo.type = SpectrumType::Histo1D;
+			if (FitMemoryBudget(histo))
+			{
+				auto histogram = std::make_shared<Histogram1D>(histo);
+				histogram->SetShardedStorage(m_isShardedStorage);
+				histogram->UpdateSnapshot(true);
+				m_histoMap[param.GetName()] = histogram;
+				std::scoped_lock<std::mutex> fillGuard(m_fillMutex);
+				m_histoFirstEvent[param.GetName()] = m_nFilledEvents;
+			}
 		}
+		PublishFillPlan();
 	}
 
-	//Once an analysis pass is done and histograms filled, reset all parameters
+	//Once an analysis pass is done and histograms filled, reset all parameters. This just moves to the next generation (see ParameterState). Physics thread only.
 	void SpectrumManager::InvalidateParameters()
+	{
+		m_paramState.touched.clear();
+		m_paramState.generation++;
+	}
+
+	//Give a ParameterBatch access to all of the currently bound parameters. Should be called before recording the first event. Physics thread only.
+	void SpectrumManager::PrepareParameterBatch(ParameterBatch& batch)
 	{
 		SPEC_PROFILE_FUNCTION();
-		std::scoped_lock<std::mutex> guard(m_managerMutex);
-		for (auto& param : m_paramMap)
-		{
-			param.second->validFlag = false;
-			param.second->value = 0.0;
-		}
+		AcquireFillPlan();
+		batch.Clear();
+		batch.m_params = m_activePlan->params;
+		batch.m_state = &m_paramState;
 	}
 
 	//Similar to GetListOfHistograms, see that documentation
@@ -467,18 +1144,21 @@ namespace Specter {
 	{
 		std::scoped_lock<std::mutex> guard(m_managerMutex);
 		m_cutMap[params.name].reset(new Cut1D(params, min, max));
+		PublishFillPlan();
 	}
 
 	void SpectrumManager::AddCut(const CutArgs& params, const std::vector<double>& xpoints, const std::vector<double>& ypoints)
 	{
 		std::scoped_lock<std::mutex> guard(m_managerMutex);
 		m_cutMap[params.name].reset(new Cut2D(params, xpoints, ypoints));
+		PublishFillPlan();
 	}
 
 	void SpectrumManager::AddCut(const CutArgs& params, const std::vector<std::string>& subhistos, double min, double max)
 	{
 		std::scoped_lock<std::mutex> guard(m_managerMutex);
 		m_cutMap[params.name].reset(new CutSummary(params, subhistos, min, max));
+		PublishFillPlan();
 	}
 
 	void SpectrumManager::RemoveCut(const std::string& name)
@@ -487,6 +1167,7 @@ namespace Specter {
 		std::scoped_lock<std::mutex> guard(m_managerMutex);
 		m_cutMap.erase(name);
 		RemoveCutFromHistograms(name); //Once a cut is gone, remove all references to it.
+		PublishFillPlan();
 	}
 
 	std::vector<double> SpectrumManager::GetCutXPoints(const std::string& name)
@@ -532,12 +1213,23 @@ namespace Specter {
 		return list;
 	}
 
+	//Number of events the cut was evaluated for, and the number of events where no histogram needed it
+	CutEvaluationStats SpectrumManager::GetCutEvaluationStats(const std::string& cutname)
+	{
+		std::scoped_lock<std::mutex> guard(m_managerMutex);
+		auto iter = m_cutMap.find(cutname);
+		if (iter != m_cutMap.end())
+			return iter->second->GetEvaluationStats();
+		return CutEvaluationStats();
+	}
+
 	/*************Cut Functions End*************/
 
 	/*
 		Private Functions
 		Can only be called from within the SpectrumManager, therefore the lock should already have been aquired by 
-		whatever parent function calls them. No explicit synchronization.
+		whatever parent function calls them. No explicit synchronization. The exception is the fill plan; the functions which
+		use a FillPlan only touch the plan they are given and the bins of its histograms (fill lock held by the caller).
 	*/
 
 	//Can only be called by RemoveCut currently. May be a use case where this should be promoted to public to on the fly mod a gram.
@@ -564,93 +1256,550 @@ namespace Specter {
 		}
 	}
 
-	//Obv. only need to draw a cut if its parent histogram is drawn.
-	void SpectrumManager::DrawCut(const std::string& name)
+	/*
+		Compile the fill plan. Resolve every parameter and cut name used by the histograms/cuts into direct pointers/indices.
+		Histograms whose parameters do not exist, or which have a cut applied that does not exist, can never be filled, so they
+		are simply left out of the plan. Same behavior as looking everything up per event, just done once.
+	*/
+	void SpectrumManager::CompileFillPlan(FillPlan& plan)
 	{
 		SPEC_PROFILE_FUNCTION();
-		auto iter = m_cutMap.find(name);
-		if (iter != m_cutMap.end())
-			iter->second->Draw();
-	}
+		plan.params = m_paramList;
+		plan.isBatchColumn.assign(plan.params.size(), false);
 
-	//Set the state of the cuts for the current event. Called by the 
-	void SpectrumManager::CheckCuts()
-	{
-		SPEC_PROFILE_FUNCTION();
+		std::unordered_map<std::string, uint32_t> cutIndexMap;
 		for (auto& iter : m_cutMap)
 		{
-			const std::string& xpar = iter.second->GetXParameter();
-			const std::string& ypar = iter.second->GetYParameter();
-			switch (iter.second->GetType())
+			CutPlanEntry entry;
+			entry.cut = iter.second.get();
+			entry.type = iter.second->GetType();
+			switch (entry.type)
 			{
 				case CutType::Cut1D:
 				{
-					auto iterX = m_paramMap.find(xpar);
-					if (iterX != m_paramMap.end() && iterX->second->validFlag)
-						iter.second->IsInside(iterX->second->value);
+					entry.xParam = FindParameterData(iter.second->GetXParameter());
 					break;
 				}
 				case CutType::Cut2D:
 				{
-					auto iterX = m_paramMap.find(xpar);
-					auto iterY = m_paramMap.find(ypar);
-					if (iterX != m_paramMap.end() && iterX->second->validFlag && iterY != m_paramMap.end() && iterY->second->validFlag)
-						iter.second->IsInside(iterX->second->value, iterY->second->value);
+					entry.xParam = FindParameterData(iter.second->GetXParameter());
+					entry.yParam = FindParameterData(iter.second->GetYParameter());
 					break;
 				}
-				case CutType::CutSummaryAll:
+				case CutType::CutSummaryAll: case CutType::CutSummaryAny:
 				{
-					std::vector<std::string> paramlist = std::static_pointer_cast<CutSummary>(iter.second)->GetSubHistograms();
-					for (auto& param : paramlist)
+					for (auto& param : std::static_pointer_cast<CutSummary>(iter.second)->GetSubHistograms())
 					{
-						auto iterX = m_paramMap.find(param);
-						if (iterX != m_paramMap.end() && iterX->second->validFlag)
-						{
-							iter.second->IsInside(iterX->second->value);
-							if (!iter.second->IsValid())
-								break;
-						}
+						ParameterData* data = FindParameterData(param);
+						if (data)
+							entry.subParams.push_back(data);
 					}
 					break;
 				}
-				case CutType::CutSummaryAny:
+				case CutType::None:
 				{
-					std::vector<std::string> paramlist = std::static_pointer_cast<CutSummary>(iter.second)->GetSubHistograms();
-					for (auto& param : paramlist)
+					SPEC_WARN("Found a cut with None type!");
+					break;
+				}
+			}
+			cutIndexMap[iter.first] = uint32_t(plan.cuts.size());
+			plan.cuts.push_back(entry);
+			plan.cutRefs.push_back(iter.second);
+		}
+
+		for (auto& pair : m_histoMap)
+		{
+			plan.histograms.push_back(pair.second); //All histograms get snapshots, even those which can't be filled
+			if (!pair.second->IsInitialized()) //Illegal histograms have no bins to fill
+				continue;
+			if (pair.second->GetParameters().windowMode != TimeWindowMode::None)
+				plan.windowed.push_back(pair.second.get());
+			uint32_t cutBegin, cutEnd;
+			if (!ResolveAppliedCuts(plan, pair.second->GetParameters(), cutIndexMap, cutBegin, cutEnd))
+				continue;
+
+			switch (pair.second->GetType())
+			{
+				case SpectrumType::Histo1D:
+				{
+					if (pair.second->GetParameters().parent != "None") //Projections are filled by their parent
+						break;
+					Fill1DEntry entry;
+					entry.histogram = static_cast<Histogram1D*>(pair.second.get());
+					entry.xParam = FindParameterData(pair.second->GetXParam());
+					entry.cutBegin = cutBegin;
+					entry.cutEnd = cutEnd;
+					entry.isBatched = cutBegin == cutEnd;
+					if (entry.xParam)
+					{
+						plan.fill1D.push_back(entry);
+						if (entry.isBatched)
+							plan.isBatchColumn[entry.xParam->index] = true;
+					}
+					break;
+				}
+				case SpectrumType::Histo2D:
+				{
+					Fill2DEntry entry;
+					entry.histogram = static_cast<Histogram2D*>(pair.second.get());
+					entry.xParam = FindParameterData(pair.second->GetXParam());
+					entry.yParam = FindParameterData(pair.second->GetYParam());
+					entry.cutBegin = cutBegin;
+					entry.cutEnd = cutEnd;
+					entry.isBatched = cutBegin == cutEnd;
+					if (entry.xParam && entry.yParam)
+						plan.fill2D.push_back(entry);
+					break;
+				}
+				case SpectrumType::Summary:
+				{
+					FillSummaryEntry entry;
+					entry.histogram = static_cast<HistogramSummary*>(pair.second.get());
+					const std::vector<std::string>& subhistos = entry.histogram->GetSubHistograms();
+					if (entry.histogram->IsLinked())
 					{
-						auto iterX = m_paramMap.find(param);
-						if (iterX != m_paramMap.end() && iterX->second->validFlag)
+						//Shared rows are filled as the histogram they belong to. The rest are filled like any other 1D spectrum, with the cuts of the summary
+						for (size_t i = 0; i < subhistos.size(); i++)
 						{
-							iter.second->IsInside(iterX->second->value);
-							if (iter.second->IsValid())
-								break;
+							Fill1DEntry rowEntry;
+							rowEntry.histogram = entry.histogram->GetRow(i);
+							rowEntry.xParam = FindParameterData(subhistos[i]);
+							rowEntry.cutBegin = cutBegin;
+							rowEntry.cutEnd = cutEnd;
+							rowEntry.isBatched = cutBegin == cutEnd;
+							if (entry.histogram->IsRowShared(i) || !rowEntry.xParam)
+								continue;
+							plan.fill1D.push_back(rowEntry);
+							if (rowEntry.isBatched)
+								plan.isBatchColumn[rowEntry.xParam->index] = true;
 						}
+						break;
+					}
+					for (size_t i = 0; i < subhistos.size(); i++)
+					{
+						ParameterData* data = FindParameterData(subhistos[i]);
+						if (data)
+							entry.subParams.emplace_back(data, i + 0.5); //avoid floating point conversion issues
 					}
+					entry.cutBegin = cutBegin;
+					entry.cutEnd = cutEnd;
+					plan.fillSummary.push_back(std::move(entry));
 					break;
 				}
-				case CutType::None:
+				case SpectrumType::HistoND:
 				{
-					SPEC_WARN("Found a cut with None type!");
+					FillNDEntry entry;
+					entry.histogram = static_cast<HistogramND*>(pair.second.get());
+					for (auto& axis : pair.second->GetParameters().axes)
+					{
+						ParameterData* data = FindParameterData(axis.par);
+						if (data == nullptr)
+							break;
+						entry.params.push_back(data);
+					}
+					entry.cutBegin = cutBegin;
+					entry.cutEnd = cutEnd;
+					if (entry.params.size() == entry.histogram->GetNumberOfAxes() && !entry.params.empty())
+						plan.fillND.push_back(std::move(entry));
+					break;
+				}
+				case SpectrumType::None:
+				{
+					SPEC_WARN("Found a spectrum with None type!");
 					break;
 				}
 			}
 		}
+
+		GroupFillEntries(plan);
 	}
 
-	bool SpectrumManager::IsCutValid(const std::string& name)
+	//Move the entries of each group together, keeping their order, and set the range of each group. groupOf holds the group of each entry
+	template<typename Entry, typename Group>
+	static void SortIntoGroups(std::vector<Entry>& entries, const std::vector<uint32_t>& groupOf, std::vector<Group>& groups)
+	{
+		for (auto& group : groups)
+			group.entryBegin = group.entryEnd = 0;
+		for (uint32_t group : groupOf)
+			groups[group].entryEnd++;
+		uint32_t offset = 0;
+		for (auto& group : groups)
+		{
+			group.entryBegin = offset;
+			offset += group.entryEnd;
+			group.entryEnd = group.entryBegin;
+		}
+
+		std::vector<Entry> sorted(entries.size());
+		for (size_t i = 0; i < entries.size(); i++)
+			sorted[groups[groupOf[i]].entryEnd++] = std::move(entries[i]);
+		entries = std::move(sorted);
+	}
+
+	//Group the 1D and 2D entries which bin the same parameter(s) the same way (see FillEvent). Can be called again after entries are removed
+	void SpectrumManager::GroupFillEntries(FillPlan& plan)
 	{
 		SPEC_PROFILE_FUNCTION();
-		auto iter = m_cutMap.find(name);
-		if (iter != m_cutMap.end())
-			return iter->second->IsValid();
-		return false;
+		std::unordered_map<ParameterData*, std::vector<uint32_t>> groupsByParam; //Candidate groups of each (x) parameter
+		std::vector<uint32_t> groupOf;
+
+		plan.groups1D.clear();
+		groupOf.resize(plan.fill1D.size());
+		for (size_t i = 0; i < plan.fill1D.size(); i++)
+		{
+			const Fill1DEntry& entry = plan.fill1D[i];
+			std::vector<uint32_t>& candidates = groupsByParam[entry.xParam];
+			auto match = std::find_if(candidates.begin(), candidates.end(), [&](uint32_t group) { return plan.groups1D[group].binner->HasSameBinning(*entry.histogram); });
+			if (match != candidates.end())
+			{
+				groupOf[i] = *match;
+				continue;
+			}
+			groupOf[i] = uint32_t(plan.groups1D.size());
+			candidates.push_back(groupOf[i]);
+			Fill1DGroup group;
+			group.binner = entry.histogram;
+			group.xParam = entry.xParam;
+			plan.groups1D.push_back(group);
+		}
+		SortIntoGroups(plan.fill1D, groupOf, plan.groups1D);
+
+		groupsByParam.clear();
+		plan.groups2D.clear();
+		groupOf.resize(plan.fill2D.size());
+		for (size_t i = 0; i < plan.fill2D.size(); i++)
+		{
+			const Fill2DEntry& entry = plan.fill2D[i];
+			std::vector<uint32_t>& candidates = groupsByParam[entry.xParam];
+			auto match = std::find_if(candidates.begin(), candidates.end(), [&](uint32_t group)
+			{
+				return plan.groups2D[group].yParam == entry.yParam && plan.groups2D[group].binner->HasSameBinning(*entry.histogram);
+			});
+			if (match != candidates.end())
+			{
+				groupOf[i] = *match;
+				continue;
+			}
+			groupOf[i] = uint32_t(plan.groups2D.size());
+			candidates.push_back(groupOf[i]);
+			Fill2DGroup group;
+			group.binner = entry.histogram;
+			group.xParam = entry.xParam;
+			group.yParam = entry.yParam;
+			plan.groups2D.push_back(group);
+		}
+		SortIntoGroups(plan.fill2D, groupOf, plan.groups2D);
 	}
 
-	void SpectrumManager::ResetCutValidities()
+	//Compile a new plan from the current maps and swap it in as the published plan. Manager lock must be held (i.e. called after any edit to the maps).
+	//The physics thread picks up the new plan the next time it calls AcquireFillPlan; the old plan (and anything removed from the maps) is released
+	//once the physics thread lets go of it.
+	void SpectrumManager::PublishFillPlan()
 	{
-		for (auto& iter : m_cutMap)
+		SPEC_PROFILE_FUNCTION();
+		std::shared_ptr<FillPlan> plan = std::make_shared<FillPlan>();
+		CompileFillPlan(*plan);
+
+		std::scoped_lock<std::mutex> guard(m_planMutex);
+		plan->version = m_planVersion.load(std::memory_order_relaxed) + 1;
+		m_publishedPlan = std::move(plan);
+		m_planVersion.store(m_publishedPlan->version, std::memory_order_release);
+	}
+
+	//Physics thread side of the plan swap. Only takes the (tiny) plan lock if the configuration actually changed.
+	void SpectrumManager::AcquireFillPlan()
+	{
+		if (m_activePlan != nullptr && m_activePlan->version == m_planVersion.load(std::memory_order_acquire))
+			return;
+
+		if (m_activePlan != nullptr)
+			FlushCutStats(*m_activePlan);
+
+		std::scoped_lock<std::mutex> guard(m_planMutex);
+		m_activePlan = m_publishedPlan;
+		m_fillState.cutMemo.assign(m_activePlan->cuts.size(), CutMemo());
+	}
+
+	//Expire (rolling) or decay the counts of the time windowed histograms, see TimeWindow. Called with the fill lock held, before filling
+	void SpectrumManager::AdvanceTimeWindows(const FillPlan& plan)
+	{
+		if (plan.windowed.empty())
+			return;
+		TimeWindow::Clock::time_point now = TimeWindow::Clock::now();
+		for (auto* histogram : plan.windowed)
+			histogram->AdvanceTimeWindow(now);
+	}
+
+	void SpectrumManager::UpdateSnapshots(const FillPlan& plan, bool ignoreRequests)
+	{
+		for (auto& histogram : plan.histograms)
+			histogram->UpdateSnapshot(ignoreRequests);
+	}
+
+	//Fill all histograms in the plan for the current state of the parameters. Fill lock must be held.
+	//Cuts are not evaluated up front; PassesCuts evaluates them on demand (see EvaluateCut).
+	//If isBatched, the batched entries are left to UpdateHistograms(ParameterBatch&): 1D entries are skipped, 2D entries only collect their values.
+	void SpectrumManager::FillEvent(const FillPlan& plan, FillState& state, bool isBatched)
+	{
+		//New event, invalidates all memoized cut results
+		++state.eventStamp;
+		++state.eventsSinceFlush;
+
+		//The bin of a group is found by the first member whose cuts pass, and reused by the rest
+		for (auto& group : plan.groups1D)
+		{
+			if (!group.xParam->IsValid())
+				continue;
+			int bin = s_binNotFound;
+			for (uint32_t i = group.entryBegin; i < group.entryEnd; i++)
+			{
+				const Fill1DEntry& entry = plan.fill1D[i];
+				if ((isBatched && entry.isBatched) || !PassesCuts(plan, state, entry.cutBegin, entry.cutEnd))
+					continue;
+				if (bin == s_binNotFound)
+					bin = group.binner->FindBin(group.xParam->value);
+				if (bin < 0)
+					break;
+				entry.histogram->FillBin(bin);
+			}
+		}
+
+		for (auto& group : plan.groups2D)
+		{
+			if (!group.xParam->IsValid() || !group.yParam->IsValid())
+				continue;
+			int bin_x = s_binNotFound;
+			int bin_y = s_binNotFound;
+			for (uint32_t i = group.entryBegin; i < group.entryEnd; i++)
+			{
+				const Fill2DEntry& entry = plan.fill2D[i];
+				if (isBatched && entry.isBatched)
+				{
+					state.batchPairs[i].first.push_back(group.xParam->value);
+					state.batchPairs[i].second.push_back(group.yParam->value);
+					continue;
+				}
+				if (!PassesCuts(plan, state, entry.cutBegin, entry.cutEnd))
+					continue;
+				if (bin_x == s_binNotFound)
+					group.binner->FindBins(group.xParam->value, group.yParam->value, bin_x, bin_y);
+				if (bin_x >= 0 && bin_y >= 0)
+					entry.histogram->FillBins(bin_x, bin_y);
+			}
+		}
+
+		for (auto& entry : plan.fillSummary)
+		{
+			if (!PassesCuts(plan, state, entry.cutBegin, entry.cutEnd))
+				continue;
+			for (auto& subParam : entry.subParams)
+			{
+				if (subParam.first->IsValid())
+					entry.histogram->Fill(subParam.first->value, subParam.second);
+			}
+		}
+
+		//One fill per event for all axes, requires every axis parameter to be valid
+		double values[HistogramND::s_maxAxes];
+		for (auto& entry : plan.fillND)
+		{
+			bool isValid = true;
+			for (size_t i = 0; i < entry.params.size(); i++)
+			{
+				isValid &= entry.params[i]->IsValid();
+				values[i] = entry.params[i]->value;
+			}
+			if (isValid && PassesCuts(plan, state, entry.cutBegin, entry.cutEnd))
+				entry.histogram->Fill(values);
+		}
+	}
+
+	//Append the indices of the cuts applied to a histogram to the plan. Returns false if any of the cuts does not exist.
+	bool SpectrumManager::ResolveAppliedCuts(FillPlan& plan, const HistogramArgs& params, const std::unordered_map<std::string, uint32_t>& cutIndexMap, uint32_t& cutBegin, uint32_t& cutEnd)
+	{
+		cutBegin = uint32_t(plan.cutIndices.size());
+		for (auto& cutname : params.cutsAppliedTo)
+		{
+			auto iter = cutIndexMap.find(cutname);
+			if (iter == cutIndexMap.end())
+			{
+				plan.cutIndices.resize(cutBegin);
+				cutEnd = cutBegin;
+				return false;
+			}
+			plan.cutIndices.push_back(iter->second);
+		}
+		cutEnd = uint32_t(plan.cutIndices.size());
+		return true;
+	}
+
+	//Remove a histogram from the map, along with its link to (or from) projections. Manager lock must be held, the fill lock must not be.
+	//Only the unlinking takes the fill lock, as the physics thread walks the projections and summary rows while filling. The histogram itself
+	//stays alive in the plan the physics thread is using until the next PublishFillPlan is picked up.
+	void SpectrumManager::EraseHistogram(const std::string& name)
+	{
+		auto iter = m_histoMap.find(name);
+		if (iter == m_histoMap.end())
+			return;
+
+		const std::string& parentName = iter->second->GetParameters().parent;
+		{
+			std::scoped_lock<std::mutex> fillGuard(m_fillMutex);
+			if (parentName != "None")
+			{
+				auto parentIter = m_histoMap.find(parentName);
+				if (parentIter != m_histoMap.end() && parentIter->second->GetType() == SpectrumType::Histo2D)
+					std::static_pointer_cast<Histogram2D>(parentIter->second)->RemoveProjection(name);
+			}
+			DetachSummaryRows(name);
+		}
+		if (parentName == "None" && iter->second->GetType() == SpectrumType::Histo2D)
+		{
+			//Projections are not filled without their parent
+			for (auto& projection : std::static_pointer_cast<Histogram2D>(iter->second)->GetProjections())
+			{
+				m_histoMap.erase(projection);
+				m_histoFirstEvent.erase(projection);
+			}
+		}
+		m_histoFirstEvent.erase(name);
+		m_histoMap.erase(iter);
+	}
+
+	//For each sub-histogram of a new linked summary, a Histogram1D the row can be shared with, if any. A histogram is a row of at most one summary,
+	//as the summary consumes the changes of its rows (BinStorage::Consumer::Summary)
+	std::vector<std::shared_ptr<Histogram1D>> SpectrumManager::FindSharedRows(const HistogramArgs& params, const std::vector<std::string>& subhistos)
+	{
+		std::unordered_set<const Histogram*> taken;
+		for (auto& pair : m_histoMap)
+		{
+			if (pair.first == params.name || pair.second->GetType() != SpectrumType::Summary)
+				continue;
+			auto summary = std::static_pointer_cast<HistogramSummary>(pair.second);
+			for (size_t i = 0; summary->IsLinked() && i < summary->GetSubHistograms().size(); i++)
+				taken.insert(summary->GetRow(i));
+		}
+
+		std::vector<std::shared_ptr<Histogram1D>> sharedRows(subhistos.size());
+		for (size_t i = 0; i < subhistos.size(); i++)
+		{
+			for (auto& pair : m_histoMap)
+			{
+				if (HistogramSummary::CanShareRow(params, subhistos[i], pair.second->GetParameters()) && taken.insert(pair.second.get()).second)
+				{
+					sharedRows[i] = std::static_pointer_cast<Histogram1D>(pair.second);
+					break;
+				}
+			}
+		}
+		return sharedRows;
+	}
+
+	//The named histogram is being removed or replaced. Any linked summary sharing it as a row keeps the row, and fills it itself from now on
+	void SpectrumManager::DetachSummaryRows(const std::string& name)
+	{
+		auto iter = m_histoMap.find(name);
+		if (iter == m_histoMap.end() || iter->second->GetType() != SpectrumType::Histo1D)
+			return;
+		for (auto& pair : m_histoMap)
+		{
+			if (pair.second->GetType() == SpectrumType::Summary)
+				std::static_pointer_cast<HistogramSummary>(pair.second)->DetachRow(iter->second.get());
+		}
+	}
+
+	ParameterData* SpectrumManager::FindParameterData(const std::string& name)
+	{
+		auto iter = m_paramMap.find(name);
+		if (iter != m_paramMap.end())
+			return iter->second.get();
+		return nullptr;
+	}
+
+	//Cuts are checked in the order they were applied, stopping at the first one which fails
+	bool SpectrumManager::PassesCuts(const FillPlan& plan, FillState& state, uint32_t cutBegin, uint32_t cutEnd)
+	{
+		for (uint32_t i = cutBegin; i < cutEnd; i++)
+		{
+			if (!EvaluateCut(plan, state, plan.cutIndices[i]))
+				return false;
+		}
+		return true;
+	}
+
+	//Get the state of a cut for the current event. The cut is only evaluated the first time it is asked for in an event;
+	//the result is memoized for any other histogram which uses the same cut. Cuts which no histogram asks for are never evaluated.
+	bool SpectrumManager::EvaluateCut(const FillPlan& plan, FillState& state, uint32_t index)
+	{
+		CutMemo& memo = state.cutMemo[index];
+		if (memo.stamp == state.eventStamp)
+			return memo.result;
+
+		const CutPlanEntry& entry = plan.cuts[index];
+		entry.cut->ResetValidity();
+		switch (entry.type)
+		{
+			case CutType::Cut1D:
+			{
+				if (entry.xParam && entry.xParam->IsValid())
+					entry.cut->IsInside(entry.xParam->value);
+				break;
+			}
+			case CutType::Cut2D:
+			{
+				if (entry.xParam && entry.xParam->IsValid() && entry.yParam && entry.yParam->IsValid())
+					entry.cut->IsInside(entry.xParam->value, entry.yParam->value);
+				break;
+			}
+			case CutType::CutSummaryAll:
+			{
+				for (auto param : entry.subParams)
+				{
+					if (param->IsValid())
+					{
+						entry.cut->IsInside(param->value);
+						if (!entry.cut->IsValid())
+							break;
+					}
+				}
+				break;
+			}
+			case CutType::CutSummaryAny:
+			{
+				for (auto param : entry.subParams)
+				{
+					if (param->IsValid())
+					{
+						entry.cut->IsInside(param->value);
+						if (entry.cut->IsValid())
+							break;
+					}
+				}
+				break;
+			}
+			case CutType::None:
+			{
+				break;
+			}
+		}
+
+		memo.stamp = state.eventStamp;
+		memo.result = entry.cut->IsValid();
+		memo.evaluated++;
+		return memo.result;
+	}
+
+	//Push the evaluation counters accumulated since the last flush to the cuts. Physics thread only. Done once per batch, every s_cutStatsFlushEvents
+	//single events, when snapshots are published and when the plan changes, rather than per event, as it is an atomic add per cut
+	void SpectrumManager::FlushCutStats(const FillPlan& plan)
+	{
+		if (m_fillState.eventsSinceFlush == 0)
+			return;
+		for (size_t i = 0; i < plan.cuts.size(); i++)
 		{
-			iter.second->ResetValidity();
+			plan.cuts[i].cut->AddEvaluationStats(m_fillState.cutMemo[i].evaluated, m_fillState.eventsSinceFlush - m_fillState.cutMemo[i].evaluated);
+			m_fillState.cutMemo[i].evaluated = 0;
 		}
+		m_fillState.eventsSinceFlush = 0;
 	}
 }
@@ -11,6 +11,38 @@
 	Modified to be non-singleton. Singleton implementation was going to hold us back from some future development.
 
 	GWM -- July 2022
+
+	Synchronization is now split in three so that the physics thread never waits on the UI:
+	- m_managerMutex guards the maps (the configuration). It is only taken by the UI/configuration side.
+	- Every edit to the maps compiles a new, immutable FillPlan and swaps it in under m_planMutex (RCU-style), bumping an atomic version.
+	  The physics thread checks the version (a single atomic load) and only touches m_planMutex, briefly, when the configuration changed.
+	  Histograms/cuts/parameters are held by shared_ptr in the plan, so removing them from the maps never invalidates a plan in use.
+	- m_fillMutex guards histogram bin data. It is taken by the physics thread while filling, and by the few UI operations which read or
+	  modify bins directly (clear, export, region analysis). Drawing uses snapshots and does not need it. Lock order is manager then fill.
+	  Adding or removing a histogram allocates it and compiles the plan under the manager lock alone; the fill lock is only taken to unlink it from
+	  projections and summaries (EraseHistogram) and to note the event it starts from.
+
+	When a ParameterBatch is replayed, histograms without cuts don't go through the per-event fill. Their values are gathered over the whole batch and handed
+	to Histogram1D/2D::FillBatch, which bins them with vectorized kernels. Histograms with cuts (and summaries, ND histograms) are still filled event by event.
+
+	Histograms which bin the same parameter(s) the same way (e.g. gated and ungated copies of one spectrum) are grouped when the plan is compiled. FillEvent
+	finds the bin once per group, and fills every member whose cuts pass, so the bin lookups per event scale with the distinct binnings, not the histograms.
+
+	A linked HistogramSummary has no entry of its own in the plan. Its private rows are plain 1D entries (batched and grouped like any other), and its shared
+	rows are filled once, as the Histogram1D they belong to. Removing or replacing that histogram detaches the row, which the summary then fills itself.
+
+	Time windowed histograms (see TimeWindow) are moved to the current time by the physics thread, before each fill and whenever snapshots are published.
+
+	Histograms are made against a memory budget. Each histogram reserves what it can grow to (EstimateHistogramMemorySize), and a new histogram which would take
+	the reservations over the budget is rejected, or downgraded until it fits (MemoryBudgetPolicy). What the histograms actually hold is reported by
+	GetMemoryReport, which also flags (and logs, once) when use comes close to the budget. Sparse storage (tiled 2D, HistogramND) grows as it is filled,
+	so only the report sees it.
+
+	With the ParameterCache on, every filled event is also recorded into the cache (under the fill lock, so the cache and the histograms always agree).
+	BackfillHistograms then clears histograms and replays the cached events into them alone: a histogram or cut made in the middle of a run sees the whole run,
+	without reading the data source again. The replay runs with its own copies of the parameters and its own cut memos (FillState), and takes the fill lock a
+	chunk at a time, so the physics thread keeps filling alongside it; StartBackfill runs it on a worker thread, off the UI. A histogram is only backfilled if
+	the cache holds every event it was filled with, i.e. the cache was recording (and not full) since the histogram was made or last cleared.
 */
 #ifndef SPECTRUM_MANAGER_H
 #define SPECTRUM_MANAGER_H
@@ -19,14 +51,40 @@
 #include "Cut.h"
 #include "Parameter.h"
 #include "Graph.h"
+#include "ParameterCache.h"
 #include "Timestep.h"
 
 #include <thread>
+#include <atomic>
 
 struct ImPlotRect;
 
 namespace Specter {
 
+	//What to do with a new histogram which doesn't fit in the memory budget
+	enum class MemoryBudgetPolicy
+	{
+		Reject,
+		Downgrade //Smaller count type, then sparse (Histogram2D), then coarser binning, until it fits. Rejected if it still doesn't
+	};
+
+	struct HistogramMemory
+	{
+		std::string name;
+		size_t used = 0; //Bytes held now
+		size_t reserved = 0; //Bytes it can grow to, counted against the budget
+		uint64_t droppedCounts = 0; //Sparse Histogram2D: counts over its memory limit
+	};
+
+	struct MemoryReport
+	{
+		size_t budget = 0; //0 for no budget
+		size_t used = 0;
+		size_t reserved = 0;
+		bool isNearBudget = false;
+		std::vector<HistogramMemory> histograms; //Largest first
+	};
+
 	class SpectrumManager
 	{
 	public:
@@ -40,27 +98,56 @@ namespace Specter {
 		{
 			std::scoped_lock<std::mutex> guard(m_managerMutex);
 			m_histoMap.clear();
+			m_histoFirstEvent.clear();
 			m_cutMap.clear();
+			PublishFillPlan();
 		}
 
 		/*Histogram Functions*/
-		void AddHistogram(const HistogramArgs& params);
-		void AddHistogramSummary(const HistogramArgs& params, const std::vector<std::string>& subhistos);
+		bool AddHistogram(const HistogramArgs& params);
+		bool AddHistogramSummary(const HistogramArgs& params, const std::vector<std::string>& subhistos);
+		void AddHistogramProjection(const HistogramArgs& params);
 		void RemoveHistogram(const std::string& name);
 		void AddCutToHistogramDraw(const std::string& cutname, const std::string& histoname);
 		void AddCutToHistogramApplied(const std::string& cutname, const std::string& histoname);
 		void UpdateHistograms();
+		void UpdateHistograms(ParameterBatch& batch);
+		void PublishSnapshots(bool ignoreRequests = false);
+		void SetShardedStorage(bool sharded);
+		bool IsShardedStorage();
 		void ClearHistograms();
 		void ClearHistogram(const std::string& name);
+		void SetHistogramProjection(const std::string& name, const ProjectionArgs& projection);
 		void DrawHistogram(const std::string& name);
 		const HistogramArgs& GetHistogramParams(const std::string& name);
 		float* GetColorScaleRange(const std::string& name);
         std::vector<double> GetBinData(const std::string& name);
+		std::vector<std::pair<std::string, BinBuffer>> CopyAllBins();
+		size_t GetNumberOfBins(const std::string& name);
+		bool RestoreBins(const std::string& name, BinBuffer&& bins);
 		std::vector<std::string> GetSubHistograms(const std::string& name);
 		StatResults AnalyzeHistogramRegion(const std::string& name, const ImPlotRect& region);
 		std::vector<HistogramArgs> GetListOfHistograms();
 		/********************/
 
+		/*Memory Functions*/
+		void SetMemoryBudget(size_t budget, MemoryBudgetPolicy policy);
+		size_t GetMemoryBudget();
+		MemoryBudgetPolicy GetMemoryBudgetPolicy();
+		size_t GetAvailableMemory(const std::string& name);
+		MemoryReport GetMemoryReport();
+		/********************/
+
+		/*Parameter Cache Functions*/
+		void SetParameterCache(const ParameterCacheArgs& args);
+		ParameterCacheArgs GetParameterCacheArgs();
+		ParameterCacheStats GetParameterCacheStats();
+		void ClearParameterCache();
+		uint64_t BackfillHistograms(const std::vector<std::string>& names);
+		void StartBackfill(const std::vector<std::string>& names);
+		bool IsBackfillRunning() const;
+		/********************/
+
 		/*ScalerGraph Functions*/
 		void AddGraph(const GraphArgs& args);
 		void RemoveGraph(const std::string& name);
@@ -76,6 +163,7 @@ namespace Specter {
 		void BindParameter(Parameter& param);
 		void BindParameter(Parameter& param, int nbins, double maxVal, double minVal);
 		void InvalidateParameters();
+		void PrepareParameterBatch(ParameterBatch& batch);
 		std::vector<std::string> GetListOfParameters();
 		/*********************/
 
@@ -100,32 +188,177 @@ namespace Specter {
 		std::vector<double> GetCutYPoints(const std::string& name);
 		std::vector<std::string> GetCutSubHistograms(const std::string& cutname);
 		std::vector<CutArgs> GetListOfCuts();
+		CutEvaluationStats GetCutEvaluationStats(const std::string& cutname);
 		/**************/
 
 	private:
+		/*
+			The fill plan is a flattened, pre-resolved version of the histogram/cut/parameter maps used by UpdateHistograms.
+			All name lookups are done once when the plan is compiled, so that the per-event path is just a walk over flat arrays
+			of raw pointers. Histograms are split by type so that each group calls the (non-virtual) fill kernel of its concrete class.
+			Raw pointers are safe here as the plan also holds a reference to everything it points to (histograms, cutRefs, params).
+			A plan is never modified after it is published.
+		*/
+		struct CutPlanEntry
+		{
+			Cut* cut = nullptr;
+			CutType type = CutType::None;
+			ParameterData* xParam = nullptr;
+			ParameterData* yParam = nullptr;
+			std::vector<ParameterData*> subParams; //Only for CutSummary
+		};
+
+		struct Fill1DEntry
+		{
+			Histogram1D* histogram = nullptr;
+			ParameterData* xParam = nullptr;
+			uint32_t cutBegin = 0; //range in FillPlan::cutIndices
+			uint32_t cutEnd = 0;
+			bool isBatched = false; //No cuts: filled in bulk when replaying a ParameterBatch
+		};
+
+		struct Fill2DEntry
+		{
+			Histogram2D* histogram = nullptr;
+			ParameterData* xParam = nullptr;
+			ParameterData* yParam = nullptr;
+			uint32_t cutBegin = 0;
+			uint32_t cutEnd = 0;
+			bool isBatched = false;
+		};
+
+		struct FillSummaryEntry
+		{
+			HistogramSummary* histogram = nullptr;
+			std::vector<std::pair<ParameterData*, double>> subParams; //parameter and the y-value of its row
+			uint32_t cutBegin = 0;
+			uint32_t cutEnd = 0;
+		};
+
+		struct FillNDEntry
+		{
+			HistogramND* histogram = nullptr;
+			std::vector<ParameterData*> params; //one per axis
+			uint32_t cutBegin = 0;
+			uint32_t cutEnd = 0;
+		};
+
+		//Entries binning the same parameter(s) with the same binning, contiguous in FillPlan::fill1D/fill2D. binner is any member, it finds the bin for all of them
+		struct Fill1DGroup
+		{
+			Histogram1D* binner = nullptr;
+			ParameterData* xParam = nullptr;
+			uint32_t entryBegin = 0;
+			uint32_t entryEnd = 0;
+		};
+
+		struct Fill2DGroup
+		{
+			Histogram2D* binner = nullptr;
+			ParameterData* xParam = nullptr;
+			ParameterData* yParam = nullptr;
+			uint32_t entryBegin = 0;
+			uint32_t entryEnd = 0;
+		};
+
+		struct FillPlan
+		{
+			std::vector<CutPlanEntry> cuts;
+			std::vector<uint32_t> cutIndices; //indices into cuts, referenced by each fill entry
+			std::vector<Fill1DEntry> fill1D;
+			std::vector<Fill2DEntry> fill2D;
+			std::vector<Fill1DGroup> groups1D;
+			std::vector<Fill2DGroup> groups2D;
+			std::vector<FillSummaryEntry> fillSummary;
+			std::vector<FillNDEntry> fillND;
+			std::vector<std::shared_ptr<Histogram>> histograms; //All histograms, also used to publish draw snapshots
+			std::vector<Histogram*> windowed; //Histograms with a time window, owned by histograms
+			std::vector<std::shared_ptr<Cut>> cutRefs;
+			std::vector<std::shared_ptr<ParameterData>> params; //All parameters in bind order, used by ParameterBatch
+			std::vector<bool> isBatchColumn; //Per parameter (bind order): true if a batched Fill1DEntry fills from it
+			uint64_t version = 0;
+		};
+
+		//Per-event memo of a cut's state, parallel to FillPlan::cuts
+		struct CutMemo
+		{
+			uint64_t stamp = 0; //event stamp of the last evaluation
+			bool result = false;
+			uint64_t evaluated = 0; //evaluations since the last FlushCutStats
+		};
+
+		//Everything FillEvent changes besides the histograms. The physics thread has its own (m_fillState), a backfill makes another
+		struct FillState
+		{
+			std::vector<CutMemo> cutMemo;
+			std::vector<std::pair<std::vector<double>, std::vector<double>>> batchPairs; //x and y values per FillPlan::fill2D entry, for batched 2D fills
+			uint64_t eventStamp = 0; //Incremented for every filled event
+			uint64_t eventsSinceFlush = 0;
+		};
+
 		//Only used from within manager
 		void RemoveCutFromHistograms(const std::string& cutname);
-		void DrawCut(const std::string& name);
-		void CheckCuts();
-		bool IsCutValid(const std::string& name);
-		void ResetCutValidities();
+		void EraseHistogram(const std::string& name);
+		std::vector<std::shared_ptr<Histogram1D>> FindSharedRows(const HistogramArgs& params, const std::vector<std::string>& subhistos);
+		void DetachSummaryRows(const std::string& name);
+		void CompileFillPlan(FillPlan& plan);
+		void GroupFillEntries(FillPlan& plan);
+		void PublishFillPlan();
+		void AcquireFillPlan();
+		void FillEvent(const FillPlan& plan, FillState& state, bool isBatched = false);
+		void ReplayCachedChunk(const FillPlan& plan, FillState& state, const ParameterCache::ChunkView& chunk, std::vector<ParameterData>& params, const std::vector<uint32_t>& eventParams);
+		void AdvanceTimeWindows(const FillPlan& plan);
+		void UpdateSnapshots(const FillPlan& plan, bool ignoreRequests);
+		bool ResolveAppliedCuts(FillPlan& plan, const HistogramArgs& params, const std::unordered_map<std::string, uint32_t>& cutIndexMap, uint32_t& cutBegin, uint32_t& cutEnd);
+		ParameterData* FindParameterData(const std::string& name);
+		bool PassesCuts(const FillPlan& plan, FillState& state, uint32_t cutBegin, uint32_t cutEnd);
+		bool EvaluateCut(const FillPlan& plan, FillState& state, uint32_t index);
+		void FlushCutStats(const FillPlan& plan);
+		bool FitMemoryBudget(HistogramArgs& params, bool isResizable = true);
+		size_t GetReservedMemory(const std::string& excluded);
 
 		//Actual data
 		std::unordered_map<std::string, std::shared_ptr<Histogram>> m_histoMap;
 		std::unordered_map<std::string, std::shared_ptr<Cut>> m_cutMap;
 		std::unordered_map<std::string, std::shared_ptr<ParameterData>> m_paramMap;
+		std::vector<std::shared_ptr<ParameterData>> m_paramList; //Same data as m_paramMap in bind order, append only. Used by ParameterBatch
+		ParameterState m_paramState; //Event generation of all parameters. Physics thread only
 		std::unordered_map<std::string, std::shared_ptr<VariableData>> m_varMap;
 		std::unordered_map<std::string, std::shared_ptr<ScalerData>> m_scalerMap;
 		std::unordered_map<std::string, std::shared_ptr<ScalerGraph>> m_graphMap;
 
+		std::shared_ptr<const FillPlan> m_publishedPlan; //Latest configuration, guarded by m_planMutex
+		std::atomic<uint64_t> m_planVersion; //Version of m_publishedPlan, readable without a lock
+		std::shared_ptr<const FillPlan> m_activePlan; //Plan currently used by the physics thread. Physics thread only
+		bool m_isShardedStorage; //If true, all histograms use per-thread sharded bin storage
+		size_t m_memoryBudget; //Bytes, 0 for no budget. Guarded by m_managerMutex
+		MemoryBudgetPolicy m_memoryBudgetPolicy;
+		bool m_isMemoryWarned; //Near budget at the last GetMemoryReport
+		FillState m_fillState; //Physics thread only
+		ParameterCache m_parameterCache;
+		uint64_t m_nFilledEvents; //Events filled so far. Guarded by m_fillMutex
+		uint64_t m_cacheFirstEvent; //m_nFilledEvents when the parameter cache last started recording. Guarded by m_fillMutex
+		std::unordered_map<std::string, uint64_t> m_histoFirstEvent; //m_nFilledEvents when each histogram was made or cleared. Missing if it holds counts from elsewhere
+		std::thread m_backfillThread; //See StartBackfill. UI thread only
+		std::atomic<bool> m_isBackfillRunning;
+		std::mutex m_backfillMutex; //Held for a whole backfill
+		std::vector<std::vector<double>> m_batchColumns; //Values of each parameter over a ParameterBatch, for batched 1D fills. Physics thread only
+
 		HistogramArgs m_nullHistoResult; //For handling bad query
 		GraphArgs m_nullGraphResult; //For handling bad query
 
-		std::mutex m_managerMutex; //synchronization
+		std::mutex m_managerMutex; //synchronization of the maps
+		std::mutex m_planMutex; //synchronization of the published plan pointer
+		std::mutex m_fillMutex; //synchronization of histogram bins
 
 		//Some scaler time stuff
 		double m_graphTimeEllapsed = 0.0;
 		static constexpr double s_graphUpdateTime = 60.0; //Fixed timestep for scaler graphs (seconds), TODO: make this user inputed
+		static constexpr int s_binNotFound = -2; //FillEvent: group bin not yet looked up (FindBin returns -1 for out of range)
+		static constexpr uint64_t s_cutStatsFlushEvents = 4096; //UpdateHistograms(): single events between FlushCutStats
+
+		static constexpr size_t s_defaultMemoryBudget = size_t(4) << 30;
+		static constexpr double s_memoryWarningFraction = 0.8; //Of the budget
 	};
 
 }
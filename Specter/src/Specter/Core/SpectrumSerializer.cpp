@@ -13,7 +13,11 @@
 */
 #include "SpectrumSerializer.h"
 
+#include "MappedFile.h"
+
 #include <fstream>
+#include <chrono>
+#include <cstring>
 #include "yaml-cpp/yaml.h"
 
 namespace Specter {
@@ -58,14 +62,53 @@ namespace Specter {
 		output << YAML::Key << "XMin" << YAML::Value << args.min_x;
 		output << YAML::Key << "XMax" << YAML::Value << args.max_x;
 		output << YAML::Key << "XBins" << YAML::Value << args.nbins_x;
+		output << YAML::Key << "XBinning" << YAML::Value << ConvertBinningTypeToString(args.binning_x);
+		if (args.binning_x == BinningType::Piecewise || args.binning_x == BinningType::Edges)
+			output << YAML::Key << "XEdges" << YAML::Value << args.edges_x;
+		if (args.binning_x == BinningType::Piecewise)
+			output << YAML::Key << "XSegmentBins" << YAML::Value << args.segmentBins_x;
 		output << YAML::Key << "YParameter" << YAML::Key << args.y_par;
 		output << YAML::Key << "YMin" << YAML::Value << args.min_y;
 		output << YAML::Key << "YMax" << YAML::Value << args.max_y;
 		output << YAML::Key << "YBins" << YAML::Value << args.nbins_y;
+		output << YAML::Key << "CountType" << YAML::Value << ConvertBinCountTypeToString(args.countType);
+		if (args.windowMode != TimeWindowMode::None)
+		{
+			output << YAML::Key << "TimeWindow" << YAML::Value << ConvertTimeWindowModeToString(args.windowMode);
+			output << YAML::Key << "WindowSeconds" << YAML::Value << args.windowSeconds;
+			output << YAML::Key << "WindowSlices" << YAML::Value << args.windowSlices;
+		}
+		if (args.maxBinMemory != 0)
+			output << YAML::Key << "MaxBinMemory" << YAML::Value << args.maxBinMemory;
 		if (args.type == SpectrumType::Summary)
 		{
 			std::vector<std::string> subhistos = manager->GetSubHistograms(args.name);
 			output << YAML::Key << "SubHistos" << YAML::Value << subhistos;
+			if (args.isLinkedSummary)
+				output << YAML::Key << "LinkedRows" << YAML::Value << true;
+		}
+		else if (args.type == SpectrumType::HistoND)
+		{
+			output << YAML::Key << "Axes" << YAML::Value << YAML::BeginSeq;
+			for (auto& axis : args.axes)
+			{
+				output << YAML::BeginMap;
+				output << YAML::Key << "Parameter" << YAML::Value << axis.par;
+				output << YAML::Key << "Bins" << YAML::Value << axis.nbins;
+				output << YAML::Key << "Min" << YAML::Value << axis.min;
+				output << YAML::Key << "Max" << YAML::Value << axis.max;
+				output << YAML::EndMap;
+			}
+			output << YAML::EndSeq;
+			output << YAML::Key << "ProjectionX" << YAML::Value << args.projection.x_axis;
+			output << YAML::Key << "ProjectionY" << YAML::Value << args.projection.y_axis;
+		}
+		if (args.parent != "None")
+		{
+			output << YAML::Key << "Parent" << YAML::Value << args.parent;
+			output << YAML::Key << "ProjectionAxis" << YAML::Value << (args.isYProjection ? "Y" : "X");
+			output << YAML::Key << "BandMin" << YAML::Value << args.bandMin;
+			output << YAML::Key << "BandMax" << YAML::Value << args.bandMax;
 		}
 		output << YAML::Key << "CutsDrawn" << YAML::Value << args.cutsDrawnUpon;
 		output << YAML::Key << "CutsApplied" << YAML::Value << args.cutsAppliedTo;
@@ -81,22 +124,150 @@ namespace Specter {
 		output << YAML::EndMap;
 	}
 
-	SpectrumSerializer::SpectrumSerializer(const std::string& filepath) :
-		m_filename(filepath)
+	/*
+		Binary files (SerializeDataWithBins). All fields are native endian, and every section starts on 8 bytes:
+		- FileHeader, then the spectra as YAML text (the same document as a .yaml file)
+		- Per histogram: RecordHeader, the name, then the counts as one BinEncoding payload
+	*/
+	static constexpr char s_binaryMagic[8] = "SPECBIN";
+	static constexpr uint32_t s_binaryVersion = 1;
+	static constexpr size_t s_minZeroRun = 8; //Shorter runs of zeros are kept in the literals, a run costs 16 bytes
+
+	struct FileHeader
+	{
+		char magic[8];
+		uint32_t version;
+		uint32_t nRecords;
+		uint64_t textSize;
+	};
+
+	struct RecordHeader
+	{
+		uint64_t nameSize;
+		uint32_t countType; //BinCountType
+		uint32_t encoding; //BinEncoding
+		uint64_t nBins;
+		uint64_t payloadSize; //bytes
+	};
+
+	enum class BinEncoding : uint32_t
 	{
+		Raw, //The counts as stored in memory
+		ZeroRuns //Repeated (uint64 zeros, uint64 nLiterals, nLiterals counts) covering all of the bins. Most spectra are mostly empty
+	};
+
+	static size_t GetPaddedSize(size_t size)
+	{
+		return (size + 7) & ~size_t(7);
 	}
 
-	SpectrumSerializer::~SpectrumSerializer() {}
+	static void WritePadding(std::ofstream& output, size_t size)
+	{
+		static const char s_zeros[8] = { 0 };
+		output.write(s_zeros, GetPaddedSize(size) - size);
+	}
 
-	void SpectrumSerializer::SerializeData(const SpectrumManager::Ref& manager)
+	//Bytes left after position. Position may be past the end when the padding of a truncated file was skipped
+	static size_t GetRemainingSize(const MappedFile& file, size_t position)
 	{
-		std::ofstream output(m_filename);
-		if (!output.is_open())
+		return position < file.GetSize() ? file.GetSize() - position : 0;
+	}
+
+	static bool ReadBytes(const MappedFile& file, size_t& position, void* destination, size_t size)
+	{
+		if (size > GetRemainingSize(file, position))
+			return false;
+		std::memcpy(destination, file.GetData() + position, size);
+		position += size;
+		return true;
+	}
+
+	//Calls func(nZeros, literals, nLiterals) for each run of zeros and the counts following it. The counts end at the next run of s_minZeroRun zeros
+	template<typename T, typename Func>
+	static void VisitZeroRuns(const T* counts, size_t nBins, Func&& func)
+	{
+		size_t bin = 0;
+		while (bin < nBins)
 		{
-			SPEC_ERROR("Unable to open {0} to write data.", m_filename);
-			return;
+			size_t zeroBegin = bin;
+			while (bin < nBins && counts[bin] == T(0))
+				bin++;
+
+			size_t literalBegin = bin;
+			size_t literalEnd = bin; //One past the last non-zero count
+			while (bin < nBins && bin - literalEnd < s_minZeroRun)
+			{
+				if (counts[bin] != T(0))
+					literalEnd = bin + 1;
+				bin++;
+			}
+			func(literalBegin - zeroBegin, counts + literalBegin, literalEnd - literalBegin);
+			bin = literalEnd;
+		}
+	}
+
+	template<typename T>
+	static size_t GetZeroRunSize(const T* counts, size_t nBins)
+	{
+		size_t size = 0;
+		VisitZeroRuns(counts, nBins, [&size](size_t, const T*, size_t nLiterals) { size += 2 * sizeof(uint64_t) + nLiterals * sizeof(T); });
+		return size;
+	}
+
+	template<typename T>
+	static void WriteZeroRuns(std::ofstream& output, const T* counts, size_t nBins)
+	{
+		VisitZeroRuns(counts, nBins, [&output](size_t nZeros, const T* literals, size_t nLiterals)
+		{
+			uint64_t run[2] = { nZeros, nLiterals };
+			output.write(reinterpret_cast<const char*>(run), sizeof(run));
+			output.write(reinterpret_cast<const char*>(literals), nLiterals * sizeof(T));
+		});
+	}
+
+	//Straight from the mapped file into the bins. Returns false if the payload doesn't describe record.nBins counts. The caller checks
+	//record.nBins against the histogram and record.payloadSize against the file first, so nothing is allocated for a corrupt record
+	static bool DecodeBins(const uint8_t* payload, const RecordHeader& record, BinBuffer& bins)
+	{
+		if (record.countType > uint32_t(BinCountType::Double))
+			return false;
+		BinCountType type = BinCountType(record.countType);
+		size_t countSize = GetBinCountSize(type);
+		if (record.encoding == uint32_t(BinEncoding::Raw))
+		{
+			if (record.payloadSize != record.nBins * countSize)
+				return false;
+			bins.Assign(type, record.nBins);
+			std::memcpy(bins.GetData<uint8_t>(), payload, record.payloadSize);
+			return true;
 		}
+		if (record.encoding != uint32_t(BinEncoding::ZeroRuns))
+			return false;
 
+		bins.Assign(type, record.nBins);
+		uint8_t* data = bins.GetData<uint8_t>();
+		size_t bin = 0;
+		size_t position = 0;
+		while (position < record.payloadSize)
+		{
+			uint64_t run[2];
+			if (record.payloadSize - position < sizeof(run))
+				return false;
+			std::memcpy(run, payload + position, sizeof(run));
+			position += sizeof(run);
+			if (run[0] > record.nBins - bin || run[1] > record.nBins - bin - run[0] || run[1] * countSize > record.payloadSize - position)
+				return false;
+			bin += run[0];
+			std::memcpy(data + bin * countSize, payload + position, run[1] * countSize);
+			bin += run[1];
+			position += run[1] * countSize;
+		}
+		return bin == record.nBins;
+	}
+
+	//The spectra (cuts, histograms, variables) as a YAML document
+	static std::string EmitSpectra(const SpectrumManager::Ref& manager)
+	{
 		auto cutList = manager->GetListOfCuts();
 		auto histoList = manager->GetListOfHistograms();
 		auto varList = manager->GetListOfVariables();
@@ -122,26 +293,13 @@ namespace Specter {
 			SerializeVariable(yamlStream, manager, var);
 		}
 		yamlStream << YAML::EndSeq << YAML::EndMap;
-
-		output << yamlStream.c_str();
-		SPEC_INFO("Successfully saved data to {0}", m_filename);
-		output.close();
+		return yamlStream.c_str();
 	}
 
-	void SpectrumSerializer::DeserializeData(SpectrumManager::Ref& manager)
+	//Create the spectra of a YAML document written by EmitSpectra. When loading in, we remove all extant data, to avoid any potential collisions.
+	static void LoadSpectra(SpectrumManager::Ref& manager, const YAML::Node& data)
 	{
-		manager->RemoveAllSpectra(); //When loading in, we remove all extant data, to avoid any potential collisions.
-
-		YAML::Node data;
-		try
-		{
-			data = YAML::LoadFile(m_filename);
-		}
-		catch (YAML::ParserException& execp)
-		{
-			SPEC_ERROR("Unable to open {0} to read data.", m_filename);
-			return;
-		}
+		manager->RemoveAllSpectra();
 
 		auto cuts = data["Cuts"];
 		if (cuts)
@@ -172,6 +330,8 @@ namespace Specter {
 		{
 			HistogramArgs tempArgs;
 			std::vector<std::string> tempSubHistos;
+			std::vector<HistogramArgs> projections; //Added once all of the parents exist
+			std::vector<std::pair<HistogramArgs, std::vector<std::string>>> summaries; //Added once all of the 1D histograms exist
 			for (const auto& histo : histos)
 			{
 				tempArgs.name = histo["Histogram"].as<std::string>();
@@ -181,20 +341,83 @@ namespace Specter {
 				tempArgs.min_x = histo["XMin"].as<double>();
 				tempArgs.max_x = histo["XMax"].as<double>();
 				tempArgs.nbins_x = histo["XBins"].as<int>();
+				//Files written before non-uniform binning was added are all uniform
+				if (histo["XBinning"])
+					tempArgs.binning_x = ConvertStringToBinningType(histo["XBinning"].as<std::string>());
+				else
+					tempArgs.binning_x = BinningType::Uniform;
+				if (histo["XEdges"])
+					tempArgs.edges_x = histo["XEdges"].as<std::vector<double>>();
+				else
+					tempArgs.edges_x.clear();
+				if (histo["XSegmentBins"])
+					tempArgs.segmentBins_x = histo["XSegmentBins"].as<std::vector<int>>();
+				else
+					tempArgs.segmentBins_x.clear();
 				tempArgs.min_y = histo["YMin"].as<double>();
 				tempArgs.max_y = histo["YMax"].as<double>();
 				tempArgs.nbins_y = histo["YBins"].as<int>();
+				//Files written before count types were added are all double
+				if (histo["CountType"])
+					tempArgs.countType = ConvertStringToBinCountType(histo["CountType"].as<std::string>());
+				else
+					tempArgs.countType = BinCountType::Double;
+				if (histo["TimeWindow"])
+				{
+					tempArgs.windowMode = ConvertStringToTimeWindowMode(histo["TimeWindow"].as<std::string>());
+					tempArgs.windowSeconds = histo["WindowSeconds"].as<double>();
+					tempArgs.windowSlices = histo["WindowSlices"].as<int>();
+				}
+				else
+					tempArgs.windowMode = TimeWindowMode::None;
+				if (histo["MaxBinMemory"])
+					tempArgs.maxBinMemory = histo["MaxBinMemory"].as<uint64_t>();
+				else
+					tempArgs.maxBinMemory = 0;
 				tempArgs.cutsDrawnUpon = histo["CutsDrawn"].as<std::vector<std::string>>();
 				tempArgs.cutsAppliedTo = histo["CutsApplied"].as<std::vector<std::string>>();
-				if (tempArgs.type == SpectrumType::Summary)
+				tempArgs.axes.clear();
+				tempArgs.projection = ProjectionArgs();
+				if (histo["Parent"])
+				{
+					tempArgs.parent = histo["Parent"].as<std::string>();
+					tempArgs.isYProjection = histo["ProjectionAxis"].as<std::string>() == "Y";
+					tempArgs.bandMin = histo["BandMin"].as<double>();
+					tempArgs.bandMax = histo["BandMax"].as<double>();
+					projections.push_back(tempArgs);
+					tempArgs.parent = "None";
+				}
+				else if (tempArgs.type == SpectrumType::Summary)
 				{
-					manager->AddHistogramSummary(tempArgs, histo["SubHistos"].as<std::vector<std::string>>());
+					tempArgs.isLinkedSummary = histo["LinkedRows"] && histo["LinkedRows"].as<bool>();
+					summaries.emplace_back(tempArgs, histo["SubHistos"].as<std::vector<std::string>>());
+					tempArgs.isLinkedSummary = false;
+				}
+				else if (tempArgs.type == SpectrumType::HistoND)
+				{
+					for (const auto& axis : histo["Axes"])
+					{
+						AxisArgs tempAxis;
+						tempAxis.par = axis["Parameter"].as<std::string>();
+						tempAxis.nbins = axis["Bins"].as<int>();
+						tempAxis.min = axis["Min"].as<double>();
+						tempAxis.max = axis["Max"].as<double>();
+						tempArgs.axes.push_back(tempAxis);
+					}
+					tempArgs.projection.x_axis = histo["ProjectionX"].as<int>();
+					tempArgs.projection.y_axis = histo["ProjectionY"].as<int>();
+					manager->AddHistogram(tempArgs);
 				}
 				else
 				{
 					manager->AddHistogram(tempArgs);
 				}
 			}
+			for (auto& projection : projections)
+				manager->AddHistogramProjection(projection);
+			//After the 1D histograms, which linked summaries share rows with
+			for (auto& summary : summaries)
+				manager->AddHistogramSummary(summary.first, summary.second);
 		}
 		auto vars = data["Variables"];
 		if (vars)
@@ -206,8 +429,175 @@ namespace Specter {
 				tempVar.SetValue(var["Value"].as<double>());
 			}
 		}
+	}
 
+	SpectrumSerializer::SpectrumSerializer(const std::string& filepath) :
+		m_filename(filepath)
+	{
+	}
+
+	SpectrumSerializer::~SpectrumSerializer() {}
+
+	void SpectrumSerializer::SerializeData(const SpectrumManager::Ref& manager)
+	{
+		std::ofstream output(m_filename);
+		if (!output.is_open())
+		{
+			SPEC_ERROR("Unable to open {0} to write data.", m_filename);
+			return;
+		}
+
+		output << EmitSpectra(manager);
+		SPEC_INFO("Successfully saved data to {0}", m_filename);
+		output.close();
+	}
+
+	void SpectrumSerializer::DeserializeData(SpectrumManager::Ref& manager)
+	{
+		YAML::Node data;
+		try
+		{
+			data = YAML::LoadFile(m_filename);
+		}
+		catch (YAML::ParserException& execp)
+		{
+			SPEC_ERROR("Unable to open {0} to read data.", m_filename);
+			return;
+		}
+
+		LoadSpectra(manager, data);
 		SPEC_INFO("Successfully loaded data from {0}", m_filename);
 	}
 
+	void SpectrumSerializer::SerializeDataWithBins(const SpectrumManager::Ref& manager)
+	{
+		SPEC_PROFILE_FUNCTION();
+		std::ofstream output(m_filename, std::ios::binary);
+		if (!output.is_open())
+		{
+			SPEC_ERROR("Unable to open {0} to write data.", m_filename);
+			return;
+		}
+
+		auto start = std::chrono::steady_clock::now();
+		std::string spectra = EmitSpectra(manager);
+		auto histogramBins = manager->CopyAllBins();
+
+		FileHeader header;
+		std::memcpy(header.magic, s_binaryMagic, sizeof(header.magic));
+		header.version = s_binaryVersion;
+		header.nRecords = uint32_t(histogramBins.size());
+		header.textSize = spectra.size();
+		output.write(reinterpret_cast<const char*>(&header), sizeof(header));
+		output.write(spectra.data(), spectra.size());
+		WritePadding(output, spectra.size());
+
+		size_t rawBytes = 0;
+		size_t writtenBytes = 0;
+		for (auto& [name, bins] : histogramBins)
+		{
+			RecordHeader record;
+			record.nameSize = name.size();
+			record.countType = uint32_t(bins.GetType());
+			record.nBins = bins.GetSize();
+			size_t zeroRunSize = bins.Visit([&bins](const auto* counts) { return GetZeroRunSize(counts, bins.GetSize()); });
+			size_t rawSize = bins.GetSize() * GetBinCountSize(bins.GetType());
+			record.encoding = zeroRunSize < rawSize ? uint32_t(BinEncoding::ZeroRuns) : uint32_t(BinEncoding::Raw);
+			record.payloadSize = std::min(zeroRunSize, rawSize);
+
+			output.write(reinterpret_cast<const char*>(&record), sizeof(record));
+			output.write(name.data(), name.size());
+			WritePadding(output, name.size());
+			if (record.encoding == uint32_t(BinEncoding::Raw))
+				output.write(reinterpret_cast<const char*>(bins.GetData<uint8_t>()), rawSize);
+			else
+				bins.Visit([&output, &bins](const auto* counts) { WriteZeroRuns(output, counts, bins.GetSize()); });
+			WritePadding(output, record.payloadSize);
+			rawBytes += rawSize;
+			writtenBytes += record.payloadSize;
+		}
+
+		if (!output.good())
+		{
+			SPEC_ERROR("Failed writing the histograms to {0}.", m_filename);
+			return;
+		}
+		double elapsed = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+		SPEC_INFO("Successfully saved data and counts of {0} histograms to {1} ({2} MB of bins in {3} MB, {4:.1f} ms)", histogramBins.size(), m_filename,
+				  rawBytes >> 20, writtenBytes >> 20, elapsed);
+	}
+
+	void SpectrumSerializer::DeserializeDataWithBins(SpectrumManager::Ref& manager)
+	{
+		SPEC_PROFILE_FUNCTION();
+		auto start = std::chrono::steady_clock::now();
+		MappedFile file;
+		if (!file.Open(m_filename))
+		{
+			SPEC_ERROR("Unable to open {0} to read data.", m_filename);
+			return;
+		}
+
+		FileHeader header;
+		size_t position = 0;
+		if (!ReadBytes(file, position, &header, sizeof(header)) || std::memcmp(header.magic, s_binaryMagic, sizeof(header.magic)) != 0 || header.version != s_binaryVersion
+			|| header.textSize > GetRemainingSize(file, position))
+		{
+			SPEC_ERROR("{0} is not a Specter histogram file (or is from an unsupported version).", m_filename);
+			return;
+		}
+
+		std::string spectra(reinterpret_cast<const char*>(file.GetData() + position), header.textSize);
+		position += GetPaddedSize(header.textSize);
+		try
+		{
+			LoadSpectra(manager, YAML::Load(spectra));
+		}
+		catch (YAML::Exception& exception)
+		{
+			SPEC_ERROR("Unable to read the spectra of {0}: {1}", m_filename, exception.what());
+			return;
+		}
+
+		size_t nRestored = 0;
+		for (uint32_t i = 0; i < header.nRecords; i++)
+		{
+			RecordHeader record;
+			std::string name;
+			BinBuffer bins;
+			if (!ReadBytes(file, position, &record, sizeof(record)) || record.nameSize > GetRemainingSize(file, position))
+			{
+				SPEC_ERROR("{0} is truncated, only the counts of {1} histograms were loaded.", m_filename, nRestored);
+				return;
+			}
+			name.assign(reinterpret_cast<const char*>(file.GetData() + position), record.nameSize);
+			position += GetPaddedSize(record.nameSize);
+			if (record.payloadSize > GetRemainingSize(file, position))
+			{
+				SPEC_ERROR("{0} is truncated, only the counts of {1} histograms were loaded.", m_filename, nRestored);
+				return;
+			}
+			else if (record.nBins != manager->GetNumberOfBins(name))
+			{
+				SPEC_WARN("Saved counts of histogram {0} in {1} don't match its definition, it was left empty.", name, m_filename);
+				position += GetPaddedSize(record.payloadSize);
+				continue;
+			}
+			else if (!DecodeBins(file.GetData() + position, record, bins))
+			{
+				SPEC_ERROR("{0} has corrupt counts for histogram {1}, only the counts of {2} histograms were loaded.", m_filename, name, nRestored);
+				return;
+			}
+			position += GetPaddedSize(record.payloadSize);
+
+			if (manager->RestoreBins(name, std::move(bins)))
+				nRestored++;
+			else
+				SPEC_WARN("Saved counts of histogram {0} in {1} don't match its definition, it was left empty.", name, m_filename);
+		}
+
+		double elapsed = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+		SPEC_INFO("Successfully loaded data and counts of {0} histograms from {1} ({2:.1f} ms)", nRestored, m_filename, elapsed);
+	}
+
 }
\ No newline at end of file
@@ -10,6 +10,12 @@
 	  don't fill, it is most likely due to the parameter not being defined in the current project.
 
 	GWM -- Feb 2022
+
+	The YAML files only hold the definitions of the spectra. SerializeDataWithBins writes a binary file (.spec) holding the same YAML document followed by the counts
+	of every histogram, so that Specter can be closed and reopened mid-experiment without losing statistics. The counts are copied from all histograms under one
+	lock, so they form a consistent snapshot, and are written out after the lock is released. Each histogram is stored raw, or as runs of zeros and non-zero counts
+	when that is smaller. DeserializeDataWithBins memory maps the file and decodes the counts straight into the new histograms, with no parsing.
+	HistogramND counts are not saved.
 */
 #ifndef SPECTRUM_SERIALIZER_H
 #define SPECTRUM_SERIALIZER_H
@@ -28,6 +34,9 @@ namespace Specter {
 
 		void SerializeData(const SpectrumManager::Ref& manager);
 		void DeserializeData(SpectrumManager::Ref& manager);
+		//Binary file with the spectra and their counts
+		void SerializeDataWithBins(const SpectrumManager::Ref& manager);
+		void DeserializeDataWithBins(SpectrumManager::Ref& manager);
 
 		inline const std::string& GetFilename() { return m_filename; }
 
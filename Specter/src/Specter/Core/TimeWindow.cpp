@@ -0,0 +1,155 @@
+/*
+	TimeWindow.cpp
+	See TimeWindow.h.
+*/
+#include "TimeWindow.h"
+
+#include <cmath>
+#include <type_traits>
+
+namespace Specter {
+
+	std::string ConvertTimeWindowModeToString(TimeWindowMode mode)
+	{
+		switch (mode)
+		{
+			case TimeWindowMode::None: return "None";
+			case TimeWindowMode::Rolling: return "Rolling";
+			case TimeWindowMode::Decaying: return "Decaying";
+		}
+		return "None";
+	}
+
+	TimeWindowMode ConvertStringToTimeWindowMode(const std::string& keyword)
+	{
+		if (keyword == "Rolling")
+			return TimeWindowMode::Rolling;
+		else if (keyword == "Decaying")
+			return TimeWindowMode::Decaying;
+		else
+			return TimeWindowMode::None;
+	}
+
+	TimeWindow::TimeWindow() :
+		m_mode(TimeWindowMode::None), m_current(0), m_sliceLength(0), m_isStarted(false), m_decayFactor(1.0)
+	{
+	}
+
+	bool TimeWindow::Init(TimeWindowMode mode, double seconds, int nSlices, BinCountType type, size_t nBins)
+	{
+		m_mode = TimeWindowMode::None;
+		m_slices.clear();
+		m_current = 0;
+		m_isStarted = false;
+		if (mode == TimeWindowMode::None)
+			return true;
+		if (!(seconds > 0.0) || nSlices <= 0)
+			return false;
+
+		double sliceSeconds = seconds / nSlices;
+		m_sliceLength = std::chrono::duration_cast<Clock::duration>(std::chrono::duration<double>(sliceSeconds));
+		if (m_sliceLength.count() <= 0)
+			return false;
+
+		m_mode = mode;
+		switch (mode)
+		{
+			case TimeWindowMode::Rolling:
+			{
+				m_slices.resize(nSlices);
+				for (auto& slice : m_slices)
+					slice.Assign(type, nBins);
+				break;
+			}
+			case TimeWindowMode::Decaying: m_decayFactor = std::exp(-1.0 / nSlices); break;
+			case TimeWindowMode::None: break;
+		}
+		return true;
+	}
+
+	void TimeWindow::Clear()
+	{
+		for (auto& slice : m_slices)
+			slice.Zero();
+	}
+
+	void TimeWindow::Advance(BinStorage& view, Clock::time_point now)
+	{
+		if (m_mode == TimeWindowMode::None)
+			return;
+
+		if (!m_isStarted)
+		{
+			m_sliceEnd = now + m_sliceLength;
+			m_isStarted = true;
+			return;
+		}
+		if (now < m_sliceEnd)
+			return;
+
+		//Catch up on every slice which ended since the last call (e.g. the UI was stalled)
+		size_t nEnded = 1 + size_t((now - m_sliceEnd) / m_sliceLength);
+		m_sliceEnd += m_sliceLength * nEnded;
+		switch (m_mode)
+		{
+			case TimeWindowMode::Rolling:
+			{
+				if (nEnded >= m_slices.size())
+				{
+					view.Clear();
+					Clear();
+					break;
+				}
+				for (size_t i = 0; i < nEnded; i++)
+				{
+					m_current = (m_current + 1) % m_slices.size();
+					view.Subtract(m_slices[m_current]);
+					m_slices[m_current].Zero();
+				}
+				break;
+			}
+			case TimeWindowMode::Decaying: view.Scale(std::pow(m_decayFactor, double(nEnded))); break;
+			case TimeWindowMode::None: break;
+		}
+	}
+
+	size_t TimeWindow::GetMemorySize() const
+	{
+		size_t size = 0;
+		for (auto& slice : m_slices)
+			size += slice.GetMemorySize();
+		return size;
+	}
+
+	void TimeWindow::IncrementBatch(const int32_t* bins, size_t count)
+	{
+		m_slices[m_current].Visit([bins, count](auto* data)
+		{
+			using CountType = std::remove_pointer_t<decltype(data)>;
+			for (size_t i = 0; i < count; i++)
+			{
+				if (bins[i] >= 0)
+					data[bins[i]] += CountType(1);
+			}
+		});
+	}
+
+	void TimeWindow::Restore(const BinBuffer& view)
+	{
+		if (!IsRolling())
+			return;
+		Clear();
+		m_slices[m_current] = view;
+	}
+
+	void TimeWindow::Add(size_t bin, double count)
+	{
+		if (!IsRolling())
+			return;
+		m_slices[m_current].Visit([bin, count](auto* data)
+		{
+			using CountType = std::remove_pointer_t<decltype(data)>;
+			data[bin] += CountType(count);
+		});
+	}
+}
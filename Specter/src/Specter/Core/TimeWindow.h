@@ -0,0 +1,86 @@
+/*
+	TimeWindow.h
+	Time windowed counts for Histogram1D/2D, for watching a spectrum "live" (e.g. the last 30 seconds while tuning the beam) instead of accumulating forever.
+	The histogram's own BinStorage always holds the current view, so drawing, region analysis, export etc. are unchanged. The window only takes counts out of it again:
+
+	- Rolling: the window is split into time slices, kept in a ring. Every fill also increments the bin in the current slice. When the current slice ends, the
+	  oldest slice is subtracted from the view and reused as the new current slice. The view is thus the sum of the last N slices (between N - 1 and N slice lengths
+	  of data), maintained with one extra increment per fill and one subtraction per slice, never by refilling. Costs one dense copy of the bins per slice.
+	- Decaying: every step the view is scaled by exp(-step / tau), i.e. each count has weight exp(-age / tau). No slices are needed. Counts are no longer integers,
+	  so decaying histograms always use double counts.
+
+	Time is wall clock time, advanced by the SpectrumManager (Advance) with the fill lock held, before each fill and whenever snapshots are published. The first
+	slice starts at the first Advance. While a source is running but idle, the view keeps emptying (rolling) or fading (decaying); once the source is detached,
+	the last view stays as it is.
+
+	Slices are plain dense arrays, written under the fill lock like all fills from the SpectrumManager. Tiled (very large) storage can decay, but has no rolling window.
+*/
+#ifndef TIME_WINDOW_H
+#define TIME_WINDOW_H
+
+#include "BinStorage.h"
+
+#include <chrono>
+
+namespace Specter {
+
+	enum class TimeWindowMode
+	{
+		None,
+		Rolling,
+		Decaying
+	};
+
+	std::string ConvertTimeWindowModeToString(TimeWindowMode mode);
+	TimeWindowMode ConvertStringToTimeWindowMode(const std::string& keyword);
+
+	class TimeWindow
+	{
+	public:
+		using Clock = std::chrono::steady_clock;
+
+		TimeWindow();
+
+		//seconds is the length of the window (rolling) or the time constant (decaying); nSlices the number of slices (rolling) or steps per time constant (decaying).
+		//Returns false if the definition is illegal.
+		bool Init(TimeWindowMode mode, double seconds, int nSlices, BinCountType type, size_t nBins);
+		//Zero the slices, when the view is cleared
+		void Clear();
+		//Move the window to now. Expired slices are subtracted from the view / the view is decayed
+		void Advance(BinStorage& view, Clock::time_point now);
+
+		TimeWindowMode GetMode() const { return m_mode; }
+		bool IsRolling() const { return m_mode == TimeWindowMode::Rolling; }
+		size_t GetMemorySize() const;
+
+		inline void Increment(size_t bin)
+		{
+			BinBuffer& slice = m_slices[m_current];
+			switch (slice.GetType())
+			{
+				case BinCountType::UInt32: slice.GetData<uint32_t>()[bin] += 1; break;
+				case BinCountType::UInt64: slice.GetData<uint64_t>()[bin] += 1; break;
+				case BinCountType::Float: slice.GetData<float>()[bin] += 1.0f; break;
+				case BinCountType::Double: slice.GetData<double>()[bin] += 1.0; break;
+			}
+		}
+
+		//Negative entries are skipped, see BinStorage::IncrementBatch
+		void IncrementBatch(const int32_t* bins, size_t count);
+		//Counts added outside of a fill (projection seeding). They expire with the current slice
+		void Add(size_t bin, double count);
+		//All counts replaced (loaded from a file). They all go into the current slice
+		void Restore(const BinBuffer& view);
+
+	private:
+		TimeWindowMode m_mode;
+		std::vector<BinBuffer> m_slices; //Rolling only, ring of slices
+		size_t m_current; //Slice being filled
+		Clock::duration m_sliceLength;
+		Clock::time_point m_sliceEnd;
+		bool m_isStarted;
+		double m_decayFactor; //Decaying only, scale of one step
+	};
+}
+
+#endif
@@ -17,13 +17,16 @@
 
 namespace Specter {
 
+    static constexpr double s_megabyte = 1024.0 * 1024.0;
+
     bool SortByString(const std::string& p1, const std::string& p2)
     {
         return p1 < p2;
     }
 
     EditorLayer::EditorLayer(const SpectrumManager::Ref& manager) :
-        Layer("EditorLayer"), m_manager(manager), m_removeHistogram(false), m_removeCut(false), m_exportHistogram(false)
+        Layer("EditorLayer"), m_manager(manager), m_removeHistogram(false), m_removeCut(false), m_exportHistogram(false), m_isFileWithBins(false),
+        m_memoryReportTimer(s_memoryReportInterval), m_memoryBudgetMB(0.0)
     {
     }
     
@@ -40,6 +43,15 @@ namespace Specter {
     void EditorLayer::OnUpdate(Timestep& step)
     {
         m_manager->UpdateGraphs(step);
+
+        //Walking every histogram for its size is not free, so the report only refreshes every so often
+        m_memoryReportTimer += step.GetElapsedSeconds();
+        if (m_memoryReportTimer >= s_memoryReportInterval)
+        {
+            m_memoryReport = m_manager->GetMemoryReport();
+            m_cacheStats = m_manager->GetParameterCacheStats();
+            m_memoryReportTimer = 0.0f;
+        }
     }
 
     void EditorLayer::OnEvent(Event& e)
@@ -51,6 +63,7 @@ namespace Specter {
     {
         m_histoList = m_manager->GetListOfHistograms();
         std::sort(m_histoList.begin(), m_histoList.end(), SortByName<HistogramArgs>);
+        m_memoryReportTimer = s_memoryReportInterval; //Refresh the memory report on the next update
     }
 
     void EditorLayer::UpdateCutList()
@@ -89,6 +102,8 @@ namespace Specter {
             UpdateCutList();
             UpdateScalerList();
             UpdateGraphList();
+            m_memoryBudgetMB = m_manager->GetMemoryBudget() / s_megabyte;
+            m_cacheArgs = m_manager->GetParameterCacheArgs();
             startFlag = false;
         }
         // We are using the ImGuiWindowFlags_NoDocking flag to make the parent window not dockable into,
@@ -140,10 +155,22 @@ namespace Specter {
             {
                 if(ImGui::MenuItem(ICON_FA_FOLDER_OPEN "\tOpen"))
                 {
+                    m_isFileWithBins = false;
                     m_fileDialog.OpenDialog(FileDialog::Type::OpenFile);
                 }
                 if(ImGui::MenuItem(ICON_FA_SAVE "\tSave"))
                 {
+                    m_isFileWithBins = false;
+                    m_fileDialog.OpenDialog(FileDialog::Type::SaveFile);
+                }
+                if(ImGui::MenuItem(ICON_FA_FOLDER_OPEN "\tOpen With Counts"))
+                {
+                    m_isFileWithBins = true;
+                    m_fileDialog.OpenDialog(FileDialog::Type::OpenFile);
+                }
+                if(ImGui::MenuItem(ICON_FA_SAVE "\tSave With Counts"))
+                {
+                    m_isFileWithBins = true;
                     m_fileDialog.OpenDialog(FileDialog::Type::SaveFile);
                 }
                 if (ImGui::MenuItem(ICON_FA_TIMES_CIRCLE "\tExit"))
@@ -197,7 +224,7 @@ namespace Specter {
         }
 
         //Render all of our sub-windows, dialogs, panels, etc
-        auto fd_result = m_fileDialog.RenderFileDialog(".yaml");
+        auto fd_result = m_fileDialog.RenderFileDialog(m_isFileWithBins ? ".spec" : ".yaml");
         if (!fd_result.first.empty())
         {
             switch (fd_result.second)
@@ -205,7 +232,10 @@ namespace Specter {
                 case FileDialog::Type::OpenFile:
                 {
                     SpectrumSerializer serializer(fd_result.first);
-                    serializer.DeserializeData(m_manager);
+                    if (m_isFileWithBins)
+                        serializer.DeserializeDataWithBins(m_manager);
+                    else
+                        serializer.DeserializeData(m_manager);
                     UpdateHistogramList();
                     UpdateCutList();
                     break;
@@ -214,7 +244,10 @@ namespace Specter {
                 {
                     SPEC_INFO("Found a Save File! {0}", fd_result.first);
                     SpectrumSerializer serializer(fd_result.first);
-                    serializer.SerializeData(m_manager);
+                    if (m_isFileWithBins)
+                        serializer.SerializeDataWithBins(m_manager);
+                    else
+                        serializer.SerializeData(m_manager);
                     break;
                 }
                 case FileDialog::Type::OpenDir: 
@@ -258,11 +291,20 @@ namespace Specter {
                 {
                     ImGui::BulletText("%s", ("X Parameter: "+params.x_par).c_str());
                     ImGui::BulletText("X Bins: %d X Min: %f X Max: %f", params.nbins_x, params.min_x, params.max_x);
+                    if (params.parent != "None")
+                        ImGui::BulletText("%s", ("Projection of: "+params.parent).c_str());
+                    if (params.binning_x != BinningType::Uniform)
+                        ImGui::BulletText("%s", ("X Binning: "+ConvertBinningTypeToString(params.binning_x)).c_str());
                     if (params.y_par != "None")
                     {
                         ImGui::BulletText("%s", ("Y Parameter: "+params.y_par).c_str());
                         ImGui::BulletText("Y Bins: %d Y Min: %f Y Max: %f", params.nbins_y, params.min_y, params.max_y);
                     }
+                    ImGui::BulletText("%s", ("Count Type: "+ConvertBinCountTypeToString(params.countType)).c_str());
+                    if (params.maxBinMemory != 0)
+                        ImGui::BulletText("Sparse: at most %.1f MB of counts", params.maxBinMemory / s_megabyte);
+                    if (params.isLinkedSummary)
+                        ImGui::BulletText("Rows shared with 1D spectra");
                     if(params.cutsDrawnUpon.size() != 0 && ImGui::TreeNode("Cuts Drawn"))
                     {
                         for(auto& cut : params.cutsDrawnUpon)
@@ -275,6 +317,9 @@ namespace Specter {
                             ImGui::BulletText("%s", cut.c_str());
                         ImGui::TreePop();
                     }
+                    //Refill from the start of the cache, e.g. after applying a new cut
+                    if (m_cacheArgs.isEnabled && !m_manager->IsBackfillRunning() && params.parent == "None" && params.windowMode == TimeWindowMode::None && ImGui::Button("Backfill"))
+                        m_manager->StartBackfill({ params.name });
                     ImGui::TreePop();
                 }
             }
@@ -290,12 +335,113 @@ namespace Specter {
                     ImGui::BulletText("%s", ("X Parameter: "+params.x_par).c_str());
                     if(params.y_par != "None")
                         ImGui::BulletText("%s", ("Y Parameter: "+params.y_par).c_str());
+                    CutEvaluationStats stats = m_manager->GetCutEvaluationStats(params.name);
+                    ImGui::BulletText("Evaluated: %llu Skipped: %llu", (unsigned long long)stats.evaluated, (unsigned long long)stats.skipped);
                     ImGui::TreePop();
                 }
             }
         }
         ImGui::End();
 
+        RenderMemoryPanel();
+
+        ImGui::End();
+    }
+
+    void EditorLayer::RenderMemoryPanel()
+    {
+        if (ImGui::Begin(ICON_FA_MEMORY " Memory"))
+        {
+            //0 turns the budget off
+            if (ImGui::InputDouble("Budget (MB)", &m_memoryBudgetMB, 0.0, 0.0, "%.0f", ImGuiInputTextFlags_EnterReturnsTrue))
+            {
+                m_memoryBudgetMB = std::max(m_memoryBudgetMB, 0.0);
+                m_manager->SetMemoryBudget(size_t(m_memoryBudgetMB * s_megabyte), m_manager->GetMemoryBudgetPolicy());
+                m_memoryReportTimer = s_memoryReportInterval;
+            }
+            MemoryBudgetPolicy policy = m_manager->GetMemoryBudgetPolicy();
+            if (ImGui::BeginCombo("Over Budget", policy == MemoryBudgetPolicy::Reject ? "Reject" : "Downgrade"))
+            {
+                if (ImGui::Selectable("Reject", policy == MemoryBudgetPolicy::Reject))
+                    m_manager->SetMemoryBudget(m_manager->GetMemoryBudget(), MemoryBudgetPolicy::Reject);
+                if (ImGui::Selectable("Downgrade", policy == MemoryBudgetPolicy::Downgrade))
+                    m_manager->SetMemoryBudget(m_manager->GetMemoryBudget(), MemoryBudgetPolicy::Downgrade);
+                ImGui::EndCombo();
+            }
+
+            double used = m_memoryReport.used / s_megabyte;
+            double reserved = m_memoryReport.reserved / s_megabyte;
+            if (m_memoryReport.budget != 0)
+            {
+                double budget = m_memoryReport.budget / s_megabyte;
+                std::string overlay = std::to_string(int64_t(used)) + " / " + std::to_string(int64_t(budget)) + " MB";
+                if (m_memoryReport.isNearBudget)
+                    ImGui::PushStyleColor(ImGuiCol_PlotHistogram, ImVec4(1.0f, 0.6f, 0.0f, 1.0f));
+                ImGui::ProgressBar(float(std::min(used / budget, 1.0)), ImVec2(-1.0f, 0.0f), overlay.c_str());
+                if (m_memoryReport.isNearBudget)
+                    ImGui::PopStyleColor();
+            }
+            ImGui::Text("In use: %.1f MB Reserved: %.1f MB", used, reserved);
+            if (m_memoryReport.isNearBudget)
+                ImGui::TextColored(ImVec4(1.0f, 0.6f, 0.0f, 1.0f), ICON_FA_EXCLAMATION_TRIANGLE " Close to the memory budget");
+
+            if (ImGui::BeginTable("MemoryTable", 4, ImGuiTableFlags_BordersH | ImGuiTableFlags_SizingStretchProp | ImGuiTableFlags_BordersOuterV | ImGuiTableFlags_RowBg))
+            {
+                ImGui::TableSetupColumn("Histogram");
+                ImGui::TableSetupColumn("In Use (MB)");
+                ImGui::TableSetupColumn("Reserved (MB)");
+                ImGui::TableSetupColumn("Dropped Counts");
+                ImGui::TableHeadersRow();
+                for (auto& histogram : m_memoryReport.histograms)
+                {
+                    ImGui::TableNextRow();
+                    ImGui::TableNextColumn();
+                    ImGui::Text("%s", histogram.name.c_str());
+                    ImGui::TableNextColumn();
+                    ImGui::Text("%.2f", histogram.used / s_megabyte);
+                    ImGui::TableNextColumn();
+                    ImGui::Text("%.2f", histogram.reserved / s_megabyte);
+                    ImGui::TableNextColumn();
+                    ImGui::Text("%llu", (unsigned long long)histogram.droppedCounts);
+                }
+                ImGui::EndTable();
+            }
+
+            ImGui::Separator();
+            ImGui::Text("Parameter Cache");
+            bool isCacheChanged = ImGui::Checkbox("Record Parameters", &m_cacheArgs.isEnabled);
+            double cacheMemoryMB = m_cacheArgs.maxMemory / s_megabyte;
+            if (ImGui::InputDouble("Cache Memory (MB)", &cacheMemoryMB, 0.0, 0.0, "%.0f", ImGuiInputTextFlags_EnterReturnsTrue))
+            {
+                m_cacheArgs.maxMemory = size_t(std::max(cacheMemoryMB, 0.0) * s_megabyte);
+                isCacheChanged = true;
+            }
+            double cacheDiskMB = m_cacheArgs.maxDisk / s_megabyte;
+            if (ImGui::InputDouble("Cache Disk (MB)", &cacheDiskMB, 0.0, 0.0, "%.0f", ImGuiInputTextFlags_EnterReturnsTrue))
+            {
+                m_cacheArgs.maxDisk = size_t(std::max(cacheDiskMB, 0.0) * s_megabyte);
+                isCacheChanged = true;
+            }
+            if (isCacheChanged)
+            {
+                m_manager->SetParameterCache(m_cacheArgs);
+                m_memoryReportTimer = s_memoryReportInterval;
+            }
+            if (m_cacheArgs.isEnabled)
+            {
+                ImGui::Text("%llu events, %.1f MB in memory, %.1f MB on disk", (unsigned long long)m_cacheStats.events, m_cacheStats.memorySize / s_megabyte,
+                            m_cacheStats.diskSize / s_megabyte);
+                if (m_cacheStats.isFull)
+                    ImGui::TextColored(ImVec4(1.0f, 0.6f, 0.0f, 1.0f), ICON_FA_EXCLAMATION_TRIANGLE " Cache is full, recording stopped. Histograms can't be backfilled");
+                if (m_manager->IsBackfillRunning())
+                    ImGui::Text("Backfilling...");
+                if (ImGui::Button("Clear Cache"))
+                {
+                    m_manager->ClearParameterCache();
+                    m_memoryReportTimer = s_memoryReportInterval;
+                }
+            }
+        }
         ImGui::End();
     }
 
@@ -434,6 +580,18 @@ namespace Specter {
         if(selectedGram.y_par != "None")
             output<<"Min Y,"<<selectedGram.min_y<<std::endl<<"Max Y,"<<selectedGram.max_y<<std::endl;
         output<<"Nbins,"<<data.size()<<std::endl;
+        if(selectedGram.binning_x != BinningType::Uniform)
+        {
+            //Non-uniform bins are exported with their low edge
+            Binning binning;
+            binning.Init(selectedGram.binning_x, selectedGram.nbins_x, selectedGram.min_x, selectedGram.max_x, selectedGram.edges_x, selectedGram.segmentBins_x);
+            output<<"Binning,"<<ConvertBinningTypeToString(selectedGram.binning_x)<<std::endl;
+            output<<"Bin,Low Edge,Counts"<<std::endl;
+            for(size_t i=0; i<data.size() && int(i)<binning.GetNBins(); i++)
+                output<<i<<","<<binning.GetBinLowEdge(int(i))<<","<<data[i]<<std::endl;
+            output.close();
+            return;
+        }
         output<<"Bin,Counts"<<std::endl;
         for(size_t i=0; i<data.size(); i++)
             output<<i<<","<<data[i]<<std::endl;
@@ -50,6 +50,7 @@ namespace Specter {
         void UpdateScalerList(); //Currently not really used, only once. Scalers all made at construction time of PhysicsLayer
         void UpdateGraphList(); //Same
         void ExportHistogram(HistogramArgs selectedGram, const std::string& filename);
+        void RenderMemoryPanel();
 
         SpectrumManager::Ref m_manager;
 
@@ -68,6 +69,12 @@ namespace Specter {
         std::vector<std::string> m_scalerList;
         std::vector<GraphArgs> m_graphList;
 
+        MemoryReport m_memoryReport;
+        float m_memoryReportTimer; //seconds since the report was refreshed
+        double m_memoryBudgetMB;
+        ParameterCacheArgs m_cacheArgs;
+        ParameterCacheStats m_cacheStats;
+
         //ImGui Settings
         bool dockspaceOpen = true;
         bool opt_fullscreen = true;
@@ -78,6 +85,9 @@ namespace Specter {
         bool m_removeHistogram;
         bool m_removeCut;
         bool m_exportHistogram;
+        bool m_isFileWithBins; //The file dialog is for a binary file with the counts (.spec) rather than a .yaml file
+
+        static constexpr float s_memoryReportInterval = 1.0f; //seconds
     };
 
     template<typename T>
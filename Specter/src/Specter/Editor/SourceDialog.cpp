@@ -40,7 +40,9 @@ namespace Specter {
 			m_args.location = "";
 			m_args.port = "52324";
 			m_args.coincidenceWindow = 3000000;
+			m_args.sortWindow = 1000000000;
 			m_args.bitflags = 0;
+			m_args.eventBatchSize = 256;
 			ImGui::OpenPopup(ICON_FA_LINK " Attach Source");
 		}
 		if (ImGui::BeginPopupModal(ICON_FA_LINK " Attach Source"))
@@ -76,6 +78,7 @@ namespace Specter {
 					m_args.bitflags = m_args.bitflags ^ CompassHeaders::EnergyCalibrated;
 				}
 				ImGui::InputScalar("Coinc. Window (ps)", ImGuiDataType_U64, &m_args.coincidenceWindow);
+				ImGui::InputScalar("Sort Window (ps)", ImGuiDataType_U64, &m_args.sortWindow);
 			}
 			else if (m_args.type == DataSource::SourceType::CompassOffline)
 			{
@@ -95,6 +98,7 @@ namespace Specter {
 				ImGui::InputText("Hostname", &m_args.location);
 				ImGui::InputText("Port", &m_args.port);
 				ImGui::InputScalar("Coinc. Window (ps)", ImGuiDataType_U64, &m_args.coincidenceWindow);
+				ImGui::InputScalar("Sort Window (ps)", ImGuiDataType_U64, &m_args.sortWindow);
 			}
 			else if (m_args.type == DataSource::SourceType::DaqromancyOffline)
 			{
@@ -119,8 +123,12 @@ namespace Specter {
 				ImGui::InputText("Hostname", &m_args.location);
 				ImGui::InputText("Port", &m_args.port);
 				ImGui::InputScalar("Coinc. Window (ps)", ImGuiDataType_U64, &m_args.coincidenceWindow);
+				ImGui::InputScalar("Sort Window (ps)", ImGuiDataType_U64, &m_args.sortWindow);
 			}
 
+			if (m_args.type != DataSource::SourceType::None)
+				ImGui::InputScalar("Event Batch Size", ImGuiDataType_U32, &m_args.eventBatchSize);
+
 			if (ImGui::Button("Ok"))
 			{
 				result = true;
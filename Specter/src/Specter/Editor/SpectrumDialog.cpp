@@ -12,8 +12,10 @@
 
 namespace Specter {
 
+	static constexpr double s_megabyte = 1024.0 * 1024.0;
+
 	SpectrumDialog::SpectrumDialog() :
-		m_openFlag(false), m_openCutFlag(false)
+		m_openFlag(false), m_openCutFlag(false), m_isBackfilled(true)
 	{
 		selectFlags = ImGuiSelectableFlags_DontClosePopups;
 		tableFlags = ImGuiTableFlags_BordersH | ImGuiTableFlags_SizingStretchProp | ImGuiTableFlags_BordersOuterV | ImGuiTableFlags_RowBg;
@@ -33,6 +35,8 @@ namespace Specter {
 			m_openFlag = false;
 			m_newParams = m_blank;
 			m_subhistos.clear();
+			m_edgesText.clear();
+			m_segmentBinsText.clear();
 			ImGui::OpenPopup(ICON_FA_CHART_BAR " New Spectrum Dialog");
 		}
 
@@ -47,14 +51,29 @@ namespace Specter {
 					m_newParams.type = SpectrumType::Histo2D;
 				else if (ImGui::Selectable("Summary", m_newParams.type == SpectrumType::Summary, selectFlags))
 					m_newParams.type = SpectrumType::Summary;
+				else if (ImGui::Selectable("HistogramND", m_newParams.type == SpectrumType::HistoND, selectFlags))
+					m_newParams.type = SpectrumType::HistoND;
+				ImGui::EndCombo();
+			}
+			if (ImGui::BeginCombo("Count Type", ConvertBinCountTypeToString(m_newParams.countType).c_str()))
+			{
+				if (ImGui::Selectable("Double", m_newParams.countType == BinCountType::Double, selectFlags))
+					m_newParams.countType = BinCountType::Double;
+				else if (ImGui::Selectable("Float", m_newParams.countType == BinCountType::Float, selectFlags))
+					m_newParams.countType = BinCountType::Float;
+				else if (ImGui::Selectable("UInt64", m_newParams.countType == BinCountType::UInt64, selectFlags))
+					m_newParams.countType = BinCountType::UInt64;
+				else if (ImGui::Selectable("UInt32", m_newParams.countType == BinCountType::UInt32, selectFlags))
+					m_newParams.countType = BinCountType::UInt32;
 				ImGui::EndCombo();
 			}
 			
 			switch (m_newParams.type)
 			{
-			case SpectrumType::Histo1D: RenderDialog1D(paramList); break;
-			case SpectrumType::Histo2D: RenderDialog2D(paramList); break;
+			case SpectrumType::Histo1D: RenderDialog1D(paramList); RenderTimeWindowOptions(); break;
+			case SpectrumType::Histo2D: RenderDialog2D(paramList); RenderTimeWindowOptions(); break;
 			case SpectrumType::Summary: RenderDialogSummary(paramList); break;
+			case SpectrumType::HistoND: RenderDialogND(paramList); break;
 			case SpectrumType::None: break;
 			}
 
@@ -73,17 +92,31 @@ namespace Specter {
 			}
 			RenderCutDialog(cutList);
 
+			RenderMemoryEstimate(manager);
+
+			bool isCacheEnabled = manager->GetParameterCacheArgs().isEnabled;
+			if (isCacheEnabled)
+				ImGui::Checkbox("Fill from parameter cache", &m_isBackfilled);
+
 			if (ImGui::Button("Ok"))
 			{
+				bool isAdded = true;
 				switch (m_newParams.type)
 				{
-				case SpectrumType::Histo1D: manager->AddHistogram(m_newParams); break;
-				case SpectrumType::Histo2D: manager->AddHistogram(m_newParams); break;
-				case SpectrumType::Summary: manager->AddHistogramSummary(m_newParams, m_subhistos); break;
+				case SpectrumType::Histo1D: ParseBinningLists(); isAdded = manager->AddHistogram(m_newParams); break;
+				case SpectrumType::Histo2D: isAdded = manager->AddHistogram(m_newParams); break;
+				case SpectrumType::Summary: isAdded = manager->AddHistogramSummary(m_newParams, m_subhistos); break;
+				case SpectrumType::HistoND: isAdded = manager->AddHistogram(m_newParams); break;
 				case SpectrumType::None: break;
 				}
-				ImGui::CloseCurrentPopup();
-				result = true;
+				//Stay open if it didn't fit in the memory budget, so the binning can be changed
+				if (isAdded)
+				{
+					if (isCacheEnabled && m_isBackfilled)
+						manager->StartBackfill({ m_newParams.name });
+					ImGui::CloseCurrentPopup();
+					result = true;
+				}
 			}
 			ImGui::SameLine();
 			if (ImGui::Button("Cancel"))
@@ -121,6 +154,52 @@ namespace Specter {
 
 			ImGui::EndTable();
 		}
+		if (ImGui::BeginCombo("X Binning", ConvertBinningTypeToString(m_newParams.binning_x).c_str()))
+		{
+			if (ImGui::Selectable("Uniform", m_newParams.binning_x == BinningType::Uniform, selectFlags))
+				m_newParams.binning_x = BinningType::Uniform;
+			else if (ImGui::Selectable("Log", m_newParams.binning_x == BinningType::Log, selectFlags))
+				m_newParams.binning_x = BinningType::Log;
+			else if (ImGui::Selectable("Piecewise", m_newParams.binning_x == BinningType::Piecewise, selectFlags))
+				m_newParams.binning_x = BinningType::Piecewise;
+			else if (ImGui::Selectable("Edges", m_newParams.binning_x == BinningType::Edges, selectFlags))
+				m_newParams.binning_x = BinningType::Edges;
+			ImGui::EndCombo();
+		}
+		//Piecewise and edge binning ignore the bins and range above; they are taken from the edges
+		if (m_newParams.binning_x == BinningType::Piecewise)
+		{
+			ImGui::InputText("Segment Edges", &m_edgesText);
+			ImGui::InputText("Bins per Segment", &m_segmentBinsText);
+		}
+		else if (m_newParams.binning_x == BinningType::Edges)
+			ImGui::InputText("Bin Edges", &m_edgesText);
+	}
+
+	//Fill the edge lists of the new histogram from the comma (or space) separated text fields
+	void SpectrumDialog::ParseBinningLists()
+	{
+		m_newParams.edges_x.clear();
+		m_newParams.segmentBins_x.clear();
+		if (m_newParams.binning_x != BinningType::Piecewise && m_newParams.binning_x != BinningType::Edges)
+			return;
+
+		std::string text = m_edgesText;
+		std::replace(text.begin(), text.end(), ',', ' ');
+		std::istringstream edgeStream(text);
+		double edge;
+		while (edgeStream >> edge)
+			m_newParams.edges_x.push_back(edge);
+
+		if (m_newParams.binning_x != BinningType::Piecewise)
+			return;
+
+		text = m_segmentBinsText;
+		std::replace(text.begin(), text.end(), ',', ' ');
+		std::istringstream binStream(text);
+		int bins;
+		while (binStream >> bins)
+			m_newParams.segmentBins_x.push_back(bins);
 	}
 
 	void SpectrumDialog::RenderDialog2D(const std::vector<std::string>& paramList)
@@ -170,6 +249,102 @@ namespace Specter {
 		}
 	}
 
+	//Rolling: show only the last windowSeconds, in windowSlices steps. Decaying: counts fade with time constant windowSeconds. See TimeWindow.h
+	void SpectrumDialog::RenderTimeWindowOptions()
+	{
+		if (ImGui::BeginCombo("Time Window", ConvertTimeWindowModeToString(m_newParams.windowMode).c_str()))
+		{
+			if (ImGui::Selectable("None", m_newParams.windowMode == TimeWindowMode::None, selectFlags))
+				m_newParams.windowMode = TimeWindowMode::None;
+			else if (ImGui::Selectable("Rolling", m_newParams.windowMode == TimeWindowMode::Rolling, selectFlags))
+				m_newParams.windowMode = TimeWindowMode::Rolling;
+			else if (ImGui::Selectable("Decaying", m_newParams.windowMode == TimeWindowMode::Decaying, selectFlags))
+				m_newParams.windowMode = TimeWindowMode::Decaying;
+			ImGui::EndCombo();
+		}
+		if (m_newParams.windowMode == TimeWindowMode::Rolling)
+		{
+			ImGui::InputDouble("Window (s)", &m_newParams.windowSeconds);
+			ImGui::InputInt("Slices", &m_newParams.windowSlices);
+		}
+		else if (m_newParams.windowMode == TimeWindowMode::Decaying)
+		{
+			ImGui::InputDouble("Time Constant (s)", &m_newParams.windowSeconds);
+			ImGui::InputInt("Steps per Time Constant", &m_newParams.windowSlices);
+		}
+	}
+
+	//What the new spectrum can grow to, against what is left of the memory budget
+	void SpectrumDialog::RenderMemoryEstimate(const SpectrumManager::Ref& manager)
+	{
+		if (m_newParams.type == SpectrumType::None || manager->GetMemoryBudget() == 0)
+			return;
+		if (m_newParams.type == SpectrumType::HistoND)
+		{
+			ImGui::Text("Memory: grows as it is filled");
+			return;
+		}
+
+		if (m_newParams.type == SpectrumType::Histo1D)
+			ParseBinningLists();
+		HistogramArgs args = m_newParams;
+		if (args.type == SpectrumType::Summary)
+			args.nbins_y = int(m_subhistos.size());
+		double size = EstimateHistogramMemorySize(args) / s_megabyte;
+		double available = manager->GetAvailableMemory(args.name) / s_megabyte;
+		ImGui::Text("Memory: up to %.1f MB, %.1f MB of the budget left", size, available);
+		if (size > available)
+		{
+			if (manager->GetMemoryBudgetPolicy() == MemoryBudgetPolicy::Reject)
+				ImGui::TextColored(ImVec4(1.0f, 0.3f, 0.3f, 1.0f), "Over the memory budget, it will not be made");
+			else
+				ImGui::TextColored(ImVec4(1.0f, 0.6f, 0.0f, 1.0f), "Over the memory budget, it will be made smaller");
+		}
+	}
+
+	void SpectrumDialog::RenderDialogND(const std::vector<std::string>& paramList)
+	{
+		if (m_newParams.axes.size() < 3)
+			m_newParams.axes.resize(3);
+		if (ImGui::BeginTable("SpecParamsTable", 4))
+		{
+			std::string label;
+			for (size_t i = 0; i < m_newParams.axes.size(); i++)
+			{
+				auto& axis = m_newParams.axes[i];
+				std::string index = std::to_string(i);
+				ImGui::TableNextRow();
+
+				ImGui::TableNextColumn();
+				label = "Param. " + index;
+				if (ImGui::BeginCombo(label.c_str(), axis.par.c_str()))
+				{
+					for (auto& params : paramList)
+					{
+						if (ImGui::Selectable(params.c_str(), params == axis.par, selectFlags))
+							axis.par = params;
+					}
+					ImGui::EndCombo();
+				}
+				ImGui::TableNextColumn();
+				label = "Bins " + index;
+				ImGui::InputInt(label.c_str(), &axis.nbins);
+				ImGui::TableNextColumn();
+				label = "Min " + index;
+				ImGui::InputDouble(label.c_str(), &axis.min);
+				ImGui::TableNextColumn();
+				label = "Max " + index;
+				ImGui::InputDouble(label.c_str(), &axis.max);
+			}
+			ImGui::EndTable();
+		}
+		if (m_newParams.axes.size() < HistogramND::s_maxAxes && ImGui::Button("Add Axis"))
+			m_newParams.axes.emplace_back();
+		ImGui::SameLine();
+		if (m_newParams.axes.size() > 3 && ImGui::Button("Remove Axis"))
+			m_newParams.axes.pop_back();
+	}
+
 	void SpectrumDialog::RenderDialogSummary(const std::vector<std::string>& paramList)
 	{
 		if (ImGui::BeginTable("SpecParamsTable", 3))
@@ -183,6 +358,8 @@ namespace Specter {
 			ImGui::InputDouble("Max X", &m_newParams.max_x);
 			ImGui::EndTable();
 		}
+		//Rows use the counts of existing 1D spectra of the parameters with the same binning, instead of filling a copy
+		ImGui::Checkbox("Share rows with 1D spectra", &m_newParams.isLinkedSummary);
 		if (ImGui::TreeNode("Selected Parameters"))
 		{
 			for (auto& name : m_subhistos)
@@ -29,13 +29,20 @@ namespace Specter {
 		void RenderDialog1D(const std::vector<std::string>& paramList);
 		void RenderDialog2D(const std::vector<std::string>& paramList);
 		void RenderDialogSummary(const std::vector<std::string>& paramList);
+		void RenderDialogND(const std::vector<std::string>& paramList);
 		void RenderCutDialog(const std::vector<CutArgs>& cutList);
+		void RenderTimeWindowOptions();
+		void RenderMemoryEstimate(const SpectrumManager::Ref& manager);
+		void ParseBinningLists();
 
 		bool m_openFlag;
 		bool m_openCutFlag;
 		HistogramArgs m_newParams;
 		HistogramArgs m_blank;
 		std::vector<std::string> m_subhistos;
+		bool m_isBackfilled; //Fill the new spectrum from the parameter cache
+		std::string m_edgesText; //Comma separated edges for non-uniform binning
+		std::string m_segmentBinsText; //Comma separated bins per segment for piecewise binning
 
 		ImGuiSelectableFlags selectFlags;
 		ImGuiTableFlags tableFlags;
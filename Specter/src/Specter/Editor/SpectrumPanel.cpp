@@ -25,6 +25,14 @@ namespace Specter {
         return stream.str();
     }
 
+    //A HistogramND is drawn (and cut) as its current 1D or 2D projection
+    static SpectrumType GetDrawnType(const HistogramArgs& args)
+    {
+        if (args.type != SpectrumType::HistoND)
+            return args.type;
+        return args.y_par == "None" ? SpectrumType::Histo1D : SpectrumType::Histo2D;
+    }
+
 	SpectrumPanel::SpectrumPanel() :
         m_zoomedFlag(false), m_cutModeFlag(false), m_acceptCutFlag(false), m_zoomedGram(),  m_totalSlots(1), m_nRegions(0)
 	{
@@ -53,7 +61,14 @@ namespace Specter {
                     }
                     ImGui::SameLine();
                     RenderRemoveRegionButton();
-                    if (m_zoomedGram.type == SpectrumType::Histo2D || m_zoomedGram.type == SpectrumType::Summary)
+                    if (m_zoomedGram.type == SpectrumType::HistoND)
+                        RenderProjectionControls(manager);
+                    else if (m_zoomedGram.type == SpectrumType::Histo2D)
+                    {
+                        ImGui::SameLine();
+                        RenderProjectButton(manager);
+                    }
+                    if (GetDrawnType(m_zoomedGram) == SpectrumType::Histo2D || m_zoomedGram.type == SpectrumType::Summary)
                     {
                         float* scale = manager->GetColorScaleRange(m_zoomedGram.name);
                         ImGui::DragFloatRange2("Min / Max", &(scale[0]), &(scale[1]), 0.01f);
@@ -169,7 +184,7 @@ namespace Specter {
 
     void SpectrumPanel::HandleCutMode()
     {
-        switch (m_zoomedGram.type)
+        switch (GetDrawnType(m_zoomedGram))
         {
         case SpectrumType::Histo1D:
         {
@@ -214,7 +229,7 @@ namespace Specter {
             ImPlot::PlotVLines(m_newCutArgs.name.c_str(), m_newCutX.data(), int(m_newCutX.size()));
             break;
         }
-        case SpectrumType::None:
+        case SpectrumType::HistoND: case SpectrumType::None:
         {
             m_cutModeFlag = false;
             break;
@@ -299,7 +314,7 @@ namespace Specter {
         {
             m_newCutArgs.x_par = m_zoomedGram.x_par;
             m_newCutArgs.y_par = m_zoomedGram.y_par;
-            switch (m_zoomedGram.type)
+            switch (GetDrawnType(m_zoomedGram))
             {
                 case SpectrumType::Histo1D:
                 {
@@ -323,7 +338,7 @@ namespace Specter {
                         m_newCutArgs.type = CutType::CutSummaryAll;
                     break;
                 }
-                case SpectrumType::None: m_newCutArgs.type = CutType::None; break;
+                case SpectrumType::HistoND: case SpectrumType::None: m_newCutArgs.type = CutType::None; break;
             }
             ImGui::InputText("Cut Name", &m_newCutArgs.name);
             if (ImGui::Button("Accept & Draw"))
@@ -340,6 +355,123 @@ namespace Specter {
         }
     }
 
+    //Select the axes a HistogramND is projected on, and gate the remaining axes
+    void SpectrumPanel::RenderProjectionControls(const SpectrumManager::Ref& manager)
+    {
+        ProjectionArgs projection = m_zoomedGram.projection;
+        const std::vector<AxisArgs>& axes = m_zoomedGram.axes;
+        if (axes.empty())
+            return;
+        bool isChanged = false;
+
+        ImGui::SetNextItemWidth(150.0f);
+        if (ImGui::BeginCombo("Projection X", axes[projection.x_axis].par.c_str()))
+        {
+            for (int i = 0; i < int(axes.size()); i++)
+            {
+                if (i != projection.y_axis && ImGui::Selectable(axes[i].par.c_str(), i == projection.x_axis))
+                {
+                    projection.x_axis = i;
+                    isChanged = true;
+                }
+            }
+            ImGui::EndCombo();
+        }
+        ImGui::SameLine();
+        ImGui::SetNextItemWidth(150.0f);
+        if (ImGui::BeginCombo("Projection Y", projection.y_axis < 0 ? "None" : axes[projection.y_axis].par.c_str()))
+        {
+            if (ImGui::Selectable("None", projection.y_axis < 0))
+            {
+                projection.y_axis = -1;
+                isChanged = true;
+            }
+            for (int i = 0; i < int(axes.size()); i++)
+            {
+                if (i != projection.x_axis && ImGui::Selectable(axes[i].par.c_str(), i == projection.y_axis))
+                {
+                    projection.y_axis = i;
+                    isChanged = true;
+                }
+            }
+            ImGui::EndCombo();
+        }
+
+        if (projection.gates.empty())
+        {
+            for (auto& axis : axes)
+                projection.gates.emplace_back(axis.min, axis.max);
+        }
+        for (int i = 0; i < int(axes.size()); i++)
+        {
+            if (i == projection.x_axis || i == projection.y_axis)
+                continue;
+            double gate[2] = { projection.gates[i].first, projection.gates[i].second };
+            std::string label = "Gate " + axes[i].par;
+            ImGui::SameLine();
+            ImGui::SetNextItemWidth(200.0f);
+            if (ImGui::DragScalarN(label.c_str(), ImGuiDataType_Double, gate, 2, float((axes[i].max - axes[i].min) * 0.001), &axes[i].min, &axes[i].max))
+            {
+                projection.gates[i] = std::make_pair(gate[0], gate[1]);
+                isChanged = true;
+            }
+        }
+
+        if (isChanged)
+        {
+            manager->SetHistogramProjection(m_zoomedGram.name, projection);
+            m_zoomedGram = manager->GetHistogramParams(m_zoomedGram.name);
+        }
+    }
+
+    //Button/dialog for making a projection of the zoomed Histogram2D, optionally within a band of the other axis
+    void SpectrumPanel::RenderProjectButton(const SpectrumManager::Ref& manager)
+    {
+        if (ImGui::Button("Project"))
+        {
+            m_newProjectionArgs = HistogramArgs();
+            m_newProjectionArgs.name = m_zoomedGram.name + "_projX";
+            m_newProjectionArgs.parent = m_zoomedGram.name;
+            m_newProjectionArgs.bandMin = m_zoomedGram.min_y;
+            m_newProjectionArgs.bandMax = m_zoomedGram.max_y;
+            ImGui::OpenPopup("New Projection Dialog");
+        }
+        if (ImGui::BeginPopupModal("New Projection Dialog"))
+        {
+            if (ImGui::RadioButton("Onto X", !m_newProjectionArgs.isYProjection))
+            {
+                m_newProjectionArgs.isYProjection = false;
+                m_newProjectionArgs.name = m_zoomedGram.name + "_projX";
+                m_newProjectionArgs.bandMin = m_zoomedGram.min_y;
+                m_newProjectionArgs.bandMax = m_zoomedGram.max_y;
+            }
+            ImGui::SameLine();
+            if (ImGui::RadioButton("Onto Y", m_newProjectionArgs.isYProjection))
+            {
+                m_newProjectionArgs.isYProjection = true;
+                m_newProjectionArgs.name = m_zoomedGram.name + "_projY";
+                m_newProjectionArgs.bandMin = m_zoomedGram.min_x;
+                m_newProjectionArgs.bandMax = m_zoomedGram.max_x;
+            }
+            ImGui::InputText("Projection Name", &m_newProjectionArgs.name);
+            std::string bandParam = m_newProjectionArgs.isYProjection ? m_zoomedGram.x_par : m_zoomedGram.y_par;
+            ImGui::InputDouble(("Band Min (" + bandParam + ")").c_str(), &m_newProjectionArgs.bandMin);
+            ImGui::InputDouble(("Band Max (" + bandParam + ")").c_str(), &m_newProjectionArgs.bandMax);
+            if (ImGui::Button("Ok"))
+            {
+                manager->AddHistogramProjection(m_newProjectionArgs);
+                ImGui::CloseCurrentPopup();
+                m_result = true;
+            }
+            ImGui::SameLine();
+            if (ImGui::Button("Cancel"))
+            {
+                ImGui::CloseCurrentPopup();
+            }
+            ImGui::EndPopup();
+        }
+    }
+
     //Simple button/dialog for removing integration regions
     void SpectrumPanel::RenderRemoveRegionButton()
     {
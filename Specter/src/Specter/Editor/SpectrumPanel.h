@@ -43,6 +43,8 @@ namespace Specter {
 		void RenderAcceptCutDialog(const SpectrumManager::Ref& manager);
 		void RenderCutButton();
 		void RenderRemoveRegionButton();
+		void RenderProjectionControls(const SpectrumManager::Ref& manager);
+		void RenderProjectButton(const SpectrumManager::Ref& manager);
 		void RemoveSelectedRegion(const std::string& region);
 
 		std::vector<HistogramArgs> m_selectedGrams;
@@ -56,6 +58,7 @@ namespace Specter {
 		int m_totalSlots;
 		int m_nRegions;
 		CutArgs m_newCutArgs;
+		HistogramArgs m_newProjectionArgs;
 		std::vector<double> m_newCutX;
 		std::vector<double> m_newCutY;
 	};
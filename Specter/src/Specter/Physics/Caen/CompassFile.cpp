@@ -96,8 +96,7 @@ namespace Specter {
 			m_hitsize += 5;
 			char* firstHit = new char[m_hitsize]; //Read chunk of first hit
 			m_file->read(firstHit, m_hitsize);
-			firstHit += m_hitsize - 4; //Move to the Nsamples value
-			uint32_t nsamples = *((uint32_t*)firstHit);
+			uint32_t nsamples = *((uint32_t*)(firstHit + m_hitsize - 4)); //Nsamples value is the last 4 bytes of the chunk
 			m_hitsize += nsamples * 2; //Each sample is two bytes
 			m_file->seekg(0, std::ios_base::beg);
 			m_file->read(header, 2);
@@ -38,7 +38,7 @@ namespace Specter {
 		bool GetNextHit();
 	
 		inline bool IsOpen() const { return m_file->is_open(); };
-		inline CompassHit GetCurrentHit() const { return m_currentHit; }
+		inline const CompassHit& GetCurrentHit() const { return m_currentHit; }
 		inline std::string GetName() const { return  m_filename; }
 		inline bool CheckHitHasBeenUsed() const { return m_hitUsedFlag; } //query to find out if we've used the current hit
 		inline void SetHitHasBeenUsed() { m_hitUsedFlag = true; } //flip the flag to indicate the current hit has been used
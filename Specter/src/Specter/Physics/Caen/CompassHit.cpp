@@ -19,6 +19,6 @@ namespace Specter {
 
 	bool Compass_IsWaves(uint16_t header)
 	{
-		return (header & CompassHeaders::EnergyCalibrated) != 0;
+		return (header & CompassHeaders::Waves) != 0;
 	}
 }
\ No newline at end of file
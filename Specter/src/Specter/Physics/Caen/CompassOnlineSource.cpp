@@ -17,15 +17,17 @@
 	Make it so that number of channels per board is no longer fixed. Use pairing function defined in Utils/Functions.h to generate a UUID for each board channel/pair.
 
 	GWM -- Oct 2022
+
+	Hits are time sorted as a stream with a user set sort window (see TimeSorter) rather than in fixed 1000 hit buffers.
 */
 #include "CompassOnlineSource.h"
 
 namespace Specter {
 
-	CompassOnlineSource::CompassOnlineSource(const std::string& hostname, const std::string& port, uint16_t header, uint64_t coincidenceWindow) :
+	CompassOnlineSource::CompassOnlineSource(const std::string& hostname, const std::string& port, uint16_t header, uint64_t coincidenceWindow, uint64_t sortWindow) :
 		DataSource(coincidenceWindow), m_bufferIter(nullptr), m_bufferEnd(nullptr), m_header(header)
 	{
-		m_eventBuilder.SetSortFlag(true);
+		m_eventBuilder.SetSortWindow(sortWindow);
 		InitConnection(hostname, port);
 	}
 
@@ -86,9 +88,9 @@ namespace Specter {
 	void CompassOnlineSource::FillBuffer()
 	{
 		SPEC_PROFILE_FUNCTION();
-		if (!m_connection.IsOpen()) //Make sure connection is still cool
+		if (!m_connection.IsOpen()) //Make sure connection is still cool; if not, build what was held back
 		{
-			m_validFlag = false;
+			EndOfData();
 			return;
 		}
 
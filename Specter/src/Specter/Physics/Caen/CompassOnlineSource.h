@@ -23,6 +23,8 @@
 	Make it so that number of channels per board is no longer fixed. Use pairing function defined in Utils/Functions.h to generate a UUID for each board channel/pair.
 
 	GWM -- Oct 2022
+
+	Hits are time sorted as a stream with a user set sort window (see TimeSorter) rather than in fixed 1000 hit buffers.
 */
 #ifndef COMPASS_ONLINE_SOURCE_H
 #define COMPASS_ONLINE_SOURCE_H
@@ -36,16 +38,11 @@ namespace Specter {
 	class CompassOnlineSource : public DataSource
 	{
 	public:
-		CompassOnlineSource(const std::string& hostname, const std::string& port, uint16_t header, uint64_t coincidenceWindow);
+		CompassOnlineSource(const std::string& hostname, const std::string& port, uint16_t header, uint64_t coincidenceWindow, uint64_t sortWindow);
 		virtual ~CompassOnlineSource() override;
 
 		virtual void ProcessData() override;
-		virtual std::vector<SpecEvent> GetEvents() override
-		{
-			auto temp = m_eventBuilder.GetReadyEvents();
-			m_eventBuilder.ClearReadyEvents();
-			return temp;
-		}
+		virtual EventArena::Ref GetEvents() override { return m_eventBuilder.GetReadyEvents(); }
 		virtual const bool IsEventReady() const override { return m_eventBuilder.IsEventReady(); }
 
 	private:
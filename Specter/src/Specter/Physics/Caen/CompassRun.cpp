@@ -21,13 +21,16 @@
 	Make it so that number of channels per board is no longer fixed. Use pairing function defined in Utils/Functions.h to generate a UUID for each board channel/pair.
 
 	GWM -- Oct 2022
+
+	Files are now merged through a TimeOrderedMerger (loser tree) rather than scanning every file for each hit, and hits are read in place
+	from the file instead of being copied out for each comparison.
 */
 #include "CompassRun.h"
 
 namespace Specter {
 	
 	CompassRun::CompassRun(const std::string& dir, uint64_t coincidenceWindow) :
-		DataSource(coincidenceWindow), m_directory(dir), m_startIndex(0)
+		DataSource(coincidenceWindow), m_directory(dir), m_isMergerBuilt(false), m_currentFile(nullptr)
 	{
 		CollectFiles();
 	}
@@ -44,6 +47,8 @@ namespace Specter {
 				nfiles++;
 		}
 
+		m_isMergerBuilt = false;
+		m_currentFile = nullptr;
 		m_datafiles.clear();
 		m_datafiles.reserve(nfiles);
 		for(auto& item : std::filesystem::directory_iterator(m_directory))
@@ -85,42 +90,40 @@ namespace Specter {
 
 	/*
 		GetHitsFromFiles() is the function which actually retrieves and sorts the data from the individual
-		files. There are several tricks which allow this to happen. First is that, after sorting, it is impossible
-		to determine which file the data originally came from (short of parsing the name of the file against board/channel).
-		However, we need to let the file know that we want it to pull the next hit. To do this, a pointer to the UsedFlag of the file
-		is retrieved along with the data. This flag is flipped so that on the next hit cycle a new hit is pulled. Second is the use
-		of a rolling start index. Once a file has gone EOF, we no longer need it. If this is the first file in the list, we can just skip
-		that index all together. In this way, the loop can go from N times to N-1 times.
+		files. Each file is already time ordered, so only the head of each file competes in the merger. The winning file is kept
+		as m_currentFile and its hit is read in place; only on the next call is that file advanced and put back into the merger.
+		The merger is built on the first call (rather than in CollectFiles) so that the first hits see any shift map that was set.
 	*/
 	bool CompassRun::GetHitsFromFiles() 
 	{
 		SPEC_PROFILE_FUNCTION();
-		std::pair<CompassHit, bool*> earliestHit = std::make_pair(CompassHit(), nullptr);
-		for(unsigned int i=m_startIndex; i<m_datafiles.size(); i++) 
+		if (!m_isMergerBuilt)
 		{
-			if(m_datafiles[i].CheckHitHasBeenUsed()) 
-				m_datafiles[i].GetNextHit();
-	
-			if(m_datafiles[i].IsEOF()) 
-			{
-				if(i == m_startIndex)
-					m_startIndex++;
-				continue;
-			} 
-			else if(i == m_startIndex) 
+			m_merger.Reset(m_datafiles.size());
+			for (std::size_t i = 0; i < m_datafiles.size(); i++)
 			{
-				earliestHit = std::make_pair(m_datafiles[i].GetCurrentHit(), m_datafiles[i].GetUsedFlagPtr());
-			} 
-			else if(m_datafiles[i].GetCurrentHit().timestamp < earliestHit.first.timestamp) 
-			{
-				earliestHit = std::make_pair(m_datafiles[i].GetCurrentHit(), m_datafiles[i].GetUsedFlagPtr());
+				m_datafiles[i].GetNextHit();
+				if (!m_datafiles[i].IsEOF())
+					m_merger.SetTimestamp(i, m_datafiles[i].GetCurrentHit().timestamp);
 			}
+			m_merger.Build();
+			m_isMergerBuilt = true;
 		}
-	
-		if(earliestHit.second == nullptr) 
-			return false; //Make sure that there actually was a hit
-		m_hit = earliestHit.first;
-		*earliestHit.second = true;
+		else if (m_currentFile != nullptr)
+		{
+			m_currentFile->GetNextHit();
+			if (m_currentFile->IsEOF())
+				m_merger.RemoveEarliest();
+			else
+				m_merger.AdvanceEarliest(m_currentFile->GetCurrentHit().timestamp);
+		}
+
+		if (m_merger.IsEmpty())
+		{
+			m_currentFile = nullptr;
+			return false;
+		}
+		m_currentFile = &m_datafiles[m_merger.GetEarliest()];
 		return true;
 	}
 
@@ -135,16 +138,18 @@ namespace Specter {
 
 		if (!GetHitsFromFiles())
 		{
-			m_validFlag = false;
+			//Build the tail of the run first; once those events have been taken we're done
+			EndOfData();
 			return;
 		}
 		
 		//Convert data from CoMPASS format to universal Specter format.
-		m_datum.longEnergy = m_hit.energy;
-		m_datum.shortEnergy = m_hit.energyShort;
-		m_datum.calEnergy = m_hit.energyCalibrated;
-		m_datum.timestamp = m_hit.timestamp;
-		m_datum.id = Utilities::GetBoardChannelUUID(m_hit.board, m_hit.channel);
+		const CompassHit& hit = m_currentFile->GetCurrentHit();
+		m_datum.longEnergy = hit.energy;
+		m_datum.shortEnergy = hit.energyShort;
+		m_datum.calEnergy = hit.energyCalibrated;
+		m_datum.timestamp = hit.timestamp;
+		m_datum.id = Utilities::GetBoardChannelUUID(hit.board, hit.channel);
 
 		m_eventBuilder.AddDatum(m_datum);
 	}
@@ -19,6 +19,9 @@
 	Make it so that number of channels per board is no longer fixed. Use pairing function defined in Utils/Functions.h to generate a UUID for each board channel/pair.
 
 	GWM -- Oct 2022
+
+	Files are now merged through a TimeOrderedMerger (loser tree) rather than scanning every file for each hit, and hits are read in place
+	from the file instead of being copied out for each comparison.
 */
 #ifndef COMPASSRUN_H
 #define COMPASSRUN_H
@@ -27,6 +30,7 @@
 #include "Specter/Physics/DataSource.h"
 #include "CompassFile.h"
 #include "Specter/Physics/ShiftMap.h"
+#include "Specter/Physics/TimeOrderedMerger.h"
 #include <filesystem>
 
 namespace Specter {
@@ -37,12 +41,7 @@ namespace Specter {
 		CompassRun(const std::string& dir, uint64_t coincidenceWindow);
 		virtual ~CompassRun();
 		virtual void ProcessData() override;
-		virtual std::vector<SpecEvent> GetEvents() override
-		{
-			auto temp = m_eventBuilder.GetReadyEvents();
-			m_eventBuilder.ClearReadyEvents();
-			return temp;
-		}
+		virtual EventArena::Ref GetEvents() override { return m_eventBuilder.GetReadyEvents(); }
 		void SetDirectory(const std::string& dir) { m_directory = dir; CollectFiles(); }
 		void SetShiftMap(const std::string& filename) { m_smap.SetFile(filename); }
 		
@@ -56,11 +55,11 @@ namespace Specter {
 		const std::string m_extension = ".BIN";
 
 		std::vector<CompassFile> m_datafiles;
-		unsigned int m_startIndex; //this is the file we start looking at; increases as we finish files.
+		TimeOrderedMerger m_merger;
+		bool m_isMergerBuilt;
+		CompassFile* m_currentFile; //file holding the hit being processed; it is advanced on the next call
 
 		ShiftMap m_smap;
-
-		CompassHit m_hit;
 	
 		unsigned int m_totalHits;
 
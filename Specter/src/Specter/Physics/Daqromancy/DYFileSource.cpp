@@ -3,7 +3,7 @@
 namespace Specter {
 
 	DYFileSource::DYFileSource(const std::string& directory, uint64_t coicidenceWindow) :
-		DataSource(coicidenceWindow), m_directory(directory)
+		DataSource(coicidenceWindow), m_directory(directory), m_isMergerBuilt(false), m_currentFile(nullptr)
 	{
 		CollectFiles();
 	}
@@ -22,6 +22,8 @@ namespace Specter {
 				nfiles++;
 		}
 
+		m_isMergerBuilt = false;
+		m_currentFile = nullptr;
 		m_files.clear();
 		m_files.reserve(nfiles);
 		for (auto& item : std::filesystem::directory_iterator(m_directory))
@@ -58,33 +60,37 @@ namespace Specter {
 		}
 	}
 
+	//Same scheme as CompassRun: the file heads compete in a TimeOrderedMerger, and the winning file is only advanced on the next call
 	bool DYFileSource::GetNextHit()
 	{
 		SPEC_PROFILE_FUNCTION();
-		DaqGrimoire::DYFileReader* earliestFile = nullptr;
-
-		for (std::size_t i = m_startIndex; i < m_files.size(); i++)
+		if (!m_isMergerBuilt)
 		{
-			if (m_files[i].IsHitUsed())
-				m_files[i].ReadNextEvent();
-
-			if (m_files[i].IsEOF())
+			m_merger.Reset(m_files.size());
+			for (std::size_t i = 0; i < m_files.size(); i++)
 			{
-				if (i == m_startIndex)
-					m_startIndex++;
-				continue;
-			}
-			else if (i == m_startIndex || m_files[i].GetCurrentEvent().timestamp < earliestFile->GetCurrentEvent().timestamp)
-			{
-				earliestFile = &(m_files[i]);
+				m_files[i].ReadNextEvent();
+				if (!m_files[i].IsEOF())
+					m_merger.SetTimestamp(i, m_files[i].GetCurrentEvent().timestamp);
 			}
+			m_merger.Build();
+			m_isMergerBuilt = true;
+		}
+		else if (m_currentFile != nullptr)
+		{
+			m_currentFile->ReadNextEvent();
+			if (m_currentFile->IsEOF())
+				m_merger.RemoveEarliest();
+			else
+				m_merger.AdvanceEarliest(m_currentFile->GetCurrentEvent().timestamp);
 		}
 
-		if (earliestFile == nullptr)
+		if (m_merger.IsEmpty())
+		{
+			m_currentFile = nullptr;
 			return false;
-
-		m_dyHit = earliestFile->GetCurrentEvent();
-		earliestFile->SetHitUsed();
+		}
+		m_currentFile = &m_files[m_merger.GetEarliest()];
 		return true;
 	}
 
@@ -98,13 +104,16 @@ namespace Specter {
 
 		if (!GetNextHit())
 		{
-			m_validFlag = false;
+			//Build the tail of the run first; once those events have been taken we're done
+			EndOfData();
+			return;
 		}
 		//Convert data from Daqromancy format to universal Specter format.
-		m_datum.longEnergy = m_dyHit.energy;
-		m_datum.shortEnergy = m_dyHit.energyShort;
-		m_datum.timestamp = m_dyHit.timestamp;
-		m_datum.id = Utilities::GetBoardChannelUUID(m_dyHit.board, m_dyHit.channel);
+		const auto& dyHit = m_currentFile->GetCurrentEvent();
+		m_datum.longEnergy = dyHit.energy;
+		m_datum.shortEnergy = dyHit.energyShort;
+		m_datum.timestamp = dyHit.timestamp;
+		m_datum.id = Utilities::GetBoardChannelUUID(dyHit.board, dyHit.channel);
 		m_eventBuilder.AddDatum(m_datum);
 	}
 }
\ No newline at end of file
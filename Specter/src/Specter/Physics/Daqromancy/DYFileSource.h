@@ -3,6 +3,7 @@
 
 #include "DaqGrimoire.h"
 #include "Specter/Physics/DataSource.h"
+#include "Specter/Physics/TimeOrderedMerger.h"
 #include <filesystem>
 
 namespace Specter {
@@ -14,12 +15,7 @@ namespace Specter {
 		virtual ~DYFileSource();
 
 		virtual void ProcessData() override;
-		virtual std::vector<SpecEvent> GetEvents() override
-		{
-			auto temp = m_eventBuilder.GetReadyEvents();
-			m_eventBuilder.ClearReadyEvents();
-			return temp;
-		}
+		virtual EventArena::Ref GetEvents() override { return m_eventBuilder.GetReadyEvents(); }
 
 		virtual const bool IsEventReady() const override { return m_eventBuilder.IsEventReady(); }
 
@@ -31,8 +27,9 @@ namespace Specter {
 		static constexpr std::string_view s_extension = ".dybin";
 
 		std::vector<DaqGrimoire::DYFileReader> m_files;
-		DaqGrimoire::DYListData m_dyHit;
-		std::size_t m_startIndex;
+		TimeOrderedMerger m_merger;
+		bool m_isMergerBuilt;
+		DaqGrimoire::DYFileReader* m_currentFile; //file holding the hit being processed; it is advanced on the next call
 
 		uint64_t m_totalDataHits;
 	};
@@ -2,10 +2,10 @@
 
 namespace Specter {
 
-	DYOnlineSource::DYOnlineSource(const std::string& hostname, const std::string& port, uint64_t coincidenceWindow) :
+	DYOnlineSource::DYOnlineSource(const std::string& hostname, const std::string& port, uint64_t coincidenceWindow, uint64_t sortWindow) :
 		DataSource(coincidenceWindow), m_clientConnection(hostname, port)
 	{
-		m_eventBuilder.SetSortFlag(true);
+		m_eventBuilder.SetSortWindow(sortWindow);
 		m_validFlag = m_clientConnection.IsConnected();
 	}
 
@@ -17,7 +17,7 @@ namespace Specter {
 	{
 		if (!m_clientConnection.IsConnected())
 		{
-			m_validFlag = false;
+			EndOfData(); //Build what the sort window was holding back
 			return;
 		}
 
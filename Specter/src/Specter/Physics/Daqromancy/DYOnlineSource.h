@@ -9,16 +9,11 @@ namespace Specter {
 	class DYOnlineSource : public DataSource
 	{
 	public:
-		DYOnlineSource(const std::string& hostname, const std::string& port, uint64_t coincidenceWindow);
+		DYOnlineSource(const std::string& hostname, const std::string& port, uint64_t coincidenceWindow, uint64_t sortWindow);
 		virtual ~DYOnlineSource();
 
 		virtual void ProcessData() override;
-		virtual std::vector<SpecEvent> GetEvents() override
-		{
-			auto temp = m_eventBuilder.GetReadyEvents();
-			m_eventBuilder.ClearReadyEvents();
-			return temp;
-		}
+		virtual EventArena::Ref GetEvents() override { return m_eventBuilder.GetReadyEvents(); }
 
 		virtual const bool IsEventReady() const override { return m_eventBuilder.IsEventReady(); }
 
@@ -5,6 +5,9 @@
 	apparent.
 
 	GWM -- Feb 2022
+
+	Sources call EndOfData when their data stops, be it a file run ending or an online connection dropping, so that the hits still held
+	by the event builder are analyzed rather than lost.
 */
 #ifndef DATA_SOURCE_H
 #define DATA_SOURCE_H
@@ -36,11 +39,26 @@ namespace Specter {
 
 		virtual ~DataSource() {};
 		virtual void ProcessData() = 0;
-		virtual std::vector<SpecEvent> GetEvents() = 0;
+		virtual EventArena::Ref GetEvents() = 0; //Built events, owned jointly with the source's event builder until released
 		virtual const bool IsEventReady() const = 0;
 		bool IsValid() { return m_validFlag; }
+		//Hits that arrived after later hits were already released by the time sorter (online sources only)
+		uint64_t GetNumberOfLateHits() const { return m_eventBuilder.GetNumberOfLateHits(); }
+		uint64_t GetMaxLateness() const { return m_eventBuilder.GetMaxLateness(); }
+		//Builds everything the event builder is still holding back (sort window and open event), e.g. when the source is stopped
+		void Flush() { m_eventBuilder.Flush(); }
 
 	protected:
+		//No more data (end of the files, or the connection was lost). The held back tail is built first, and the source only goes
+		//invalid once those events have been taken.
+		void EndOfData()
+		{
+			if (m_eventBuilder.HasPendingData())
+				m_eventBuilder.Flush();
+			else if (!m_eventBuilder.IsEventReady())
+				m_validFlag = false;
+		}
+
 		bool m_validFlag;
 		SpecData m_datum;
 		PhysicsEventBuilder m_eventBuilder;
@@ -52,7 +70,9 @@ namespace Specter {
 		std::string location = "";
 		std::string port = "";
 		uint64_t coincidenceWindow = 0;
+		uint64_t sortWindow = 1000000000; //Max expected out-of-orderness (ps) of online data; hits are held back this long to be time sorted
 		uint16_t bitflags = 0;
+		uint32_t eventBatchSize = 256; //Number of events filled per manager lock. Larger is higher throughput, smaller is lower latency
 	};
 
 	DataSource* CreateDataSource(const SourceArgs& args);
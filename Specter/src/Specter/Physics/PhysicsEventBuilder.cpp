@@ -1,27 +1,38 @@
 /*
 	PhysicsEventBuilder.h
-	Class for taking in raw SpecData and converting into a SpecEvent. SpecEvent is just a std::vector of SpecData, where
+	Class for taking in raw SpecData and converting into a SpecEvent. SpecEvent is a view of consecutive SpecData in an EventArena (see SpecData.h), where
 	the held SpecData all falls within a time window called the coincidence window. As soon as a SpecData is given that falls outside
-	of this window, the current event is shifted to the ready event vector. The ready event can then be retrieved. The hit that triggered the end of 
+	of this window, the current event is closed and becomes ready. The ready events can then be retrieved. The hit that triggered the end of 
 	event then is used to start the new event. The current pattern is strongly associated with digital electronics concepts 
 	for nuclear data aquisition systems.
 
 	GWM -- Feb 2022
 
 	Added data time sorting, make event building model more compatible with different data sources.  -- GWM April 2023
+
+	Hits are now written once into an EventArena and events are built in place, as (begin, end) ranges of the arena. GetReadyEvents hands
+	the whole arena to the caller, no copies. Arenas are pooled: once every reference outside the builder is dropped, the arena is cleared
+	(keeping its capacity) and reused, so steady state building does not allocate. The event still open at the end of a buffer is carried
+	into the next build rather than being cut (or dropped), and Flush closes it at the end of the data.
+
+	Online sources now set a sort window instead of the sort flag: hits go through a streaming TimeSorter and come out in time order, so
+	events are built as the hits arrive rather than one 1000 hit buffer at a time. File sources keep the buffered path; their input is already
+	ordered and they care about throughput, not latency.
 */
 #include "PhysicsEventBuilder.h"
 
 namespace Specter {
 
 	PhysicsEventBuilder::PhysicsEventBuilder() :
-		m_sortFlag(false), m_coincWindow(0), m_bufferIndex(0)
+		m_sortFlag(false), m_isStreamSorted(false), m_eventStartTime(0), m_coincWindow(0), m_bufferIndex(0)
 	{
+		m_arena = AcquireArena();
 	}
 
 	PhysicsEventBuilder::PhysicsEventBuilder(uint64_t windowSize) :
-		m_sortFlag(false), m_coincWindow(windowSize), m_bufferIndex(0)
+		m_sortFlag(false), m_isStreamSorted(false), m_eventStartTime(0), m_coincWindow(windowSize), m_bufferIndex(0)
 	{
+		m_arena = AcquireArena();
 	}
 
 	PhysicsEventBuilder::~PhysicsEventBuilder()
@@ -34,38 +45,115 @@ namespace Specter {
 		if (datum.timestamp == 0) //Ignore empty data (need a valid timestamp)
 			return;
 
-		m_dataBuffer[m_bufferIndex] = datum;
+		if (m_isStreamSorted)
+		{
+			m_sorter.Push(datum);
+			while (m_sorter.PopReleased(m_releasedDatum))
+				AddOrderedDatum(m_releasedDatum);
+			return;
+		}
+
+		m_arena->m_hits.push_back(datum);
 		m_bufferIndex++;
 		if (m_bufferIndex < s_maxDataBuffer) //If we haven't filled the buffer keep going
 			return;
-		else if (m_sortFlag) //do time sorting if needed
-			std::sort(m_dataBuffer.begin(), m_dataBuffer.end(), [](SpecData& i, SpecData& j) { return i.timestamp < j.timestamp; });
-		
-		//Generate our ready events
-		m_readyEvents.clear();
-		uint64_t eventStartTime = m_dataBuffer[0].timestamp;
-		SpecEvent event;
-		event.push_back(m_dataBuffer[0]);
-		for (auto& data : m_dataBuffer)
+
+		BuildEvents(false);
+		m_bufferIndex = 0;
+	}
+
+	//Time ordered input: an event is closed as soon as a hit falls outside of its window. A late hit (older than the event start, see TimeSorter)
+	//is kept in the open event rather than closing it
+	void PhysicsEventBuilder::AddOrderedDatum(const SpecData& datum)
+	{
+		std::vector<SpecData>& hits = m_arena->m_hits;
+		if (GetFirstPendingHit() == hits.size())
+			m_eventStartTime = datum.timestamp;
+		else if (datum.timestamp >= m_eventStartTime + m_coincWindow)
 		{
-			if (data.timestamp - eventStartTime < m_coincWindow) //are we within active window
-			{
-				event.push_back(data);
-			}
-			else // found one that falls outside
+			m_arena->m_eventEnds.push_back(hits.size());
+			m_eventStartTime = datum.timestamp;
+		}
+		hits.push_back(datum);
+	}
+
+	void PhysicsEventBuilder::AppendToEvent(std::span<const SpecData> hits)
+	{
+		m_arena->m_hits.insert(m_arena->m_hits.end(), hits.begin(), hits.end());
+	}
+
+	void PhysicsEventBuilder::CloseEvent()
+	{
+		if (HasPendingData())
+			m_arena->m_eventEnds.push_back(m_arena->m_hits.size());
+	}
+
+	void PhysicsEventBuilder::Flush()
+	{
+		m_bufferIndex = 0;
+		while (m_sorter.PopAny(m_releasedDatum))
+			AddOrderedDatum(m_releasedDatum);
+
+		if (!HasPendingData())
+			return;
+		else if (m_isStreamSorted)
+			CloseEvent();
+		else
+			BuildEvents(true);
+	}
+
+	//Splits the pending hits into events in place. Unless asked to close it, the last event is left pending, as hits
+	//belonging to it may still be on the way.
+	void PhysicsEventBuilder::BuildEvents(bool closeLastEvent)
+	{
+		SPEC_PROFILE_FUNCTION();
+		std::vector<SpecData>& hits = m_arena->m_hits;
+		std::vector<std::size_t>& eventEnds = m_arena->m_eventEnds;
+		std::size_t first = GetFirstPendingHit();
+		if (m_sortFlag) //do time sorting if needed
+			std::sort(hits.begin() + first, hits.end(), [](const SpecData& i, const SpecData& j) { return i.timestamp < j.timestamp; });
+
+		uint64_t eventStartTime = hits[first].timestamp;
+		for (std::size_t i = first + 1; i < hits.size(); i++)
+		{
+			if (hits[i].timestamp - eventStartTime >= m_coincWindow) // found one that falls outside the active window
 			{
-				m_readyEvents.push_back(event);
-				event.clear();
-				eventStartTime = data.timestamp;
-				event.push_back(data);
+				eventEnds.push_back(i);
+				eventStartTime = hits[i].timestamp;
 			}
 		}
-		m_bufferIndex = 0; //Reset the buffer without reallocating
+
+		if (closeLastEvent)
+			eventEnds.push_back(hits.size());
 	}
 
-	std::vector<SpecEvent> PhysicsEventBuilder::GetReadyEvents() const
+	EventArena::Ref PhysicsEventBuilder::GetReadyEvents()
 	{
-		return m_readyEvents;
+		SPEC_PROFILE_FUNCTION();
+		EventArena::Ref ready = m_arena;
+		m_arena = AcquireArena();
+
+		//Pending hits (the open event) move to the new arena
+		std::size_t first = ready->m_eventEnds.empty() ? 0 : ready->m_eventEnds.back();
+		m_arena->m_hits.assign(ready->m_hits.begin() + first, ready->m_hits.end());
+		ready->m_hits.resize(first);
+		return ready;
+	}
+
+	//The pool holds one reference to each arena, so a use count of one means nobody else is reading it
+	EventArena::Ref PhysicsEventBuilder::AcquireArena()
+	{
+		for (auto& arena : m_arenaPool)
+		{
+			if (arena.use_count() == 1)
+			{
+				arena->Clear();
+				return arena;
+			}
+		}
+
+		m_arenaPool.push_back(std::make_shared<EventArena>());
+		return m_arenaPool.back();
 	}
 
 }
\ No newline at end of file
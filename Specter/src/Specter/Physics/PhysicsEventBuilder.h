@@ -1,19 +1,29 @@
 /*
 	PhysicsEventBuilder.h
-	Class for taking in raw SpecData and converting into a SpecEvent. SpecEvent is just a std::vector of SpecData, where
+	Class for taking in raw SpecData and converting into a SpecEvent. SpecEvent is a view of consecutive SpecData in an EventArena (see SpecData.h), where
 	the held SpecData all falls within a time window called the coincidence window. As soon as a SpecData is given that falls outside
-	of this window, the current event is shifted to the ready event vector. The ready event can then be retrieved. The hit that triggered the end of 
+	of this window, the current event is closed and becomes ready. The ready events can then be retrieved. The hit that triggered the end of 
 	event then is used to start the new event. The current pattern is strongly associated with digital electronics concepts 
 	for nuclear data aquisition systems.
 
 	GWM -- Feb 2022
 
 	Added data time sorting, make event building model more compatible with different data sources.  -- GWM April 2023
+
+	Hits are now written once into an EventArena and events are built in place, as (begin, end) ranges of the arena. GetReadyEvents hands
+	the whole arena to the caller, no copies. Arenas are pooled: once every reference outside the builder is dropped, the arena is cleared
+	(keeping its capacity) and reused, so steady state building does not allocate. The event still open at the end of a buffer is carried
+	into the next build rather than being cut (or dropped), and Flush closes it at the end of the data.
+
+	Online sources now set a sort window instead of the sort flag: hits go through a streaming TimeSorter and come out in time order, so
+	events are built as the hits arrive rather than one 1000 hit buffer at a time. File sources keep the buffered path; their input is already
+	ordered and they care about throughput, not latency.
 */
 #ifndef PHYSICS_EVENT_BUILDER_H
 #define PHYSICS_EVENT_BUILDER_H
 
 #include "SpecData.h"
+#include "TimeSorter.h"
 
 namespace Specter {
 
@@ -25,22 +35,45 @@ namespace Specter {
 		~PhysicsEventBuilder();
 		void SetCoincidenceWindow(uint64_t windowSize) { m_coincWindow = windowSize; }
 		void SetSortFlag(bool flag) { m_sortFlag = flag; }
+		void SetSortWindow(uint64_t window) //Stream sort the input, releasing hits once they are window older than the newest hit of the slowest board
+		{
+			m_isStreamSorted = true;
+			m_sorter.SetWindow(window);
+		}
 		void ClearAll() // reset all internal structures
 		{
 			m_bufferIndex = 0;
-			m_readyEvents.clear();
+			m_arena->Clear();
+			m_sorter.Clear();
 		}
-		void ClearReadyEvents() { m_readyEvents.clear(); }
 		void AddDatum(const SpecData& datum);
-		bool IsEventReady() const { return !m_readyEvents.empty(); }
-		std::vector<SpecEvent> GetReadyEvents() const;
+		//For sources whose data arrives already built into events: append hits, then close them as one event
+		void AppendToEvent(std::span<const SpecData> hits);
+		void CloseEvent();
+		//Build all pending hits, including the still open event. Call at the end of the data.
+		void Flush();
+		bool IsEventReady() const { return m_arena->GetNumberOfEvents() != 0; }
+		bool HasPendingData() const { return GetFirstPendingHit() != m_arena->m_hits.size() || !m_sorter.IsEmpty(); }
+		uint64_t GetNumberOfLateHits() const { return m_sorter.GetNumberOfLateHits(); }
+		uint64_t GetMaxLateness() const { return m_sorter.GetMaxLateness(); }
+		//Take the built events. The builder reuses the arena once the caller releases it.
+		EventArena::Ref GetReadyEvents();
 
 	private:
+		void AddOrderedDatum(const SpecData& datum);
+		void BuildEvents(bool closeLastEvent);
+		EventArena::Ref AcquireArena();
+		std::size_t GetFirstPendingHit() const { return m_arena->m_eventEnds.empty() ? 0 : m_arena->m_eventEnds.back(); }
+
 		bool m_sortFlag;
+		bool m_isStreamSorted;
+		TimeSorter m_sorter;
+		SpecData m_releasedDatum;
+		uint64_t m_eventStartTime; //first hit of the open event, when stream sorted
 		static constexpr int s_maxDataBuffer = 1000;
-		std::array<SpecData, s_maxDataBuffer> m_dataBuffer;
-		int m_bufferIndex;
-		std::vector<SpecEvent> m_readyEvents;
+		int m_bufferIndex; //hits added since the last build
+		EventArena::Ref m_arena; //built events, followed by the pending hits
+		std::vector<EventArena::Ref> m_arenaPool; //every arena we made, including m_arena and those handed out
 		uint64_t m_coincWindow;
 
 	};
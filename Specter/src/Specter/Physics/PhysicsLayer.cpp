@@ -6,6 +6,17 @@
 	PhysicsLayer also owns the AnalysisStack for the application.
 
 	GWM -- Feb 2022
+
+	Events are now staged into a ParameterBatch and histograms are filled a block at a time, to reduce the number of times the
+	SpectrumManager lock is taken. The batch size is set through the SourceArgs.
+
+	Events arrive as an EventArena shared with the source's event builder. The arena keeps the hits alive even if the source is detached
+	mid-analysis, and is released after the analysis stack is done with it so the builder can reuse it.
+
+	On detach, the number of hits that came in later than the sort window allowed is reported, to help tune the window.
+
+	When the source is stopped, the hits it is still holding back (sort window and open event) are flushed and analyzed before the thread
+	exits, and online sources do the same when their connection drops. The late hit count is mirrored and logged while running as well.
 */
 #include "PhysicsLayer.h"
 #include "SpecData.h"
@@ -13,7 +24,8 @@
 namespace Specter {
 
 	PhysicsLayer::PhysicsLayer(const SpectrumManager::Ref& manager) :
-		m_manager(manager), m_activeFlag(false), m_source(nullptr), m_physThread(nullptr)
+		m_manager(manager), m_activeFlag(false), m_nLateHits(0), m_maxLateness(0), m_nReportedLateHits(0), m_source(nullptr), m_physThread(nullptr),
+		m_eventBatchSize(1)
 	{
 	}
 
@@ -84,6 +96,11 @@ namespace Specter {
 		if (m_source->IsValid())
 		{
 			SPEC_INFO("Source attached... Starting new analysis thread...");
+			m_eventBatchSize = args.eventBatchSize == 0 ? 1 : args.eventBatchSize;
+			m_nLateHits = 0;
+			m_maxLateness = 0;
+			m_nReportedLateHits = 0;
+			m_lastLateHitReport = std::chrono::steady_clock::now();
 			m_activeFlag = true;
 
 			m_physThread = new std::thread(&PhysicsLayer::RunSource, std::ref(*this));
@@ -100,12 +117,8 @@ namespace Specter {
 		SPEC_PROFILE_FUNCTION();
 		SPEC_INFO("Detaching physics data source...");
 
+		//The thread flushes the source on its way out, so it must be done before the source goes away
 		m_activeFlag = false;
-		{
-			std::scoped_lock<std::mutex> guard(m_sourceMutex);
-			m_source.reset(nullptr);
-		}
-		
 		if (m_physThread != nullptr && m_physThread->joinable())
 		{
 			m_physThread->join();
@@ -113,6 +126,13 @@ namespace Specter {
 		delete m_physThread;
 		m_physThread = nullptr;
 
+		{
+			std::scoped_lock<std::mutex> guard(m_sourceMutex);
+			if (m_source != nullptr && m_source->GetNumberOfLateHits() != 0)
+				SPEC_WARN("{0} hits arrived later than the sort window allowed (worst by {1} ps). Consider a larger sort window.", m_source->GetNumberOfLateHits(), m_source->GetMaxLateness());
+			m_source.reset(nullptr);
+		}
+
 		SPEC_INFO("Detach succesful.");
 	}
 
@@ -120,7 +140,10 @@ namespace Specter {
 	{
 		SPEC_PROFILE_FUNCTION();
 
-		std::vector<SpecEvent> events;
+		EventArena::Ref events;
+		ParameterBatch batch(m_eventBatchSize);
+		m_manager->PrepareParameterBatch(batch);
+		auto lastFlush = std::chrono::steady_clock::now();
 		while(m_activeFlag)
 		{
 			//Scope to encapsulate access to the data source
@@ -128,6 +151,10 @@ namespace Specter {
 				std::scoped_lock<std::mutex> guard(m_sourceMutex);
 				if (m_source == nullptr || !m_source->IsValid())
 				{
+					//Make sure the tail of the data makes it into the histograms
+					if (!batch.IsEmpty())
+						m_manager->UpdateHistograms(batch);
+					m_manager->PublishSnapshots(true);
 					SPEC_INFO("End of data source.");
 					return;
 				}
@@ -137,21 +164,79 @@ namespace Specter {
 				{
 					events = m_source->GetEvents();
 				}
+				m_nLateHits = m_source->GetNumberOfLateHits();
+				m_maxLateness = m_source->GetMaxLateness();
 			}
 
-			for (auto& event : events)
+			if (AnalyzeEvents(events, batch))
+				lastFlush = std::chrono::steady_clock::now();
+
+			//Slow sources shouldn't leave events sitting in a partial batch, and the UI still needs snapshots when the source is idle
+			if (std::chrono::steady_clock::now() - lastFlush > s_maxBatchLatency)
 			{
-				for (auto& stage : m_physStack)
-					stage->AnalyzePhysicsEvent(event);
+				if (!batch.IsEmpty())
+					m_manager->UpdateHistograms(batch);
+				else
+					m_manager->PublishSnapshots();
+				lastFlush = std::chrono::steady_clock::now();
+			}
+			ReportLateHits();
+		}
 
-				//Now that the analysis stack has filled all our Parameters with data, update the histogram counts
-				m_manager->UpdateHistograms();
-				//Invalidate all parameters to get ready for next event
-				m_manager->InvalidateParameters();
+		//Stopped with the source still running: analyze what it was holding back rather than dropping it
+		{
+			std::scoped_lock<std::mutex> guard(m_sourceMutex);
+			if (m_source != nullptr && m_source->IsValid())
+			{
+				m_source->Flush();
+				if (m_source->IsEventReady())
+					events = m_source->GetEvents();
 			}
+		}
+		AnalyzeEvents(events, batch);
+
+		if (!batch.IsEmpty())
+			m_manager->UpdateHistograms(batch);
+		m_manager->PublishSnapshots(true);
+	}
+
+	//Runs the analysis stack over the events and stages them into the batch. Returns true if a full batch was filled into the histograms.
+	bool PhysicsLayer::AnalyzeEvents(EventArena::Ref& events, ParameterBatch& batch)
+	{
+		SPEC_PROFILE_FUNCTION();
+		bool wasFilled = false;
+		std::size_t nEvents = events ? events->GetNumberOfEvents() : 0;
+		for (std::size_t i = 0; i < nEvents; i++)
+		{
+			SpecEvent event = events->GetEvent(i);
+			for (auto& stage : m_physStack)
+				stage->AnalyzePhysicsEvent(event);
 
-			if(!events.empty())
-				events.clear();
+			//Now that the analysis stack has filled all our Parameters with data, stage them (this also invalidates them for the next event)
+			batch.RecordEvent();
+			if (batch.IsFull())
+			{
+				m_manager->UpdateHistograms(batch);
+				wasFilled = true;
+			}
 		}
+
+		//Hand the arena back to the event builder for reuse
+		events.reset();
+		return wasFilled;
+	}
+
+	//Warns as soon as hits start arriving later than the sort window allows, and then at most once per interval as the count grows
+	void PhysicsLayer::ReportLateHits()
+	{
+		uint64_t nLateHits = m_nLateHits;
+		if (nLateHits == m_nReportedLateHits)
+			return;
+		else if (m_nReportedLateHits != 0 && std::chrono::steady_clock::now() - m_lastLateHitReport < s_lateHitReportInterval)
+			return;
+
+		SPEC_WARN("{0} hits so far arrived later than the sort window allowed (worst by {1} ps). Consider a larger sort window.", nLateHits, m_maxLateness.load());
+		m_nReportedLateHits = nLateHits;
+		m_lastLateHitReport = std::chrono::steady_clock::now();
 	}
 }
@@ -6,6 +6,11 @@
 	PhysicsLayer also owns the AnalysisStack for the application.
 
 	GWM -- Feb 2022
+
+	Events are now staged into a ParameterBatch and histograms are filled a block at a time, to reduce the number of times the
+	SpectrumManager lock is taken. The batch size is set through the SourceArgs.
+
+	The late hit count of the source is mirrored while the thread runs (see GetNumberOfLateHits), and is logged when it grows.
 */
 #ifndef PHYSICS_LAYER_H
 #define PHYSICS_LAYER_H
@@ -21,6 +26,7 @@
 #include <thread>
 #include <mutex>
 #include <atomic>
+#include <chrono>
 
 namespace Specter {
 
@@ -41,19 +47,33 @@ namespace Specter {
 
 		void PushStage(AnalysisStage* stage);
 
+		//Late hits of the attached source so far, updated by the physics thread while it runs
+		uint64_t GetNumberOfLateHits() const { return m_nLateHits; }
+		uint64_t GetMaxLateness() const { return m_maxLateness; }
+
 	private:
 		void AttachDataSource(const SourceArgs& args);
 		void DetachDataSource();
 		void RunSource();
+		bool AnalyzeEvents(EventArena::Ref& events, ParameterBatch& batch);
+		void ReportLateHits();
 
 		SpectrumManager::Ref m_manager;
 		AnalysisStack m_physStack;
 		std::atomic<bool> m_activeFlag; //safe read/write across thread, but more expensive
+		std::atomic<uint64_t> m_nLateHits;
+		std::atomic<uint64_t> m_maxLateness;
+		uint64_t m_nReportedLateHits; //physics thread only
+		std::chrono::steady_clock::time_point m_lastLateHitReport; //physics thread only
 
 		std::mutex m_sourceMutex;
 
 		std::unique_ptr<DataSource> m_source;
 		std::thread* m_physThread;
+		size_t m_eventBatchSize;
+
+		static constexpr std::chrono::milliseconds s_maxBatchLatency = std::chrono::milliseconds(100); //Flush partial batches at least this often
+		static constexpr std::chrono::seconds s_lateHitReportInterval = std::chrono::seconds(10); //Warn about new late hits at most this often
 
 	};
 
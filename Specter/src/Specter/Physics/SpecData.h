@@ -9,10 +9,16 @@
 	Update to reflect new CAEN binary data format with headers to indicate data contents.
 
 	GWM -- May 2022
+
+	SpecEvent is now a view (std::span) of hits rather than an owning vector. Built events live back to back in an EventArena, which the
+	event builder fills once and hands out whole; the arena is recycled by the builder once the consumer drops its reference. Views are only
+	valid while the arena that owns them is held.
 */
 #ifndef SPECDATA_H
 #define SPECDATA_H
 
+#include <span>
+
 namespace Specter {
 
 	struct SpecData
@@ -24,7 +30,35 @@ namespace Specter {
 		uint32_t id = 0;
 	};
 
-	using SpecEvent = std::vector<SpecData>;
+	using SpecEvent = std::span<const SpecData>;
+
+	//Hits of many events stored contiguously. Event i is the range of hits [eventEnds[i-1], eventEnds[i]).
+	//Hits past the last event end are still pending (not yet built into an event).
+	class EventArena
+	{
+	public:
+		using Ref = std::shared_ptr<EventArena>;
+
+		std::size_t GetNumberOfEvents() const { return m_eventEnds.size(); }
+		SpecEvent GetEvent(std::size_t index) const
+		{
+			std::size_t begin = index == 0 ? 0 : m_eventEnds[index - 1];
+			return SpecEvent(m_hits.data() + begin, m_eventEnds[index] - begin);
+		}
+
+		//Keeps capacity, so a recycled arena does not allocate again
+		void Clear()
+		{
+			m_hits.clear();
+			m_eventEnds.clear();
+		}
+
+	private:
+		friend class PhysicsEventBuilder;
+
+		std::vector<SpecData> m_hits;
+		std::vector<std::size_t> m_eventEnds;
+	};
 
 }
 
@@ -0,0 +1,92 @@
+/*
+	TimeOrderedMerger.cpp
+	Merges several time ordered sources (typically one file per digitizer channel) into one time ordered stream. This is a loser tree
+	(tournament tree) over source indices: each internal node remembers the loser of the match played there, and the overall winner is
+	the source with the earliest head. Taking the winner and replaying its path costs log2(N) comparisons, where the old linear scan
+	over every file cost N. Ties go to the lower source index, matching the previous scan.
+
+	The merger only holds timestamps and indices. The sources keep their hits, so a hit is read in place by whoever owns the source and
+	is never copied to be compared.
+*/
+#include "TimeOrderedMerger.h"
+
+namespace Specter {
+
+	TimeOrderedMerger::TimeOrderedMerger() :
+		m_nActive(0)
+	{
+	}
+
+	TimeOrderedMerger::~TimeOrderedMerger() {}
+
+	void TimeOrderedMerger::Reset(std::size_t nSources)
+	{
+		m_timestamps.assign(nSources, 0);
+		m_isDone.assign(nSources, 1);
+		m_losers.assign(std::max<std::size_t>(nSources, 1), 0);
+		m_nActive = 0;
+	}
+
+	void TimeOrderedMerger::SetTimestamp(std::size_t source, uint64_t timestamp)
+	{
+		if (m_isDone[source])
+			m_nActive++;
+		m_timestamps[source] = timestamp;
+		m_isDone[source] = 0;
+	}
+
+	//Play every match bottom up. Only the winners need to be stored while building; the tree keeps the losers.
+	void TimeOrderedMerger::Build()
+	{
+		SPEC_PROFILE_FUNCTION();
+		std::size_t nSources = m_timestamps.size();
+		if (nSources == 0)
+			return;
+
+		std::vector<std::size_t> winners(2 * nSources);
+		for (std::size_t i = 0; i < nSources; i++)
+			winners[nSources + i] = i;
+		for (std::size_t node = nSources - 1; node > 0; node--)
+		{
+			std::size_t left = winners[2 * node];
+			std::size_t right = winners[2 * node + 1];
+			if (IsEarlier(left, right))
+			{
+				winners[node] = left;
+				m_losers[node] = right;
+			}
+			else
+			{
+				winners[node] = right;
+				m_losers[node] = left;
+			}
+		}
+		m_losers[0] = nSources == 1 ? 0 : winners[1];
+	}
+
+	void TimeOrderedMerger::AdvanceEarliest(uint64_t timestamp)
+	{
+		m_timestamps[m_losers[0]] = timestamp;
+		Replay();
+	}
+
+	void TimeOrderedMerger::RemoveEarliest()
+	{
+		m_isDone[m_losers[0]] = 1;
+		m_nActive--;
+		Replay();
+	}
+
+	//The winner's head changed, so only the matches on its path to the root need to be replayed
+	void TimeOrderedMerger::Replay()
+	{
+		std::size_t nSources = m_timestamps.size();
+		std::size_t winner = m_losers[0];
+		for (std::size_t node = (nSources + winner) / 2; node > 0; node /= 2)
+		{
+			if (IsEarlier(m_losers[node], winner))
+				std::swap(m_losers[node], winner);
+		}
+		m_losers[0] = winner;
+	}
+}
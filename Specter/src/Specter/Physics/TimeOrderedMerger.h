@@ -0,0 +1,50 @@
+/*
+	TimeOrderedMerger.h
+	Merges several time ordered sources (typically one file per digitizer channel) into one time ordered stream. This is a loser tree
+	(tournament tree) over source indices: each internal node remembers the loser of the match played there, and the overall winner is
+	the source with the earliest head. Taking the winner and replaying its path costs log2(N) comparisons, where the old linear scan
+	over every file cost N. Ties go to the lower source index, matching the previous scan.
+
+	The merger only holds timestamps and indices. The sources keep their hits, so a hit is read in place by whoever owns the source and
+	is never copied to be compared.
+
+	Usage: Reset(N), SetTimestamp for every source that has data, Build(). Then, while !IsEmpty(), use GetEarliest() and either
+	AdvanceEarliest(next timestamp) or RemoveEarliest() if that source is done.
+*/
+#ifndef TIME_ORDERED_MERGER_H
+#define TIME_ORDERED_MERGER_H
+
+namespace Specter {
+
+	class TimeOrderedMerger
+	{
+	public:
+		TimeOrderedMerger();
+		~TimeOrderedMerger();
+
+		void Reset(std::size_t nSources); //All sources start out empty
+		void SetTimestamp(std::size_t source, uint64_t timestamp);
+		void Build();
+
+		bool IsEmpty() const { return m_nActive == 0; }
+		std::size_t GetEarliest() const { return m_losers[0]; }
+		void AdvanceEarliest(uint64_t timestamp);
+		void RemoveEarliest();
+
+	private:
+		bool IsEarlier(std::size_t a, std::size_t b) const
+		{
+			if (m_isDone[a] != m_isDone[b])
+				return m_isDone[b];
+			return m_timestamps[a] < m_timestamps[b] || (m_timestamps[a] == m_timestamps[b] && a < b);
+		}
+		void Replay();
+
+		std::vector<uint64_t> m_timestamps;
+		std::vector<char> m_isDone;
+		std::vector<std::size_t> m_losers; //m_losers[0] is the winner, nodes 1 to N-1 hold losers. Source i is leaf N + i.
+		std::size_t m_nActive;
+	};
+}
+
+#endif
@@ -0,0 +1,85 @@
+#include "TimeSorter.h"
+
+namespace Specter {
+
+	TimeSorter::TimeSorter(uint64_t window) :
+		m_window(window), m_watermark(0), m_nPushed(0), m_releasedTimestamp(0), m_nLateHits(0), m_maxLateness(0)
+	{
+	}
+
+	TimeSorter::~TimeSorter() {}
+
+	void TimeSorter::Push(const SpecData& datum)
+	{
+		if (datum.timestamp < m_releasedTimestamp)
+		{
+			m_nLateHits++;
+			m_maxLateness = std::max(m_maxLateness, m_releasedTimestamp - datum.timestamp);
+		}
+		UpdateWatermark(datum);
+
+		m_heap.push_back(datum);
+		std::push_heap(m_heap.begin(), m_heap.end(), IsLater);
+	}
+
+	//A late hit is always past the watermark, so it comes out on the next pop
+	bool TimeSorter::PopReleased(SpecData& datum)
+	{
+		if (m_heap.empty() || m_watermark < m_window || m_heap.front().timestamp > m_watermark - m_window)
+			return false;
+
+		PopEarliest(datum);
+		return true;
+	}
+
+	bool TimeSorter::PopAny(SpecData& datum)
+	{
+		if (m_heap.empty())
+			return false;
+
+		PopEarliest(datum);
+		return true;
+	}
+
+	void TimeSorter::PopEarliest(SpecData& datum)
+	{
+		std::pop_heap(m_heap.begin(), m_heap.end(), IsLater);
+		datum = m_heap.back();
+		m_heap.pop_back();
+		m_releasedTimestamp = std::max(m_releasedTimestamp, datum.timestamp);
+	}
+
+	//Note the hit on its board, and move the watermark to the newest hit of the slowest active board
+	void TimeSorter::UpdateWatermark(const SpecData& datum)
+	{
+		uint32_t board = Utilities::GetBoardFromUUID(datum.id);
+		auto iter = std::find_if(m_boards.begin(), m_boards.end(), [board](const BoardClock& clock) { return clock.board == board; });
+		if (iter == m_boards.end())
+		{
+			m_boards.emplace_back();
+			iter = m_boards.end() - 1;
+			iter->board = board;
+		}
+		iter->newestTimestamp = std::max(iter->newestTimestamp, datum.timestamp);
+		iter->lastHit = m_nPushed++;
+
+		uint64_t watermark = UINT64_MAX;
+		for (auto& clock : m_boards)
+		{
+			if (m_nPushed - clock.lastHit <= s_idleBoardHits)
+				watermark = std::min(watermark, clock.newestTimestamp);
+		}
+		m_watermark = watermark;
+	}
+
+	void TimeSorter::Clear()
+	{
+		m_heap.clear();
+		m_boards.clear();
+		m_watermark = 0;
+		m_nPushed = 0;
+		m_releasedTimestamp = 0;
+		m_nLateHits = 0;
+		m_maxLateness = 0;
+	}
+}
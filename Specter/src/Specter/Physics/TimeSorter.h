@@ -0,0 +1,65 @@
+/*
+	TimeSorter.h
+	Streaming time sorter for online sources. Hits arrive roughly in time order (each board is ordered, but boards are read out in chunks),
+	so they are held in a min-heap and released in timestamp order once they are older than the watermark: the newest hit of the slowest
+	board, less the sort window. Boards are told apart by the board number in the hit id (see Utilities::GetBoardChannelUUID), so a board
+	that runs behind the others holds the release back instead of having its hits counted as late. The window only has to cover the
+	out-of-orderness within one board's readout.
+
+	A board that has sent nothing for the last s_idleBoardHits hits is idle, and left out of the watermark until it sends again, so that a
+	quiet (or dead) board doesn't hold everything back.
+
+	A hit that arrives older than one that was already released is late: it is passed on straight away (out of order), and counted. The late
+	count and the worst lateness are what to look at when tuning the window.
+*/
+#ifndef TIME_SORTER_H
+#define TIME_SORTER_H
+
+#include "SpecData.h"
+
+namespace Specter {
+
+	class TimeSorter
+	{
+	public:
+		TimeSorter(uint64_t window = 0);
+		~TimeSorter();
+
+		void SetWindow(uint64_t window) { m_window = window; }
+		uint64_t GetWindow() const { return m_window; }
+
+		void Push(const SpecData& datum);
+		bool PopReleased(SpecData& datum); //Next hit past the watermark, in time order
+		bool PopAny(SpecData& datum); //Next hit regardless of the watermark, for draining at the end of the data
+		void Clear();
+
+		bool IsEmpty() const { return m_heap.empty(); }
+		uint64_t GetNumberOfLateHits() const { return m_nLateHits; }
+		uint64_t GetMaxLateness() const { return m_maxLateness; }
+
+	private:
+		struct BoardClock
+		{
+			uint32_t board = 0;
+			uint64_t newestTimestamp = 0;
+			uint64_t lastHit = 0; //m_nPushed when the board last sent a hit
+		};
+
+		static bool IsLater(const SpecData& a, const SpecData& b) { return a.timestamp > b.timestamp; }
+		void PopEarliest(SpecData& datum);
+		void UpdateWatermark(const SpecData& datum);
+
+		std::vector<SpecData> m_heap; //std heap ordered with IsLater, so the earliest hit is at the front
+		std::vector<BoardClock> m_boards; //Few boards, searched linearly
+		uint64_t m_window;
+		uint64_t m_watermark; //Oldest newest timestamp over the active boards
+		uint64_t m_nPushed;
+		uint64_t m_releasedTimestamp; //latest timestamp released so far
+		uint64_t m_nLateHits;
+		uint64_t m_maxLateness;
+
+		static constexpr uint64_t s_idleBoardHits = 1 << 16;
+	};
+}
+
+#endif
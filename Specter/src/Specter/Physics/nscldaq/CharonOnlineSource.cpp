@@ -5,10 +5,9 @@
 namespace Specter {
 
     CharonOnlineSource::CharonOnlineSource(const std::string& hostname, const std::string& port) :
-        DataSource(0), m_isEventReady(false), m_client(hostname, port)
+        DataSource(0), m_client(hostname, port)
     {
         m_validFlag = m_client.IsConnected();
-        m_readyEvents.emplace_back();
 
         m_unpackers.push_back(std::make_shared<CaenUnpacker>());
         m_unpackers.push_back(std::make_shared<MesyTecUnpacker>());
@@ -22,15 +21,13 @@ namespace Specter {
     {
         if(!m_client.IsConnected())
         {
-            m_validFlag = false;
+            EndOfData();
             return;
         }
 
         if(m_client.GetNextEvent(m_rawBuffer))
         {
-            m_event.clear();
             UnpackRawBuffer();
-            m_isEventReady = true;
         }
     }
 
@@ -51,7 +48,7 @@ namespace Specter {
                     result = unpacker->Unpack(iter, end);
                     iter = result.finalPosition;
                     wasUnpacked = true;
-                    m_event.insert(m_event.end(), result.data.begin(), result.data.end());
+                    m_eventBuilder.AppendToEvent(result.data);
                     break;
                 }
             }
@@ -62,6 +59,7 @@ namespace Specter {
             }
         }
 
-        m_readyEvents[0] = m_event;
+        //Charon hands us built events, so the whole buffer is one event
+        m_eventBuilder.CloseEvent();
     }
 }
\ No newline at end of file
@@ -14,21 +14,14 @@ namespace Specter {
         virtual ~CharonOnlineSource();
 
         virtual void ProcessData() override;
-        virtual std::vector<SpecEvent> GetEvents() override
-        {
-            m_isEventReady = false;
-            return m_readyEvents;
-        }
-        virtual const bool IsEventReady() const override { return m_isEventReady; }
+        virtual EventArena::Ref GetEvents() override { return m_eventBuilder.GetReadyEvents(); }
+        virtual const bool IsEventReady() const override { return m_eventBuilder.IsEventReady(); }
 
     private:
         void UnpackRawBuffer();
 
         CharonClient m_client;
-        bool m_isEventReady;
         std::vector<uint8_t> m_rawBuffer;
-        SpecEvent m_event;
-        std::vector<SpecEvent> m_readyEvents;
         std::vector<Unpacker::Ref> m_unpackers;
     };
 }
@@ -4,10 +4,10 @@
 
 namespace Specter {
 
-	RitualOnlineSource::RitualOnlineSource(const std::string& hostname, const std::string& port, uint64_t coincidenceWindow) :
+	RitualOnlineSource::RitualOnlineSource(const std::string& hostname, const std::string& port, uint64_t coincidenceWindow, uint64_t sortWindow) :
 		DataSource(coincidenceWindow), m_client(hostname, port)
 	{
-		m_eventBuilder.SetSortFlag(true);
+		m_eventBuilder.SetSortWindow(sortWindow);
 		m_validFlag = m_client.IsConnected();
 	}
 
@@ -17,13 +17,12 @@ namespace Specter {
 
 	void RitualOnlineSource::ProcessData()
 	{
-		if (!m_client.IsConnected())
-			m_validFlag = false;
-
 		if (m_client.GetData(m_recievedMessage))
 		{
 			ReadMessage();
 		}
+		else if (!m_client.IsConnected())
+			EndOfData(); //Everything received has been read; build what the sort window was holding back
 	}
 
 	void RitualOnlineSource::ReadMessage()
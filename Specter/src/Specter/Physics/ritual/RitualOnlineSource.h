@@ -9,16 +9,11 @@ namespace Specter {
 	class RitualOnlineSource : public DataSource
 	{
 	public:
-		RitualOnlineSource(const std::string& hostname, const std::string& port, uint64_t coincidenceWindow);
+		RitualOnlineSource(const std::string& hostname, const std::string& port, uint64_t coincidenceWindow, uint64_t sortWindow);
 		virtual ~RitualOnlineSource();
 
 		virtual void ProcessData() override;
-		virtual std::vector<SpecEvent> GetEvents() override
-		{
-			auto temp = m_eventBuilder.GetReadyEvents();
-			m_eventBuilder.ClearReadyEvents();
-			return temp;
-		}
+		virtual EventArena::Ref GetEvents() override { return m_eventBuilder.GetReadyEvents(); }
 		virtual const bool IsEventReady() const override { return m_eventBuilder.IsEventReady(); }
 
 	private:
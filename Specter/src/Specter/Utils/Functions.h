@@ -1,6 +1,8 @@
 #ifndef SPEC_FUNCTIONS_H
 #define SPEC_FUNCTIONS_H
 
+#include <cmath>
+
 namespace Specter {
 
 	namespace Utilities
@@ -13,6 +15,14 @@ namespace Specter {
 		{
 			return board >= channel ? (board * board + board + channel) : (channel * channel + board);
 		}
+
+		//Inverse of GetBoardChannelUUID for the board number
+		inline uint32_t GetBoardFromUUID(uint32_t uuid)
+		{
+			uint32_t root = uint32_t(std::sqrt(double(uuid)));
+			uint32_t rest = uuid - root * root;
+			return rest < root ? rest : root;
+		}
 	}
 }
 